@@ -17,7 +17,16 @@
 #include <stdarg.h>
 #include <math.h>
 #include <wchar.h>
+#include <wctype.h>
+#include <limits.h>
 #include <locale.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #ifndef cog_malloc
 #define cog_malloc malloc
@@ -41,21 +50,50 @@
 #define STRING_HASH_SEED 0xCBF29CE484222327ULL
 #endif
 
+#ifndef COG_STREAM_BLOCK_SIZE
+#define COG_STREAM_BLOCK_SIZE 4096
+#endif
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define GET_TYPENAME_STRING(obj) (obj && obj->type ? obj->type->name : "empty List")
 
 #define trace() printf("TRACE: %s: reached %s:%i\n", __func__, __FILE__, __LINE__)
 static void print_backtrace();
 static void debug_dump_stuff();
+static void event_loop_free();
+static void par_pool_free();
+static void format_float(char* buffer, size_t size, double f);
 
 // MARK: GLOBALS
 
 typedef struct chunk chunk;
 
-static struct {
+typedef struct {
+    cog_object* obj;
+    int64_t hash;
+} hash_memo_slot;
+
+struct io_watch {
+    cog_object* readers; // fibers waiting to read from it
+    cog_object* writers;
+    uint32_t events; // what it is registered for, if anything
+};
+
+struct fiber_timer {
+    double when;
+    cog_object* fiber;
+};
+
+// Everything an interpreter has is in its state, so a process can run more
+// than one; each thread works on whichever state it last switched to.
+struct _cog_state {
     chunk* mem;
     cog_object* freelist;
     size_t freespace;
     size_t alloc_chunks;
+    // when the main loop should GC next, shared with any loops nested in it by
+    // cog_call, or 0 if not decided yet
+    size_t next_gc;
     cog_object* gc_protected;
 
     cog_object* stdout_stream;
@@ -67,12 +105,71 @@ static struct {
     cog_object* stack;
     cog_object* command_queue;
     cog_object* scopes;
+    // the cells of the command queue with a `when`, first to last, so that
+    // unwinding can skip straight from one to the next
+    cog_object* handlers;
 
     cog_object* error_sym;
     cog_object* not_impl_sym;
     cog_object* on_exit_sym;
     cog_object* on_enter_sym;
-} COG_GLOBALS = {0};
+    cog_object* escape_sym;
+    cog_object* escaping; // the Escape being unwound to
+    // what was running when C called into Cognate with cog_call, innermost
+    // first, each a list of the stack, queue, handlers, scopes and generator
+    cog_object* calls;
+
+    uint64_t table_edits; // how many transient tables have been made
+
+    hash_memo_slot* hash_memo;
+    size_t hash_memo_cap;
+    size_t hash_memo_count;
+
+    hash_memo_slot* interned; // the canonical values, by their hash
+    size_t interned_cap;
+    size_t interned_count;
+
+    size_t threads; // how many workers Parallel-Map and Parallel-For use, or 0 if not decided yet
+    cog_state** pool; // interpreters the workers of earlier jobs left set up, for the next
+    size_t pool_count;
+
+    cog_object* fiber; // the fiber that is running, or NULL if none were ever spawned
+    cog_object* main_fiber;
+    cog_object* ready_fibers; // waiting for their turn, oldest first
+    cog_object* ready_fibers_tail;
+    int fiber_stop; // whether the running fiber should give way after this command
+    uint64_t fibers_made;
+    cog_object* generator; // the one running, if any
+    // event loop (see FIBERS)
+    int epoll_fd; // one more than the descriptor, so 0 is none yet
+    struct io_watch* watches; // indexed by file descriptor
+    size_t watches_cap;
+    size_t io_waiting; // fibers waiting on a file descriptor
+    struct fiber_timer* timers; // binary heap, soonest first
+    size_t timers_count, timers_cap;
+};
+
+static __thread cog_state* current_state = NULL;
+#define COG_GLOBALS (*current_state)
+
+cog_state* cog_new_state() {
+    cog_state* state = (cog_state*)calloc(1, sizeof(cog_state));
+    if (state == NULL) {
+        perror(__func__);
+        abort();
+    }
+    return state;
+}
+
+cog_state* cog_set_state(cog_state* state) {
+    cog_state* old = current_state;
+    current_state = state;
+    return old;
+}
+
+cog_state* cog_get_state() {
+    return current_state;
+}
 
 cog_object* cog_not_implemented() {
     return COG_GLOBALS.not_impl_sym;
@@ -184,6 +281,71 @@ static bool markobject(cog_object* obj, cog_object* arg) {
     return true;
 }
 
+// Hashes of immutable objects are remembered the first time they're worked
+// out, in a linear probing table on the side keyed by address, so objects
+// don't need another field. The `hashed` bit says whether an object has an
+// entry, so objects that were never hashed don't look in the table at all.
+// The table is pruned after marking, before dead objects get reused.
+
+static size_t hash_memo_index(cog_object* obj, size_t cap) {
+    // objects are 32 bytes apart, so the low bits tell nothing
+    return (((uint64_t)(uintptr_t)obj >> 5) * 0x9E3779B97F4A7C15ULL >> 32) & (cap - 1);
+}
+
+static void hash_memo_resize(size_t cap, bool only_marked) {
+    hash_memo_slot* old = COG_GLOBALS.hash_memo;
+    size_t old_cap = COG_GLOBALS.hash_memo_cap;
+    COG_GLOBALS.hash_memo = cap ? (hash_memo_slot*)calloc(cap, sizeof(hash_memo_slot)) : NULL;
+    if (cap && !COG_GLOBALS.hash_memo) {
+        perror(__func__);
+        abort();
+    }
+    COG_GLOBALS.hash_memo_cap = cap;
+    COG_GLOBALS.hash_memo_count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        cog_object* obj = old[i].obj;
+        if (!obj || (only_marked && !obj->marked)) continue;
+        size_t j = hash_memo_index(obj, cap);
+        while (COG_GLOBALS.hash_memo[j].obj) j = (j + 1) & (cap - 1);
+        COG_GLOBALS.hash_memo[j] = old[i];
+        COG_GLOBALS.hash_memo_count++;
+    }
+    free(old);
+}
+
+static void hash_memo_put(cog_object* obj, int64_t hash) {
+    if ((COG_GLOBALS.hash_memo_count + 1) * 4 > COG_GLOBALS.hash_memo_cap * 3)
+        hash_memo_resize(COG_GLOBALS.hash_memo_cap ? COG_GLOBALS.hash_memo_cap * 2 : 256, false);
+    size_t mask = COG_GLOBALS.hash_memo_cap - 1;
+    size_t i = hash_memo_index(obj, COG_GLOBALS.hash_memo_cap);
+    while (COG_GLOBALS.hash_memo[i].obj) i = (i + 1) & mask;
+    COG_GLOBALS.hash_memo[i] = (hash_memo_slot){obj, hash};
+    COG_GLOBALS.hash_memo_count++;
+    obj->hashed = true;
+}
+
+static int64_t hash_memo_get(cog_object* obj) {
+    assert(obj->hashed);
+    size_t mask = COG_GLOBALS.hash_memo_cap - 1;
+    size_t i = hash_memo_index(obj, COG_GLOBALS.hash_memo_cap);
+    while (COG_GLOBALS.hash_memo[i].obj != obj) i = (i + 1) & mask;
+    return COG_GLOBALS.hash_memo[i].hash;
+}
+
+static void hash_memo_prune() {
+    size_t live = 0;
+    for (size_t i = 0; i < COG_GLOBALS.hash_memo_cap; i++) {
+        cog_object* obj = COG_GLOBALS.hash_memo[i].obj;
+        if (obj && obj->marked) live++;
+    }
+    if (live == COG_GLOBALS.hash_memo_count) return;
+    size_t cap = live ? 256 : 0;
+    while (cap && live * 2 > cap) cap *= 2;
+    hash_memo_resize(cap, true);
+}
+
+static void intern_prune();
+
 static void gc() {
     cog_walk(COG_GLOBALS.gc_protected, markobject, NULL);
     cog_walk(COG_GLOBALS.stdout_stream, markobject, NULL);
@@ -193,10 +355,26 @@ static void gc() {
     cog_walk(COG_GLOBALS.stack, markobject, NULL);
     cog_walk(COG_GLOBALS.command_queue, markobject, NULL);
     cog_walk(COG_GLOBALS.scopes, markobject, NULL);
+    cog_walk(COG_GLOBALS.handlers, markobject, NULL);
     cog_walk(COG_GLOBALS.error_sym, markobject, NULL);
     cog_walk(COG_GLOBALS.not_impl_sym, markobject, NULL);
     cog_walk(COG_GLOBALS.on_exit_sym, markobject, NULL);
     cog_walk(COG_GLOBALS.on_enter_sym, markobject, NULL);
+    cog_walk(COG_GLOBALS.escape_sym, markobject, NULL);
+    cog_walk(COG_GLOBALS.escaping, markobject, NULL);
+    cog_walk(COG_GLOBALS.calls, markobject, NULL);
+    cog_walk(COG_GLOBALS.fiber, markobject, NULL);
+    cog_walk(COG_GLOBALS.main_fiber, markobject, NULL);
+    cog_walk(COG_GLOBALS.ready_fibers, markobject, NULL);
+    cog_walk(COG_GLOBALS.generator, markobject, NULL);
+    for (size_t i = 0; i < COG_GLOBALS.watches_cap; i++) {
+        cog_walk(COG_GLOBALS.watches[i].readers, markobject, NULL);
+        cog_walk(COG_GLOBALS.watches[i].writers, markobject, NULL);
+    }
+    for (size_t i = 0; i < COG_GLOBALS.timers_count; i++)
+        cog_walk(COG_GLOBALS.timers[i].fiber, markobject, NULL);
+    hash_memo_prune();
+    intern_prune();
     COG_GLOBALS.freelist = NULL;
     COG_GLOBALS.freespace = 0;
     for (chunk** c = &COG_GLOBALS.mem; *c;) {
@@ -240,6 +418,7 @@ double cog_get_gc_fragmentation() {
 }
 
 void cog_quit() {
+    par_pool_free();
     COG_GLOBALS.gc_protected = NULL;
     COG_GLOBALS.stdout_stream = NULL;
     COG_GLOBALS.stdin_stream = NULL;
@@ -252,8 +431,19 @@ void cog_quit() {
     COG_GLOBALS.not_impl_sym = NULL;
     COG_GLOBALS.on_enter_sym = NULL;
     COG_GLOBALS.on_exit_sym = NULL;
+    COG_GLOBALS.handlers = NULL;
+    COG_GLOBALS.escape_sym = NULL;
+    COG_GLOBALS.escaping = NULL;
+    COG_GLOBALS.calls = NULL;
+    COG_GLOBALS.fiber = NULL;
+    COG_GLOBALS.main_fiber = NULL;
+    COG_GLOBALS.ready_fibers = NULL;
+    COG_GLOBALS.generator = NULL;
+    event_loop_free();
     gc();
     assert(COG_GLOBALS.mem == NULL);
+    free(current_state);
+    current_state = NULL;
 }
 
 // MARK: MODULES
@@ -392,163 +582,445 @@ cog_object_method ome_list_show_recursive = {&cog_ot_list, "Show_Recursive", m_l
 
 cog_object* m_list_hash() {
     cog_object* self = cog_pop();
-    cog_object* d;
-    d = cog_hash(self->data);
-    if (!d) return cog_not_implemented();
-    int64_t data_hash = d->as_int;
-    d = cog_hash(self->next);
-    if (!d) return cog_not_implemented();
-    int64_t next_hash = d->as_int;
-    cog_push(cog_box_int(data_hash + (FNV_PRIME * (1 + next_hash))));
+    // each cell hashes to data + P * (1 + hash of the rest), which unrolls to
+    // a sum down the spine, so long lists don't recurse, and it can stop at
+    // a tail whose hash is already known
+    uint64_t hash = 0, scale = 1;
+    cog_object* cell = self;
+    do {
+        int64_t d;
+        if (!cog_hash_value(cell->data, &d)) return cog_not_implemented();
+        hash += scale * ((uint64_t)d + FNV_PRIME);
+        scale *= FNV_PRIME;
+        cell = cell->next;
+    } while (cell && cell->type == &cog_ot_list && !cell->hashed);
+    int64_t rest;
+    if (!cog_hash_value(cell, &rest)) return cog_not_implemented();
+    cog_push(cog_box_int(hash + scale * (uint64_t)rest));
     return NULL;
 }
 cog_object_method ome_list_hash = {&cog_ot_list, "Hash", m_list_hash};
 
+cog_object* m_list_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    // iterate down the spine instead of recursing, and stop at a shared tail
+    while (self != other && self && other && self->type == &cog_ot_list && other->type == &cog_ot_list) {
+        if (!cog_equal(self->data, other->data)) {
+            cog_push(cog_box_bool(false));
+            return NULL;
+        }
+        self = self->next;
+        other = other->next;
+    }
+    cog_push(cog_box_bool(cog_equal(self, other)));
+    return NULL;
+}
+cog_object_method ome_list_equal = {&cog_ot_list, "Equal", m_list_equal};
+
 // MARK: TABLES
 
 cog_obj_type cog_ot_table = {"Table", cog_walk_only_next, NULL};
 
 cog_object* cog_emptytab() {
-    return cog_make_obj(&cog_ot_table);
+    cog_object* tab = cog_make_obj(&cog_ot_table);
+    tab->as_int = 0; // the number of entries
+    return tab;
 }
 
-cog_object* cog_hash(cog_object* obj) {
-    if (!obj) return cog_box_int(0);
+// only for objects that can't change once they're made
+static bool remembers_hash(cog_object* obj) {
+    cog_obj_type* t = obj->type;
+    // a string that fits in one chunk is quicker to hash again than to look up
+    if (t == &cog_ot_string) return obj->next != NULL;
+    return t == &cog_ot_list || t == &cog_ot_symbol || t == &cog_ot_table || t == &cog_ot_ordered_map || t == &cog_ot_vector;
+}
+
+bool cog_hash_value(cog_object* obj, int64_t* hash) {
+    if (!obj) {
+        *hash = 0;
+        return true;
+    }
+    if (obj->hashed) {
+        *hash = hash_memo_get(obj);
+        return true;
+    }
     if (cog_same_identifiers(cog_run_well_known(obj, "Hash"), cog_not_implemented()))
-        return NULL;
-    return cog_expect_type_fatal(cog_pop(), &cog_ot_int);
+        return false;
+    *hash = cog_expect_type_fatal(cog_pop(), &cog_ot_int)->as_int;
+    if (remembers_hash(obj)) hash_memo_put(obj, *hash);
+    return true;
+}
+
+cog_object* cog_hash(cog_object* obj) {
+    int64_t hash;
+    if (!cog_hash_value(obj, &hash)) return NULL;
+    return cog_box_int(hash);
+}
+
+// Tables are persistent hash array mapped tries. Each node has 32 slots,
+// picked by 5 bits of the key's hash at a time, which either hold an entry
+// inline or a subtree; the node only stores the slots that are used, and a
+// slot's position is found by counting the bits set below it in the
+// bitmap. Past the end of the hash, a node just holds a list of entries
+// that all have the same hash.
+//
+// Nodes made while building a transient table are tagged with its edit
+// number, and get changed in place instead of copied until it is frozen.
+
+typedef struct {
+    uint64_t hash; // of the key, cached so it never has to be hashed again
+    cog_object* key;
+    cog_object* val;
+} hamt_entry;
+
+typedef struct {
+    uint32_t datamap; // slots that hold an entry
+    uint32_t nodemap; // slots that hold a subtree
+    uint32_t nentries;
+    uint32_t nchildren;
+    uint64_t edit; // the transient that owns this node, or 0
+    hamt_entry* entries;
+    cog_object** children;
+} hamt_node;
+
+#define HAMT_BITS 5
+#define HAMT_MASK ((1 << HAMT_BITS) - 1)
+#define NODE(obj) ((hamt_node*)(obj)->as_ptr)
+
+static cog_object* walk_hamt_node(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    hamt_node* n = NODE(obj);
+    for (uint32_t i = 0; i < n->nentries; i++) {
+        cog_walk(n->entries[i].key, f, arg);
+        cog_walk(n->entries[i].val, f, arg);
+    }
+    for (uint32_t i = 0; i < n->nchildren; i++)
+        cog_walk(n->children[i], f, arg);
+    return NULL;
 }
 
-static cog_object* _treenode(cog_object* key, cog_object* val, cog_object* left, cog_object* right) {
-    cog_object* a = cog_make_obj(&cog_ot_list);
-    cog_object* b = cog_make_obj(&cog_ot_list);
-    cog_object* c = cog_make_obj(&cog_ot_list);
-    a->data = b;
-    a->next = c;
-    b->data = key;
-    b->next = val;
-    c->data = left;
-    c->next = right;
-    return a;
+static void free_hamt_node(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
 }
 
-#define TKEY data->data
-#define TVAL data->next
-#define TLEFT next->data
-#define TRIGHT next->next
+static cog_obj_type ot_hamt_node = {"[[Table::Node]]", walk_hamt_node, free_hamt_node};
 
-static cog_object* _wraptab(cog_object* tree) {
-    cog_object* tab = cog_emptytab();
-    tab->next = tree;
-    return tab;
+static hamt_node* hamt_alloc(uint32_t datamap, uint32_t nodemap, uint32_t nentries, uint32_t nchildren, uint64_t edit) {
+    // the entries and children live in the same block as the header
+    hamt_node* n = (hamt_node*)malloc(sizeof(hamt_node) + nentries * sizeof(hamt_entry) + nchildren * sizeof(cog_object*));
+    if (n == NULL) {
+        perror(__func__);
+        abort();
+    }
+    n->datamap = datamap;
+    n->nodemap = nodemap;
+    n->nentries = nentries;
+    n->nchildren = nchildren;
+    n->edit = edit;
+    n->entries = (hamt_entry*)(n + 1);
+    n->children = (cog_object**)(n->entries + nentries);
+    return n;
+}
+
+static cog_object* hamt_new_node(uint32_t datamap, uint32_t nodemap, uint32_t nentries, uint32_t nchildren, uint64_t edit) {
+    cog_object* obj = cog_make_obj(&ot_hamt_node);
+    obj->as_ptr = (void*)hamt_alloc(datamap, nodemap, nentries, nchildren, edit);
+    return obj;
+}
+
+static inline uint32_t hamt_bit(uint64_t hash, int shift) {
+    return 1u << ((hash >> shift) & HAMT_MASK);
+}
+
+static inline uint32_t hamt_index(uint32_t bitmap, uint32_t bit) {
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+// for two keys with the same hash
+static bool same_key(cog_object* a, cog_object* b) {
+    return cog_equal(a, b);
+}
+
+static bool hamt_entry_is(hamt_entry* e, cog_object* key, uint64_t hash) {
+    return e->hash == hash && same_key(e->key, key);
 }
 
-static cog_object* _iou_helper(cog_object* tree, cog_object* key, cog_object* val, int64_t hash) {
-    if (!tree) {
-        // we got to the end without finding a existing node, so add a new one
-        // cog_printf("DEBUG: New node with %O: %O\n", key, val);
-        return _treenode(key, val, NULL, NULL);
+// get a version of a node that can be changed: the node itself if the
+// transient owns it, else a copy. The copy leaves out entry `skip_entry`
+// and/or child `skip_child` (-1 for none) and leaves a gap for the new ones
+// at `add_entry` and `add_child`.
+static cog_object* hamt_edit(cog_object* obj, uint64_t edit, uint32_t datamap, uint32_t nodemap, int skip_entry, int add_entry, int skip_child, int add_child) {
+    hamt_node* n = NODE(obj);
+    bool owned = edit && n->edit == edit;
+    if (owned && skip_entry < 0 && add_entry < 0 && skip_child < 0 && add_child < 0) return obj;
+    uint32_t ne = n->nentries - (skip_entry >= 0) + (add_entry >= 0);
+    uint32_t nc = n->nchildren - (skip_child >= 0) + (add_child >= 0);
+    hamt_node* m = hamt_alloc(datamap, nodemap, ne, nc, edit);
+    for (uint32_t i = 0, j = 0; j < ne; j++) {
+        if ((int)j == add_entry) continue;
+        if ((int)i == skip_entry) i++;
+        m->entries[j] = n->entries[i++];
+    }
+    for (uint32_t i = 0, j = 0; j < nc; j++) {
+        if ((int)j == add_child) continue;
+        if ((int)i == skip_child) i++;
+        m->children[j] = n->children[i++];
     }
-    if (cog_equal(tree->TKEY, key)) {
-        // update this node
-        // cog_printf("DEBUG: Update node with %O: %O\n", key, val);
-        return _treenode(tree->TKEY, val, tree->TRIGHT, tree->TLEFT);
+    if (owned) {
+        // nothing else can see this node, so just swap out its insides
+        free(n);
+        obj->as_ptr = (void*)m;
+        return obj;
     }
-    // need to recurse
-    bool is_left = hash < (cog_hash(tree->TKEY)->as_int);
-    // printf("->%s", is_left ? "left" : "right");
-    // fflush(stdout);
-    if (is_left) return _treenode(tree->TKEY, tree->TVAL, _iou_helper(tree->TLEFT, key, val, hash), tree->TRIGHT);
-    else return _treenode(tree->TKEY, tree->TVAL, tree->TLEFT, _iou_helper(tree->TRIGHT, key, val, hash));
+    obj = cog_make_obj(&ot_hamt_node);
+    obj->as_ptr = (void*)m;
+    return obj;
 }
 
-static cog_object* _succ(cog_object* tree) {
-    tree = tree->TRIGHT;
-    while (tree != NULL && tree->TLEFT != NULL)
-        tree = tree->TLEFT;
-    return tree;
+static cog_object* hamt_pair(int shift, hamt_entry* a, hamt_entry* b, uint64_t edit) {
+    if (shift >= 64) {
+        cog_object* obj = hamt_new_node(0, 0, 2, 0, edit);
+        NODE(obj)->entries[0] = *a;
+        NODE(obj)->entries[1] = *b;
+        return obj;
+    }
+    uint32_t ba = hamt_bit(a->hash, shift), bb = hamt_bit(b->hash, shift);
+    if (ba == bb) {
+        cog_object* obj = hamt_new_node(0, ba, 0, 1, edit);
+        NODE(obj)->children[0] = hamt_pair(shift + HAMT_BITS, a, b, edit);
+        return obj;
+    }
+    cog_object* obj = hamt_new_node(ba | bb, 0, 2, 0, edit);
+    NODE(obj)->entries[ba < bb ? 0 : 1] = *a;
+    NODE(obj)->entries[ba < bb ? 1 : 0] = *b;
+    return obj;
 }
 
-static cog_object* _rem_helper(cog_object* tree, cog_object* key, int64_t hash) {
-    if (!tree) return NULL;
+static cog_object* hamt_insert(cog_object* obj, int shift, hamt_entry* e, bool* added, uint64_t edit) {
+    if (!obj) {
+        *added = true;
+        obj = hamt_new_node(hamt_bit(e->hash, shift), 0, 1, 0, edit);
+        NODE(obj)->entries[0] = *e;
+        return obj;
+    }
+    hamt_node* n = NODE(obj);
+    if (shift >= 64) {
+        for (uint32_t i = 0; i < n->nentries; i++) {
+            if (hamt_entry_is(&n->entries[i], e->key, e->hash)) {
+                obj = hamt_edit(obj, edit, 0, 0, -1, -1, -1, -1);
+                NODE(obj)->entries[i].val = e->val;
+                return obj;
+            }
+        }
+        *added = true;
+        uint32_t i = n->nentries;
+        obj = hamt_edit(obj, edit, 0, 0, -1, i, -1, -1);
+        NODE(obj)->entries[i] = *e;
+        return obj;
+    }
+    uint32_t bit = hamt_bit(e->hash, shift);
+    if (n->datamap & bit) {
+        uint32_t i = hamt_index(n->datamap, bit);
+        hamt_entry* old = &n->entries[i];
+        if (hamt_entry_is(old, e->key, e->hash)) {
+            obj = hamt_edit(obj, edit, n->datamap, n->nodemap, -1, -1, -1, -1);
+            NODE(obj)->entries[i].val = e->val;
+            return obj;
+        }
+        // two different keys want the slot, so they both go down a level
+        *added = true;
+        uint32_t j = hamt_index(n->nodemap, bit);
+        cog_object* sub = hamt_pair(shift + HAMT_BITS, old, e, edit);
+        obj = hamt_edit(obj, edit, n->datamap & ~bit, n->nodemap | bit, i, -1, -1, j);
+        NODE(obj)->children[j] = sub;
+        return obj;
+    }
+    if (n->nodemap & bit) {
+        uint32_t j = hamt_index(n->nodemap, bit);
+        cog_object* sub = hamt_insert(n->children[j], shift + HAMT_BITS, e, added, edit);
+        if (sub == n->children[j]) return obj; // was changed in place
+        obj = hamt_edit(obj, edit, n->datamap, n->nodemap, -1, -1, -1, -1);
+        NODE(obj)->children[j] = sub;
+        return obj;
+    }
+    *added = true;
+    uint32_t i = hamt_index(n->datamap, bit);
+    obj = hamt_edit(obj, edit, n->datamap | bit, n->nodemap, -1, i, -1, -1);
+    NODE(obj)->entries[i] = *e;
+    return obj;
+}
 
-    if (cog_equal(key, tree->TKEY)) {
-        // this node is what needs to be deleted
-        // No children
-        if (!tree->TLEFT && !tree->TRIGHT) return NULL;
-        // if only one child, then just become that one
-        else if (tree->TRIGHT && !tree->TLEFT) return tree->TRIGHT;
-        else if (tree->TLEFT && !tree->TRIGHT) return tree->TLEFT;
-        else {
-            // two children
-            cog_object* next = _succ(tree);
-            return _treenode(next->TKEY, next->TVAL, tree->TLEFT, _rem_helper(tree->TRIGHT, next->TKEY, cog_hash(next->TKEY)->as_int));
+static cog_object* hamt_remove(cog_object* obj, int shift, cog_object* key, uint64_t hash, bool* removed, uint64_t edit) {
+    if (!obj) return NULL;
+    hamt_node* n = NODE(obj);
+    if (shift >= 64) {
+        for (uint32_t i = 0; i < n->nentries; i++) {
+            if (hamt_entry_is(&n->entries[i], key, hash)) {
+                *removed = true;
+                if (n->nentries == 1) return NULL;
+                return hamt_edit(obj, edit, 0, 0, i, -1, -1, -1);
+            }
         }
-    } else {
-        // it's another node that needs to be deleted
-        bool is_left = hash < (cog_hash(tree->TKEY)->as_int);
-        if (is_left) return _treenode(tree->TKEY, tree->TVAL, _rem_helper(tree->TLEFT, key, hash), tree->TRIGHT);
-        else return _treenode(tree->TKEY, tree->TVAL, tree->TLEFT, _rem_helper(tree->TRIGHT, key, hash));
+        return obj;
     }
+    uint32_t bit = hamt_bit(hash, shift);
+    if (n->datamap & bit) {
+        uint32_t i = hamt_index(n->datamap, bit);
+        if (!hamt_entry_is(&n->entries[i], key, hash)) return obj;
+        *removed = true;
+        if (n->nentries == 1 && n->nchildren == 0) return NULL;
+        return hamt_edit(obj, edit, n->datamap & ~bit, n->nodemap, i, -1, -1, -1);
+    }
+    if (n->nodemap & bit) {
+        uint32_t j = hamt_index(n->nodemap, bit);
+        cog_object* child = n->children[j];
+        cog_object* sub = hamt_remove(child, shift + HAMT_BITS, key, hash, removed, edit);
+        if (!*removed) return obj;
+        if (!sub) {
+            if (n->nentries == 0 && n->nchildren == 1) return NULL;
+            return hamt_edit(obj, edit, n->datamap, n->nodemap & ~bit, -1, -1, j, -1);
+        }
+        hamt_node* s = NODE(sub);
+        if (s->nentries == 1 && s->nchildren == 0) {
+            // a subtree with only one entry left gets pulled back up here
+            hamt_entry last = s->entries[0];
+            uint32_t i = hamt_index(n->datamap, bit);
+            obj = hamt_edit(obj, edit, n->datamap | bit, n->nodemap & ~bit, -1, i, j, -1);
+            NODE(obj)->entries[i] = last;
+            return obj;
+        }
+        if (sub == child) return obj; // was changed in place
+        obj = hamt_edit(obj, edit, n->datamap, n->nodemap, -1, -1, -1, -1);
+        NODE(obj)->children[j] = sub;
+        return obj;
+    }
+    return obj;
 }
 
-cog_object* cog_table_get(cog_object* tab, cog_object* key, bool* found) {
-    assert(tab && tab->type == &cog_ot_table);
-    cog_object* tree = tab->next; // get the internal tree
-    int64_t hash = cog_hash(key)->as_int;
-    // cog_printf("DEBUG: getting with hash %llX, tree is: %O\n", hash, tree);
-    while (tree) {
-        // cog_printf("DEBUG: looking at key %O\n", tree->TKEY);
-        if (cog_equal(tree->TKEY, key)) {
+static cog_object* _wraptab(cog_object* root, int64_t size) {
+    cog_object* tab = cog_emptytab();
+    tab->next = root;
+    tab->as_int = size;
+    return tab;
+}
+
+static uint64_t key_hash(cog_object* key) {
+    int64_t h;
+    bool ok = cog_hash_value(key, &h);
+    assert(ok);
+    (void)ok;
+    return (uint64_t)h;
+}
+
+static cog_object* hamt_get(cog_object* obj, cog_object* key, uint64_t hash, bool* found) {
+    for (int shift = 0; obj; shift += HAMT_BITS) {
+        hamt_node* n = NODE(obj);
+        if (shift >= 64) {
+            for (uint32_t i = 0; i < n->nentries; i++) {
+                if (hamt_entry_is(&n->entries[i], key, hash)) {
+                    *found = true;
+                    return n->entries[i].val;
+                }
+            }
+            break;
+        }
+        uint32_t bit = hamt_bit(hash, shift);
+        if (n->datamap & bit) {
+            hamt_entry* e = &n->entries[hamt_index(n->datamap, bit)];
+            if (!hamt_entry_is(e, key, hash)) break;
             *found = true;
-            return tree->TVAL;
+            return e->val;
         }
-        bool is_left = hash < (cog_hash(tree->TKEY)->as_int);
-        if (is_left) tree = tree->TLEFT;
-        else tree = tree->TRIGHT;
-        // printf("%s->", is_left ? "left" : "right");
-        // fflush(stdout);
+        if (!(n->nodemap & bit)) break;
+        obj = n->children[hamt_index(n->nodemap, bit)];
     }
     *found = false;
     return NULL;
 }
 
+cog_object* cog_table_get(cog_object* tab, cog_object* key, bool* found) {
+    assert(tab && tab->type == &cog_ot_table);
+    return hamt_get(tab->next, key, key_hash(key), found);
+}
+
 cog_object* cog_table_insert_or_update(cog_object* tab, cog_object* key, cog_object* val) {
     assert(tab && tab->type == &cog_ot_table);
-    // cog_printf("DEBUG: adding key %O to table\n", key);
-    return _wraptab(_iou_helper(tab->next, key, val, cog_hash(key)->as_int));
+    hamt_entry e = {key_hash(key), key, val};
+    bool added = false;
+    cog_object* root = hamt_insert(tab->next, 0, &e, &added, 0);
+    return _wraptab(root, tab->as_int + added);
 }
 
 cog_object* cog_table_remove(cog_object* tab, cog_object* key) {
     assert(tab && tab->type == &cog_ot_table);
-    bool found;
-    cog_table_get(tab, key, &found);
-    if (!found) return tab; // same table if no update needed
-    return _wraptab(_rem_helper(tab->next, key, cog_hash(key)->as_int));
+    bool removed = false;
+    cog_object* root = hamt_remove(tab->next, 0, key, key_hash(key), &removed, 0);
+    if (!removed) return tab; // same table if no update needed
+    return _wraptab(root, tab->as_int - 1);
+}
+
+void cog_table_transient(cog_transient_table* t, cog_object* tab) {
+    assert(tab && tab->type == &cog_ot_table);
+    t->root = tab->next;
+    t->size = tab->as_int;
+    t->edit = ++COG_GLOBALS.table_edits;
+}
+
+void cog_transient_insert(cog_transient_table* t, cog_object* key, cog_object* val) {
+    assert(t->edit && "transient used after being frozen");
+    hamt_entry e = {key_hash(key), key, val};
+    bool added = false;
+    t->root = hamt_insert(t->root, 0, &e, &added, t->edit);
+    t->size += added;
+}
+
+void cog_transient_remove(cog_transient_table* t, cog_object* key) {
+    assert(t->edit && "transient used after being frozen");
+    bool removed = false;
+    t->root = hamt_remove(t->root, 0, key, key_hash(key), &removed, t->edit);
+    t->size -= removed;
+}
+
+cog_object* cog_transient_freeze(cog_transient_table* t) {
+    // the edit number is never given out again, so the nodes are now
+    // as good as persistent ones
+    t->edit = 0;
+    return _wraptab(t->root, t->size);
+}
+
+size_t cog_table_size(cog_object* tab) {
+    assert(tab && tab->type == &cog_ot_table);
+    return tab->as_int;
 }
 
-static cog_object* _reduce_helper(cog_object* tree, cog_object* (*func)(cog_object*, cog_object*), cog_object* accum) {
-    if (!tree) return accum;
-    accum = _reduce_helper(tree->TLEFT, func, accum);
-    accum = func(tree, accum);
-    accum = _reduce_helper(tree->TRIGHT, func, accum);
+static cog_object* _reduce_helper(cog_object* obj, cog_object* (*func)(cog_object*, cog_object*, cog_object*), cog_object* accum) {
+    if (!obj) return accum;
+    hamt_node* n = NODE(obj);
+    for (uint32_t i = 0; i < n->nentries; i++)
+        accum = func(n->entries[i].key, n->entries[i].val, accum);
+    for (uint32_t i = 0; i < n->nchildren; i++)
+        accum = _reduce_helper(n->children[i], func, accum);
     return accum;
 }
 
-cog_object* cog_table_reduce(cog_object* table, cog_object* (*func)(cog_object*, cog_object*), cog_object* accum) {
+cog_object* cog_table_reduce(cog_object* table, cog_object* (*func)(cog_object*, cog_object*, cog_object*), cog_object* accum) {
     assert(table && table->type == &cog_ot_table);
     return _reduce_helper(table->next, func, accum);
 }
 
-void _table_show_rec_helper(cog_object* tree, cog_object* alist, cog_object* stream, int64_t* counter, bool readably) {
-    if (!tree) return;
-    _table_show_rec_helper(tree->TLEFT, alist, stream, counter, readably);
-    if (tree->TLEFT) cog_fputs_imm(stream, ", ");
-    cog_print_refs_recursive(tree->TKEY, alist, stream, counter, readably);
-    cog_fputs_imm(stream, ": ");
-    cog_print_refs_recursive(tree->TVAL, alist, stream, counter, readably);
-    if (tree->TRIGHT) cog_fputs_imm(stream, ", ");
-    _table_show_rec_helper(tree->TRIGHT, alist, stream, counter, readably);
+void _table_show_rec_helper(cog_object* obj, cog_object* alist, cog_object* stream, int64_t* counter, bool readably, bool* first) {
+    if (!obj) return;
+    hamt_node* n = NODE(obj);
+    for (uint32_t i = 0; i < n->nentries; i++) {
+        if (!*first) cog_fputs_imm(stream, ", ");
+        *first = false;
+        cog_print_refs_recursive(n->entries[i].key, alist, stream, counter, readably);
+        cog_fputs_imm(stream, ": ");
+        cog_print_refs_recursive(n->entries[i].val, alist, stream, counter, readably);
+    }
+    for (uint32_t i = 0; i < n->nchildren; i++)
+        _table_show_rec_helper(n->children[i], alist, stream, counter, readably, first);
 }
 
 cog_object* m_table_show_recursive() {
@@ -557,1950 +1029,6076 @@ cog_object* m_table_show_recursive() {
     cog_object* stream = cog_pop();
     cog_object* alist = cog_pop();
     int64_t* counter = (int64_t*)cog_pop()->as_ptr;
+    bool first = true;
     cog_fputs_imm(stream, "{ ");
-    _table_show_rec_helper(table->next, alist, stream, counter, readably);
+    _table_show_rec_helper(table->next, alist, stream, counter, readably, &first);
     cog_fputs_imm(stream, " }");
     return NULL;
 }
 cog_object_method ome_table_show_recursive = {&cog_ot_table, "Show_Recursive", m_table_show_recursive};
 
+static bool _table_hash_helper(cog_object* obj, uint64_t* hash) {
+    if (!obj) return true;
+    hamt_node* n = NODE(obj);
+    for (uint32_t i = 0; i < n->nentries; i++) {
+        int64_t vh;
+        if (!cog_hash_value(n->entries[i].val, &vh)) return false;
+        // added up so the order the entries are in doesn't matter
+        *hash += n->entries[i].hash * FNV_PRIME + vh;
+    }
+    for (uint32_t i = 0; i < n->nchildren; i++)
+        if (!_table_hash_helper(n->children[i], hash)) return false;
+    return true;
+}
+
 cog_object* m_table_hash() {
     cog_object* self = cog_pop();
-    cog_object* tree_hash = cog_hash(self->next);
-    if (!tree_hash) return cog_not_implemented(); // will be the case if there are mutable values
-    cog_push(cog_box_int(tree_hash->as_int ^ 0x123456789ABCE1BLL));
+    uint64_t hash = self->as_int;
+    if (!_table_hash_helper(self->next, &hash)) return cog_not_implemented(); // will be the case if there are mutable values
+    cog_push(cog_box_int(hash ^ 0x123456789ABCE1BLL));
     return NULL;
 }
 cog_object_method ome_table_hash = {&cog_ot_table, "Hash", m_table_hash};
 
-// MARK: ENVIRONMENT
-
-void cog_defun(cog_object* identifier, cog_object* value) {
-    cog_object* top_scope = COG_GLOBALS.scopes->data;
-    // TODO: do env with tables
-    cog_object* pair = cog_assoc(top_scope, identifier, cog_same_identifiers);
-    if (pair) {
-        pair->next = value;
-    } else {
-        pair = cog_make_obj(&cog_ot_list);
-        pair->data = identifier;
-        pair->next = value;
-        cog_push_to(&COG_GLOBALS.scopes->data, pair);
+static bool _table_equal_helper(cog_object* obj, cog_object* other_root) {
+    if (!obj) return true;
+    hamt_node* n = NODE(obj);
+    for (uint32_t i = 0; i < n->nentries; i++) {
+        // the entry already knows its hash, so the key isn't hashed again
+        bool found;
+        cog_object* val = hamt_get(other_root, n->entries[i].key, n->entries[i].hash, &found);
+        if (!found || !cog_equal(n->entries[i].val, val)) return false;
     }
+    for (uint32_t i = 0; i < n->nchildren; i++)
+        if (!_table_equal_helper(n->children[i], other_root)) return false;
+    return true;
 }
 
-cog_object* cog_get_fun(cog_object* identifier, bool* found) {
-    COG_ITER_LIST(COG_GLOBALS.scopes, scope) {
-        cog_object* pair = cog_assoc(scope, identifier, cog_same_identifiers);
-        if (pair) {
-            *found = true;
-            return pair->next;
-        }
+cog_object* m_table_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    bool eq = self->as_int == other->as_int && (self->next == other->next || _table_equal_helper(self->next, other->next));
+    cog_push(cog_box_bool(eq));
+    return NULL;
+}
+cog_object_method ome_table_equal = {&cog_ot_table, "Equal", m_table_equal};
+
+// MARK: DICTS
+
+// Dicts are mutable hash tables using open addressing with Robin Hood
+// probing: an entry that is further from its home slot than the one in
+// the way takes that slot, and the displaced entry moves on. This keeps
+// probe lengths short and lets a lookup stop as soon as it reaches an
+// entry closer to home than it would be.
+
+typedef struct {
+    uint64_t hash;
+    cog_object* key;
+    cog_object* val;
+    uint32_t dist; // how far from its home slot, plus one; 0 if the slot is empty
+} dict_slot;
+
+typedef struct {
+    dict_slot* slots;
+    size_t cap; // always a power of two
+    size_t count;
+} cog_dict;
+
+#define DICT_MIN_CAP 8
+
+static cog_object* walk_dict(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    cog_dict* d = (cog_dict*)obj->as_ptr;
+    for (size_t i = 0; i < d->cap; i++) {
+        if (!d->slots[i].dist) continue;
+        cog_walk(d->slots[i].key, f, arg);
+        cog_walk(d->slots[i].val, f, arg);
     }
-    *found = false;
     return NULL;
 }
 
-void cog_push_new_scope() {
-    cog_push_scope(cog_make_obj(&cog_ot_list));
+static void free_dict(cog_object* obj) {
+    cog_dict* d = (cog_dict*)obj->as_ptr;
+    if (d) {
+        free(d->slots);
+        free(d);
+        obj->as_ptr = NULL;
+    }
 }
 
-void cog_push_scope(cog_object* scope) {
-    cog_push_to(&COG_GLOBALS.scopes, scope);
-}
+cog_obj_type cog_ot_dict = {"Dict", walk_dict, free_dict};
 
-void cog_pop_scope() {
-    cog_pop_from(&COG_GLOBALS.scopes);
+cog_object* cog_make_dict() {
+    cog_dict* d = (cog_dict*)calloc(1, sizeof(cog_dict));
+    if (d == NULL) {
+        perror(__func__);
+        abort();
+    }
+    cog_object* obj = cog_make_obj(&cog_ot_dict);
+    obj->as_ptr = (void*)d;
+    return obj;
 }
 
-// MARK: CORE OF VM
-
-void cog_push(cog_object* item) {
-    cog_push_to(&COG_GLOBALS.stack, item);
+static dict_slot* dict_find(cog_dict* d, cog_object* key, uint64_t hash) {
+    if (!d->cap) return NULL;
+    size_t mask = d->cap - 1;
+    for (size_t i = hash & mask, dist = 1; d->slots[i].dist >= dist; i = (i + 1) & mask, dist++) {
+        if (d->slots[i].hash == hash && same_key(d->slots[i].key, key)) return &d->slots[i];
+    }
+    return NULL;
 }
 
-cog_object* cog_pop() {
-    return cog_pop_from(&COG_GLOBALS.stack);
+static void dict_place(cog_dict* d, dict_slot e) {
+    // e is known not to be in the dict already
+    size_t mask = d->cap - 1;
+    e.dist = 1;
+    for (size_t i = e.hash & mask;; i = (i + 1) & mask, e.dist++) {
+        if (!d->slots[i].dist) {
+            d->slots[i] = e;
+            return;
+        }
+        if (d->slots[i].dist < e.dist) {
+            dict_slot tmp = d->slots[i];
+            d->slots[i] = e;
+            e = tmp;
+        }
+    }
 }
 
-cog_object* cog_get_stack() {
-    return COG_GLOBALS.stack;
+static void dict_grow(cog_dict* d) {
+    dict_slot* old = d->slots;
+    size_t oldcap = d->cap;
+    d->cap = oldcap ? oldcap * 2 : DICT_MIN_CAP;
+    d->slots = (dict_slot*)calloc(d->cap, sizeof(dict_slot));
+    if (d->slots == NULL) {
+        perror(__func__);
+        abort();
+    }
+    for (size_t i = 0; i < oldcap; i++)
+        if (old[i].dist) dict_place(d, old[i]);
+    free(old);
 }
 
-size_t cog_stack_length() {
-    size_t len = 0;
-    COG_ITER_LIST(COG_GLOBALS.stack, _) len++;
-    return len;
+cog_object* cog_dict_get(cog_object* dict, cog_object* key, bool* found) {
+    assert(dict && dict->type == &cog_ot_dict);
+    dict_slot* slot = dict_find((cog_dict*)dict->as_ptr, key, key_hash(key));
+    *found = slot != NULL;
+    return slot ? slot->val : NULL;
 }
 
-bool cog_stack_has_at_least(size_t n) {
-    size_t len = 0;
-    COG_ITER_LIST(COG_GLOBALS.stack, _) {
-        len++;
-        if (len >= n) return true;
+void cog_dict_set(cog_object* dict, cog_object* key, cog_object* val) {
+    assert(dict && dict->type == &cog_ot_dict);
+    cog_dict* d = (cog_dict*)dict->as_ptr;
+    uint64_t hash = key_hash(key);
+    dict_slot* slot = dict_find(d, key, hash);
+    if (slot) {
+        slot->val = val;
+        return;
     }
-    return false;
+    // keep it at most 7/8 full
+    if ((d->count + 1) * 8 > d->cap * 7) dict_grow(d);
+    dict_slot e = {hash, key, val, 0};
+    dict_place(d, e);
+    d->count++;
+}
+
+bool cog_dict_remove(cog_object* dict, cog_object* key) {
+    assert(dict && dict->type == &cog_ot_dict);
+    cog_dict* d = (cog_dict*)dict->as_ptr;
+    dict_slot* slot = dict_find(d, key, key_hash(key));
+    if (!slot) return false;
+    // shift the entries after it back, until one is already at home
+    size_t mask = d->cap - 1;
+    size_t i = slot - d->slots;
+    for (size_t next = (i + 1) & mask; d->slots[next].dist > 1; i = next, next = (next + 1) & mask) {
+        d->slots[i] = d->slots[next];
+        d->slots[i].dist--;
+    }
+    memset(&d->slots[i], 0, sizeof(dict_slot));
+    d->count--;
+    return true;
 }
 
-bool cog_is_stack_empty() {
-    return COG_GLOBALS.stack == NULL;
+size_t cog_dict_size(cog_object* dict) {
+    assert(dict && dict->type == &cog_ot_dict);
+    return ((cog_dict*)dict->as_ptr)->count;
 }
 
-void cog_run_next(cog_object* item, cog_object* when, cog_object* cookie) {
-    cog_push_to(&cookie, item);
-    cog_push_to(&cookie, when);
-    cog_push_to(&COG_GLOBALS.command_queue, cookie);
+cog_object* cog_dict_to_table(cog_object* dict) {
+    assert(dict && dict->type == &cog_ot_dict);
+    cog_dict* d = (cog_dict*)dict->as_ptr;
+    cog_transient_table tab;
+    cog_table_transient(&tab, cog_emptytab());
+    for (size_t i = 0; i < d->cap; i++)
+        if (d->slots[i].dist) cog_transient_insert(&tab, d->slots[i].key, d->slots[i].val);
+    return cog_transient_freeze(&tab);
 }
 
-bool cog_has_well_known(cog_object* obj, const char* meth) {
-    assert(obj != NULL);
-    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
-        cog_module* mod = (cog_module*)modobj->as_ptr;
-        if (mod->mtab == NULL) continue;
-        for (size_t i = 0; mod->mtab[i] != NULL; i++) {
-            cog_object_method* m = mod->mtab[i];
-            if (strcmp(m->wkm, meth) == 0 && m->type_for == obj->type) return true;
-        }
+cog_object* m_dict_show_recursive() {
+    cog_object* dict = cog_pop();
+    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    cog_object* stream = cog_pop();
+    cog_object* alist = cog_pop();
+    int64_t* counter = (int64_t*)cog_pop()->as_ptr;
+    cog_dict* d = (cog_dict*)dict->as_ptr;
+    bool first = true;
+    cog_fputs_imm(stream, "<Dict { ");
+    for (size_t i = 0; i < d->cap; i++) {
+        if (!d->slots[i].dist) continue;
+        if (!first) cog_fputs_imm(stream, ", ");
+        first = false;
+        cog_print_refs_recursive(d->slots[i].key, alist, stream, counter, readably);
+        cog_fputs_imm(stream, ": ");
+        cog_print_refs_recursive(d->slots[i].val, alist, stream, counter, readably);
     }
-    return false;
+    cog_fputs_imm(stream, " }>");
+    return NULL;
 }
+cog_object_method ome_dict_show_recursive = {&cog_ot_dict, "Show_Recursive", m_dict_show_recursive};
 
-cog_object* cog_run_well_known(cog_object* obj, const char* meth) {
-    assert(obj != NULL);
-    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
-        cog_module* mod = (cog_module*)modobj->as_ptr;
-        if (mod->mtab == NULL) continue;
-        for (size_t i = 0; mod->mtab[i] != NULL; i++) {
-            cog_object_method* m = mod->mtab[i];
-            if (strcmp(m->wkm, meth) == 0 && m->type_for == obj->type) {
-                cog_push(obj);
-                cog_object* res = m->func();
-                if (res && cog_same_identifiers(res, COG_GLOBALS.not_impl_sym)) continue;
-                return res;
-            }
-        }
+// it can change, so it can only be equal to itself, and it hashes by its
+// address, which stays the same for as long as it lives
+cog_object* m_dict_hash() {
+    cog_object* self = cog_pop();
+    // objects are 32 bytes apart, so the address is mixed to spread the low bits
+    cog_push(cog_box_int((int64_t)((uint64_t)(uintptr_t)self * 0x9E3779B97F4A7C15ULL)));
+    return NULL;
+}
+cog_object_method ome_dict_hash = {&cog_ot_dict, "Hash", m_dict_hash};
+
+// MARK: ORDERED MAPS
+
+// Ordered maps are persistent B-trees kept sorted by key, so they can be
+// walked in order and searched for the keys nearest to one that isn't
+// there. The keys of one map are either all numbers or all strings. The
+// nodes are wide, so a lookup only has to visit a few of them, and a
+// change rebuilds just the nodes on the path down to it.
+
+#define BTREE_ORDER 16
+#define BTREE_MIN (BTREE_ORDER - 1) // fewest keys in a node other than the root
+#define BTREE_MAX (2 * BTREE_ORDER - 1) // most keys in a node
+
+typedef struct {
+    uint32_t n;
+    bool leaf;
+    cog_object** keys;
+    cog_object** vals;
+    cog_object** children; // n + 1 of them, or NULL in a leaf
+} btree_node;
+
+// an unpacked copy of a node being changed, with room for one key too many
+typedef struct {
+    uint32_t n;
+    bool leaf;
+    cog_object* keys[BTREE_MAX + 1];
+    cog_object* vals[BTREE_MAX + 1];
+    cog_object* children[BTREE_MAX + 2];
+} btree_scratch;
+
+#define BNODE(obj) ((btree_node*)(obj)->as_ptr)
+
+static cog_object* walk_btree_node(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    btree_node* n = BNODE(obj);
+    for (uint32_t i = 0; i < n->n; i++) {
+        cog_walk(n->keys[i], f, arg);
+        cog_walk(n->vals[i], f, arg);
     }
-    return cog_not_implemented();
+    if (!n->leaf)
+        for (uint32_t i = 0; i <= n->n; i++)
+            cog_walk(n->children[i], f, arg);
+    return NULL;
 }
 
-cog_object* cog_run_well_known_strict(cog_object* obj, const char* meth) {
-    cog_object* res = cog_run_well_known(obj, meth);
-    if (res && cog_same_identifiers(res, COG_GLOBALS.not_impl_sym)) {
-        const char* method_name = meth;
-        fprintf(stderr, "error: %s not implemented for %s\n", method_name, obj->type ? obj->type->name : "empty List");
-        COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
-            cog_module* mod = (cog_module*)modobj->as_ptr;
-            if (mod->types == NULL) continue;
-            for (size_t i = 0; mod->types[i] != NULL; i++) {
-                cog_obj_type* t = mod->types[i];
-                if (t == obj->type) goto hasimport;
-            }
-        }
-        fprintf(stderr, "did you forget to import the module?\n");
-        hasimport:
-        print_backtrace();
-        abort();
-    }
-    return res;
+static void free_btree_node(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
 }
 
-cog_object* cog_mainloop(cog_object* status) {
-    size_t next_gc = COG_GLOBALS.alloc_chunks * 2;
-    while (COG_GLOBALS.command_queue) {
-        cog_object* cmd = cog_pop_from(&COG_GLOBALS.command_queue);
-        if (cmd == NULL) {
-            fprintf(stderr, "got NULL as object in command queue\n");
-            abort();
+static cog_obj_type ot_btree_node = {"[[OrderedMap::Node]]", walk_btree_node, free_btree_node};
+
+cog_obj_type cog_ot_ordered_map = {"OrderedMap", cog_walk_only_next, NULL};
+
+cog_object* cog_empty_omap() {
+    cog_object* map = cog_make_obj(&cog_ot_ordered_map);
+    map->as_int = 0; // the number of entries
+    return map;
+}
+
+static cog_object* _wrap_omap(cog_object* root, size_t size) {
+    cog_object* map = cog_make_obj(&cog_ot_ordered_map);
+    map->next = root;
+    map->as_int = size;
+    return map;
+}
+
+static cog_object* btree_pack(btree_scratch* s) {
+    // the arrays live in the same block as the header
+    size_t nchildren = s->leaf ? 0 : s->n + 1;
+    btree_node* n = (btree_node*)malloc(sizeof(btree_node) + (2 * s->n + nchildren) * sizeof(cog_object*));
+    if (n == NULL) {
+        perror(__func__);
+        abort();
+    }
+    n->n = s->n;
+    n->leaf = s->leaf;
+    n->keys = (cog_object**)(n + 1);
+    n->vals = n->keys + s->n;
+    n->children = s->leaf ? NULL : n->vals + s->n;
+    memcpy(n->keys, s->keys, s->n * sizeof(cog_object*));
+    memcpy(n->vals, s->vals, s->n * sizeof(cog_object*));
+    if (!s->leaf) memcpy(n->children, s->children, nchildren * sizeof(cog_object*));
+    cog_object* obj = cog_make_obj(&ot_btree_node);
+    obj->as_ptr = (void*)n;
+    return obj;
+}
+
+static void btree_unpack(cog_object* obj, btree_scratch* s) {
+    btree_node* n = BNODE(obj);
+    s->n = n->n;
+    s->leaf = n->leaf;
+    memcpy(s->keys, n->keys, n->n * sizeof(cog_object*));
+    memcpy(s->vals, n->vals, n->n * sizeof(cog_object*));
+    if (!n->leaf) memcpy(s->children, n->children, (n->n + 1) * sizeof(cog_object*));
+}
+
+// put in a key at i, with the subtree to the right of it
+static void scratch_insert(btree_scratch* s, uint32_t i, cog_object* key, cog_object* val, cog_object* right) {
+    memmove(&s->keys[i + 1], &s->keys[i], (s->n - i) * sizeof(cog_object*));
+    memmove(&s->vals[i + 1], &s->vals[i], (s->n - i) * sizeof(cog_object*));
+    if (!s->leaf) {
+        memmove(&s->children[i + 2], &s->children[i + 1], (s->n - i) * sizeof(cog_object*));
+        s->children[i + 1] = right;
+    }
+    s->keys[i] = key;
+    s->vals[i] = val;
+    s->n++;
+}
+
+// take out key i, with the subtree to the right of it
+static void scratch_delete(btree_scratch* s, uint32_t i) {
+    memmove(&s->keys[i], &s->keys[i + 1], (s->n - i - 1) * sizeof(cog_object*));
+    memmove(&s->vals[i], &s->vals[i + 1], (s->n - i - 1) * sizeof(cog_object*));
+    if (!s->leaf) memmove(&s->children[i + 1], &s->children[i + 2], (s->n - i - 1) * sizeof(cog_object*));
+    s->n--;
+}
+
+// 1 for numbers, 2 for strings, 0 for anything that can't be a key
+static int omap_key_kind(cog_object* key) {
+    if (!key) return 0;
+    if (key->type == &cog_ot_int) return 1;
+    if (key->type == &cog_ot_float) return isnan(key->as_float) ? 0 : 1;
+    if (key->type == &cog_ot_string) return 2;
+    return 0;
+}
+
+static int omap_compare(cog_object* a, cog_object* b) {
+    if (a->type == &cog_ot_string) return cog_strcmp(a, b);
+    if (a->type == &cog_ot_int && b->type == &cog_ot_int) return (a->as_int > b->as_int) - (a->as_int < b->as_int);
+    double x = a->type == &cog_ot_float ? a->as_float : a->as_int;
+    double y = b->type == &cog_ot_float ? b->as_float : b->as_int;
+    return (x > y) - (x < y);
+}
+
+// the index of the first key in the node that isn't less than the key
+static uint32_t btree_search(btree_node* n, cog_object* key, bool* found) {
+    uint32_t lo = 0, hi = n->n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (omap_compare(n->keys[mid], key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = lo < n->n && omap_compare(n->keys[lo], key) == 0;
+    return lo;
+}
+
+// split a node that has one key too many around its middle key
+static void btree_split(cog_object* node, cog_object** left, cog_object** key, cog_object** val, cog_object** right) {
+    btree_scratch l, r;
+    btree_unpack(node, &l);
+    uint32_t mid = l.n / 2;
+    r.leaf = l.leaf;
+    r.n = l.n - mid - 1;
+    memcpy(r.keys, &l.keys[mid + 1], r.n * sizeof(cog_object*));
+    memcpy(r.vals, &l.vals[mid + 1], r.n * sizeof(cog_object*));
+    if (!l.leaf) memcpy(r.children, &l.children[mid + 1], (r.n + 1) * sizeof(cog_object*));
+    *key = l.keys[mid];
+    *val = l.vals[mid];
+    l.n = mid;
+    *left = btree_pack(&l);
+    *right = btree_pack(&r);
+}
+
+// may return a node with one key too many, which the caller splits
+static cog_object* btree_insert(cog_object* node, cog_object* key, cog_object* val, bool* added) {
+    bool found;
+    uint32_t i = btree_search(BNODE(node), key, &found);
+    btree_scratch s;
+    btree_unpack(node, &s);
+    if (found) s.vals[i] = val;
+    else if (s.leaf) {
+        scratch_insert(&s, i, key, val, NULL);
+        *added = true;
+    } else {
+        cog_object* child = btree_insert(s.children[i], key, val, added);
+        if (BNODE(child)->n > BTREE_MAX) {
+            cog_object *left, *mkey, *mval, *right;
+            btree_split(child, &left, &mkey, &mval, &right);
+            s.children[i] = left;
+            scratch_insert(&s, i, mkey, mval, right);
+        } else s.children[i] = child;
+    }
+    return btree_pack(&s);
+}
+
+// after a removal from child i, give it enough keys again, either by
+// moving one across from a sibling through the parent, or by merging it
+// with a sibling and the key between them
+static void btree_fix_child(btree_scratch* s, uint32_t i) {
+    if (BNODE(s->children[i])->n >= BTREE_MIN) return;
+    btree_scratch c, sib;
+    if (i > 0 && BNODE(s->children[i - 1])->n > BTREE_MIN) {
+        btree_unpack(s->children[i], &c);
+        btree_unpack(s->children[i - 1], &sib);
+        memmove(&c.keys[1], &c.keys[0], c.n * sizeof(cog_object*));
+        memmove(&c.vals[1], &c.vals[0], c.n * sizeof(cog_object*));
+        if (!c.leaf) {
+            memmove(&c.children[1], &c.children[0], (c.n + 1) * sizeof(cog_object*));
+            c.children[0] = sib.children[sib.n];
         }
-        cog_object* when = cmd->data;
-        cog_object* which = cmd->next->data;
-        cog_object* cookie = cmd->next->next;
-        if (which == NULL) {
-            fprintf(stderr, "got NULL as command in command queue\n");
-            abort();
+        c.keys[0] = s->keys[i - 1];
+        c.vals[0] = s->vals[i - 1];
+        c.n++;
+        sib.n--;
+        s->keys[i - 1] = sib.keys[sib.n];
+        s->vals[i - 1] = sib.vals[sib.n];
+        s->children[i - 1] = btree_pack(&sib);
+        s->children[i] = btree_pack(&c);
+    } else if (i < s->n && BNODE(s->children[i + 1])->n > BTREE_MIN) {
+        btree_unpack(s->children[i], &c);
+        btree_unpack(s->children[i + 1], &sib);
+        c.keys[c.n] = s->keys[i];
+        c.vals[c.n] = s->vals[i];
+        if (!c.leaf) c.children[c.n + 1] = sib.children[0];
+        c.n++;
+        s->keys[i] = sib.keys[0];
+        s->vals[i] = sib.vals[0];
+        memmove(&sib.keys[0], &sib.keys[1], (sib.n - 1) * sizeof(cog_object*));
+        memmove(&sib.vals[0], &sib.vals[1], (sib.n - 1) * sizeof(cog_object*));
+        if (!sib.leaf) memmove(&sib.children[0], &sib.children[1], sib.n * sizeof(cog_object*));
+        sib.n--;
+        s->children[i] = btree_pack(&c);
+        s->children[i + 1] = btree_pack(&sib);
+    } else {
+        uint32_t j = i < s->n ? i : i - 1;
+        btree_unpack(s->children[j], &c);
+        btree_unpack(s->children[j + 1], &sib);
+        c.keys[c.n] = s->keys[j];
+        c.vals[c.n] = s->vals[j];
+        memcpy(&c.keys[c.n + 1], sib.keys, sib.n * sizeof(cog_object*));
+        memcpy(&c.vals[c.n + 1], sib.vals, sib.n * sizeof(cog_object*));
+        if (!c.leaf) memcpy(&c.children[c.n + 1], sib.children, (sib.n + 1) * sizeof(cog_object*));
+        c.n += sib.n + 1;
+        s->children[j] = btree_pack(&c);
+        scratch_delete(s, j);
+    }
+}
+
+// take the last key out of a subtree
+static cog_object* btree_remove_last(cog_object* node, cog_object** key, cog_object** val) {
+    btree_scratch s;
+    btree_unpack(node, &s);
+    if (s.leaf) {
+        s.n--;
+        *key = s.keys[s.n];
+        *val = s.vals[s.n];
+    } else {
+        s.children[s.n] = btree_remove_last(s.children[s.n], key, val);
+        btree_fix_child(&s, s.n);
+    }
+    return btree_pack(&s);
+}
+
+// may return a node with too few keys, which the caller fixes
+static cog_object* btree_remove(cog_object* node, cog_object* key, bool* removed) {
+    bool found;
+    uint32_t i = btree_search(BNODE(node), key, &found);
+    if (!found && BNODE(node)->leaf) return node;
+    btree_scratch s;
+    btree_unpack(node, &s);
+    if (found && s.leaf) {
+        scratch_delete(&s, i);
+        *removed = true;
+    } else if (found) {
+        // replace it with the key just before it
+        s.children[i] = btree_remove_last(s.children[i], &s.keys[i], &s.vals[i]);
+        *removed = true;
+        btree_fix_child(&s, i);
+    } else {
+        cog_object* child = btree_remove(s.children[i], key, removed);
+        if (!*removed) return node;
+        s.children[i] = child;
+        btree_fix_child(&s, i);
+    }
+    return btree_pack(&s);
+}
+
+static bool btree_first(cog_object* node, cog_object** key, cog_object** val) {
+    if (!node) return false;
+    while (!BNODE(node)->leaf) node = BNODE(node)->children[0];
+    *key = BNODE(node)->keys[0];
+    *val = BNODE(node)->vals[0];
+    return true;
+}
+
+// the entry with the smallest key at or after the key (or strictly after,
+// if strict); false if there isn't one
+static bool btree_ceiling(cog_object* node, cog_object* key, bool strict, cog_object** k, cog_object** v) {
+    bool any = false;
+    while (node) {
+        btree_node* n = BNODE(node);
+        bool found;
+        uint32_t i = btree_search(n, key, &found);
+        if (found && !strict) {
+            *k = n->keys[i];
+            *v = n->vals[i];
+            return true;
         }
-        bool is_normal_exec = cog_same_identifiers(status, when);
-        if (is_normal_exec
-                || cog_same_identifiers(cog_on_exit(), when)
-                || cog_same_identifiers(cog_on_enter(), when)) {
-            cog_push(cookie);
-            cog_object* new_status = cog_run_well_known(which, "Exec");
-            if (cog_same_identifiers(new_status, cog_not_implemented())) {
-                cog_pop();
-                cog_push(cog_sprintf("Can't run %O", which));
-                new_status = cog_error();
-            }
-            if (is_normal_exec) status = new_status;
-            // maybe do a GC
-            if (COG_GLOBALS.alloc_chunks > next_gc) {
-                // protect status in case it is nonstandard
-                cog_walk(status, markobject, NULL);
-                gc();
-                next_gc = COG_GLOBALS.alloc_chunks * 2;
-            }
+        if (found) i++;
+        if (i < n->n) {
+            *k = n->keys[i];
+            *v = n->vals[i];
+            any = true;
         }
+        node = n->leaf ? NULL : n->children[i];
     }
-    return status;
+    return any;
+}
+
+// the entry with the largest key at or before the key; false if there isn't one
+static bool btree_floor(cog_object* node, cog_object* key, cog_object** k, cog_object** v) {
+    bool any = false;
+    while (node) {
+        btree_node* n = BNODE(node);
+        bool found;
+        uint32_t i = btree_search(n, key, &found);
+        if (found) {
+            *k = n->keys[i];
+            *v = n->vals[i];
+            return true;
+        }
+        if (i > 0) {
+            *k = n->keys[i - 1];
+            *v = n->vals[i - 1];
+            any = true;
+        }
+        node = n->leaf ? NULL : n->children[i];
+    }
+    return any;
 }
 
-cog_object* cog_obj_push_self() {
-    cog_object* self = cog_pop();
-    cog_pop(); // ignore cookie
-    cog_push(self);
+cog_object* cog_omap_get(cog_object* map, cog_object* key, bool* found) {
+    assert(map && map->type == &cog_ot_ordered_map);
+    for (cog_object* node = map->next; node;) {
+        btree_node* n = BNODE(node);
+        uint32_t i = btree_search(n, key, found);
+        if (*found) return n->vals[i];
+        node = n->leaf ? NULL : n->children[i];
+    }
+    *found = false;
     return NULL;
 }
 
-// MARK: NUMBERS
+cog_object* cog_omap_insert(cog_object* map, cog_object* key, cog_object* val) {
+    assert(map && map->type == &cog_ot_ordered_map);
+    bool added = false;
+    btree_scratch s;
+    cog_object* root;
+    if (!map->next) {
+        s.n = 0;
+        s.leaf = true;
+        scratch_insert(&s, 0, key, val, NULL);
+        root = btree_pack(&s);
+        added = true;
+    } else {
+        root = btree_insert(map->next, key, val, &added);
+        if (BNODE(root)->n > BTREE_MAX) {
+            // grow a new root
+            s.n = 1;
+            s.leaf = false;
+            btree_split(root, &s.children[0], &s.keys[0], &s.vals[0], &s.children[1]);
+            root = btree_pack(&s);
+        }
+    }
+    return _wrap_omap(root, map->as_int + added);
+}
 
-cog_obj_type cog_ot_int = {"Integer", NULL};
-cog_object* cog_box_int(int64_t i) {
-    cog_object* obj = cog_make_obj(&cog_ot_int);
-    obj->as_int = i;
-    return obj;
+cog_object* cog_omap_remove(cog_object* map, cog_object* key) {
+    assert(map && map->type == &cog_ot_ordered_map);
+    if (!map->next) return map;
+    bool removed = false;
+    cog_object* root = btree_remove(map->next, key, &removed);
+    if (!removed) return map;
+    if (BNODE(root)->n == 0) root = BNODE(root)->leaf ? NULL : BNODE(root)->children[0];
+    return _wrap_omap(root, map->as_int - 1);
 }
-int64_t cog_unbox_int(cog_object* obj) {
-    assert(obj->type == &cog_ot_int);
-    return obj->as_int;
+
+size_t cog_omap_size(cog_object* map) {
+    assert(map && map->type == &cog_ot_ordered_map);
+    return map->as_int;
 }
-cog_object* int_printself() {
-    cog_object* num = cog_pop();
-    cog_pop(); // ignore cookie
-    char buffer[21];
-    snprintf(buffer, sizeof(buffer), "%" PRId64, num->as_int);
-    cog_push(cog_string(buffer));
+
+// goes backwards, so that pushing each entry onto a list leaves it in order
+static cog_object* _omap_reduce_helper(cog_object* node, cog_object* (*func)(cog_object*, cog_object*, cog_object*), cog_object* accum) {
+    if (!node) return accum;
+    btree_node* n = BNODE(node);
+    for (uint32_t i = n->n; i > 0; i--) {
+        if (!n->leaf) accum = _omap_reduce_helper(n->children[i], func, accum);
+        accum = func(n->keys[i - 1], n->vals[i - 1], accum);
+    }
+    if (!n->leaf) accum = _omap_reduce_helper(n->children[0], func, accum);
+    return accum;
+}
+
+cog_object* cog_omap_reduce_reverse(cog_object* map, cog_object* (*func)(cog_object*, cog_object*, cog_object*), cog_object* accum) {
+    assert(map && map->type == &cog_ot_ordered_map);
+    return _omap_reduce_helper(map->next, func, accum);
+}
+
+static void _omap_show_rec_helper(cog_object* node, cog_object* alist, cog_object* stream, int64_t* counter, bool readably, bool* first) {
+    if (!node) return;
+    btree_node* n = BNODE(node);
+    for (uint32_t i = 0; i <= n->n; i++) {
+        if (!n->leaf) _omap_show_rec_helper(n->children[i], alist, stream, counter, readably, first);
+        if (i == n->n) break;
+        if (!*first) cog_fputs_imm(stream, ", ");
+        *first = false;
+        cog_print_refs_recursive(n->keys[i], alist, stream, counter, readably);
+        cog_fputs_imm(stream, ": ");
+        cog_print_refs_recursive(n->vals[i], alist, stream, counter, readably);
+    }
+}
+
+cog_object* m_omap_show_recursive() {
+    cog_object* map = cog_pop();
+    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    cog_object* stream = cog_pop();
+    cog_object* alist = cog_pop();
+    int64_t* counter = (int64_t*)cog_pop()->as_ptr;
+    bool first = true;
+    cog_fputs_imm(stream, "<OrderedMap { ");
+    _omap_show_rec_helper(map->next, alist, stream, counter, readably, &first);
+    cog_fputs_imm(stream, " }>");
     return NULL;
 }
-cog_object_method ome_int_show = {&cog_ot_int, "Show", int_printself};
-cog_object_method ome_int_exec = {&cog_ot_int, "Exec", cog_obj_push_self};
+cog_object_method ome_omap_show_recursive = {&cog_ot_ordered_map, "Show_Recursive", m_omap_show_recursive};
+
+static bool _omap_hash_helper(cog_object* node, uint64_t* hash) {
+    if (!node) return true;
+    btree_node* n = BNODE(node);
+    for (uint32_t i = 0; i <= n->n; i++) {
+        if (!n->leaf && !_omap_hash_helper(n->children[i], hash)) return false;
+        if (i == n->n) break;
+        int64_t kh, vh;
+        if (!cog_hash_value(n->keys[i], &kh) || !cog_hash_value(n->vals[i], &vh)) return false;
+        *hash = (*hash * FNV_PRIME) ^ (kh + vh * FNV_PRIME);
+    }
+    return true;
+}
 
-static cog_object* m_int_hash() {
-    // Integers hash to themselves
+cog_object* m_omap_hash() {
+    cog_object* self = cog_pop();
+    uint64_t hash = self->as_int;
+    if (!_omap_hash_helper(self->next, &hash)) return cog_not_implemented();
+    cog_push(cog_box_int(hash ^ 0x2A5E77D0C3B1F49LL));
     return NULL;
 }
-cog_object_method ome_int_hash = {&cog_ot_int, "Hash", m_int_hash};
+cog_object_method ome_omap_hash = {&cog_ot_ordered_map, "Hash", m_omap_hash};
+
+static bool _omap_equal_helper(cog_object* node, cog_object* other) {
+    if (!node) return true;
+    btree_node* n = BNODE(node);
+    for (uint32_t i = 0; i <= n->n; i++) {
+        if (!n->leaf && !_omap_equal_helper(n->children[i], other)) return false;
+        if (i == n->n) break;
+        bool found;
+        cog_object* val = cog_omap_get(other, n->keys[i], &found);
+        if (!found || !cog_equal(n->vals[i], val)) return false;
+    }
+    return true;
+}
 
-static cog_object* m_int_equal_other_type() {
+cog_object* m_omap_equal() {
     cog_object* self = cog_pop();
     cog_object* other = cog_pop();
-    if (other->type == &cog_ot_float) {
-        cog_push(cog_box_bool(self->as_int == other->as_float));
-        return NULL;
+    bool eq = self->as_int == other->as_int && (self->next == other->next || _omap_equal_helper(self->next, other));
+    cog_push(cog_box_bool(eq));
+    return NULL;
+}
+cog_object_method ome_omap_equal = {&cog_ot_ordered_map, "Equal", m_omap_equal};
+
+// a lazy list of the (key value) entries of an ordered map, in order,
+// from one key to another. Until it is forced, next is the list
+// (root from to flags); after that next is NULL and data is the list cell
+// ((key value) . Entries) or NULL if there were no more
+cog_obj_type ot_omap_range = {"Entries", cog_walk_both, NULL};
+
+#define RANGE_AFTER 1 // leave out the `from` key itself
+#define RANGE_NO_FROM 2 // start at the first key
+#define RANGE_NO_TO 4 // go to the last key
+
+static cog_object* omap_range(cog_object* root, cog_object* from, cog_object* to, int flags) {
+    cog_object* state = NULL;
+    cog_push_to(&state, cog_box_int(flags));
+    cog_push_to(&state, to);
+    cog_push_to(&state, from);
+    cog_push_to(&state, root);
+    cog_object* range = cog_make_obj(&ot_omap_range);
+    range->next = state;
+    return range;
+}
+
+static cog_object* omap_range_force(cog_object* range) {
+    if (range->next) {
+        cog_object* root = range->next->data;
+        cog_object* from = range->next->next->data;
+        cog_object* to = range->next->next->next->data;
+        int flags = range->next->next->next->next->data->as_int;
+        cog_object *key, *val;
+        bool any = flags & RANGE_NO_FROM ? btree_first(root, &key, &val) : btree_ceiling(root, from, flags & RANGE_AFTER, &key, &val);
+        if (any && !(flags & RANGE_NO_TO) && omap_compare(key, to) > 0) any = false;
+        if (any) {
+            cog_object* entry = NULL;
+            cog_push_to(&entry, val);
+            cog_push_to(&entry, key);
+            range->data = cog_make_obj(&cog_ot_list);
+            range->data->data = entry;
+            range->data->next = omap_range(root, key, to, (flags & RANGE_NO_TO) | RANGE_AFTER);
+        } else range->data = NULL;
+        range->next = NULL;
     }
-    cog_push(other);
-    return cog_not_implemented();
+    return range->data;
 }
-cog_object_method ome_int_equal_other_type = {&cog_ot_int, "Equal_OtherType", m_int_equal_other_type};
 
-cog_obj_type cog_ot_bool = {"Boolean", NULL};
-cog_object* cog_box_bool(bool i) {
-    cog_object* obj = cog_make_obj(&cog_ot_bool);
-    obj->as_int = i;
-    return obj;
-}
-bool cog_unbox_bool(cog_object* obj) {
-    assert(obj->type == &cog_ot_bool);
-    return obj->as_int;
+cog_object* m_omap_range_show() {
+    cog_object* range = cog_pop();
+    cog_pop(); // ignore readably
+    if (range->next) cog_push(cog_string("<Entries>"));
+    else if (range->data) cog_push(cog_sprintf("<Entries at %O>", range->data->data));
+    else cog_push(cog_string("<Entries at end>"));
+    return NULL;
 }
-cog_object* bool_printself() {
-    cog_object* num = cog_pop();
-    cog_pop(); // ignore cookie
-    char buffer[6];
-    snprintf(buffer, sizeof(buffer), "%s", num->as_int ? "True" : "False");
-    cog_push(cog_string(buffer));
+cog_object_method ome_omap_range_show = {&ot_omap_range, "Show", m_omap_range_show};
+
+cog_object_method ome_omap_range_hash = {&ot_omap_range, "Hash", cog_not_implemented};
+
+// MARK: VECTORS
+
+// Vectors are persistent arrays, stored as a trie of 32-wide nodes indexed
+// by 5 bits of the index at a time, plus a tail node that holds the last
+// up to 32 items so adding to the end usually only copies the tail. Getting
+// or changing one item only touches one node per level.
+
+#define VEC_BITS 5
+#define VEC_WIDTH (1 << VEC_BITS)
+#define VEC_MASK (VEC_WIDTH - 1)
+
+typedef struct {
+    uint32_t n;
+    cog_object* items[VEC_WIDTH]; // the values in a leaf, else the child nodes
+} vec_node;
+
+typedef struct {
+    size_t count;
+    int shift; // how far to shift the index for the root's slot
+    cog_object* root; // NULL if all the items fit in the tail
+    cog_object* tail; // NULL if the vector is empty
+} cog_vector;
+
+#define VNODE(obj) ((vec_node*)(obj)->as_ptr)
+#define VEC(obj) ((cog_vector*)(obj)->as_ptr)
+
+static cog_object* walk_vec_node(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    vec_node* n = VNODE(obj);
+    for (uint32_t i = 0; i < n->n; i++)
+        cog_walk(n->items[i], f, arg);
     return NULL;
 }
-cog_object_method ome_bool_show = {&cog_ot_bool, "Show", bool_printself};
-cog_object_method ome_bool_exec = {&cog_ot_bool, "Exec", cog_obj_push_self};
 
-static cog_object* m_bool_hash() {
-    cog_object* num = cog_pop();
-    int64_t hash = num->as_int;
-    // Booleans hash like integers
-    cog_push(cog_box_int(hash));
+static void free_vec_node(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
+}
+
+static cog_obj_type ot_vec_node = {"[[Vector::Node]]", walk_vec_node, free_vec_node};
+
+static cog_object* walk_vector(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    cog_walk(VEC(obj)->root, f, arg);
+    cog_walk(VEC(obj)->tail, f, arg);
     return NULL;
 }
-cog_object_method ome_bool_hash = {&cog_ot_bool, "Hash", m_bool_hash};
 
-cog_obj_type cog_ot_float = {"Number", NULL};
-cog_object* cog_box_float(double i) {
-    cog_object* obj = cog_make_obj(&cog_ot_float);
-    obj->as_float = i;
+static void free_vector(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
+}
+
+cog_obj_type cog_ot_vector = {"Vector", walk_vector, free_vector};
+
+static cog_object* vec_new_node(vec_node* copy_of) {
+    vec_node* n = (vec_node*)malloc(sizeof(vec_node));
+    if (n == NULL) {
+        perror(__func__);
+        abort();
+    }
+    if (copy_of) memcpy(n, copy_of, sizeof(vec_node));
+    else n->n = 0;
+    cog_object* obj = cog_make_obj(&ot_vec_node);
+    obj->as_ptr = (void*)n;
     return obj;
 }
-double cog_unbox_float(cog_object* obj) {
-    assert(obj->type == &cog_ot_float);
-    return obj->as_float;
+
+static cog_object* _wrap_vector(size_t count, int shift, cog_object* root, cog_object* tail) {
+    cog_vector* v = (cog_vector*)malloc(sizeof(cog_vector));
+    if (v == NULL) {
+        perror(__func__);
+        abort();
+    }
+    v->count = count;
+    v->shift = shift;
+    v->root = root;
+    v->tail = tail;
+    cog_object* obj = cog_make_obj(&cog_ot_vector);
+    obj->as_ptr = (void*)v;
+    return obj;
 }
-cog_object* float_printself() {
-    cog_object* num = cog_pop();
-    cog_pop(); // ignore cookie
-    char buffer[32];
-    snprintf(buffer, sizeof(buffer), "%lg%s", num->as_float, floor(num->as_float) == num->as_float ? ".0" : "");
-    cog_push(cog_string(buffer));
-    return NULL;
+
+cog_object* cog_empty_vector() {
+    return _wrap_vector(0, VEC_BITS, NULL, NULL);
 }
-cog_object_method ome_float_show = {&cog_ot_float, "Show", float_printself};
-cog_object_method ome_float_exec = {&cog_ot_float, "Exec", cog_obj_push_self};
 
-static cog_object* m_float_hash() {
-    cog_object* num = cog_pop();
-    double val = num->as_float;
-    // floats hash to their int value if it's an int, otherwise the reinterpret_cast of their bits
-    int64_t hash = val == floor(val) ? (int64_t)val : *(int64_t*)&val;
-    cog_push(cog_box_int(hash));
-    return NULL;
+size_t cog_vector_length(cog_object* vec) {
+    assert(vec && vec->type == &cog_ot_vector);
+    return VEC(vec)->count;
 }
-cog_object_method ome_float_hash = {&cog_ot_float, "Hash", m_float_hash};
 
-static cog_object* m_float_equal_other_type() {
-    cog_object* self = cog_pop();
-    cog_object* other = cog_pop();
-    if (other->type == &cog_ot_int) {
-        cog_push(cog_box_bool(self->as_float == other->as_int));
-        return NULL;
-    }
-    return cog_not_implemented();
+// how many items are in the trie, not the tail
+static size_t vec_tail_offset(cog_vector* v) {
+    return v->count < VEC_WIDTH ? 0 : ((v->count - 1) >> VEC_BITS) << VEC_BITS;
 }
-cog_object_method ome_float_equal_other_type = {&cog_ot_float, "Equal_OtherType", m_float_equal_other_type};
 
-// MARK: IDENTIFIERS
+// the node that holds item i
+static vec_node* vec_leaf_for(cog_vector* v, size_t i) {
+    if (i >= vec_tail_offset(v)) return VNODE(v->tail);
+    cog_object* node = v->root;
+    for (int level = v->shift; level > 0; level -= VEC_BITS)
+        node = VNODE(node)->items[(i >> level) & VEC_MASK];
+    return VNODE(node);
+}
 
-static cog_object* walk_identifier(cog_object* i, cog_walk_fun f, cog_object* arg) {
-    (void)arg;
-    if (i->as_int) return NULL;
-    return i->next;
+cog_object* cog_vector_nth(cog_object* vec, size_t i) {
+    assert(vec && vec->type == &cog_ot_vector);
+    assert(i < VEC(vec)->count);
+    return vec_leaf_for(VEC(vec), i)->items[i & VEC_MASK];
 }
-cog_obj_type cog_ot_identifier = {"Identifier", walk_identifier};
 
-// TODO: parameterize / calculate this constant at compile time
-#define MAXPACKED 11
-const char* const PACKEDALPHABET = "0123456789abcdefghijklmnopqrstuvwxyz-?!'+/\\*>=<^.";
+// a chain of single-child nodes down to the node
+static cog_object* vec_new_path(int level, cog_object* node) {
+    if (level == 0) return node;
+    cog_object* ret = vec_new_node(NULL);
+    VNODE(ret)->items[0] = vec_new_path(level - VEC_BITS, node);
+    VNODE(ret)->n = 1;
+    return ret;
+}
 
-static bool pack_identifier_c(const char* const buffer, cog_packed_identifier* out) {
-    cog_packed_identifier res = 0;
-    size_t len = 0;
-    size_t base = strlen(PACKEDALPHABET);
-    for (const char* s = buffer; *s; s++, len++) {
-        if (len > MAXPACKED) return false;
-        // !!! identifiers are case insensitive
-        const char* where = strchr(PACKEDALPHABET, tolower(*s));
-        if (where == NULL) return false;
-        res *= base;
-        res += where - PACKEDALPHABET;
-    }
-    *out = (res << 1) | 1;
-    return true;
+// put a full tail into the trie, as the leaf after the last one
+static cog_object* vec_push_tail(size_t count, int level, cog_object* parent, cog_object* tail) {
+    uint32_t sub = ((count - 1) >> level) & VEC_MASK;
+    cog_object* ret = vec_new_node(parent ? VNODE(parent) : NULL);
+    vec_node* r = VNODE(ret);
+    if (level == VEC_BITS) r->items[sub] = tail;
+    else if (sub < r->n) r->items[sub] = vec_push_tail(count, level - VEC_BITS, r->items[sub], tail);
+    else r->items[sub] = vec_new_path(level - VEC_BITS, tail);
+    if (sub >= r->n) r->n = sub + 1;
+    return ret;
 }
 
-static bool pack_identifier(cog_object* string, cog_packed_identifier* out) {
-    cog_packed_identifier res = 0;
-    size_t len = cog_strlen(string);
-    if (len > MAXPACKED) return false;
-    size_t base = strlen(PACKEDALPHABET);
-    for (size_t i = 0; i < len; i++) {
-        // !!! identifiers are case insensitive
-        const char* where = strchr(PACKEDALPHABET, tolower(cog_nthchar(string, i)));
-        if (where == NULL) return false;
-        res *= base;
-        res += where - PACKEDALPHABET;
+cog_object* cog_vector_conj(cog_object* vec, cog_object* item) {
+    assert(vec && vec->type == &cog_ot_vector);
+    cog_vector* v = VEC(vec);
+    if (v->count - vec_tail_offset(v) < VEC_WIDTH) {
+        // there's still room in the tail
+        cog_object* tail = vec_new_node(v->tail ? VNODE(v->tail) : NULL);
+        VNODE(tail)->items[VNODE(tail)->n++] = item;
+        return _wrap_vector(v->count + 1, v->shift, v->root, tail);
+    }
+    cog_object* root;
+    int shift = v->shift;
+    if ((v->count >> VEC_BITS) > ((size_t)1 << v->shift)) {
+        // the trie is full, so add a level on top
+        root = vec_new_node(NULL);
+        VNODE(root)->items[0] = v->root;
+        VNODE(root)->items[1] = vec_new_path(v->shift, v->tail);
+        VNODE(root)->n = 2;
+        shift += VEC_BITS;
+    } else root = vec_push_tail(v->count, v->shift, v->root, v->tail);
+    cog_object* tail = vec_new_node(NULL);
+    VNODE(tail)->items[0] = item;
+    VNODE(tail)->n = 1;
+    return _wrap_vector(v->count + 1, shift, root, tail);
+}
+
+static cog_object* vec_assoc(int level, cog_object* node, size_t i, cog_object* item) {
+    cog_object* ret = vec_new_node(VNODE(node));
+    vec_node* r = VNODE(ret);
+    if (level == 0) r->items[i & VEC_MASK] = item;
+    else {
+        uint32_t sub = (i >> level) & VEC_MASK;
+        r->items[sub] = vec_assoc(level - VEC_BITS, r->items[sub], i, item);
+    }
+    return ret;
+}
+
+cog_object* cog_vector_assoc(cog_object* vec, size_t i, cog_object* item) {
+    assert(vec && vec->type == &cog_ot_vector);
+    cog_vector* v = VEC(vec);
+    assert(i <= v->count);
+    if (i == v->count) return cog_vector_conj(vec, item);
+    if (i >= vec_tail_offset(v)) {
+        cog_object* tail = vec_new_node(VNODE(v->tail));
+        VNODE(tail)->items[i & VEC_MASK] = item;
+        return _wrap_vector(v->count, v->shift, v->root, tail);
+    }
+    return _wrap_vector(v->count, v->shift, vec_assoc(v->shift, v->root, i, item), v->tail);
+}
+
+// builds a vector all at once, a level at a time from the leaves up,
+// instead of copying the tail for every item
+cog_object* cog_vector_from_array(cog_object** items, size_t count) {
+    if (count == 0) return cog_empty_vector();
+    size_t tailoff = count <= VEC_WIDTH ? 0 : ((count - 1) >> VEC_BITS) << VEC_BITS;
+    cog_object* tail = vec_new_node(NULL);
+    VNODE(tail)->n = count - tailoff;
+    memcpy(VNODE(tail)->items, items + tailoff, (count - tailoff) * sizeof(cog_object*));
+    if (tailoff == 0) return _wrap_vector(count, VEC_BITS, NULL, tail);
+    // the nodes of one level, starting with the leaves; each pass over it
+    // replaces them with their parents
+    size_t nnodes = tailoff >> VEC_BITS;
+    cog_object** level = (cog_object**)malloc(nnodes * sizeof(cog_object*));
+    if (level == NULL) {
+        perror(__func__);
+        abort();
+    }
+    for (size_t i = 0; i < nnodes; i++) {
+        level[i] = vec_new_node(NULL);
+        VNODE(level[i])->n = VEC_WIDTH;
+        memcpy(VNODE(level[i])->items, items + (i << VEC_BITS), VEC_WIDTH * sizeof(cog_object*));
+    }
+    int shift = 0;
+    do {
+        size_t nparents = (nnodes + VEC_MASK) >> VEC_BITS;
+        for (size_t i = 0; i < nparents; i++) {
+            cog_object* parent = vec_new_node(NULL);
+            uint32_t n = min(nnodes - (i << VEC_BITS), VEC_WIDTH);
+            VNODE(parent)->n = n;
+            memcpy(VNODE(parent)->items, level + (i << VEC_BITS), n * sizeof(cog_object*));
+            level[i] = parent;
+        }
+        nnodes = nparents;
+        shift += VEC_BITS;
+    } while (nnodes > 1);
+    cog_object* root = level[0];
+    free(level);
+    return _wrap_vector(count, shift, root, tail);
+}
+
+// copies out items [start, end) into the array
+static void vec_copy_out(cog_vector* v, size_t start, size_t end, cog_object** out) {
+    while (start < end) {
+        vec_node* leaf = vec_leaf_for(v, start);
+        size_t n = min(end - start, VEC_WIDTH - (start & VEC_MASK));
+        memcpy(out, &leaf->items[start & VEC_MASK], n * sizeof(cog_object*));
+        out += n;
+        start += n;
     }
-    *out = (res << 1) | 1;
-    return true;
 }
 
-cog_object* cog_explode_identifier(cog_object* i, bool cap_first) {
-    cog_object* buffer = cog_emptystring();
-    cog_object* tail = buffer;
-    if (i->as_packed_sym & 1) {
-        // packed identifier
-        cog_packed_identifier s = i->as_packed_sym >> 1;
-        size_t base = strlen(PACKEDALPHABET);
-        cog_packed_identifier div = 1;
-        while ((div * base) < s)
-            div *= base;
-        int (*tr)(int) = cap_first ? toupper : tolower;
-        for (;;) {
-            cog_string_append_byte(&tail, tr(PACKEDALPHABET[(s / div) % base]));
-            if (div == 1) break;
-            div /= base;
-            tr = tolower;
-        }
-    } else if (i->as_fun != NULL) {
-        // builtin identifier
-        for (const char* s = i->as_fun->name; *s; s++)
-            cog_string_append_byte(&tail, *s);
-    } else {
-        // long identifier
-        buffer = i->next;
+cog_object* cog_vector_slice(cog_object* vec, size_t start, size_t end) {
+    assert(vec && vec->type == &cog_ot_vector);
+    assert(start <= end && end <= VEC(vec)->count);
+    if (start == 0 && end == VEC(vec)->count) return vec;
+    cog_object** items = (cog_object**)malloc((end - start + 1) * sizeof(cog_object*));
+    if (items == NULL) {
+        perror(__func__);
+        abort();
     }
-    return buffer;
+    vec_copy_out(VEC(vec), start, end, items);
+    cog_object* result = cog_vector_from_array(items, end - start);
+    free(items);
+    return result;
+}
+
+cog_object* cog_vector_concat(cog_object* a, cog_object* b) {
+    assert(a && a->type == &cog_ot_vector);
+    assert(b && b->type == &cog_ot_vector);
+    cog_vector* va = VEC(a);
+    cog_vector* vb = VEC(b);
+    if (vb->count == 0) return a;
+    if (va->count == 0) return b;
+    // adding a few items one at a time is cheaper than rebuilding everything
+    if (vb->count <= VEC_WIDTH) {
+        for (size_t i = 0; i < vb->count; i++)
+            a = cog_vector_conj(a, VNODE(vb->tail)->items[i]);
+        return a;
+    }
+    cog_object** items = (cog_object**)malloc((va->count + vb->count) * sizeof(cog_object*));
+    if (items == NULL) {
+        perror(__func__);
+        abort();
+    }
+    vec_copy_out(va, 0, va->count, items);
+    vec_copy_out(vb, 0, vb->count, items + va->count);
+    cog_object* result = cog_vector_from_array(items, va->count + vb->count);
+    free(items);
+    return result;
+}
+
+cog_object* cog_list_to_vector(cog_object* list) {
+    size_t count = cog_list_length(list);
+    cog_object** items = (cog_object**)malloc((count + 1) * sizeof(cog_object*));
+    if (items == NULL) {
+        perror(__func__);
+        abort();
+    }
+    for (size_t i = 0; i < count; i++, list = list->next)
+        items[i] = list->data;
+    cog_object* vec = cog_vector_from_array(items, count);
+    free(items);
+    return vec;
 }
 
-cog_object* cog_make_identifier_c(const char* const name) {
-    // TODO: intern?
-    cog_object* out = cog_make_obj(&cog_ot_identifier);
-    // first try the builtin function names
-    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
-        cog_module* mod = (cog_module*)modobj->as_ptr;
-        if (mod->table == NULL) continue;
-        for (size_t i = 0; mod->table[i] != NULL; i++) {
-            cog_modfunc* m = mod->table[i];
-            // !!! not case sensitive
-            if ((m->when == COG_FUNC || m->when == COG_COOKIEFUNC) && !strcasecmp(m->name, name)) {
-                // found desired modfunc
-                out->as_fun = m;
-                goto done;
-            }
-        }
-    }
-    // then try packed identifier
-    cog_packed_identifier packed;
-    if (pack_identifier_c(name, &packed)) {
-        out->as_packed_sym = packed;
-        goto done;
+cog_object* cog_vector_to_list(cog_object* vec) {
+    assert(vec && vec->type == &cog_ot_vector);
+    cog_object* list = NULL;
+    for (size_t i = VEC(vec)->count; i > 0; i--)
+        cog_push_to(&list, cog_vector_nth(vec, i - 1));
+    return list;
+}
+
+cog_object* m_vector_show_recursive() {
+    cog_object* vec = cog_pop();
+    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    cog_object* stream = cog_pop();
+    cog_object* alist = cog_pop();
+    int64_t* counter = (int64_t*)cog_pop()->as_ptr;
+    cog_fputchar_imm(stream, '[');
+    for (size_t i = 0; i < VEC(vec)->count; i++) {
+        if (i) cog_fputchar_imm(stream, ' ');
+        cog_print_refs_recursive(cog_vector_nth(vec, i), alist, stream, counter, readably);
     }
-    // then default to long identifier
-    out->next = cog_string(name);
-    done:
-    return out;
+    cog_fputchar_imm(stream, ']');
+    return NULL;
 }
+cog_object_method ome_vector_show_recursive = {&cog_ot_vector, "Show_Recursive", m_vector_show_recursive};
 
-cog_object* cog_make_identifier(cog_object* string) {
-    cog_object* out = cog_make_obj(&cog_ot_identifier);
-    // first try the builtin function names
-    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
-        cog_module* mod = (cog_module*)modobj->as_ptr;
-        if (mod->table == NULL) continue;
-        for (size_t i = 0; mod->table[i] != NULL; i++) {
-            cog_modfunc* m = mod->table[i];
-            // !!! not case sensitive
-            if ((m->when == COG_FUNC || m->when == COG_COOKIEFUNC) && !cog_strcasecmp_c(string, m->name)) {
-                // found desired modfunc
-                out->as_fun = m;
-                goto done;
-            }
-        }
+cog_object* m_vector_hash() {
+    cog_object* self = cog_pop();
+    uint64_t hash = VEC(self)->count;
+    for (size_t i = 0; i < VEC(self)->count; i++) {
+        int64_t h;
+        if (!cog_hash_value(cog_vector_nth(self, i), &h)) return cog_not_implemented();
+        hash = hash * FNV_PRIME + h;
     }
-    // then try packed identifier
-    cog_packed_identifier packed;
-    if (pack_identifier(string, &packed)) {
-        out->as_packed_sym = packed;
-        goto done;
+    cog_push(cog_box_int(hash ^ 0x5EC70A11DE2B93LL));
+    return NULL;
+}
+cog_object_method ome_vector_hash = {&cog_ot_vector, "Hash", m_vector_hash};
+
+cog_object* m_vector_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    bool eq = VEC(self)->count == VEC(other)->count;
+    for (size_t i = 0; eq && i < VEC(self)->count; i++)
+        eq = cog_equal(cog_vector_nth(self, i), cog_vector_nth(other, i));
+    cog_push(cog_box_bool(eq));
+    return NULL;
+}
+cog_object_method ome_vector_equal = {&cog_ot_vector, "Equal", m_vector_equal};
+
+// a lazy list of the items of a vector from some index on, so that First,
+// Rest and For-Each can walk a vector without copying it. Until it is
+// forced, next is the list (vector index); after that it is like Lines
+cog_obj_type ot_vector_seq = {"VectorSeq", cog_walk_both, NULL};
+
+static cog_object* vector_seq(cog_object* vec, size_t start) {
+    cog_object* state = NULL;
+    cog_push_to(&state, cog_box_int(start));
+    cog_push_to(&state, vec);
+    cog_object* seq = cog_make_obj(&ot_vector_seq);
+    seq->next = state;
+    return seq;
+}
+
+static cog_object* vector_seq_force(cog_object* seq) {
+    if (seq->next) {
+        cog_object* vec = seq->next->data;
+        size_t i = seq->next->next->data->as_int;
+        if (i < VEC(vec)->count) {
+            seq->data = cog_make_obj(&cog_ot_list);
+            seq->data->data = cog_vector_nth(vec, i);
+            seq->data->next = vector_seq(vec, i + 1);
+        } else seq->data = NULL;
+        seq->next = NULL;
     }
-    // then default to long identifier
-    out->next = string;
-    done:
-    return out;
+    return seq->data;
 }
 
-cog_object* m_show_identifier() {
-    cog_object* i = cog_pop();
+cog_object* m_vector_seq_show() {
+    cog_object* seq = cog_pop();
     cog_pop(); // ignore readably
-    cog_push(cog_explode_identifier(i, true));
+    if (seq->next) cog_push(cog_sprintf("<VectorSeq at %O of %O>", seq->next->next->data, seq->next->data));
+    else if (seq->data) cog_push(cog_sprintf("<VectorSeq at %O>", seq->data->data));
+    else cog_push(cog_string("<VectorSeq at end>"));
     return NULL;
 }
-cog_object_method ome_identifier_show = {
-    &cog_ot_identifier,
-    "Show",
-    m_show_identifier
-};
+cog_object_method ome_vector_seq_show = {&ot_vector_seq, "Show", m_vector_seq_show};
 
-cog_object* m_run_identifier() {
-    cog_object* self = cog_pop();
-    cog_object* cookie = cog_pop();
-    // first look up definition
-    bool found = false;
-    cog_object* def = cog_get_fun(self, &found);
-    if (found) {
-        // push the definition instead
-        cog_run_next(def, NULL, cookie);
-        return NULL;
-    } else {
-        // use builtin identifier if available or throw undefined
-        if (!self->next && (self->as_packed_sym & 1) == 0 && self->as_packed_sym != 0) {
-            cog_run_next(cog_make_bfunction(self->as_fun), NULL, cookie);
-            return NULL;
-        } else {
-            cog_push(cog_sprintf("undefined: %O", self));
-            return cog_error();
-        }
-    }
+cog_object_method ome_vector_seq_hash = {&ot_vector_seq, "Hash", cog_not_implemented};
+
+// MARK: NUMERIC ARRAYS
+
+// Packed arrays of 64-bit floats or integers, for numeric data that would
+// take a boxed number and a list cell per item otherwise. The kernels are
+// plain scalar loops over the buffers; they save the boxing and the
+// dispatch on every item, but don't use any SIMD instructions themselves.
+
+typedef struct {
+    size_t len;
+    union {
+        double* f;
+        int64_t* i;
+    };
+} cog_numarray;
+
+#define NUMARRAY(obj) ((cog_numarray*)(obj)->as_ptr)
+
+static void free_numarray(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
 }
-cog_object_method ome_identifier_exec = {&cog_ot_identifier, "Exec", m_run_identifier};
 
-static int64_t _string_hash(cog_object*, int64_t);
+cog_obj_type cog_ot_f64_array = {"F64Array", NULL, free_numarray};
+cog_obj_type cog_ot_i64_array = {"I64Array", NULL, free_numarray};
 
-static cog_object* m_identifier_hash() {
-    cog_push(cog_box_int(_string_hash(cog_explode_identifier(cog_pop(), true), IDENT_HASH_SEED)));
-    return NULL;
+#define IS_NUMARRAY(obj) ((obj) && ((obj)->type == &cog_ot_f64_array || (obj)->type == &cog_ot_i64_array))
+
+cog_object* cog_make_numarray(bool is_float, size_t len) {
+    // the items live in the same block as the header
+    cog_numarray* a = (cog_numarray*)malloc(sizeof(cog_numarray) + len * sizeof(double));
+    if (a == NULL) {
+        perror(__func__);
+        abort();
+    }
+    a->len = len;
+    a->f = (double*)(a + 1);
+    cog_object* obj = cog_make_obj(is_float ? &cog_ot_f64_array : &cog_ot_i64_array);
+    obj->as_ptr = (void*)a;
+    return obj;
 }
-cog_object_method ome_identifier_hash = {&cog_ot_identifier, "Hash", m_identifier_hash};
 
-bool cog_same_identifiers(cog_object* s1, cog_object* s2) {
-    if (!s1 && !s2) return true;
-    if (!s1 || !s2) return false;
-    assert(s1->type == &cog_ot_identifier);
-    assert(s2->type == &cog_ot_identifier);
-    return !cog_strcasecmp(cog_explode_identifier(s1, false), cog_explode_identifier(s2, false));
+size_t cog_numarray_length(cog_object* arr) {
+    assert(IS_NUMARRAY(arr));
+    return NUMARRAY(arr)->len;
 }
 
-// MARK: SYMBOLS
+cog_object* cog_numarray_nth(cog_object* arr, size_t i) {
+    assert(IS_NUMARRAY(arr) && i < NUMARRAY(arr)->len);
+    if (arr->type == &cog_ot_f64_array) return cog_box_float(NUMARRAY(arr)->f[i]);
+    return cog_box_int(NUMARRAY(arr)->i[i]);
+}
 
-cog_obj_type cog_ot_symbol = {"Symbol", cog_walk_only_next, NULL};
+cog_object* cog_numarray_to_list(cog_object* arr) {
+    cog_object* list = NULL;
+    for (size_t i = NUMARRAY(arr)->len; i > 0; i--)
+        cog_push_to(&list, cog_numarray_nth(arr, i - 1));
+    return list;
+}
 
-cog_object_method ome_symbol_exec = {&cog_ot_symbol, "Exec", cog_obj_push_self};
+// each operand of an arithmetic kernel is a whole array, or one number
+// that goes with every item of the other
+typedef struct {
+    bool is_array;
+    bool is_float;
+    size_t len;
+    double f;
+    int64_t i;
+    cog_object* arr;
+} numarray_operand;
+
+static bool numarray_operand_of(cog_object* obj, numarray_operand* o) {
+    o->arr = obj;
+    if (IS_NUMARRAY(obj)) {
+        o->is_array = true;
+        o->is_float = obj->type == &cog_ot_f64_array;
+        o->len = NUMARRAY(obj)->len;
+        return true;
+    }
+    o->is_array = false;
+    o->len = 1;
+    if (obj && obj->type == &cog_ot_int) {
+        o->is_float = false;
+        o->i = obj->as_int;
+        o->f = obj->as_int;
+        return true;
+    }
+    if (obj && obj->type == &cog_ot_float) {
+        o->is_float = true;
+        o->f = obj->as_float;
+        return true;
+    }
+    return false;
+}
 
-cog_object* cog_sym(cog_object* i) {
-    cog_object* s = cog_make_obj(&cog_ot_symbol);
-    s->next = i;
-    return s;
+// the operand's items as doubles; a temporary copy (to be freed) if it was
+// an integer array
+static double* numarray_operand_floats(numarray_operand* o, double** to_free) {
+    *to_free = NULL;
+    if (!o->is_array) return &o->f;
+    if (o->is_float) return NUMARRAY(o->arr)->f;
+    double* d = (double*)malloc((o->len + 1) * sizeof(double));
+    if (d == NULL) {
+        perror(__func__);
+        abort();
+    }
+    int64_t* src = NUMARRAY(o->arr)->i;
+    for (size_t i = 0; i < o->len; i++) d[i] = src[i];
+    *to_free = d;
+    return d;
 }
 
-cog_object* m_symbol_show() {
-    cog_object* sym = cog_pop();
-    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
-    cog_object* chars = cog_explode_identifier(sym->next, false);
-    if (!readably) {
-        cog_push(chars);
+#define _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, op) \
+    do { \
+        if (!(x_is_array)) { \
+            __typeof__(*(x)) xv = *(x); \
+            for (size_t i = 0; i < (n); i++) (out)[i] = xv op (y)[i]; \
+        } else if (!(y_is_array)) { \
+            __typeof__(*(y)) yv = *(y); \
+            for (size_t i = 0; i < (n); i++) (out)[i] = (x)[i] op yv; \
+        } else { \
+            for (size_t i = 0; i < (n); i++) (out)[i] = (x)[i] op (y)[i]; \
+        } \
+    } while (0)
+
+#define _ARRAY_SWITCH(op, out, x, x_is_array, y, y_is_array, n) \
+    do { \
+        if (!strcmp(op, "+")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, +); \
+        else if (!strcmp(op, "-")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, -); \
+        else if (!strcmp(op, "*")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, *); \
+        else if (!strcmp(op, "/")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, /); \
+        else if (!strcmp(op, "<")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, <); \
+        else if (!strcmp(op, ">")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, >); \
+        else if (!strcmp(op, "<=")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, <=); \
+        else if (!strcmp(op, ">=")) _ARRAY_APPLY(out, x, x_is_array, y, y_is_array, n, >=); \
+        else abort(); \
+    } while (0)
+
+// applies an arithmetic or comparison operator to `left op right` item by
+// item, where at least one of them is an array. Comparisons give an
+// integer array of 1s and 0s.
+cog_object* cog_numarray_arith(const char* op, cog_object* left, cog_object* right) {
+    numarray_operand x, y;
+    if (!numarray_operand_of(left, &x) || !numarray_operand_of(right, &y))
+        COG_RETURN_ERROR(cog_sprintf("Can't apply operator %s to %s and %s", op, GET_TYPENAME_STRING(left), GET_TYPENAME_STRING(right)));
+    if (x.is_array && y.is_array && x.len != y.len)
+        COG_RETURN_ERROR(cog_sprintf("Can't apply operator %s to arrays of lengths %O and %O", op, cog_box_int(x.len), cog_box_int(y.len)));
+    size_t n = x.is_array ? x.len : y.len;
+    bool compare = op[0] == '<' || op[0] == '>';
+    bool use_floats = x.is_float || y.is_float || !strcmp(op, "/");
+    cog_object* result = cog_make_numarray(use_floats && !compare, n);
+    if (!use_floats) {
+        int64_t* xp = x.is_array ? NUMARRAY(left)->i : &x.i;
+        int64_t* yp = y.is_array ? NUMARRAY(right)->i : &y.i;
+        _ARRAY_SWITCH(op, NUMARRAY(result)->i, xp, x.is_array, yp, y.is_array, n);
     } else {
-        cog_push(cog_sprintf("\\%#O", chars));
+        double *xfree, *yfree;
+        double* xp = numarray_operand_floats(&x, &xfree);
+        double* yp = numarray_operand_floats(&y, &yfree);
+        if (compare) _ARRAY_SWITCH(op, NUMARRAY(result)->i, xp, x.is_array, yp, y.is_array, n);
+        else _ARRAY_SWITCH(op, NUMARRAY(result)->f, xp, x.is_array, yp, y.is_array, n);
+        free(xfree);
+        free(yfree);
     }
+    cog_push(result);
     return NULL;
 }
-cog_object_method ome_symbol_show = {&cog_ot_symbol, "Show", m_symbol_show};
 
-static cog_object* m_symbol_hash() {
-    cog_push(cog_box_int(_string_hash(cog_explode_identifier(cog_pop()->next, false), SYM_HASH_SEED)));
+cog_object* m_numarray_show() {
+    cog_object* arr = cog_pop();
+    cog_pop(); // ignore readably
+    cog_numarray* a = NUMARRAY(arr);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    cog_strbuf_puts(&sb, arr->type == &cog_ot_f64_array ? "F64[" : "I64[");
+    for (size_t i = 0; i < a->len; i++) {
+        if (i) cog_strbuf_putc(&sb, ' ');
+        if (arr->type == &cog_ot_i64_array) cog_strbuf_printf(&sb, "%" PRId64, a->i[i]);
+        else {
+            char buffer[32];
+            format_float(buffer, sizeof(buffer), a->f[i]);
+            cog_strbuf_puts(&sb, buffer);
+        }
+    }
+    cog_strbuf_putc(&sb, ']');
+    cog_push(cog_strbuf_to_string(&sb));
+    cog_strbuf_free(&sb);
     return NULL;
 }
-cog_object_method ome_symbol_hash = {&cog_ot_symbol, "Hash", m_symbol_hash};
+cog_object_method ome_f64_array_show = {&cog_ot_f64_array, "Show", m_numarray_show};
+cog_object_method ome_i64_array_show = {&cog_ot_i64_array, "Show", m_numarray_show};
 
-// MARK: STRINGS
+cog_object* m_numarray_hash() {
+    cog_object* self = cog_pop();
+    cog_numarray* a = NUMARRAY(self);
+    // the bits of a double are the same size as an int64
+    uint64_t hash = a->len ^ (self->type == &cog_ot_f64_array ? 0x3F64A77A1LL : 0x164A77A1LL);
+    for (size_t i = 0; i < a->len; i++)
+        hash = (hash ^ (uint64_t)a->i[i]) * FNV_PRIME;
+    cog_push(cog_box_int(hash));
+    return NULL;
+}
+cog_object_method ome_f64_array_hash = {&cog_ot_f64_array, "Hash", m_numarray_hash};
+cog_object_method ome_i64_array_hash = {&cog_ot_i64_array, "Hash", m_numarray_hash};
 
-cog_obj_type cog_ot_string = {"String", cog_walk_only_next, NULL};
+cog_object* m_numarray_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    cog_numarray* a = NUMARRAY(self);
+    cog_numarray* b = NUMARRAY(other);
+    bool eq = a->len == b->len;
+    // compared as numbers, not bits, so 0.0 and -0.0 are equal
+    if (self->type == &cog_ot_f64_array)
+        for (size_t i = 0; eq && i < a->len; i++) eq = a->f[i] == b->f[i];
+    else
+        eq = eq && !memcmp(a->i, b->i, a->len * sizeof(int64_t));
+    cog_push(cog_box_bool(eq));
+    return NULL;
+}
+cog_object_method ome_f64_array_equal = {&cog_ot_f64_array, "Equal", m_numarray_equal};
+cog_object_method ome_i64_array_equal = {&cog_ot_i64_array, "Equal", m_numarray_equal};
 
-cog_object* cog_emptystring() {
-    return cog_make_obj(&cog_ot_string);
+// MARK: CANONICAL VALUES
+
+// Canonicalizing hash-conses immutable values: each one is looked up in a
+// weak set, and the copy already there is used instead if there is one, so
+// data with a lot of repetition only takes up memory once. Lists are done
+// from the end, so each cell only needs comparing with cells that have the
+// very same tail. Nothing in the set keeps a value alive; the GC drops the
+// entries for values that weren't marked.
+//
+// Matching uses cog_equal(), so no two canonical values of the same type
+// are equal, which is what lets cog_equal() tell them apart by address.
+
+static size_t intern_index(int64_t hash, size_t cap) {
+    // numbers hash to themselves, so mix the bits
+    return ((uint64_t)hash * 0x9E3779B97F4A7C15ULL >> 32) & (cap - 1);
 }
 
-void cog_string_append_byte(cog_object** str, char data) {
-    if ((*str)->stored_chars >= COG_MAX_CHARS_PER_BUFFER_CHUNK) {
-        while ((*str)->next != NULL) {
-            *str = (*str)->next;
-        }
-        cog_object* next = cog_emptystring();
-        next->as_chars[0] = data;
-        next->stored_chars = 1;
-        (*str)->next = next;
-        *str = next;
+static void intern_resize(size_t cap, bool only_marked) {
+    hash_memo_slot* old = COG_GLOBALS.interned;
+    size_t old_cap = COG_GLOBALS.interned_cap;
+    COG_GLOBALS.interned = cap ? (hash_memo_slot*)calloc(cap, sizeof(hash_memo_slot)) : NULL;
+    if (cap && !COG_GLOBALS.interned) {
+        perror(__func__);
+        abort();
     }
-    else {
-        (*str)->as_chars[(*str)->stored_chars] = data;
-        (*str)->stored_chars++;
+    COG_GLOBALS.interned_cap = cap;
+    COG_GLOBALS.interned_count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (!old[i].obj || (only_marked && !old[i].obj->marked)) continue;
+        size_t j = intern_index(old[i].hash, cap);
+        while (COG_GLOBALS.interned[j].obj) j = (j + 1) & (cap - 1);
+        COG_GLOBALS.interned[j] = old[i];
+        COG_GLOBALS.interned_count++;
     }
+    free(old);
 }
 
-void cog_string_prepend_byte(cog_object** str, char data) {
-    if ((*str) && (*str)->stored_chars < COG_MAX_CHARS_PER_BUFFER_CHUNK) {
-        memmove((*str)->as_chars + 1, (*str)->as_chars, (*str)->stored_chars);
-        (*str)->as_chars[0] = data;
-        (*str)->stored_chars++;
+static void intern_prune() {
+    size_t live = 0;
+    for (size_t i = 0; i < COG_GLOBALS.interned_cap; i++) {
+        cog_object* obj = COG_GLOBALS.interned[i].obj;
+        if (obj && obj->marked) live++;
     }
-    else {
-        cog_object* new_head = cog_emptystring();
-        new_head->as_chars[0] = data;
-        new_head->stored_chars = 1;
-        new_head->next = *str;
-        *str = new_head;
+    if (live == COG_GLOBALS.interned_count) return;
+    size_t cap = live ? 256 : 0;
+    while (cap && live * 2 > cap) cap *= 2;
+    intern_resize(cap, true);
+}
+
+// whether a canonical value can stand in for obj, where everything obj
+// holds is already canonical
+static bool intern_same(cog_object* there, cog_object* obj) {
+    // an Integer and a Number can be equal, but one can't stand in for the other
+    if (there->type != obj->type) return false;
+    // so the items of two cells are only the same if they are the same objects
+    if (obj->type == &cog_ot_list) return there->data == obj->data && there->next == obj->next;
+    // 0.0 and -0.0 are equal but not the same
+    if (obj->type == &cog_ot_float) return memcmp(&there->as_float, &obj->as_float, sizeof(double)) == 0;
+    return cog_equal(there, obj);
+}
+
+static cog_object* intern(cog_object* obj) {
+    int64_t hash;
+    if (!cog_hash_value(obj, &hash)) return obj;
+    if ((COG_GLOBALS.interned_count + 1) * 2 > COG_GLOBALS.interned_cap)
+        intern_resize(COG_GLOBALS.interned_cap ? COG_GLOBALS.interned_cap * 2 : 256, false);
+    size_t mask = COG_GLOBALS.interned_cap - 1;
+    size_t i = intern_index(hash, COG_GLOBALS.interned_cap);
+    for (; COG_GLOBALS.interned[i].obj; i = (i + 1) & mask) {
+        cog_object* there = COG_GLOBALS.interned[i].obj;
+        if (COG_GLOBALS.interned[i].hash == hash && intern_same(there, obj)) return there;
     }
+    COG_GLOBALS.interned[i] = (hash_memo_slot){obj, hash};
+    COG_GLOBALS.interned_count++;
+    obj->canonical = true;
+    return obj;
 }
 
-size_t cog_strlen(cog_object* str) {
-    size_t len = 0;
-    while (str != NULL) {
-        len += str->stored_chars;
-        str = str->next;
+static cog_object* canonicalize_list(cog_object* list) {
+    size_t n = 0;
+    cog_object* tail = list;
+    for (; tail && tail->type == &cog_ot_list && !tail->canonical; tail = tail->next) n++;
+    cog_object** cells = (cog_object**)malloc(n * sizeof(cog_object*));
+    if (n && !cells) {
+        perror(__func__);
+        abort();
     }
-    return len;
+    n = 0;
+    for (cog_object* c = list; c != tail; c = c->next) cells[n++] = c;
+    cog_object* rest = cog_canonicalize(tail);
+    while (n-- > 0) {
+        cog_object* cell = cells[n];
+        cog_object* data = cog_canonicalize(cell->data);
+        if (data != cell->data || rest != cell->next) {
+            // the original cells may be shared, so they aren't changed
+            cell = cog_make_obj(&cog_ot_list);
+            cell->data = data;
+            cell->next = rest;
+        }
+        rest = intern(cell);
+    }
+    free(cells);
+    return rest;
+}
+
+cog_object* cog_canonicalize(cog_object* obj) {
+    if (!obj || obj->canonical) return obj;
+    cog_obj_type* t = obj->type;
+    if (t == &cog_ot_list) return canonicalize_list(obj);
+    // NaN isn't equal to itself, but == would say one shared copy was
+    if (t == &cog_ot_float && isnan(obj->as_float)) return obj;
+    if (t == &cog_ot_int || t == &cog_ot_float || t == &cog_ot_bool || t == &cog_ot_string || t == &cog_ot_symbol)
+        return intern(obj);
+    return obj;
 }
 
-char cog_nthchar(cog_object* str, size_t i) {
-    while (i >= str->stored_chars) {
-        if (str == NULL) return 0;
-        i -= str->stored_chars;
-        str = str->next;
+// MARK: ENVIRONMENT
+
+void cog_defun(cog_object* identifier, cog_object* value) {
+    cog_object* top_scope = COG_GLOBALS.scopes->data;
+    // TODO: do env with tables
+    cog_object* pair = cog_assoc(top_scope, identifier, cog_same_identifiers);
+    if (pair) {
+        pair->next = value;
+    } else {
+        pair = cog_make_obj(&cog_ot_list);
+        pair->data = identifier;
+        pair->next = value;
+        cog_push_to(&COG_GLOBALS.scopes->data, pair);
     }
-    if (!str || i >= str->stored_chars) return 0;
-    return str->as_chars[i];
 }
 
-void _str_set_nthchar(cog_object* str, size_t i, char c) {
-    while (i >= str->stored_chars) {
-        assert(str != NULL);
-        i -= str->stored_chars;
-        str = str->next;
+cog_object* cog_get_fun(cog_object* identifier, bool* found) {
+    COG_ITER_LIST(COG_GLOBALS.scopes, scope) {
+        cog_object* pair = cog_assoc(scope, identifier, cog_same_identifiers);
+        if (pair) {
+            *found = true;
+            return pair->next;
+        }
     }
-    assert(str && i < str->stored_chars);
-    str->as_chars[i] = c;
+    *found = false;
+    return NULL;
 }
 
-void cog_string_insert_char(cog_object** str, char data, size_t index) {
-    cog_object* current = *str;
-
-    while (current && index >= current->stored_chars) {
-        index -= current->stored_chars;
-        current = current->next;
-    }
+void cog_push_new_scope() {
+    cog_push_scope(cog_make_obj(&cog_ot_list));
+}
 
-    if (!current) {
-        // If index is out of bounds, append to the end
-        cog_string_append_byte(str, data);
-        return;
-    }
+void cog_push_scope(cog_object* scope) {
+    cog_push_to(&COG_GLOBALS.scopes, scope);
+}
 
-    if (current->stored_chars < COG_MAX_CHARS_PER_BUFFER_CHUNK) {
-        memmove(current->as_chars + index + 2, current->as_chars + index + 1, current->stored_chars - index);
-        current->as_chars[index] = data;
-        current->stored_chars++;
-    } else {
-        cog_string_prepend_byte(&current->next, current->as_chars[COG_MAX_CHARS_PER_BUFFER_CHUNK - 1]);
-        memmove(current->as_chars + index + 2, current->as_chars + index + 1, current->stored_chars - index);
-        current->stored_chars = COG_MAX_CHARS_PER_BUFFER_CHUNK;
-        current->as_chars[index] = data;
-    }
+void cog_pop_scope() {
+    cog_pop_from(&COG_GLOBALS.scopes);
 }
 
-void cog_string_delete_char(cog_object** str, size_t index) {
-    cog_object** current = str;
+// MARK: CORE OF VM
 
-    while (*current && index >= (*current)->stored_chars) {
-        index -= (*current)->stored_chars;
-        current = &(*current)->next;
-    }
+void cog_push(cog_object* item) {
+    cog_push_to(&COG_GLOBALS.stack, item);
+}
 
-    if (!*current) {
-        // If index is out of bounds, do nothing
-        return;
-    }
+cog_object* cog_pop() {
+    return cog_pop_from(&COG_GLOBALS.stack);
+}
 
-    memmove((*current)->as_chars + index, (*current)->as_chars + index + 1, (*current)->stored_chars - index - 1);
-    (*current)->stored_chars--;
+cog_object* cog_get_stack() {
+    return COG_GLOBALS.stack;
+}
 
-    if ((*current)->stored_chars == 0) {
-        *current = (*current)->next;
-    }
+size_t cog_stack_length() {
+    size_t len = 0;
+    COG_ITER_LIST(COG_GLOBALS.stack, _) len++;
+    return len;
 }
 
-cog_object* cog_substring(cog_object* str, size_t start, size_t end) {
-    while (str && start >= str->stored_chars) {
-        start -= str->stored_chars;
-        end -= str->stored_chars;
-        str = str->next;
-    }
-    if (!str) return NULL;
-    cog_object* out = cog_strdup(str);
-    while (start > 0) {
-        cog_string_delete_char(&out, 0);
-        start--;
-        end--;
-    }
-    cog_object* end_chunk = out;
-    while (end_chunk && end >= end_chunk->stored_chars) {
-        end -= end_chunk->stored_chars;
-        end_chunk = end_chunk->next;
-    }
-    if (end_chunk) {
-        end_chunk->stored_chars = end;
-        end_chunk->next = NULL;
+bool cog_stack_has_at_least(size_t n) {
+    size_t len = 0;
+    COG_ITER_LIST(COG_GLOBALS.stack, _) {
+        len++;
+        if (len >= n) return true;
     }
-    return out;
+    return false;
 }
 
-cog_object* cog_string(const char* const cstr) {
-    return cog_string_from_bytes(cstr, strlen(cstr));
+bool cog_is_stack_empty() {
+    return COG_GLOBALS.stack == NULL;
 }
 
-cog_object* cog_string_from_bytes(const char* const cstr, size_t n) {
-    cog_object* str = cog_emptystring();
-    cog_object* tail = str;
-    for (size_t i = 0; i < n; i++)
-        cog_string_append_byte(&tail, cstr[i]);
-    return str;
+void cog_run_next(cog_object* item, cog_object* when, cog_object* cookie) {
+    cog_push_to(&cookie, item);
+    cog_push_to(&cookie, when);
+    cog_push_to(&COG_GLOBALS.command_queue, cookie);
+    if (when) cog_push_to(&COG_GLOBALS.handlers, COG_GLOBALS.command_queue);
 }
 
-size_t cog_string_to_cstring(cog_object* str, char* const cstr, size_t len) {
-    char* p = cstr;
-    while (str && (p - cstr) < len) {
-        size_t nmore = min(str->stored_chars, len - (p - cstr));
-        memcpy(p, str->as_chars, nmore);
-        p += nmore;
-        str = str->next;
+bool cog_has_well_known(cog_object* obj, const char* meth) {
+    assert(obj != NULL);
+    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
+        cog_module* mod = (cog_module*)modobj->as_ptr;
+        if (mod->mtab == NULL) continue;
+        for (size_t i = 0; mod->mtab[i] != NULL; i++) {
+            cog_object_method* m = mod->mtab[i];
+            if (strcmp(m->wkm, meth) == 0 && m->type_for == obj->type) return true;
+        }
     }
-    *p = 0;
-    return p - cstr;
+    return false;
 }
 
-cog_object* m_string_show() {
-    cog_object* buffer = cog_pop();
-    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
-    if (!readably) {
-        cog_push(buffer);
-    }
-    else {
-        cog_object* ebuf = cog_emptystring();
-        cog_object* tail = ebuf;
-        cog_string_append_byte(&tail, '"');
-        cog_object* chunk = buffer;
-        while (chunk) {
-            for (size_t i = 0; i < chunk->stored_chars; i++) {
-                bool special = false;
-                char ch = cog_maybe_escape_char(chunk->as_chars[i], &special);
-                if (special) cog_string_append_byte(&tail, '\\');
-                cog_string_append_byte(&tail, ch);
+cog_object* cog_run_well_known(cog_object* obj, const char* meth) {
+    assert(obj != NULL);
+    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
+        cog_module* mod = (cog_module*)modobj->as_ptr;
+        if (mod->mtab == NULL) continue;
+        for (size_t i = 0; mod->mtab[i] != NULL; i++) {
+            cog_object_method* m = mod->mtab[i];
+            if (strcmp(m->wkm, meth) == 0 && m->type_for == obj->type) {
+                cog_push(obj);
+                cog_object* res = m->func();
+                if (res && cog_same_identifiers(res, COG_GLOBALS.not_impl_sym)) continue;
+                return res;
             }
-            chunk = chunk->next;
         }
-        cog_string_append_byte(&tail, '"');
-        cog_push(ebuf);
     }
-    return NULL;
+    return cog_not_implemented();
 }
-cog_object_method ome_string_show = {&cog_ot_string, "Show", m_string_show};
-cog_object_method ome_string_exec = {&cog_ot_string, "Exec", cog_obj_push_self};
 
-static int64_t _string_hash(cog_object* str, int64_t hash) {
-    while (str) {
-        for (int i = 0; i < str->stored_chars; i++) {
-            hash ^= (int64_t)str->as_chars[i];
-            hash *= FNV_PRIME;
+cog_object* cog_run_well_known_strict(cog_object* obj, const char* meth) {
+    cog_object* res = cog_run_well_known(obj, meth);
+    if (res && cog_same_identifiers(res, COG_GLOBALS.not_impl_sym)) {
+        const char* method_name = meth;
+        fprintf(stderr, "error: %s not implemented for %s\n", method_name, obj->type ? obj->type->name : "empty List");
+        COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
+            cog_module* mod = (cog_module*)modobj->as_ptr;
+            if (mod->types == NULL) continue;
+            for (size_t i = 0; mod->types[i] != NULL; i++) {
+                cog_obj_type* t = mod->types[i];
+                if (t == obj->type) goto hasimport;
+            }
         }
-        str = str->next;
+        fprintf(stderr, "did you forget to import the module?\n");
+        hasimport:
+        print_backtrace();
+        abort();
     }
-    return hash;
+    return res;
 }
 
-static cog_object* m_string_hash() {
-    cog_push(cog_box_int(_string_hash(cog_pop(), STRING_HASH_SEED)));
-    return NULL;
+#ifndef COG_FIBER_SLICE
+#define COG_FIBER_SLICE 1000
+#endif
+
+static cog_object* fiber_switch();
+static bool fiber_finished(cog_object** status);
+static bool fiber_others_alive();
+
+static bool same_status(cog_object* a, cog_object* b) {
+    return a == b || (a && b && cog_same_identifiers(a, b));
 }
-cog_object_method ome_string_hash = {&cog_ot_string, "Hash", m_string_hash};
 
-cog_object* cog_make_character(char c) {
-    // a character is just a one character string
-    cog_object* obj = cog_emptystring();
-    cog_string_append_byte(&obj, c);
-    return obj;
+cog_object* cog_mainloop(cog_object* status) {
+    if (!COG_GLOBALS.next_gc) COG_GLOBALS.next_gc = COG_GLOBALS.alloc_chunks * 2;
+    size_t slice = 0;
+    run:
+    while (COG_GLOBALS.command_queue) {
+        // only commands with a `when` can run while unwinding, so skip
+        // straight to the next one rather than looking at everything
+        if (status) {
+            COG_GLOBALS.command_queue = COG_GLOBALS.handlers ? COG_GLOBALS.handlers->data : NULL;
+            if (!COG_GLOBALS.command_queue) break;
+        }
+        if (COG_GLOBALS.handlers && COG_GLOBALS.handlers->data == COG_GLOBALS.command_queue)
+            COG_GLOBALS.handlers = COG_GLOBALS.handlers->next;
+        cog_object* cmd = cog_pop_from(&COG_GLOBALS.command_queue);
+        if (cmd == NULL) {
+            fprintf(stderr, "got NULL as object in command queue\n");
+            abort();
+        }
+        cog_object* when = cmd->data;
+        cog_object* which = cmd->next->data;
+        cog_object* cookie = cmd->next->next;
+        if (which == NULL) {
+            fprintf(stderr, "got NULL as command in command queue\n");
+            abort();
+        }
+        bool is_normal_exec = same_status(status, when);
+        if (is_normal_exec
+                || same_status(cog_on_exit(), when)
+                || same_status(cog_on_enter(), when)) {
+            cog_push(cookie);
+            cog_object* new_status = cog_run_well_known(which, "Exec");
+            if (cog_same_identifiers(new_status, cog_not_implemented())) {
+                cog_pop();
+                cog_push(cog_sprintf("Can't run %O", which));
+                new_status = cog_error();
+            }
+            if (is_normal_exec) status = new_status;
+            // maybe do a GC
+            if (COG_GLOBALS.alloc_chunks > COG_GLOBALS.next_gc) {
+                // protect status in case it is nonstandard
+                cog_walk(status, markobject, NULL);
+                gc();
+                COG_GLOBALS.next_gc = COG_GLOBALS.alloc_chunks * 2;
+            }
+        }
+        // let another fiber have a turn, unless this is inside a cog_call
+        if (status == NULL && !COG_GLOBALS.calls && (COG_GLOBALS.fiber_stop
+                || (fiber_others_alive() && ++slice >= COG_FIBER_SLICE))) {
+            status = fiber_switch();
+            slice = 0;
+        }
+    }
+    // a spawned fiber ran out of commands, so go on with the next one
+    if (!COG_GLOBALS.calls && fiber_finished(&status)) {
+        slice = 0;
+        goto run;
+    }
+    return status;
 }
 
-cog_object* cog_strappend(cog_object* str1, cog_object* str2) {
-    cog_object* str1clone = cog_strdup(str1);
-    cog_object* str12 = cog_strcat(&str1clone, str2);
-    assert(cog_strlen(str12) == cog_strlen(str1) + cog_strlen(str2));
-    return str12;
+cog_object* cog_call(cog_object* fn, size_t nargs, cog_object* const* args, cog_object** results) {
+    // keep what was running safe from the GC, and out of the way
+    cog_object* saved = NULL;
+    cog_push_to(&saved, COG_GLOBALS.generator);
+    cog_push_to(&saved, COG_GLOBALS.scopes);
+    cog_push_to(&saved, COG_GLOBALS.handlers);
+    cog_push_to(&saved, COG_GLOBALS.command_queue);
+    cog_push_to(&saved, COG_GLOBALS.stack);
+    cog_push_to(&COG_GLOBALS.calls, saved);
+    COG_GLOBALS.stack = COG_GLOBALS.command_queue = COG_GLOBALS.handlers = COG_GLOBALS.generator = NULL;
+    for (size_t i = nargs; i > 0; i--) cog_push(args[i - 1]);
+    cog_run_next(fn, NULL, NULL);
+    cog_object* status = cog_mainloop(NULL);
+    cog_object* got = COG_GLOBALS.stack;
+    saved = cog_pop_from(&COG_GLOBALS.calls);
+    COG_GLOBALS.stack = cog_pop_from(&saved);
+    COG_GLOBALS.command_queue = cog_pop_from(&saved);
+    COG_GLOBALS.handlers = cog_pop_from(&saved);
+    COG_GLOBALS.scopes = cog_pop_from(&saved);
+    COG_GLOBALS.generator = cog_pop_from(&saved);
+    if (results) *results = status ? NULL : got;
+    // the error goes where the caller can return it from
+    if (same_status(status, cog_error()) && got) cog_push(got->data);
+    return status;
 }
 
-int cog_strcmp(cog_object* str1, cog_object* str2) {
-    return cog_strncmp(str1, str2, SIZE_MAX);
+cog_object* cog_obj_push_self() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore cookie
+    cog_push(self);
+    return NULL;
 }
 
-int cog_strncmp(cog_object* str1, cog_object* str2, size_t n) {
-    assert(!str1 || str1->type == &cog_ot_string);
-    assert(!str2 || str2->type == &cog_ot_string);
-    int i1 = 0, i2 = 0;
-    while (str1 && str2 && n > 0) {
-        char c1 = str1->as_chars[i1];
-        char c2 = str2->as_chars[i2];
-        char d = c1 - c2;
-        if (d != 0) return d;
-        i1++, i2++, n--;
-        while (str1 && i1 >= str1->stored_chars) {
-            i1 -= str1->stored_chars;
-            str1 = str1->next;
-        }
-        while (str2 && i2 >= str2->stored_chars) {
-            i2 -= str2->stored_chars;
-            str2 = str2->next;
-        }
-    }
-    if (n == 0) return 0;
-    if (!str1 && !str2) return 0;
-    if (!str1) return -1;
-    if (!str2) return 1;
-    return 0;
-}
+// MARK: NUMBERS
 
-int cog_strcasecmp(cog_object* str1, cog_object* str2) {
-    assert(str1->type == &cog_ot_string);
-    assert(str2->type == &cog_ot_string);
-    int i1 = 0, i2 = 0;
-    while (str1 && str2) {
-        char d = tolower(str1->as_chars[i1]) - tolower(str2->as_chars[i2]);
-        if (d != 0) return d;
-        i1++, i2++;
-        while (str1 && i1 >= str1->stored_chars) {
-            i1 = 0;
-            str1 = str1->next;
-        }
-        while (str2 && i2 >= str2->stored_chars) {
-            i2 = 0;
-            str2 = str2->next;
-        }
-    }
-    if (!str1 && !str2) return 0;
-    if (str1) return 1;
-    return -1;
+cog_obj_type cog_ot_int = {"Integer", NULL};
+cog_object* cog_box_int(int64_t i) {
+    cog_object* obj = cog_make_obj(&cog_ot_int);
+    obj->as_int = i;
+    return obj;
 }
-
-int cog_strcmp_c(cog_object* str1, const char* const str2) {
-    assert(str1->type == &cog_ot_string);
-    int i1 = 0;
-    const char* p = str2;
-    while (str1 && *p) {
-        char d = str1->as_chars[i1] - *p;
-        if (d != 0) return d;
-        i1++, p++;
-        if (i1 >= str1->stored_chars) {
-            i1 = 0;
-            str1 = str1->next;
-        }
-    }
-    if (!str1 && !*p) return 0;
-    if (str1) return 1;
-    return -1;
+int64_t cog_unbox_int(cog_object* obj) {
+    assert(obj->type == &cog_ot_int);
+    return obj->as_int;
 }
-
-int cog_strcasecmp_c(cog_object* str1, const char* const str2) {
-    assert(str1->type == &cog_ot_string);
-    int i1 = 0;
-    const char* p = str2;
-    while (str1 && *p) {
-        char d = tolower(str1->as_chars[i1]) - tolower(*p);
-        if (d != 0) return d;
-        i1++, p++;
-        if (i1 >= str1->stored_chars) {
-            i1 = 0;
-            str1 = str1->next;
-        }
-    }
-    if (!str1 && !*p) return 0;
-    if (str1) return 1;
-    return -1;
+cog_object* int_printself() {
+    cog_object* num = cog_pop();
+    cog_pop(); // ignore cookie
+    char buffer[21];
+    snprintf(buffer, sizeof(buffer), "%" PRId64, num->as_int);
+    cog_push(cog_string(buffer));
+    return NULL;
 }
+cog_object_method ome_int_show = {&cog_ot_int, "Show", int_printself};
+cog_object_method ome_int_exec = {&cog_ot_int, "Exec", cog_obj_push_self};
 
-// MARK: GENERAL STREAM STUFF
-
-cog_obj_type ot_eof = {"EOF", NULL};
-
-cog_object* cog_eof() {
-    return cog_make_obj(&ot_eof);
+static cog_object* m_int_hash() {
+    // Integers hash to themselves
+    return NULL;
 }
+cog_object_method ome_int_hash = {&cog_ot_int, "Hash", m_int_hash};
 
-char cog_getch(cog_object* file) {
-    cog_run_well_known_strict(file, "Stream::GetChar");
-    cog_object* ch = cog_pop();
-    if (ch && ch->type == &ot_eof) return EOF;
-    return cog_nthchar(ch, 0);
+static cog_object* m_int_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    cog_push(cog_box_bool(self->as_int == other->as_int));
+    return NULL;
 }
+cog_object_method ome_int_equal = {&cog_ot_int, "Equal", m_int_equal};
 
-void cog_fputs_imm(cog_object* stream, const char* const string) {
-    cog_push(cog_string(string));
-    cog_run_well_known_strict(stream, "Stream::PutString");
+static cog_object* m_int_equal_other_type() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    if (other->type == &cog_ot_float) {
+        cog_push(cog_box_bool(self->as_int == other->as_float));
+        return NULL;
+    }
+    cog_push(other);
+    return cog_not_implemented();
 }
+cog_object_method ome_int_equal_other_type = {&cog_ot_int, "Equal_OtherType", m_int_equal_other_type};
 
-void cog_fputchar_imm(cog_object* stream, char ch) {
-    cog_push(cog_make_character(ch));
-    cog_run_well_known_strict(stream, "Stream::PutString");
+cog_obj_type cog_ot_bool = {"Boolean", NULL};
+cog_object* cog_box_bool(bool i) {
+    cog_object* obj = cog_make_obj(&cog_ot_bool);
+    obj->as_int = i;
+    return obj;
 }
-
-void cog_ungetch(cog_object* file, char ch) {
-    cog_push(cog_make_character(ch));
-    cog_run_well_known_strict(file, "Stream::UngetString");
+bool cog_unbox_bool(cog_object* obj) {
+    assert(obj->type == &cog_ot_bool);
+    return obj->as_int;
 }
-
-// MARK: STRING STREAMS
-
-cog_obj_type ot_iostring = {"IOString", cog_walk_both, NULL};
-cog_object* cog_empty_io_string() {
-    cog_object* stream = cog_make_obj(&ot_iostring);
-    stream->data = cog_box_int(0); // the cursor position
-    stream->next = cog_make_obj(&cog_ot_list);
-    stream->next->data = cog_emptystring(); // the ungetc stack
-    stream->next->next = cog_emptystring(); // the actual contents
-    return stream;
+cog_object* bool_printself() {
+    cog_object* num = cog_pop();
+    cog_pop(); // ignore cookie
+    char buffer[6];
+    snprintf(buffer, sizeof(buffer), "%s", num->as_int ? "True" : "False");
+    cog_push(cog_string(buffer));
+    return NULL;
 }
+cog_object_method ome_bool_show = {&cog_ot_bool, "Show", bool_printself};
+cog_object_method ome_bool_exec = {&cog_ot_bool, "Exec", cog_obj_push_self};
 
-cog_object* cog_iostring_wrap(cog_object* string) {
-    cog_object* stream = cog_empty_io_string();
-    stream->next->next = string;
-    return stream;
+static cog_object* m_bool_hash() {
+    cog_object* num = cog_pop();
+    int64_t hash = num->as_int;
+    // Booleans hash like integers
+    cog_push(cog_box_int(hash));
+    return NULL;
 }
+cog_object_method ome_bool_hash = {&cog_ot_bool, "Hash", m_bool_hash};
+cog_object_method ome_bool_equal = {&cog_ot_bool, "Equal", m_int_equal};
 
-cog_object* cog_iostring_get_contents(cog_object* stream) {
-    assert(stream && stream->type == &ot_iostring);
-    return stream->next->next;
+cog_obj_type cog_ot_float = {"Number", NULL};
+cog_object* cog_box_float(double i) {
+    cog_object* obj = cog_make_obj(&cog_ot_float);
+    obj->as_float = i;
+    return obj;
 }
-
-static cog_object* m_iostring_write() {
-    cog_object* stream = cog_pop();
-    cog_object* buf = cog_expect_type_fatal(cog_pop(), &cog_ot_string);
-    if (cog_strlen(stream->next->data) > 0) {
-        cog_push(cog_string("can't write until ungets stack is empty"));
-        return cog_error();
-    }
-    int64_t pos = stream->data->as_int;
-    cog_object* data = cog_iostring_get_contents(stream);
-    cog_object* tail = data;
-    size_t len = cog_strlen(data);
-    while (buf) {
-        for (int i = 0; i < buf->stored_chars; i++) {
-            if (pos < len) _str_set_nthchar(data, pos, buf->as_chars[i]);
-            else cog_string_append_byte(&tail, buf->as_chars[i]);
-            pos++;
-        }
-        buf = buf->next;
-    }
-    stream->data = cog_box_int(pos);
-    return NULL;
+double cog_unbox_float(cog_object* obj) {
+    assert(obj->type == &cog_ot_float);
+    return obj->as_float;
 }
-cog_object_method ome_iostring_write = {&ot_iostring, "Stream::PutString", m_iostring_write};
-
-cog_object* m_iostring_getch() {
-    cog_object* stream = cog_pop();
-    if (cog_strlen(stream->next->data) > 0) {
-        char c = cog_nthchar(stream->next->data, 0);
-        cog_string_delete_char(&stream->next->data, 0);
-        cog_push(cog_make_character(c));
-        return NULL;
-    }
-    int64_t pos = stream->data->as_int;
-    cog_object* data = cog_iostring_get_contents(stream);
-    size_t len = cog_strlen(data);
-    if (pos < len) {
-        cog_push(cog_make_character(cog_nthchar(data, pos)));
-        stream->data = cog_box_int(pos + 1);
-    } else {
-        cog_push(cog_eof());
-    }
-    return NULL;
+// how a Number gets shown, wherever it is
+static void format_float(char* buffer, size_t size, double f) {
+    snprintf(buffer, size, "%lg%s", f, floor(f) == f ? ".0" : "");
 }
-cog_object_method ome_iostring_getch = {&ot_iostring, "Stream::GetChar", m_iostring_getch};
-
-cog_object* m_iostring_ungets() {
-    cog_object* stream = cog_pop();
-    cog_object* buf = cog_expect_type_fatal(cog_pop(), &cog_ot_string);
-    size_t len = cog_strlen(buf);
-    for (size_t iplus1 = len; iplus1 > 0; iplus1--) {
-        cog_string_prepend_byte(&stream->next->data, cog_nthchar(buf, iplus1 - 1));
-    }
+cog_object* float_printself() {
+    cog_object* num = cog_pop();
+    cog_pop(); // ignore cookie
+    char buffer[32];
+    format_float(buffer, sizeof(buffer), num->as_float);
+    cog_push(cog_string(buffer));
     return NULL;
 }
-cog_object_method ome_iostring_ungets = {&ot_iostring, "Stream::UngetString", m_iostring_ungets};
+cog_object_method ome_float_show = {&cog_ot_float, "Show", float_printself};
+cog_object_method ome_float_exec = {&cog_ot_float, "Exec", cog_obj_push_self};
 
-cog_object* m_iostring_show() {
-    cog_object* stream = cog_pop();
-    cog_pop(); // ignore readably
-    cog_push(cog_sprintf("<IOstring at pos %O of %O>", stream->data, cog_iostring_get_contents(stream)));
+static cog_object* m_float_hash() {
+    cog_object* num = cog_pop();
+    double val = num->as_float;
+    // floats hash to their int value if it's an int, otherwise the reinterpret_cast of their bits
+    int64_t hash = val == floor(val) ? (int64_t)val : *(int64_t*)&val;
+    cog_push(cog_box_int(hash));
     return NULL;
 }
-cog_object_method ome_iostring_show = {&ot_iostring, "Show", m_iostring_show};
-
-// MARK: BUILTIN FUNCTION OBJECTS
-
-cog_obj_type ot_bfunction = {"BuiltinFunction", NULL};
+cog_object_method ome_float_hash = {&cog_ot_float, "Hash", m_float_hash};
 
-cog_object* cog_make_bfunction(cog_modfunc* func) {
-    assert(func);
-    assert(func->when == COG_FUNC || func->when == COG_COOKIEFUNC);
-    cog_object* obj = cog_make_obj(&ot_bfunction);
-    obj->as_fun = func;
-    return obj;
+static cog_object* m_float_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    cog_push(cog_box_bool(self->as_float == other->as_float));
+    return NULL;
 }
+cog_object_method ome_float_equal = {&cog_ot_float, "Equal", m_float_equal};
 
-cog_object* m_bfunction_exec() {
+static cog_object* m_float_equal_other_type() {
     cog_object* self = cog_pop();
-    cog_modfunc* f = self->as_fun;
-    if (f->when == COG_FUNC) cog_pop(); // discard cookie
-    // jump straight into the function
-    return f->fun();
+    cog_object* other = cog_pop();
+    if (other->type == &cog_ot_int) {
+        cog_push(cog_box_bool(self->as_float == other->as_int));
+        return NULL;
+    }
+    cog_push(other);
+    return cog_not_implemented();
 }
-cog_object_method ome_bfunction_exec = {&ot_bfunction, "Exec", m_bfunction_exec};
-
-// MARK: BLOCKS AND CLOSURES
+cog_object_method ome_float_equal_other_type = {&cog_ot_float, "Equal_OtherType", m_float_equal_other_type};
 
-cog_obj_type ot_block = {"Block", cog_walk_only_next, NULL};
-cog_obj_type ot_closure = {"Closure", cog_walk_both, NULL};
+// MARK: IDENTIFIERS
 
-cog_object* cog_make_block(cog_object* commands) {
-    assert(!commands || commands->type == &cog_ot_list);
-    cog_object* obj = cog_make_obj(&ot_block);
-    obj->next = commands;
-    return obj;
+static cog_object* walk_identifier(cog_object* i, cog_walk_fun f, cog_object* arg) {
+    (void)arg;
+    if (i->as_int) return NULL;
+    return i->next;
 }
+cog_obj_type cog_ot_identifier = {"Identifier", walk_identifier};
 
-cog_object* cog_make_closure(cog_object* block, cog_object* scopes) {
-    assert(block && block->type == &ot_block);
-    assert(!scopes || scopes->type == &cog_ot_list);
+// TODO: parameterize / calculate this constant at compile time
+#define MAXPACKED 11
+const char* const PACKEDALPHABET = "0123456789abcdefghijklmnopqrstuvwxyz-?!'+/\\*>=<^.";
+
+static bool pack_identifier_c(const char* const buffer, cog_packed_identifier* out) {
+    cog_packed_identifier res = 0;
+    size_t len = 0;
+    size_t base = strlen(PACKEDALPHABET);
+    for (const char* s = buffer; *s; s++, len++) {
+        if (len > MAXPACKED) return false;
+        // !!! identifiers are case insensitive
+        const char* where = strchr(PACKEDALPHABET, tolower(*s));
+        if (where == NULL) return false;
+        res *= base;
+        res += where - PACKEDALPHABET;
+    }
+    *out = (res << 1) | 1;
+    return true;
+}
+
+static bool pack_identifier(cog_object* string, cog_packed_identifier* out) {
+    cog_packed_identifier res = 0;
+    size_t len = cog_strlen(string);
+    if (len > MAXPACKED) return false;
+    size_t base = strlen(PACKEDALPHABET);
+    for (size_t i = 0; i < len; i++) {
+        // !!! identifiers are case insensitive
+        const char* where = strchr(PACKEDALPHABET, tolower(cog_nthchar(string, i)));
+        if (where == NULL) return false;
+        res *= base;
+        res += where - PACKEDALPHABET;
+    }
+    *out = (res << 1) | 1;
+    return true;
+}
+
+cog_object* cog_explode_identifier(cog_object* i, bool cap_first) {
+    cog_object* buffer = cog_emptystring();
+    cog_object* tail = buffer;
+    if (i->as_packed_sym & 1) {
+        // packed identifier
+        cog_packed_identifier s = i->as_packed_sym >> 1;
+        size_t base = strlen(PACKEDALPHABET);
+        cog_packed_identifier div = 1;
+        while ((div * base) < s)
+            div *= base;
+        int (*tr)(int) = cap_first ? toupper : tolower;
+        for (;;) {
+            cog_string_append_byte(&tail, tr(PACKEDALPHABET[(s / div) % base]));
+            if (div == 1) break;
+            div /= base;
+            tr = tolower;
+        }
+    } else if (i->as_fun != NULL) {
+        // builtin identifier
+        for (const char* s = i->as_fun->name; *s; s++)
+            cog_string_append_byte(&tail, *s);
+    } else {
+        // long identifier
+        buffer = i->next;
+    }
+    return buffer;
+}
+
+cog_object* cog_make_identifier_c(const char* const name) {
+    // TODO: intern?
+    cog_object* out = cog_make_obj(&cog_ot_identifier);
+    // first try the builtin function names
+    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
+        cog_module* mod = (cog_module*)modobj->as_ptr;
+        if (mod->table == NULL) continue;
+        for (size_t i = 0; mod->table[i] != NULL; i++) {
+            cog_modfunc* m = mod->table[i];
+            // !!! not case sensitive
+            if ((m->when == COG_FUNC || m->when == COG_COOKIEFUNC) && !strcasecmp(m->name, name)) {
+                // found desired modfunc
+                out->as_fun = m;
+                goto done;
+            }
+        }
+    }
+    // then try packed identifier
+    cog_packed_identifier packed;
+    if (pack_identifier_c(name, &packed)) {
+        out->as_packed_sym = packed;
+        goto done;
+    }
+    // then default to long identifier
+    out->next = cog_string(name);
+    done:
+    return out;
+}
+
+cog_object* cog_make_identifier(cog_object* string) {
+    cog_object* out = cog_make_obj(&cog_ot_identifier);
+    // first try the builtin function names
+    COG_ITER_LIST(COG_GLOBALS.modules, modobj) {
+        cog_module* mod = (cog_module*)modobj->as_ptr;
+        if (mod->table == NULL) continue;
+        for (size_t i = 0; mod->table[i] != NULL; i++) {
+            cog_modfunc* m = mod->table[i];
+            // !!! not case sensitive
+            if ((m->when == COG_FUNC || m->when == COG_COOKIEFUNC) && !cog_strcasecmp_c(string, m->name)) {
+                // found desired modfunc
+                out->as_fun = m;
+                goto done;
+            }
+        }
+    }
+    // then try packed identifier
+    cog_packed_identifier packed;
+    if (pack_identifier(string, &packed)) {
+        out->as_packed_sym = packed;
+        goto done;
+    }
+    // then default to long identifier
+    out->next = string;
+    done:
+    return out;
+}
+
+cog_object* m_show_identifier() {
+    cog_object* i = cog_pop();
+    cog_pop(); // ignore readably
+    cog_push(cog_explode_identifier(i, true));
+    return NULL;
+}
+cog_object_method ome_identifier_show = {
+    &cog_ot_identifier,
+    "Show",
+    m_show_identifier
+};
+
+cog_object* m_run_identifier() {
+    cog_object* self = cog_pop();
+    cog_object* cookie = cog_pop();
+    // first look up definition
+    bool found = false;
+    cog_object* def = cog_get_fun(self, &found);
+    if (found) {
+        // push the definition instead
+        cog_run_next(def, NULL, cookie);
+        return NULL;
+    } else {
+        // use builtin identifier if available or throw undefined
+        if (!self->next && (self->as_packed_sym & 1) == 0 && self->as_packed_sym != 0) {
+            // run it right here, rather than queueing it, so handlers named
+            // by identifiers still run while unwinding
+            cog_modfunc* f = self->as_fun;
+            if (f->when == COG_COOKIEFUNC) cog_push(cookie);
+            return f->fun();
+        } else {
+            cog_push(cog_sprintf("undefined: %O", self));
+            return cog_error();
+        }
+    }
+}
+cog_object_method ome_identifier_exec = {&cog_ot_identifier, "Exec", m_run_identifier};
+
+static int64_t _string_hash(cog_object*, int64_t);
+
+static cog_object* m_identifier_hash() {
+    cog_push(cog_box_int(_string_hash(cog_explode_identifier(cog_pop(), true), IDENT_HASH_SEED)));
+    return NULL;
+}
+cog_object_method ome_identifier_hash = {&cog_ot_identifier, "Hash", m_identifier_hash};
+
+static cog_object* m_identifier_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    // packed identifiers are already lowercase, so they can be compared without unpacking
+    if ((self->as_packed_sym & 1) && (other->as_packed_sym & 1))
+        cog_push(cog_box_bool(self->as_packed_sym == other->as_packed_sym));
+    else
+        cog_push(cog_box_bool(cog_same_identifiers(self, other)));
+    return NULL;
+}
+cog_object_method ome_identifier_equal = {&cog_ot_identifier, "Equal", m_identifier_equal};
+
+bool cog_same_identifiers(cog_object* s1, cog_object* s2) {
+    if (!s1 && !s2) return true;
+    if (!s1 || !s2) return false;
+    assert(s1->type == &cog_ot_identifier);
+    assert(s2->type == &cog_ot_identifier);
+    return !cog_strcasecmp(cog_explode_identifier(s1, false), cog_explode_identifier(s2, false));
+}
+
+// MARK: SYMBOLS
+
+cog_obj_type cog_ot_symbol = {"Symbol", cog_walk_only_next, NULL};
+
+cog_object_method ome_symbol_exec = {&cog_ot_symbol, "Exec", cog_obj_push_self};
+
+cog_object* cog_sym(cog_object* i) {
+    cog_object* s = cog_make_obj(&cog_ot_symbol);
+    s->next = i;
+    return s;
+}
+
+cog_object* m_symbol_show() {
+    cog_object* sym = cog_pop();
+    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    cog_object* chars = cog_explode_identifier(sym->next, false);
+    if (!readably) {
+        cog_push(chars);
+    } else {
+        cog_push(cog_sprintf("\\%#O", chars));
+    }
+    return NULL;
+}
+cog_object_method ome_symbol_show = {&cog_ot_symbol, "Show", m_symbol_show};
+
+static cog_object* m_symbol_hash() {
+    cog_push(cog_box_int(_string_hash(cog_explode_identifier(cog_pop()->next, false), SYM_HASH_SEED)));
+    return NULL;
+}
+cog_object_method ome_symbol_hash = {&cog_ot_symbol, "Hash", m_symbol_hash};
+
+static cog_object* m_symbol_equal() {
+    cog_object* self = cog_pop()->next;
+    cog_object* other = cog_pop()->next;
+    // unlike identifiers, long symbols keep their case
+    if ((self->as_packed_sym & 1) && (other->as_packed_sym & 1))
+        cog_push(cog_box_bool(self->as_packed_sym == other->as_packed_sym));
+    else
+        cog_push(cog_box_bool(!cog_strcmp(cog_explode_identifier(self, false), cog_explode_identifier(other, false))));
+    return NULL;
+}
+cog_object_method ome_symbol_equal = {&cog_ot_symbol, "Equal", m_symbol_equal};
+
+// MARK: STRINGS
+
+cog_obj_type cog_ot_string = {"String", cog_walk_only_next, NULL};
+
+cog_object* cog_emptystring() {
+    return cog_make_obj(&cog_ot_string);
+}
+
+void cog_string_append_byte(cog_object** str, char data) {
+    if ((*str)->stored_chars >= COG_MAX_CHARS_PER_BUFFER_CHUNK) {
+        while ((*str)->next != NULL) {
+            *str = (*str)->next;
+        }
+        cog_object* next = cog_emptystring();
+        next->as_chars[0] = data;
+        next->stored_chars = 1;
+        (*str)->next = next;
+        *str = next;
+    }
+    else {
+        (*str)->as_chars[(*str)->stored_chars] = data;
+        (*str)->stored_chars++;
+    }
+}
+
+void cog_string_prepend_byte(cog_object** str, char data) {
+    if ((*str) && (*str)->stored_chars < COG_MAX_CHARS_PER_BUFFER_CHUNK) {
+        memmove((*str)->as_chars + 1, (*str)->as_chars, (*str)->stored_chars);
+        (*str)->as_chars[0] = data;
+        (*str)->stored_chars++;
+    }
+    else {
+        cog_object* new_head = cog_emptystring();
+        new_head->as_chars[0] = data;
+        new_head->stored_chars = 1;
+        new_head->next = *str;
+        *str = new_head;
+    }
+}
+
+size_t cog_strlen(cog_object* str) {
+    size_t len = 0;
+    while (str != NULL) {
+        len += str->stored_chars;
+        str = str->next;
+    }
+    return len;
+}
+
+char cog_nthchar(cog_object* str, size_t i) {
+    while (i >= str->stored_chars) {
+        if (str == NULL) return 0;
+        i -= str->stored_chars;
+        str = str->next;
+    }
+    if (!str || i >= str->stored_chars) return 0;
+    return str->as_chars[i];
+}
+
+void _str_set_nthchar(cog_object* str, size_t i, char c) {
+    while (i >= str->stored_chars) {
+        assert(str != NULL);
+        i -= str->stored_chars;
+        str = str->next;
+    }
+    assert(str && i < str->stored_chars);
+    str->as_chars[i] = c;
+}
+
+void cog_string_insert_char(cog_object** str, char data, size_t index) {
+    cog_object* current = *str;
+
+    while (current && index >= current->stored_chars) {
+        index -= current->stored_chars;
+        current = current->next;
+    }
+
+    if (!current) {
+        // If index is out of bounds, append to the end
+        cog_string_append_byte(str, data);
+        return;
+    }
+
+    if (current->stored_chars < COG_MAX_CHARS_PER_BUFFER_CHUNK) {
+        memmove(current->as_chars + index + 2, current->as_chars + index + 1, current->stored_chars - index);
+        current->as_chars[index] = data;
+        current->stored_chars++;
+    } else {
+        cog_string_prepend_byte(&current->next, current->as_chars[COG_MAX_CHARS_PER_BUFFER_CHUNK - 1]);
+        memmove(current->as_chars + index + 2, current->as_chars + index + 1, current->stored_chars - index);
+        current->stored_chars = COG_MAX_CHARS_PER_BUFFER_CHUNK;
+        current->as_chars[index] = data;
+    }
+}
+
+void cog_string_delete_char(cog_object** str, size_t index) {
+    cog_object** current = str;
+
+    while (*current && index >= (*current)->stored_chars) {
+        index -= (*current)->stored_chars;
+        current = &(*current)->next;
+    }
+
+    if (!*current) {
+        // If index is out of bounds, do nothing
+        return;
+    }
+
+    memmove((*current)->as_chars + index, (*current)->as_chars + index + 1, (*current)->stored_chars - index - 1);
+    (*current)->stored_chars--;
+
+    if ((*current)->stored_chars == 0) {
+        *current = (*current)->next;
+    }
+}
+
+cog_object* cog_substring(cog_object* str, size_t start, size_t end) {
+    while (str && start >= str->stored_chars) {
+        start -= str->stored_chars;
+        end -= str->stored_chars;
+        str = str->next;
+    }
+    if (!str) return NULL;
+    cog_object* out = cog_strdup(str);
+    while (start > 0) {
+        cog_string_delete_char(&out, 0);
+        start--;
+        end--;
+    }
+    cog_object* end_chunk = out;
+    while (end_chunk && end >= end_chunk->stored_chars) {
+        end -= end_chunk->stored_chars;
+        end_chunk = end_chunk->next;
+    }
+    if (end_chunk) {
+        end_chunk->stored_chars = end;
+        end_chunk->next = NULL;
+    }
+    return out;
+}
+
+cog_object* cog_string(const char* const cstr) {
+    return cog_string_from_bytes(cstr, strlen(cstr));
+}
+
+cog_object* cog_string_from_bytes(const char* const cstr, size_t n) {
+    cog_object* str = cog_emptystring();
+    cog_object* tail = str;
+    const char* p = cstr;
+    // fill whole chunks at a time
+    for (;;) {
+        size_t nmore = min(n, COG_MAX_CHARS_PER_BUFFER_CHUNK);
+        memcpy(tail->as_chars, p, nmore);
+        tail->stored_chars = nmore;
+        p += nmore;
+        n -= nmore;
+        if (n == 0) break;
+        tail->next = cog_emptystring();
+        tail = tail->next;
+    }
+    return str;
+}
+
+size_t cog_string_to_cstring(cog_object* str, char* const cstr, size_t len) {
+    char* p = cstr;
+    while (str && (p - cstr) < len) {
+        size_t nmore = min(str->stored_chars, len - (p - cstr));
+        memcpy(p, str->as_chars, nmore);
+        p += nmore;
+        str = str->next;
+    }
+    *p = 0;
+    return p - cstr;
+}
+
+cog_object* m_string_show() {
+    cog_object* buffer = cog_pop();
+    bool readably = cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    if (!readably) {
+        cog_push(buffer);
+    }
+    else {
+        cog_strbuf sb = COG_STRBUF_INIT;
+        cog_strbuf_putc(&sb, '"');
+        cog_object* chunk = buffer;
+        while (chunk) {
+            for (size_t i = 0; i < chunk->stored_chars; i++) {
+                bool special = false;
+                char ch = cog_maybe_escape_char(chunk->as_chars[i], &special);
+                if (special) cog_strbuf_putc(&sb, '\\');
+                cog_strbuf_putc(&sb, ch);
+            }
+            chunk = chunk->next;
+        }
+        cog_strbuf_putc(&sb, '"');
+        cog_push(cog_strbuf_to_string(&sb));
+        cog_strbuf_free(&sb);
+    }
+    return NULL;
+}
+cog_object_method ome_string_show = {&cog_ot_string, "Show", m_string_show};
+cog_object_method ome_string_exec = {&cog_ot_string, "Exec", cog_obj_push_self};
+
+static int64_t _string_hash(cog_object* str, int64_t hash) {
+    while (str) {
+        for (int i = 0; i < str->stored_chars; i++) {
+            hash ^= (int64_t)str->as_chars[i];
+            hash *= FNV_PRIME;
+        }
+        str = str->next;
+    }
+    return hash;
+}
+
+static cog_object* m_string_hash() {
+    cog_push(cog_box_int(_string_hash(cog_pop(), STRING_HASH_SEED)));
+    return NULL;
+}
+cog_object_method ome_string_hash = {&cog_ot_string, "Hash", m_string_hash};
+
+static cog_object* m_string_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    cog_push(cog_box_bool(!cog_strcmp(self, other)));
+    return NULL;
+}
+cog_object_method ome_string_equal = {&cog_ot_string, "Equal", m_string_equal};
+
+cog_object* cog_make_character(char c) {
+    // a character is just a one character string
+    cog_object* obj = cog_emptystring();
+    cog_string_append_byte(&obj, c);
+    return obj;
+}
+
+cog_object* cog_strappend(cog_object* str1, cog_object* str2) {
+    cog_object* str1clone = cog_strdup(str1);
+    cog_object* str12 = cog_strcat(&str1clone, str2);
+    assert(cog_strlen(str12) == cog_strlen(str1) + cog_strlen(str2));
+    return str12;
+}
+
+int cog_strcmp(cog_object* str1, cog_object* str2) {
+    return cog_strncmp(str1, str2, SIZE_MAX);
+}
+
+int cog_strncmp(cog_object* str1, cog_object* str2, size_t n) {
+    assert(!str1 || str1->type == &cog_ot_string);
+    assert(!str2 || str2->type == &cog_ot_string);
+    int i1 = 0, i2 = 0;
+    while (str1 && str2 && n > 0) {
+        // as unsigned bytes, so the order is consistent
+        int d = (unsigned char)str1->as_chars[i1] - (unsigned char)str2->as_chars[i2];
+        if (d != 0) return d;
+        i1++, i2++, n--;
+        while (str1 && i1 >= str1->stored_chars) {
+            i1 -= str1->stored_chars;
+            str1 = str1->next;
+        }
+        while (str2 && i2 >= str2->stored_chars) {
+            i2 -= str2->stored_chars;
+            str2 = str2->next;
+        }
+    }
+    if (n == 0) return 0;
+    if (!str1 && !str2) return 0;
+    if (!str1) return -1;
+    if (!str2) return 1;
+    return 0;
+}
+
+int cog_strcasecmp(cog_object* str1, cog_object* str2) {
+    assert(str1->type == &cog_ot_string);
+    assert(str2->type == &cog_ot_string);
+    int i1 = 0, i2 = 0;
+    while (str1 && str2) {
+        char d = tolower(str1->as_chars[i1]) - tolower(str2->as_chars[i2]);
+        if (d != 0) return d;
+        i1++, i2++;
+        while (str1 && i1 >= str1->stored_chars) {
+            i1 = 0;
+            str1 = str1->next;
+        }
+        while (str2 && i2 >= str2->stored_chars) {
+            i2 = 0;
+            str2 = str2->next;
+        }
+    }
+    if (!str1 && !str2) return 0;
+    if (str1) return 1;
+    return -1;
+}
+
+int cog_strcmp_c(cog_object* str1, const char* const str2) {
+    assert(str1->type == &cog_ot_string);
+    int i1 = 0;
+    const char* p = str2;
+    while (str1 && *p) {
+        char d = str1->as_chars[i1] - *p;
+        if (d != 0) return d;
+        i1++, p++;
+        if (i1 >= str1->stored_chars) {
+            i1 = 0;
+            str1 = str1->next;
+        }
+    }
+    if (!str1 && !*p) return 0;
+    if (str1) return 1;
+    return -1;
+}
+
+int cog_strcasecmp_c(cog_object* str1, const char* const str2) {
+    assert(str1->type == &cog_ot_string);
+    int i1 = 0;
+    const char* p = str2;
+    while (str1 && *p) {
+        char d = tolower(str1->as_chars[i1]) - tolower(*p);
+        if (d != 0) return d;
+        i1++, p++;
+        if (i1 >= str1->stored_chars) {
+            i1 = 0;
+            str1 = str1->next;
+        }
+    }
+    if (!str1 && !*p) return 0;
+    if (str1) return 1;
+    return -1;
+}
+
+// MARK: STRING BUILDERS
+
+static void strbuf_reserve(cog_strbuf* sb, size_t more) {
+    if (sb->len + more <= sb->cap) return;
+    size_t newcap = sb->cap ? sb->cap : 64;
+    while (newcap < sb->len + more) newcap *= 2;
+    char* newdata = (char*)realloc(sb->data, newcap);
+    if (newdata == NULL) {
+        perror(__func__);
+        abort();
+    }
+    sb->data = newdata;
+    sb->cap = newcap;
+}
+
+void cog_strbuf_putc(cog_strbuf* sb, char c) {
+    strbuf_reserve(sb, 1);
+    sb->data[sb->len++] = c;
+}
+
+void cog_strbuf_write(cog_strbuf* sb, const char* const bytes, size_t n) {
+    if (n == 0) return;
+    strbuf_reserve(sb, n);
+    memcpy(sb->data + sb->len, bytes, n);
+    sb->len += n;
+}
+
+void cog_strbuf_puts(cog_strbuf* sb, const char* const s) {
+    cog_strbuf_write(sb, s, strlen(s));
+}
+
+void cog_strbuf_append_string(cog_strbuf* sb, cog_object* str) {
+    assert(!str || str->type == &cog_ot_string);
+    strbuf_reserve(sb, cog_strlen(str));
+    while (str) {
+        memcpy(sb->data + sb->len, str->as_chars, str->stored_chars);
+        sb->len += str->stored_chars;
+        str = str->next;
+    }
+}
+
+void cog_strbuf_printf(cog_strbuf* sb, const char* const fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (n <= 0) return;
+    // +1 for the null that vsnprintf() insists on writing
+    strbuf_reserve(sb, n + 1);
+    va_start(args, fmt);
+    vsnprintf(sb->data + sb->len, n + 1, fmt, args);
+    va_end(args);
+    sb->len += n;
+}
+
+cog_object* cog_strbuf_to_string(cog_strbuf* sb) {
+    return cog_string_from_bytes(sb->data, sb->len);
+}
+
+void cog_strbuf_free(cog_strbuf* sb) {
+    free(sb->data);
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+}
+
+cog_obj_type ot_strbuf_stream = {"StringBuilder::Stream", NULL, NULL};
+
+cog_object* cog_strbuf_stream(cog_strbuf* sb) {
+    cog_object* stream = cog_make_obj(&ot_strbuf_stream);
+    stream->as_ptr = (void*)sb;
+    return stream;
+}
+
+static cog_object* m_strbuf_stream_write() {
+    cog_object* stream = cog_pop();
+    cog_object* buf = cog_expect_type_fatal(cog_pop(), &cog_ot_string);
+    cog_strbuf_append_string((cog_strbuf*)stream->as_ptr, buf);
+    return NULL;
+}
+cog_object_method ome_strbuf_stream_write = {&ot_strbuf_stream, "Stream::PutString", m_strbuf_stream_write};
+
+static cog_object* m_strbuf_stream_show() {
+    cog_object* stream = cog_pop();
+    cog_pop(); // ignore readably
+    cog_strbuf* sb = (cog_strbuf*)stream->as_ptr;
+    cog_push(cog_sprintf("<StringBuilder::Stream of %zu bytes>", sb->len));
+    return NULL;
+}
+cog_object_method ome_strbuf_stream_show = {&ot_strbuf_stream, "Show", m_strbuf_stream_show};
+
+static cog_object* m_strbuf_stream_putbytes() {
+    cog_object* stream = cog_pop();
+    cog_strbuf* bytes = (cog_strbuf*)cog_expect_type_fatal(cog_pop(), &ot_strbuf_stream)->as_ptr;
+    cog_strbuf_write((cog_strbuf*)stream->as_ptr, bytes->data, bytes->len);
+    return NULL;
+}
+cog_object_method ome_strbuf_stream_putbytes = {&ot_strbuf_stream, "Stream::PutBytes", m_strbuf_stream_putbytes};
+
+// MARK: GENERAL STREAM STUFF
+
+cog_obj_type ot_eof = {"EOF", NULL};
+
+cog_object* cog_eof() {
+    return cog_make_obj(&ot_eof);
+}
+
+static int iostring_getc(cog_object*);
+extern cog_obj_type ot_iostring;
+
+char cog_getch(cog_object* file) {
+    // string streams don't need a string object per character
+    if (file->type == &ot_iostring) return iostring_getc(file);
+    cog_run_well_known_strict(file, "Stream::GetChar");
+    cog_object* ch = cog_pop();
+    if (ch && ch->type == &ot_eof) return EOF;
+    return cog_nthchar(ch, 0);
+}
+
+cog_object* cog_read(cog_object* stream, size_t n) {
+    cog_push(cog_box_int(n));
+    cog_object* res = cog_run_well_known(stream, "Stream::Read");
+    if (!cog_same_identifiers(res, cog_not_implemented())) return res;
+    // fall back to one character at a time
+    cog_pop();
+    cog_strbuf sb = COG_STRBUF_INIT;
+    int ch;
+    while (sb.len < n && (ch = cog_getch(stream)) != EOF) cog_strbuf_putc(&sb, ch);
+    cog_push(sb.len || !n ? cog_strbuf_to_string(&sb) : cog_eof());
+    cog_strbuf_free(&sb);
+    return NULL;
+}
+
+bool cog_stream_ready(cog_object* stream) {
+    cog_object* res = cog_run_well_known(stream, "Stream::Ready");
+    if (cog_same_identifiers(res, cog_not_implemented())) return true;
+    return cog_pop()->as_int;
+}
+
+int cog_stream_fd(cog_object* stream) {
+    cog_object* res = cog_run_well_known(stream, "Stream::Fd");
+    if (cog_same_identifiers(res, cog_not_implemented())) return -1;
+    return cog_pop()->as_int;
+}
+
+cog_object* cog_readline(cog_object* stream) {
+    cog_object* res = cog_run_well_known(stream, "Stream::ReadLine");
+    if (!cog_same_identifiers(res, cog_not_implemented())) return res;
+    cog_strbuf sb = COG_STRBUF_INIT;
+    int ch;
+    while ((ch = cog_getch(stream)) != EOF) {
+        cog_strbuf_putc(&sb, ch);
+        if (ch == '\n') break;
+    }
+    cog_push(sb.len ? cog_strbuf_to_string(&sb) : cog_eof());
+    cog_strbuf_free(&sb);
+    return NULL;
+}
+
+static void put_string(cog_object* stream, cog_object* string) {
+    // string builders don't need to go through method dispatch
+    if (stream->type == &ot_strbuf_stream) {
+        cog_strbuf_append_string((cog_strbuf*)stream->as_ptr, string);
+        return;
+    }
+    cog_push(string);
+    cog_run_well_known_strict(stream, "Stream::PutString");
+}
+
+void cog_strbuf_flush(cog_strbuf* sb, cog_object* stream) {
+    if (sb->len == 0) return;
+    if (stream->type == &ot_strbuf_stream) {
+        cog_strbuf_write((cog_strbuf*)stream->as_ptr, sb->data, sb->len);
+    } else {
+        // hand over the raw bytes if the stream can take them, to save
+        // making a string out of them first
+        cog_push(cog_strbuf_stream(sb));
+        if (cog_same_identifiers(cog_run_well_known(stream, "Stream::PutBytes"), cog_not_implemented())) {
+            cog_pop();
+            put_string(stream, cog_strbuf_to_string(sb));
+        }
+    }
+    sb->len = 0;
+}
+
+void cog_fputs_imm(cog_object* stream, const char* const string) {
+    if (stream->type == &ot_strbuf_stream) {
+        cog_strbuf_puts((cog_strbuf*)stream->as_ptr, string);
+        return;
+    }
+    put_string(stream, cog_string(string));
+}
+
+void cog_fputchar_imm(cog_object* stream, char ch) {
+    if (stream->type == &ot_strbuf_stream) {
+        cog_strbuf_putc((cog_strbuf*)stream->as_ptr, ch);
+        return;
+    }
+    put_string(stream, cog_make_character(ch));
+}
+
+cog_object* cog_flush(cog_object* stream) {
+    cog_object* res = cog_run_well_known(stream, "Stream::Flush");
+    if (cog_same_identifiers(res, cog_not_implemented())) return NULL;
+    return res;
+}
+
+void cog_ungetch(cog_object* file, char ch) {
+    cog_push(cog_make_character(ch));
+    cog_run_well_known_strict(file, "Stream::UngetString");
+}
+
+// MARK: STRING STREAMS
+
+// what an IOString's as_ptr points to
+typedef struct {
+    cog_object* contents;
+    cog_object* ungets; // the ungetc stack
+    cog_object* source; // stream to read more contents from when it runs out, or NULL
+    size_t base; // position of the start of contents
+    size_t pos; // the cursor position
+    // the chunk the cursor was last in, so reading along doesn't have to
+    // walk the whole string every time
+    cog_object* chunk;
+    size_t chunk_start;
+} iostring;
+
+static cog_object* walk_iostring(cog_object* stream, cog_walk_fun f, cog_object* arg) {
+    iostring* s = (iostring*)stream->as_ptr;
+    cog_walk(s->contents, f, arg);
+    cog_walk(s->ungets, f, arg);
+    cog_walk(s->source, f, arg);
+    return NULL;
+}
+
+static void free_iostring(cog_object* stream) {
+    free(stream->as_ptr);
+    stream->as_ptr = NULL;
+}
+
+cog_obj_type ot_iostring = {"IOString", walk_iostring, free_iostring};
+
+cog_object* cog_empty_io_string() {
+    return cog_iostring_wrap(cog_emptystring());
+}
+
+cog_object* cog_iostring_wrap(cog_object* string) {
+    cog_object* stream = cog_make_obj(&ot_iostring);
+    iostring* s = (iostring*)calloc(1, sizeof(iostring));
+    if (s == NULL) {
+        perror(__func__);
+        abort();
+    }
+    s->contents = s->chunk = string;
+    stream->as_ptr = (void*)s;
+    return stream;
+}
+
+static cog_object* iostring_reader(cog_object* source) {
+    cog_object* stream = cog_empty_io_string();
+    ((iostring*)stream->as_ptr)->source = source;
+    return stream;
+}
+
+cog_object* cog_iostring_get_contents(cog_object* stream) {
+    assert(stream && stream->type == &ot_iostring);
+    return ((iostring*)stream->as_ptr)->contents;
+}
+
+// find the chunk holding the byte at the cursor, or the last chunk if
+// the cursor is at the end
+static cog_object* iostring_seek(iostring* s, size_t* offset) {
+    if (s->chunk == NULL || s->pos < s->chunk_start) {
+        s->chunk = s->contents;
+        s->chunk_start = s->base;
+    }
+    while (s->chunk->next && s->pos >= s->chunk_start + s->chunk->stored_chars) {
+        s->chunk_start += s->chunk->stored_chars;
+        s->chunk = s->chunk->next;
+    }
+    *offset = s->pos - s->chunk_start;
+    return s->chunk;
+}
+
+// get some more contents from the source, returning false at its end
+static bool iostring_refill(iostring* s) {
+    if (!s->source) return false;
+    if (cog_read(s->source, COG_STREAM_BLOCK_SIZE) != NULL) {
+        // a read error ends the input like EOF does
+        cog_pop();
+        s->source = NULL;
+        return false;
+    }
+    cog_object* block = cog_pop();
+    if (block && block->type == &ot_eof) {
+        s->source = NULL;
+        return false;
+    }
+    // everything before the cursor has been read already so it can go
+    s->base = s->pos;
+    s->contents = s->chunk = block;
+    s->chunk_start = s->pos;
+    return true;
+}
+
+// copy up to n bytes out from the cursor, up to and including `stop`
+// if it isn't EOF
+static void iostring_copy_out(iostring* s, cog_strbuf* out, size_t n, int stop) {
+    while (n && s->ungets) {
+        char c = cog_nthchar(s->ungets, 0);
+        cog_string_delete_char(&s->ungets, 0);
+        cog_strbuf_putc(out, c);
+        n--;
+        if (c == stop) return;
+    }
+    while (n) {
+        size_t off;
+        cog_object* chunk = iostring_seek(s, &off);
+        if (off >= chunk->stored_chars) {
+            if (iostring_refill(s)) continue;
+            return;
+        }
+        size_t nmore = min(n, chunk->stored_chars - off);
+        const char* start = chunk->as_chars + off;
+        const char* found = stop != EOF ? (const char*)memchr(start, stop, nmore) : NULL;
+        if (found) nmore = found - start + 1;
+        cog_strbuf_write(out, start, nmore);
+        s->pos += nmore;
+        n -= nmore;
+        if (found) return;
+    }
+}
+
+static int iostring_getc(cog_object* stream) {
+    iostring* s = (iostring*)stream->as_ptr;
+    if (s->ungets) {
+        char c = cog_nthchar(s->ungets, 0);
+        cog_string_delete_char(&s->ungets, 0);
+        return (unsigned char)c;
+    }
+    for (;;) {
+        size_t off;
+        cog_object* chunk = iostring_seek(s, &off);
+        if (off < chunk->stored_chars) {
+            s->pos++;
+            return (unsigned char)chunk->as_chars[off];
+        }
+        if (!iostring_refill(s)) return EOF;
+    }
+}
+
+static void iostring_write(iostring* s, const char* data, size_t len) {
+    // overwrite what's under the cursor...
+    while (len) {
+        size_t off;
+        cog_object* chunk = iostring_seek(s, &off);
+        if (off >= chunk->stored_chars) break;
+        size_t nmore = min(len, chunk->stored_chars - off);
+        memcpy(chunk->as_chars + off, data, nmore);
+        s->pos += nmore;
+        data += nmore;
+        len -= nmore;
+    }
+    if (!len) return;
+    // ...and add the rest onto the end
+    size_t off;
+    cog_object* tail = iostring_seek(s, &off);
+    size_t nmore = min(len, COG_MAX_CHARS_PER_BUFFER_CHUNK - tail->stored_chars);
+    memcpy(tail->as_chars + tail->stored_chars, data, nmore);
+    tail->stored_chars += nmore;
+    s->pos += nmore;
+    if (len > nmore) {
+        tail->next = cog_string_from_bytes(data + nmore, len - nmore);
+        s->pos += len - nmore;
+    }
+}
+
+static cog_object* m_iostring_write() {
+    cog_object* stream = cog_pop();
+    cog_object* buf = cog_expect_type_fatal(cog_pop(), &cog_ot_string);
+    iostring* s = (iostring*)stream->as_ptr;
+    if (s->ungets) {
+        cog_push(cog_string("can't write until ungets stack is empty"));
+        return cog_error();
+    }
+    for (; buf; buf = buf->next) iostring_write(s, buf->as_chars, buf->stored_chars);
+    return NULL;
+}
+cog_object_method ome_iostring_write = {&ot_iostring, "Stream::PutString", m_iostring_write};
+
+static cog_object* m_iostring_putbytes() {
+    cog_object* stream = cog_pop();
+    cog_strbuf* bytes = (cog_strbuf*)cog_expect_type_fatal(cog_pop(), &ot_strbuf_stream)->as_ptr;
+    iostring* s = (iostring*)stream->as_ptr;
+    if (s->ungets) {
+        cog_push(cog_string("can't write until ungets stack is empty"));
+        return cog_error();
+    }
+    iostring_write(s, bytes->data, bytes->len);
+    return NULL;
+}
+cog_object_method ome_iostring_putbytes = {&ot_iostring, "Stream::PutBytes", m_iostring_putbytes};
+
+cog_object* m_iostring_getch() {
+    int c = iostring_getc(cog_pop());
+    cog_push(c == EOF ? cog_eof() : cog_make_character(c));
+    return NULL;
+}
+cog_object_method ome_iostring_getch = {&ot_iostring, "Stream::GetChar", m_iostring_getch};
+
+static cog_object* iostring_read_until(size_t n, int stop) {
+    cog_object* stream = cog_pop();
+    cog_strbuf sb = COG_STRBUF_INIT;
+    iostring_copy_out((iostring*)stream->as_ptr, &sb, n, stop);
+    cog_push(sb.len || !n ? cog_strbuf_to_string(&sb) : cog_eof());
+    cog_strbuf_free(&sb);
+    return NULL;
+}
+
+static cog_object* m_iostring_read() {
+    cog_object* stream = cog_pop();
+    size_t n = cog_expect_type_fatal(cog_pop(), &cog_ot_int)->as_int;
+    cog_push(stream);
+    return iostring_read_until(n, EOF);
+}
+cog_object_method ome_iostring_read = {&ot_iostring, "Stream::Read", m_iostring_read};
+
+static cog_object* m_iostring_readline() {
+    return iostring_read_until(SIZE_MAX, '\n');
+}
+cog_object_method ome_iostring_readline = {&ot_iostring, "Stream::ReadLine", m_iostring_readline};
+
+cog_object* m_iostring_ungets() {
+    cog_object* stream = cog_pop();
+    cog_object* buf = cog_expect_type_fatal(cog_pop(), &cog_ot_string);
+    iostring* s = (iostring*)stream->as_ptr;
+    size_t len = cog_strlen(buf);
+    for (size_t iplus1 = len; iplus1 > 0; iplus1--) {
+        cog_string_prepend_byte(&s->ungets, cog_nthchar(buf, iplus1 - 1));
+    }
+    return NULL;
+}
+cog_object_method ome_iostring_ungets = {&ot_iostring, "Stream::UngetString", m_iostring_ungets};
+
+cog_object* m_iostring_show() {
+    cog_object* stream = cog_pop();
+    cog_pop(); // ignore readably
+    iostring* s = (iostring*)stream->as_ptr;
+    cog_push(cog_sprintf("<IOstring at pos %zu of %O>", s->pos, s->contents));
+    return NULL;
+}
+cog_object_method ome_iostring_show = {&ot_iostring, "Show", m_iostring_show};
+
+// MARK: LINES
+
+// a lazy list of the lines of a stream. Until it is forced, next is the
+// stream; after that next is NULL and data is the list cell (line . Lines)
+// or NULL if the stream had run out
+cog_obj_type ot_lines = {"Lines", cog_walk_both, NULL};
+
+cog_object* cog_lines(cog_object* stream) {
+    cog_object* lines = cog_make_obj(&ot_lines);
+    lines->next = stream;
+    return lines;
+}
+
+static cog_object* lines_force(cog_object* lines, cog_object** out) {
+    if (lines->next) {
+        cog_object* status = cog_readline(lines->next);
+        if (status) return status;
+        cog_object* line = cog_pop();
+        if (line && line->type == &ot_eof) {
+            lines->data = NULL;
+        } else {
+            // chop off the newline
+            cog_object* tail = line;
+            while (tail->next) tail = tail->next;
+            if (tail->stored_chars && tail->as_chars[tail->stored_chars - 1] == '\n') tail->stored_chars--;
+            lines->data = cog_make_obj(&cog_ot_list);
+            lines->data->data = line;
+            lines->data->next = cog_lines(lines->next);
+        }
+        lines->next = NULL;
+    }
+    *out = lines->data;
+    return NULL;
+}
+
+cog_object* m_lines_show() {
+    cog_object* lines = cog_pop();
+    cog_pop(); // ignore readably
+    if (lines->next) cog_push(cog_sprintf("<Lines of %O>", lines->next));
+    else if (lines->data) cog_push(cog_sprintf("<Lines at %#O>", lines->data->data));
+    else cog_push(cog_string("<Lines at end>"));
+    return NULL;
+}
+cog_object_method ome_lines_show = {&ot_lines, "Show", m_lines_show};
+
+cog_object_method ome_lines_hash = {&ot_lines, "Hash", cog_not_implemented};
+
+// MARK: GENERATORS
+
+// A generator runs its block with a stack, command queue and scopes of its
+// own, swapped in when something asks it for a value and swapped out again
+// when it Yields one, so it is a one-shot continuation that is only ever
+// moved, never copied.
+
+enum { GEN_SUSPENDED, GEN_RUNNING, GEN_DONE, GEN_FAILED };
+
+typedef struct {
+    // its own context, while it isn't running
+    cog_object* stack;
+    cog_object* command_queue;
+    cog_object* scopes;
+    cog_object* handlers;
+    // whoever it is running for, while it is
+    cog_object* caller_stack;
+    cog_object* caller_queue;
+    cog_object* caller_scopes;
+    cog_object* caller_handlers;
+    cog_object* outer; // the generator that was running before this one
+    cog_object* value; // what it last yielded, until it is taken
+    bool has_value;
+    int state;
+} generator;
+
+#define GENERATOR(obj) ((generator*)(obj)->as_ptr)
+
+static cog_object* walk_generator(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    generator* g = GENERATOR(obj);
+    cog_walk(g->stack, f, arg);
+    cog_walk(g->command_queue, f, arg);
+    cog_walk(g->scopes, f, arg);
+    cog_walk(g->handlers, f, arg);
+    cog_walk(g->caller_stack, f, arg);
+    cog_walk(g->caller_queue, f, arg);
+    cog_walk(g->caller_scopes, f, arg);
+    cog_walk(g->caller_handlers, f, arg);
+    cog_walk(g->outer, f, arg);
+    cog_walk(g->value, f, arg);
+    return NULL;
+}
+
+static void free_generator(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
+}
+
+cog_obj_type ot_generator = {"Generator", walk_generator, free_generator};
+
+static cog_object* generator_new(cog_object* command_queue, cog_object* handlers, cog_object* scopes) {
+    generator* g = (generator*)calloc(1, sizeof(generator));
+    if (g == NULL) {
+        perror(__func__);
+        abort();
+    }
+    g->command_queue = command_queue;
+    g->handlers = handlers;
+    g->scopes = scopes;
+    g->state = GEN_SUSPENDED;
+    cog_object* obj = cog_make_obj(&ot_generator);
+    obj->as_ptr = (void*)g;
+    return obj;
+}
+
+// swaps the generator in, so it runs until it yields or finishes
+static void generator_resume(cog_object* obj) {
+    generator* g = GENERATOR(obj);
+    g->caller_stack = COG_GLOBALS.stack;
+    g->caller_queue = COG_GLOBALS.command_queue;
+    g->caller_scopes = COG_GLOBALS.scopes;
+    g->caller_handlers = COG_GLOBALS.handlers;
+    g->outer = COG_GLOBALS.generator;
+    COG_GLOBALS.stack = g->stack;
+    COG_GLOBALS.command_queue = g->command_queue;
+    COG_GLOBALS.scopes = g->scopes;
+    COG_GLOBALS.handlers = g->handlers;
+    COG_GLOBALS.generator = obj;
+    g->stack = g->command_queue = g->scopes = g->handlers = NULL;
+    g->state = GEN_RUNNING;
+}
+
+// swaps the running generator back out, saving its context if it isn't done
+static void generator_return(cog_object* obj, int state) {
+    generator* g = GENERATOR(obj);
+    if (state == GEN_SUSPENDED) {
+        g->stack = COG_GLOBALS.stack;
+        g->command_queue = COG_GLOBALS.command_queue;
+        g->scopes = COG_GLOBALS.scopes;
+        g->handlers = COG_GLOBALS.handlers;
+    }
+    COG_GLOBALS.stack = g->caller_stack;
+    COG_GLOBALS.command_queue = g->caller_queue;
+    COG_GLOBALS.scopes = g->caller_scopes;
+    COG_GLOBALS.handlers = g->caller_handlers;
+    COG_GLOBALS.generator = g->outer;
+    g->caller_stack = g->caller_queue = g->caller_scopes = g->caller_handlers = g->outer = NULL;
+    g->state = state;
+}
+
+// Makes sure the generator has a value ready, unless it is finished. If it
+// has to be resumed to make one, `retry` is queued with `cookie` to look
+// again once it has, and `resumed` is set.
+static cog_object* generator_fill(cog_object* obj, cog_object* retry, cog_object* cookie, bool* resumed) {
+    generator* g = GENERATOR(obj);
+    *resumed = false;
+    if (g->has_value || g->state == GEN_DONE || g->state == GEN_FAILED) return NULL;
+    if (g->state == GEN_RUNNING) COG_RETURN_ERROR(cog_string("A generator can't be asked for a value while it is making one"));
+    cog_run_next(retry, NULL, cookie);
+    generator_resume(obj);
+    *resumed = true;
+    return NULL;
+}
+
+static cog_object* generator_take(cog_object* obj) {
+    generator* g = GENERATOR(obj);
+    cog_object* value = g->value;
+    g->value = NULL;
+    g->has_value = false;
+    return value;
+}
+
+cog_object* m_generator_show() {
+    cog_object* obj = cog_pop();
+    cog_pop(); // ignore readably
+    static const char* const states[] = {"suspended", "running", "done", "failed"};
+    cog_push(cog_sprintf("<Generator %s>", states[GENERATOR(obj)->state]));
+    return NULL;
+}
+cog_object_method ome_generator_show = {&ot_generator, "Show", m_generator_show};
+
+cog_object_method ome_generator_hash = {&ot_generator, "Hash", cog_not_implemented};
+
+// MARK: LAZY SEQUENCES
+
+// a lazy range of numbers. data is the next number and next is the end;
+// unlike Lines it doesn't remember what it was forced into, so holding on
+// to the start of a long range doesn't hold on to every number in it
+cog_obj_type ot_lazy_range = {"Range", cog_walk_both, NULL};
+
+static cog_object* lazy_range(cog_object* start, cog_object* end) {
+    cog_object* range = cog_make_obj(&ot_lazy_range);
+    range->data = start;
+    range->next = end;
+    return range;
+}
+
+static cog_object* lazy_range_force(cog_object* range) {
+    cog_object* start = range->data;
+    cog_object* end = range->next;
+    cog_object* next;
+    if (start->type == &cog_ot_int && end->type == &cog_ot_int) {
+        if (start->as_int >= end->as_int) return NULL;
+        next = cog_box_int(start->as_int + 1);
+    } else {
+        double s = start->type == &cog_ot_float ? start->as_float : start->as_int;
+        double e = end->type == &cog_ot_float ? end->as_float : end->as_int;
+        if (s >= e) return NULL;
+        next = cog_box_float(s + 1);
+    }
+    cog_object* cell = cog_make_obj(&cog_ot_list);
+    cell->data = start;
+    cell->next = lazy_range(next, end);
+    return cell;
+}
+
+static int64_t lazy_range_length(cog_object* range) {
+    cog_object* start = range->data;
+    cog_object* end = range->next;
+    if (start->type == &cog_ot_int && end->type == &cog_ot_int)
+        return end->as_int > start->as_int ? end->as_int - start->as_int : 0;
+    double s = start->type == &cog_ot_float ? start->as_float : start->as_int;
+    double e = end->type == &cog_ot_float ? end->as_float : end->as_int;
+    return e > s ? (int64_t)ceil(e - s) : 0;
+}
+
+cog_object* m_lazy_range_show() {
+    cog_object* range = cog_pop();
+    cog_pop(); // ignore readably
+    cog_push(cog_sprintf("<Range %O to %O>", range->data, range->next));
+    return NULL;
+}
+cog_object_method ome_lazy_range_show = {&ot_lazy_range, "Show", m_lazy_range_show};
+
+cog_object_method ome_lazy_range_hash = {&ot_lazy_range, "Hash", cog_not_implemented};
+
+// a range is equal to the list of numbers it stands for, so it gets
+// compared with a list or another range item by item, forced as it goes
+static bool lazy_range_equal(cog_object* a, cog_object* b) {
+    for (;;) {
+        if (a && b && a->type == &ot_lazy_range && b->type == &ot_lazy_range
+            && a->data->type == &cog_ot_int && a->next->type == &cog_ot_int
+            && b->data->type == &cog_ot_int && b->next->type == &cog_ot_int) {
+            // two ranges of integers are the same numbers if they start
+            // at the same one and have as many
+            int64_t n = lazy_range_length(a);
+            return n == lazy_range_length(b) && (n == 0 || a->data->as_int == b->data->as_int);
+        }
+        if (a && a->type == &ot_lazy_range) a = lazy_range_force(a);
+        if (b && b->type == &ot_lazy_range) b = lazy_range_force(b);
+        if (!a || !b || a->type != &cog_ot_list || b->type != &cog_ot_list) return cog_equal(a, b);
+        if (!cog_equal(a->data, b->data)) return false;
+        a = a->next;
+        b = b->next;
+    }
+}
+
+cog_object* m_lazy_range_equal() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    cog_push(cog_box_bool(lazy_range_equal(self, other)));
+    return NULL;
+}
+cog_object_method ome_lazy_range_equal = {&ot_lazy_range, "Equal", m_lazy_range_equal};
+
+cog_object* m_lazy_range_equal_other_type() {
+    cog_object* self = cog_pop();
+    cog_object* other = cog_pop();
+    if (other->type == &cog_ot_list) {
+        cog_push(cog_box_bool(lazy_range_equal(self, other)));
+        return NULL;
+    }
+    cog_push(other);
+    return cog_not_implemented();
+}
+cog_object_method ome_lazy_range_equal_other_type = {&ot_lazy_range, "Equal_OtherType", m_lazy_range_equal_other_type};
+
+#define COG_IS_LAZY_LIST(obj) ((obj) && ((obj)->type == &ot_lines || (obj)->type == &ot_omap_range || (obj)->type == &ot_vector_seq || (obj)->type == &ot_lazy_range))
+
+// turns a lazy list (Lines, Entries, VectorSeq or Range) into the list
+// cell it stands for, so that the list functions can take them
+#define COG_FORCE_LAZY(obj) \
+    do { \
+        if ((obj) && (obj)->type == &ot_lines) { \
+            cog_object* status__ = lines_force((obj), &(obj)); \
+            if (status__) return status__; \
+        } else if ((obj) && (obj)->type == &ot_omap_range) { \
+            (obj) = omap_range_force(obj); \
+        } else if ((obj) && (obj)->type == &ot_vector_seq) { \
+            (obj) = vector_seq_force(obj); \
+        } else if ((obj) && (obj)->type == &ot_lazy_range) { \
+            (obj) = lazy_range_force(obj); \
+        } \
+    } while (0)
+
+// A Seq is a pipeline of Map, Filter and Take stages over a source list,
+// lazy list or generator. Adding a stage to a Seq makes a new Seq with the same source
+// and one more stage, so nothing runs until For or List pulls items
+// through the whole pipeline one at a time, without building any lists in
+// between. data is the source and next is the list of stages, each a cell
+// of the stage kind and its block or count.
+cog_obj_type ot_seq = {"Seq", cog_walk_both, NULL};
+
+enum { SEQ_MAP, SEQ_FILTER, SEQ_TAKE };
+
+static cog_object* seq_add_stage(cog_object* source, int kind, cog_object* arg) {
+    // copy the stages, backwards, so the old Seq is left alone
+    cog_object* stages = NULL;
+    if (source && source->type == &ot_seq) {
+        COG_ITER_LIST(source->next, stage) cog_push_to(&stages, stage);
+        source = source->data;
+    } else if (source && source->type == &cog_ot_vector) source = vector_seq(source, 0);
+    cog_object* stage = cog_make_obj(&cog_ot_list);
+    stage->data = cog_box_int(kind);
+    stage->next = arg;
+    cog_push_to(&stages, stage);
+    cog_reverse_list_inplace(&stages);
+    cog_object* seq = cog_make_obj(&ot_seq);
+    seq->data = source;
+    seq->next = stages;
+    return seq;
+}
+
+cog_object* m_seq_show() {
+    cog_object* seq = cog_pop();
+    cog_pop(); // ignore readably
+    cog_push(cog_sprintf("<Seq of %O with %O stages>", seq->data, cog_box_int(cog_list_length(seq->next))));
+    return NULL;
+}
+cog_object_method ome_seq_show = {&ot_seq, "Show", m_seq_show};
+
+cog_object_method ome_seq_hash = {&ot_seq, "Hash", cog_not_implemented};
+
+// what a run of a Seq is waiting on the block it just ran for
+enum { SEQ_START, SEQ_AFTER_MAP, SEQ_AFTER_FILTER, SEQ_AFTER_BLOCK };
+
+// where a Seq being run through has got to
+typedef struct {
+    cog_object* source; // what is left of the source
+    cog_object* stages;
+    cog_object* stage; // the next stage for the item to go through
+    size_t stage_index;
+    cog_object* item;
+    cog_object* block; // what For runs on each item, or NULL for List
+    cog_object* list; // what List has built so far, backwards
+    cog_object* below; // the stack under the item a Map or Filter stage was given
+    int waiting;
+    int64_t* taken; // how many items got through each stage, for Take
+} seq_run;
+
+#define SEQ_RUN(obj) ((seq_run*)(obj)->as_ptr)
+
+static cog_object* walk_seq_run(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    seq_run* r = SEQ_RUN(obj);
+    cog_walk(r->source, f, arg);
+    cog_walk(r->stages, f, arg);
+    cog_walk(r->stage, f, arg);
+    cog_walk(r->item, f, arg);
+    cog_walk(r->block, f, arg);
+    cog_walk(r->list, f, arg);
+    cog_walk(r->below, f, arg);
+    return NULL;
+}
+
+static void free_seq_run(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
+}
+
+static cog_obj_type ot_seq_run = {"[[Seq::Run]]", walk_seq_run, free_seq_run};
+
+// starts pulling items through a Seq (or any list or generator), to be run by `block`
+// or collected into a list if it is NULL
+static void seq_start(cog_object* seq, cog_object* block) {
+    cog_object* source = seq;
+    cog_object* stages = NULL;
+    if (seq && seq->type == &ot_seq) {
+        source = seq->data;
+        stages = seq->next;
+    }
+    size_t nstages = cog_list_length(stages);
+    seq_run* r = (seq_run*)calloc(1, sizeof(seq_run) + nstages * sizeof(int64_t));
+    if (r == NULL) {
+        perror(__func__);
+        abort();
+    }
+    r->source = source;
+    r->stages = stages;
+    r->block = block;
+    r->waiting = SEQ_START;
+    r->taken = (int64_t*)(r + 1);
+    cog_object* run = cog_make_obj(&ot_seq_run);
+    run->as_ptr = (void*)r;
+    cog_run_next(cog_make_identifier_c("[[Seq::Next]]"), NULL, run);
+}
+
+// whether a Take stage has already let through all it will
+static bool seq_run_done(seq_run* r) {
+    size_t i = 0;
+    COG_ITER_LIST(r->stages, stage) {
+        if (stage->data->as_int == SEQ_TAKE && r->taken[i] >= stage->next->as_int) return true;
+        i++;
+    }
+    return false;
+}
+
+cog_object* fn_seq_next() {
+    cog_object* run = cog_pop();
+    seq_run* r = SEQ_RUN(run);
+    bool pull = true;
+    if (r->waiting == SEQ_AFTER_MAP || r->waiting == SEQ_AFTER_FILTER) {
+        // the stage should have swapped the item for one value, and left the rest alone
+        bool one = COG_GLOBALS.stack && COG_GLOBALS.stack->next == r->below;
+        r->below = NULL;
+        if (!one) COG_RETURN_ERROR(cog_sprintf("Expected the block given to %s to return one value",
+            r->waiting == SEQ_AFTER_MAP ? "Lazy-Map" : "Lazy-Filter"));
+    }
+    if (r->waiting == SEQ_AFTER_MAP) {
+        r->item = cog_pop();
+        pull = false;
+    } else if (r->waiting == SEQ_AFTER_FILTER) {
+        cog_object* keep = cog_pop();
+        COG_ENSURE_TYPE(keep, &cog_ot_bool);
+        pull = !keep->as_int;
+    }
+    if (!pull) {
+        r->stage = r->stage->next;
+        r->stage_index++;
+    }
+    r->waiting = SEQ_START;
+    for (;;) {
+        if (pull) {
+            cog_object* source = r->source;
+            bool from_generator = source && source->type == &ot_generator;
+            if (seq_run_done(r)) source = NULL;
+            else if (from_generator) {
+                // come back here once it has made the next one
+                bool resumed;
+                cog_object* status = generator_fill(source, cog_make_identifier_c("[[Seq::Next]]"), run, &resumed);
+                if (status || resumed) return status;
+                if (!GENERATOR(source)->has_value) source = NULL;
+            } else {
+                COG_FORCE_LAZY(source);
+                COG_ENSURE_LIST(source);
+            }
+            if (!source) {
+                if (!r->block) {
+                    cog_reverse_list_inplace(&r->list);
+                    cog_push(r->list);
+                }
+                return NULL;
+            }
+            if (from_generator) r->item = generator_take(source);
+            else {
+                r->item = source->data;
+                r->source = source->next;
+            }
+            r->stage = r->stages;
+            r->stage_index = 0;
+        }
+        pull = true;
+        // put the item through the stages
+        while (r->stage) {
+            cog_object* stage = r->stage->data;
+            if (stage->data->as_int == SEQ_TAKE) {
+                r->taken[r->stage_index]++;
+                r->stage = r->stage->next;
+                r->stage_index++;
+                continue;
+            }
+            r->waiting = stage->data->as_int == SEQ_MAP ? SEQ_AFTER_MAP : SEQ_AFTER_FILTER;
+            cog_run_next(cog_make_identifier_c("[[Seq::Next]]"), NULL, run);
+            cog_run_next(stage->next, NULL, NULL);
+            r->below = COG_GLOBALS.stack;
+            cog_push(r->item);
+            return NULL;
+        }
+        // and hand it on
+        if (r->block) {
+            r->waiting = SEQ_AFTER_BLOCK;
+            cog_run_next(cog_make_identifier_c("[[Seq::Next]]"), NULL, run);
+            cog_run_next(r->block, NULL, NULL);
+            cog_push(r->item);
+            return NULL;
+        }
+        cog_push_to(&r->list, r->item);
+    }
+}
+cog_modfunc fne_seq_next = {"[[Seq::Next]]", COG_COOKIEFUNC, fn_seq_next, NULL};
+
+// MARK: BUILTIN FUNCTION OBJECTS
+
+cog_obj_type ot_bfunction = {"BuiltinFunction", NULL};
+
+cog_object* cog_make_bfunction(cog_modfunc* func) {
+    assert(func);
+    assert(func->when == COG_FUNC || func->when == COG_COOKIEFUNC);
+    cog_object* obj = cog_make_obj(&ot_bfunction);
+    obj->as_fun = func;
+    return obj;
+}
+
+cog_object* m_bfunction_exec() {
+    cog_object* self = cog_pop();
+    cog_modfunc* f = self->as_fun;
+    if (f->when == COG_FUNC) cog_pop(); // discard cookie
+    // jump straight into the function
+    return f->fun();
+}
+cog_object_method ome_bfunction_exec = {&ot_bfunction, "Exec", m_bfunction_exec};
+
+// MARK: BLOCKS AND CLOSURES
+
+cog_obj_type ot_block = {"Block", cog_walk_only_next, NULL};
+cog_obj_type ot_closure = {"Closure", cog_walk_both, NULL};
+
+cog_object* cog_make_block(cog_object* commands) {
+    assert(!commands || commands->type == &cog_ot_list);
+    cog_object* obj = cog_make_obj(&ot_block);
+    obj->next = commands;
+    return obj;
+}
+
+cog_object* cog_make_closure(cog_object* block, cog_object* scopes) {
+    assert(block && block->type == &ot_block);
+    assert(!scopes || scopes->type == &cog_ot_list);
     cog_object* obj = cog_make_obj(&ot_closure);
     obj->data = block;
     obj->next = scopes;
     return obj;
 }
 
-cog_object* m_closure_exec() {
-    cog_object* self = cog_pop();
+cog_object* m_closure_exec() {
+    cog_object* self = cog_pop();
+    cog_object* cookie = cog_pop();
+    if (!cookie) cookie = cog_box_bool(true);
+    bool should_push_scope = cog_expect_type_fatal(cookie, &cog_ot_bool)->as_int;
+    // push scope teardown command
+    if (should_push_scope) cog_run_next(cog_make_identifier_c("[[Closure::RestoreCallerScope]]"), cog_on_exit(), COG_GLOBALS.scopes);
+    // push all current commands
+    cog_object* head_existing = COG_GLOBALS.command_queue;
+    COG_GLOBALS.command_queue = NULL;
+    COG_ITER_LIST(self->data->next, cmd) cog_run_next(cmd, NULL, NULL);
+    cog_reverse_list_inplace(&COG_GLOBALS.command_queue);
+    cog_list_splice(&COG_GLOBALS.command_queue, head_existing);
+    cog_push_to(&cookie, self->next);
+    cog_run_next(cog_make_identifier_c("[[Closure::InsertCallScope]]"), cog_on_enter(), cookie);
+    return NULL;
+}
+cog_object_method ome_closure_exec = {&ot_closure, "Exec", m_closure_exec};
+
+cog_object* fn_closure_restore_scope() {
+    cog_object* old_scope = cog_pop();
+    COG_GLOBALS.scopes = old_scope;
+    return NULL;
+}
+cog_modfunc fne_closure_restore_scope = {
+    "[[Closure::RestoreCallerScope]]",
+    COG_COOKIEFUNC,
+    fn_closure_restore_scope,
+    NULL,
+};
+
+cog_object* fn_closure_insert_new_scope() {
+    cog_object* cookie2 = cog_pop();
+    cog_object* closed_scopes = cookie2->data;
+    bool should_push_new = cookie2->next ? cookie2->next->as_int : false;
+    COG_GLOBALS.scopes = closed_scopes;
+    if (should_push_new) cog_push_new_scope();
+    return NULL;
+}
+cog_modfunc fne_closure_insert_new_scope = {
+    "[[Closure::InsertCallScope]]",
+    COG_COOKIEFUNC,
+    fn_closure_insert_new_scope,
+    NULL,
+};
+
+cog_object* m_block_exec() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore cookie
+    cog_push(cog_make_closure(self, COG_GLOBALS.scopes));
+    return NULL;
+}
+cog_object_method ome_block_exec = {&ot_block, "Exec", m_block_exec};
+
+cog_object* m_block_show() {
+    cog_object* block = cog_pop();
+    cog_pop(); // ignore readably
+    cog_push(cog_sprintf("<Block %O>", block->next));
+    return NULL;
+}
+cog_object_method ome_block_show = {&ot_block, "Show", m_block_show};
+
+// MARK: DUMPER
+
+static bool make_refs_list(cog_object* obj, cog_object* alist_header) {
+    cog_object* entry = cog_assoc(alist_header->data, obj, cog_same_pointer);
+    if (entry) {
+        entry->next = cog_box_int(2);
+        return false;
+    }
+    cog_object* pair = cog_make_obj(&cog_ot_list);
+    pair->data = obj;
+    pair->next = cog_box_int(1);
+    cog_push_to(&alist_header->data, pair);
+    return cog_has_well_known(obj, "Show_Recursive");
+}
+
+int64_t cog_rec_get_refnum(cog_object* obj, cog_object* alist, int64_t* counter) {
+    cog_object* entry = cog_assoc(alist, obj, cog_same_pointer);
+    if (entry) {
+        int64_t value = entry->next->as_int;
+        if (value < 0) {
+            return value;
+        }
+        if (value > 1) {
+            int64_t my_id = (*counter)++;
+            entry->next = cog_box_int(-my_id);
+            return my_id;
+        }
+    }
+    return 0;
+}
+
+void cog_print_refs_recursive(cog_object* obj, cog_object* alist, cog_object* stream, int64_t* counter, bool readably) {
+    char buffer[256];
+    if (obj == NULL) {
+        cog_fputs_imm(stream, "nil");
+        return;
+    }
+    // test if it's in the table
+    int64_t ref = cog_rec_get_refnum(obj, alist, counter);
+    if (ref < 0) {
+        snprintf(buffer, sizeof(buffer), "#%" PRId64 "#", -ref);
+        cog_fputs_imm(stream, buffer);
+        return;
+    }
+    if (ref) {
+        snprintf(buffer, sizeof(buffer), "#%" PRId64 "=", ref);
+        cog_fputs_imm(stream, buffer);
+    }
+    // Use Show_Recursive if available
+    cog_object* counter_ptr = cog_make_obj(&cog_ot_pointer);
+    counter_ptr->as_ptr = (void*)counter;
+    cog_push(counter_ptr);
+    cog_push(alist);
+    cog_push(stream);
+    cog_push(cog_box_bool(readably));
+    if (cog_same_identifiers(cog_run_well_known(obj, "Show_Recursive"), cog_not_implemented())) {
+        cog_pop();
+        cog_pop();
+        cog_pop();
+        cog_pop();
+        // defer to Show if that didn't work
+        cog_push(cog_box_bool(readably));
+        if (cog_same_identifiers(cog_run_well_known(obj, "Show"), cog_not_implemented())) {
+            cog_pop();
+            snprintf(buffer, sizeof(buffer), "#<%s: %p %p>", obj->type ? obj->type->name : "NULL", obj->data, obj->next);
+            cog_fputs_imm(stream, buffer);
+        } else {
+            put_string(stream, cog_pop());
+        }
+    }
+}
+
+void cog_dump(cog_object* obj, cog_object* stream, bool readably) {
+    cog_object* alist_header = cog_make_obj(&cog_ot_list);
+    int64_t counter = 1;
+    cog_walk(obj, make_refs_list, alist_header);
+    if (stream->type == &ot_strbuf_stream) {
+        cog_print_refs_recursive(obj, alist_header->data, stream, &counter, readably);
+        return;
+    }
+    // build it up in memory and then write it out all at once
+    cog_strbuf sb = COG_STRBUF_INIT;
+    cog_print_refs_recursive(obj, alist_header->data, cog_strbuf_stream(&sb), &counter, readably);
+    cog_strbuf_flush(&sb, stream);
+    cog_strbuf_free(&sb);
+}
+
+// MARK: PARSER
+
+const char COG_ESCAPE_MAP[23] = "a\ab\bf\fn\nr\rt\tv\ve\x1b\\\\\"\"z";
+
+char cog_maybe_escape_char(char c, bool* did_escape) {
+    const char* p = COG_ESCAPE_MAP;
+    while (*p) {
+        if (*(p + 1) == c) {
+            *did_escape = true;
+            return *p;
+        }
+        p += 2;
+    }
+    return c;
+}
+
+char cog_unescape_char(char c) {
+    const char* p = COG_ESCAPE_MAP;
+    while (*p) {
+        if (*p == c) return *(p + 1);
+        p += 2;
+    }
+    return c;
+}
+
+const char doc_parser_internals[] = "Parser Internal -- you should never see this.";
+
+static void run_nextitem_next(cog_object* stream, cog_object* ibuf) {
+    cog_object* cookie = cog_emptystring();
+    cog_push_to(&cookie, cog_box_int(0));
+    cog_push_to(&cookie, ibuf);
+    cog_push_to(&cookie, COG_GLOBALS.modules);
+    cog_push_to(&cookie, stream);
+    cog_run_next(cog_make_identifier_c("[[Parser::NextItem]]"), NULL, cookie);
+}
+
+cog_object* fn_parser_handle_token() {
+    cog_object* cookie = cog_pop();
+    cog_object* stream = cookie->data;
+    cog_object* modlist = cookie->next->data;
+    cog_object* buffer = cookie->next->next->data;
+    cog_object* index = cookie->next->next->next;
+    cog_module* curr_mod;
+    cog_modfunc* curr_func;
+    cog_object* cookie2;
+    cog_object* res;
+    if (!modlist) goto error;
+    // handle what's in the buffer
+    curr_mod = (cog_module*)modlist->data->as_ptr;
+    if (!curr_mod->table) goto nextmod;
+    curr_func = curr_mod->table[index->as_int];
+    if (!curr_func) goto nextmod;
+    if (curr_func->when != COG_PARSE_TOKEN_HANDLER) goto nextfun;
+    if (curr_func->name && buffer->type == &cog_ot_string && cog_strcasecmp_c(buffer, curr_func->name))
+        goto nextfun;
+    if (curr_func->name && buffer->type != &cog_ot_string) goto nextfun;
+
+    cookie2 = cog_make_obj(&cog_ot_list);
+    cookie2->data = buffer;
+    cookie2->next = stream;
+    cog_push(cookie2);
+    res = curr_func->fun();
+    if (cog_same_identifiers(res, cog_not_implemented())) {
+        cog_pop();
+        if (buffer->type == &cog_ot_string && cog_strlen(buffer) == 0) {
+            // clearing buffer == no token
+            // so try again
+            run_nextitem_next(stream, cog_emptystring());
+            return NULL;
+        }
+        goto nextfun;
+    }
+    return res;
+
+    nextfun:
+    cookie->next->next->next = cog_box_int(index->as_int + 1);
+    goto retry;
+
+    nextmod:
+    cookie->next->next->next = cog_box_int(0);
+    cog_pop_from(&cookie->next->data);
+    goto retry;
+
+    error:
+    cog_push(cog_box_bool(true));
+    cog_run_well_known_strict(buffer, "Show");
+    COG_RETURN_ERROR(cog_sprintf("PARSE ERROR: could not handle token %O", cog_pop()));
+
+    retry:
+    cog_run_next(cog_make_identifier_c("[[Parser::HandleToken]]"), NULL, cookie);
+    return NULL;
+}
+cog_modfunc fne_parser_handle_token = {
+    "[[Parser::HandleToken]]",
+    COG_COOKIEFUNC,
+    fn_parser_handle_token,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_nextitem() {
+    cog_object* cookie = cog_pop();
+    cog_object* stream = cookie->data;
+    cog_object* modlist = cookie->next->data;
+    cog_object* buffer = cookie->next->next->data;
+    cog_object* index = cookie->next->next->next->data;
+    cog_object* curr_char = cookie->next->next->next->next;
+    cog_object* tail = buffer;
+    cog_module* curr_mod;
+    cog_modfunc* curr_func;
+    cog_object* cookie2;
+    cog_object* res;
+    cog_object* old_top;
+    int ch;
+
+    if (curr_char->type != &ot_eof && cog_strlen(curr_char) != 1) goto firstchar;
+    ch = curr_char->type != &ot_eof ? cog_nthchar(curr_char, 0) : EOF;
+
+    if (!modlist) goto nextchar;
+    // test current character
+    curr_mod = (cog_module*)modlist->data->as_ptr;
+    if (!curr_mod->table) goto nextmod;
+    curr_func = curr_mod->table[index->as_int];
+    if (!curr_func) goto nextmod;
+    if (curr_func->when != COG_PARSE_INDIV_CHAR && curr_func->when != COG_PARSE_END_CHAR) goto nextfun;
+    if (curr_func->when == COG_PARSE_END_CHAR && cog_strlen(buffer) == 0) goto nextfun;
+    if (curr_func->name != NULL && strchr(curr_func->name, ch) == NULL) goto nextfun;
+
+    cookie2 = stream;
+    cog_push_to(&cookie2, curr_char);
+    cog_push_to(&cookie2, buffer);
+    old_top = COG_GLOBALS.stack->data;
+    cog_push(cookie2);
+    res = curr_func->fun();
+    if (cog_same_identifiers(res, cog_not_implemented())) {
+        cog_pop();
+        goto nextfun;
+    }
+    assert(COG_GLOBALS.stack->data == old_top);
+    goto end_of_token;
+
+    nextfun:
+    cookie->next->next->next->data = cog_box_int(index->as_int + 1);
+    goto loop;
+
+    nextmod:
+    cookie->next->next->next->data = cog_box_int(0);
+    cog_pop_from(&cookie->next->data);
+    goto loop;
+
+    nextchar:
+    if (curr_char->type == &ot_eof && cog_strlen(buffer) == 0) goto end_of_token;
+    if (ch != EOF) cog_string_append_byte(&tail, ch);
+
+    firstchar:
+    if (stream->type == &ot_iostring) {
+        int c = iostring_getc(stream);
+        cog_push(c == EOF ? cog_eof() : cog_make_character(c));
+    }
+    else COG_RUN_WKM_RETURN_IF_ERROR(stream, "Stream::GetChar");
+    cookie->next->next->next->next = cog_pop();
+    cookie->next->data = COG_GLOBALS.modules;
+
+    loop:
+    cog_run_next(cog_make_identifier_c("[[Parser::NextItem]]"), NULL, cookie);
+    return NULL;
+
+    end_of_token:
+    if (cog_strlen(buffer) == 0 && curr_char->type == &cog_ot_string) buffer = curr_char;
+    else if (ch != EOF) cog_ungetch(stream, ch);
+    // handle current token
+    if (cog_strlen(buffer) == 0) {
+        assert(curr_char->type == &ot_eof);
+        buffer = curr_char;
+    }
+    cookie = cog_box_int(0);
+    cog_push_to(&cookie, buffer);
+    cog_push_to(&cookie, COG_GLOBALS.modules);
+    cog_push_to(&cookie, stream);
+    cog_run_next(cog_make_identifier_c("[[Parser::HandleToken]]"), NULL, cookie);
+    return NULL;
+}
+cog_modfunc fne_parser_nextitem = {
+    "[[Parser::NextItem]]",
+    COG_COOKIEFUNC,
+    fn_parser_nextitem,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_rule_special_chars() {
+    cog_object* cookie = cog_pop();
+    cog_object* ch = cookie->next->data;
+    if (ch->type == &cog_ot_string) {
+        char ch = cog_nthchar(cookie->next->data, 0);
+        if (isspace(ch)) return NULL;
+        if (strchr("([{\"~;", ch)) return NULL;
+    }
+    if (ch->type == &ot_eof) return NULL;
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_rule_special_chars = {
+    NULL,
+    COG_PARSE_INDIV_CHAR,
+    fn_parser_rule_special_chars,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_rule_break_chars() {
+    cog_object* cookie = cog_pop();
+    cog_object* ch = cookie->next->data;
+    if (cookie->next->data->type == &cog_ot_string) {
+        char ch = cog_nthchar(cookie->next->data, 0);
+        if (strchr("\\)]}", ch)) return NULL;
+    }
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_rule_break_chars = {
+    NULL,
+    COG_PARSE_END_CHAR,
+    fn_parser_rule_break_chars,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_ignore_whitespace() {
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        size_t len = cog_strlen(s);
+        for (size_t i = 0; i < len; i++) {
+            if (!isspace(cog_nthchar(s, i))) {
+                cog_push(cookie);
+                return cog_not_implemented();
+            }
+        }
+        // clear the token to discard it
+        s->stored_chars = 0;
+        s->next = NULL;
+    }
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_ignore_whitespace = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_ignore_whitespace,
+    doc_parser_internals
+};
+
+cog_object* fn_parser_handle_int() {
+    char buffer[32];
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        cog_string_to_cstring(s, buffer, sizeof(buffer));
+        int64_t i;
+        int len = 0;
+        int filled = sscanf(buffer, "%" SCNd64 "%n", &i, &len);
+        if (len == cog_strlen(s)) {
+            cog_push(cog_box_int(i));
+            return NULL;
+        }
+    }
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_handle_int = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_int,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_handle_float() {
+    char buffer[32];
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        cog_string_to_cstring(s, buffer, sizeof(buffer));
+        double i;
+        int len = 0;
+        int filled = sscanf(buffer, "%lg%n", &i, &len);
+        if (len == cog_strlen(s)) {
+            cog_push(cog_box_float(i));
+            return NULL;
+        }
+    }
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_handle_float = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_float,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_handle_bool() {
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    cog_push(cog_box_bool(cog_strcasecmp_c(s, "true") == 0));
+    return NULL;
+}
+cog_modfunc fne_parser_handle_bool_true = {
+    "true",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_bool,
+    doc_parser_internals,
+};
+cog_modfunc fne_parser_handle_bool_false = {
+    "false",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_bool,
+    doc_parser_internals,
+};
+
+bool all_valid_for_ident(cog_object* string) {
+    size_t len = cog_strlen(string);
+    for (size_t i = 0; i < len; i++) {
+        char ch = cog_nthchar(string, i);
+        if (!(isalpha(ch) || isdigit(ch) || strchr("-?!'+/*>=<^.", ch))) return false;
+    }
+    return true;
+}
+
+cog_object* fn_parser_handle_symbols() {
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        char first = cog_nthchar(s, 0);
+        if (first == '\\') {
+            cog_string_delete_char(&s, 0);
+            if (!all_valid_for_ident(s)) {
+                cog_string_prepend_byte(&s, '\\');
+            } else {
+                cog_push(cog_sym(cog_make_identifier(s)));
+                return NULL;
+            }
+        }
+    }
+    // defer to next stuff
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_handle_symbols = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_symbols,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_discard_informal_syntax() {
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        char first = cog_nthchar(s, 0);
+        if (tolower(first) == first && isalpha(first)) {
+            // clear string to signal there is no token here
+            s->stored_chars = 0;
+            s->next = NULL;
+        }
+    }
+    // defer to next stuff
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_discard_informal_syntax = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_discard_informal_syntax,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_handle_identifiers() {
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        char first = cog_nthchar(s, 0);
+        if (!isalpha(first) || (toupper(first) == first && all_valid_for_ident(s))) {
+            // defined identifier
+            cog_push(cog_make_identifier(s));
+            return NULL;
+        }
+    }
+    // defer to next stuff
+    cog_push(cookie);
+    return cog_not_implemented();
+}
+cog_modfunc fne_parser_handle_identifiers = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_identifiers,
+    doc_parser_internals,
+};
+
+cog_object* fn_parser_handle_open_paren() {
+    cog_object* cookie = cog_pop();
+    cog_object* stream = cookie->next;
+    cog_push(NULL); // the current block
+    cog_push(NULL); // the current statement
+    cog_object* cookie2 = stream;
+    cog_push_to(&cookie2, cog_make_character(')'));
+    cog_run_next(cog_make_identifier_c("[[Parser::ParseBlockLoop]]"), NULL, cookie2);
+    run_nextitem_next(stream, cog_emptystring());
+    return NULL;
+}
+cog_modfunc fne_parser_handle_open_paren = {
+    "(",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_open_paren,
+    doc_parser_internals
+};
+
+cog_obj_type ot_parser_sentinel = {"[[Parser::Object::Sentinel]]", cog_walk_only_next, NULL};
+
+cog_object* make_sentinel(cog_object* ch) {
+    cog_object* x = cog_make_obj(&ot_parser_sentinel);
+    x->next = ch;
+    return x;
+}
+
+cog_object* fn_parser_handle_close_paren_or_eof() {
+    cog_object* cookie = cog_pop();
+    cog_object* closer = cookie->data;
+    if (closer->type == &ot_eof) goto yes;
+    if (cog_strlen(closer) == 1 && strchr(")]}\xff", cog_nthchar(closer, 0))) goto yes;
+    cog_push(cookie);
+    return cog_not_implemented();
+
+    yes:
+    cog_push(make_sentinel(closer));
+    return NULL;
+}
+cog_modfunc fne_parser_handle_close_paren_or_eof = {
+    NULL,
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_close_paren_or_eof,
+    doc_parser_internals
+};
+
+cog_object* fn_parser_handle_string() {
+    cog_object* cookie = cog_pop();
+    cog_object* stream = cookie->next;
+    cog_object* buffer = cog_emptystring();
+    cog_object* tail = buffer;
+    char ch;
+    for (;;) {
+        ch = cog_getch(stream);
+        if (ch == '"') break;
+        if (ch == EOF || ch == '\n') goto unterminated;
+        if (ch == '\\') {
+            ch = cog_getch(stream);
+            if (ch == EOF) goto unterminated;
+            if (ch == 'x') {
+                // \x escapes are not in cognac but github copilot
+                // gave this to me for free and it works so why not
+                char hex[3];
+                hex[0] = cog_getch(stream);
+                hex[1] = cog_getch(stream);
+                hex[2] = 0;
+                if (hex[0] == EOF || hex[1] == EOF) goto unterminated;
+                if (!isxdigit(hex[0]) || !isxdigit(hex[1])) goto badescape;
+                ch = strtol(hex, NULL, 16);
+            } else {
+                char ch2 = cog_unescape_char(ch);
+                if (ch2 == ch) {
+                    cog_string_append_byte(&tail, '\\');
+                } else {
+                    ch = ch2;
+                }
+            }
+        }
+        cog_string_append_byte(&tail, ch);
+    }
+    cog_push(buffer);
+    return NULL;
+
+    unterminated:
+    cog_push(cog_string("unterminated string"));
+    return cog_error();
+
+    badescape:
+    cog_push(cog_string("bad hex escape sequence in string"));
+    return cog_error();
+}
+cog_modfunc fne_parser_handle_string = {
+    "\"",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_string,
+    doc_parser_internals
+};
+
+cog_object* fn_parser_handle_comments() {
+    cog_object* cookie = cog_pop();
+    cog_object* buffer = cookie->data;
+    // there is no token here
+    buffer->stored_chars = 0;
+    buffer->next = NULL;
+    cog_object* stream = cookie->next;
+    bool isline = false;
+    char ch = cog_getch(stream);
+    if (ch == EOF) goto unterminated;
+    if (ch == '~') isline =  true;
+    for (;;) {
+        ch = cog_getch(stream);
+        if (!isline && ch == EOF) goto unterminated;
+        if (!isline && ch == '~') break;
+        if (isline && ch == '\n') break;
+    }
+    cog_push(cookie);
+    return cog_not_implemented();
+
+    unterminated:
+    cog_push(cog_string("unterminated block comment"));
+    return cog_error();
+}
+cog_modfunc fne_parser_handle_comments = {
+    "~",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_comments,
+    doc_parser_internals
+};
+
+cog_object* fn_parser_handle_def_and_let() {
+    cog_object* cookie = cog_pop();
+    cog_object* s = cookie->data;
+    bool is_def = !cog_strcasecmp_c(s, "def");
+    cog_run_next(cog_make_identifier_c("[[Parser::TransformDefOrLet]]"), NULL, cog_box_bool(is_def));
+    run_nextitem_next(cookie->next, cog_emptystring());
+    return NULL;
+}
+cog_modfunc fne_parser_handle_def = {
+    "def",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_def_and_let,
+    doc_parser_internals
+};
+cog_modfunc fne_parser_handle_let = {
+    "let",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_def_and_let,
+    doc_parser_internals
+};
+
+cog_obj_type ot_def_or_let_special = {"[[Parser::Special::DefOrLet]]", cog_walk_only_next, NULL};
+cog_obj_type ot_var = {"Var", cog_walk_only_next, NULL};
+
+cog_object* make_def_or_let_special_obj(cog_object* what, bool is_def) {
+    cog_object* obj = cog_make_obj(&ot_def_or_let_special);
+    obj->as_int = is_def;
+    obj->next = what;
+    return obj;
+}
+
+cog_object* cog_make_var(cog_object* what) {
+    cog_object* obj = cog_make_obj(&ot_var);
+    obj->next = what;
+    return obj;
+}
+
+cog_object* m_def_or_let_exec() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore cookie
+    bool is_def = self->as_int;
+    cog_object* symbol = self->next;
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* value = cog_pop();
+    cog_defun(symbol, is_def ? value : cog_make_var(value));
+    return NULL;
+}
+cog_object_method ome_def_or_let_exec = {&ot_def_or_let_special, "Exec", m_def_or_let_exec};
+
+cog_object* m_def_or_let_show() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore readably
+    bool is_def = self->as_int;
+    cog_object* symbol = self->next;
+    cog_push(cog_sprintf("<%s %O>", is_def ? "Def" : "Let", symbol));
+    return NULL;
+}
+cog_object_method ome_def_or_let_show = {&ot_def_or_let_special, "Show", m_def_or_let_show};
+
+cog_object* m_var_run_self() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore cookie
+    cog_push(self->next);
+    return NULL;
+}
+cog_object_method ome_var_exec = {&ot_var, "Exec", m_var_run_self};
+
+cog_object* fn_parser_transform_def_or_let() {
+    cog_object* cookie = cog_pop();
+    bool is_def = cookie->as_int;
+    cog_object* what = cog_pop();
+    if (!what || what->type != &cog_ot_identifier) goto error;
+    cog_push(make_def_or_let_special_obj(what, is_def));
+    return NULL;
+
+    error:
+    cog_push(cog_sprintf("expected identifier after %s not %O", is_def ? "Def" : "Let", what));
+    return cog_error();
+}
+cog_modfunc fne_parser_transform_def_or_let = {
+    "[[Parser::TransformDefOrLet]]",
+    COG_COOKIEFUNC,
+    fn_parser_transform_def_or_let,
+    doc_parser_internals
+};
+
+void handle_end_of_statement() {
+    cog_object* statement = cog_pop();
+    cog_object* block_contents = cog_pop();
+    cog_list_splice(&block_contents, statement);
+    cog_push(block_contents);
+    cog_push(NULL); // next statement list
+}
+
+void handle_end_of_block() {
+    handle_end_of_statement();
+    cog_pop(); // throw out empty new statement;
+    cog_object* commands = cog_pop();
+    cog_push(cog_make_block(commands));
+}
+
+void handle_item(cog_object* ijp) {
+    cog_object* statement = cog_pop();
+    cog_push_to(&statement, ijp);
+    cog_push(statement);
+}
+
+cog_object* fn_parser_handle_semicolon() {
     cog_object* cookie = cog_pop();
-    if (!cookie) cookie = cog_box_bool(true);
-    bool should_push_scope = cog_expect_type_fatal(cookie, &cog_ot_bool)->as_int;
-    // push scope teardown command
-    if (should_push_scope) cog_run_next(cog_make_identifier_c("[[Closure::RestoreCallerScope]]"), cog_on_exit(), COG_GLOBALS.scopes);
-    // push all current commands
-    cog_object* head_existing = COG_GLOBALS.command_queue;
-    COG_GLOBALS.command_queue = NULL;
-    COG_ITER_LIST(self->data->next, cmd) cog_run_next(cmd, NULL, NULL);
-    cog_reverse_list_inplace(&COG_GLOBALS.command_queue);
-    cog_list_splice(&COG_GLOBALS.command_queue, head_existing);
-    cog_push_to(&cookie, self->next);
-    cog_run_next(cog_make_identifier_c("[[Closure::InsertCallScope]]"), cog_on_enter(), cookie);
-    return NULL;
+    cog_object* s = cookie->data;
+    if (s->type == &cog_ot_string) {
+        s->stored_chars = 0;
+        s->next = NULL;
+    }
+    handle_end_of_statement();
+    cog_push(cookie);
+    return cog_not_implemented();
 }
-cog_object_method ome_closure_exec = {&ot_closure, "Exec", m_closure_exec};
+cog_modfunc fne_parser_handle_semicolon = {
+    ";",
+    COG_PARSE_TOKEN_HANDLER,
+    fn_parser_handle_semicolon,
+    doc_parser_internals
+};
 
-cog_object* fn_closure_restore_scope() {
-    cog_object* old_scope = cog_pop();
-    COG_GLOBALS.scopes = old_scope;
+cog_object* fn_parser_parse_block_loop() {
+    cog_object* cookie = cog_pop();
+    cog_object* stopwhen = cookie->data;
+    cog_object* stream = cookie->next;
+    cog_object* ijp = cog_pop();
+    if (!ijp || ijp->type != &ot_parser_sentinel) goto next;
+    if (ijp->next->type == &ot_eof && stopwhen->type == &ot_eof) goto stop;
+    if (ijp->next->type == &cog_ot_string && stopwhen->type == &cog_ot_string && !cog_strcmp(ijp->next, stopwhen)) goto stop;
+    // else it is an error
+    cog_push(ijp->next->type == &cog_ot_string ? cog_sprintf("unexpected %O", ijp->next) : cog_string("unexpected EOF"));
+    return cog_error();
+
+    next:
+    handle_item(ijp);
+    cog_run_next(cog_make_identifier_c("[[Parser::ParseBlockLoop]]"), NULL, cookie);
+    run_nextitem_next(stream, cog_emptystring());
+    return NULL;
+
+    stop:
+    handle_end_of_block();
     return NULL;
 }
-cog_modfunc fne_closure_restore_scope = {
-    "[[Closure::RestoreCallerScope]]",
+cog_modfunc fne_parser_parse_block_loop = {
+    "[[Parser::ParseBlockLoop]]",
     COG_COOKIEFUNC,
-    fn_closure_restore_scope,
-    NULL,
+    fn_parser_parse_block_loop,
+    doc_parser_internals
 };
 
-cog_object* fn_closure_insert_new_scope() {
-    cog_object* cookie2 = cog_pop();
-    cog_object* closed_scopes = cookie2->data;
-    bool should_push_new = cookie2->next ? cookie2->next->as_int : false;
-    COG_GLOBALS.scopes = closed_scopes;
-    if (should_push_new) cog_push_new_scope();
+cog_object* fn_parse() {
+    cog_object* stream = cog_pop();
+    if (stream == NULL) {
+        cog_push(NULL);
+        return NULL;
+    }
+    if (stream->type == &cog_ot_string) {
+        stream = cog_iostring_wrap(stream);
+    }
+    else if (stream->type != &ot_iostring) {
+        // read other streams a block at a time instead of a char at a time
+        stream = iostring_reader(stream);
+    }
+    cog_object* cookie2 = stream;
+    cog_push_to(&cookie2, cog_eof());
+    cog_run_next(cog_make_identifier_c("[[Parser::ParseBlockLoop]]"), NULL, cookie2);
+    run_nextitem_next(stream, cog_emptystring());
+    cog_push(NULL);
+    cog_push(NULL); // for block parsing and stuff
     return NULL;
 }
-cog_modfunc fne_closure_insert_new_scope = {
-    "[[Closure::InsertCallScope]]",
-    COG_COOKIEFUNC,
-    fn_closure_insert_new_scope,
-    NULL,
+cog_modfunc fne_parse = {
+    "Parse",
+    COG_FUNC,
+    fn_parse,
+    "Parse the next item from the stream on the stack "
+    "into a Cognate data structure."
 };
 
-cog_object* m_block_exec() {
+// MARK: PARALLEL
+
+// Parallel-Map and Parallel-For run the block in worker interpreters, one
+// per thread, each with its own state. Nothing can point from one heap into
+// another, so the block (with everything it closes over) and each item are
+// copied into the worker, and the results are copied back into the
+// caller's heap afterwards. The caller's heap only gets read while the
+// workers run, since the caller is waiting in a builtin and can't GC.
+//
+// Each worker starts with an even share of the items, as a range it takes
+// from the front of; one that runs out steals the back half of another's.
+// Whatever the block prints is held per item and written out in order.
+
+// stands in for something that couldn't be copied into a worker, like a
+// file, so the block only fails if it actually uses it. as_ptr is the name
+// of the type it stands in for.
+static cog_obj_type ot_not_shared = {"[[Parallel::NotShared]]", NULL};
+
+cog_object* m_not_shared_exec() {
     cog_object* self = cog_pop();
     cog_pop(); // ignore cookie
-    cog_push(cog_make_closure(self, COG_GLOBALS.scopes));
-    return NULL;
+    COG_RETURN_ERROR(cog_sprintf("a %s can't be used in a parallel block", (const char*)self->as_ptr));
 }
-cog_object_method ome_block_exec = {&ot_block, "Exec", m_block_exec};
+cog_object_method ome_not_shared_exec = {&ot_not_shared, "Exec", m_not_shared_exec};
 
-cog_object* m_block_show() {
-    cog_object* block = cog_pop();
+cog_object* m_not_shared_show() {
+    cog_object* self = cog_pop();
     cog_pop(); // ignore readably
-    cog_push(cog_sprintf("<Block %O>", block->next));
+    cog_push(cog_sprintf("<%s, not shared>", (const char*)self->as_ptr));
     return NULL;
 }
-cog_object_method ome_block_show = {&ot_block, "Show", m_block_show};
+cog_object_method ome_not_shared_show = {&ot_not_shared, "Show", m_not_shared_show};
 
-// MARK: DUMPER
+typedef struct {
+    cog_object* from;
+    cog_object* to; // NULL while a container is still being copied
+} marshal_slot;
 
-static bool make_refs_list(cog_object* obj, cog_object* alist_header) {
-    cog_object* entry = cog_assoc(alist_header->data, obj, cog_same_pointer);
-    if (entry) {
-        entry->next = cog_box_int(2);
-        return false;
-    }
-    cog_object* pair = cog_make_obj(&cog_ot_list);
-    pair->data = obj;
-    pair->next = cog_box_int(1);
-    cog_push_to(&alist_header->data, pair);
-    return cog_has_well_known(obj, "Show_Recursive");
+typedef struct {
+    marshal_slot* slots;
+    size_t cap;
+    size_t count;
+    const char* unshared; // the type of the first thing that couldn't be copied, or NULL
+} marshal_memo;
+
+static size_t marshal_index(cog_object* obj, size_t cap) {
+    return (((uint64_t)(uintptr_t)obj >> 5) * 0x9E3779B97F4A7C15ULL >> 32) & (cap - 1);
 }
 
-int64_t cog_rec_get_refnum(cog_object* obj, cog_object* alist, int64_t* counter) {
-    cog_object* entry = cog_assoc(alist, obj, cog_same_pointer);
-    if (entry) {
-        int64_t value = entry->next->as_int;
-        if (value < 0) {
-            return value;
+static marshal_slot* marshal_find(marshal_memo* m, cog_object* from) {
+    if (!m->cap) return NULL;
+    for (size_t i = marshal_index(from, m->cap); m->slots[i].from; i = (i + 1) & (m->cap - 1))
+        if (m->slots[i].from == from) return &m->slots[i];
+    return NULL;
+}
+
+static void marshal_put(marshal_memo* m, cog_object* from, cog_object* to) {
+    marshal_slot* there = marshal_find(m, from);
+    if (there) {
+        there->to = to;
+        return;
+    }
+    if ((m->count + 1) * 2 > m->cap) {
+        marshal_slot* old = m->slots;
+        size_t old_cap = m->cap;
+        m->cap = old_cap ? old_cap * 2 : 256;
+        m->slots = (marshal_slot*)calloc(m->cap, sizeof(marshal_slot));
+        if (m->slots == NULL) {
+            perror(__func__);
+            abort();
         }
-        if (value > 1) {
-            int64_t my_id = (*counter)++;
-            entry->next = cog_box_int(-my_id);
-            return my_id;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old[i].from) continue;
+            size_t j = marshal_index(old[i].from, m->cap);
+            while (m->slots[j].from) j = (j + 1) & (m->cap - 1);
+            m->slots[j] = old[i];
         }
+        free(old);
     }
-    return 0;
+    size_t i = marshal_index(from, m->cap);
+    while (m->slots[i].from) i = (i + 1) & (m->cap - 1);
+    m->slots[i] = (marshal_slot){from, to};
+    m->count++;
 }
 
-void cog_print_refs_recursive(cog_object* obj, cog_object* alist, cog_object* stream, int64_t* counter, bool readably) {
-    char buffer[256];
-    if (obj == NULL) {
-        cog_fputs_imm(stream, "nil");
-        return;
+static void marshal_memo_free(marshal_memo* m) {
+    free(m->slots);
+    *m = (marshal_memo){0};
+}
+
+static cog_object* marshal(cog_object* obj, marshal_memo* m);
+extern cog_obj_type ot_channel;
+static cog_object* channel_share(cog_object* obj);
+
+static cog_object* marshal_unshared(marshal_memo* m, const char* why) {
+    if (!m->unshared) m->unshared = why;
+    cog_object* stand_in = cog_make_obj(&ot_not_shared);
+    stand_in->as_ptr = (void*)why;
+    return stand_in;
+}
+
+typedef struct {
+    marshal_memo* m;
+    cog_transient_table t;
+    cog_object* map;
+} marshal_rebuild;
+
+static cog_object* _marshal_table_entry(cog_object* key, cog_object* val, cog_object* ctx) {
+    marshal_rebuild* r = (marshal_rebuild*)ctx->as_ptr;
+    cog_transient_insert(&r->t, marshal(key, r->m), marshal(val, r->m));
+    return ctx;
+}
+
+static cog_object* _marshal_omap_entry(cog_object* key, cog_object* val, cog_object* ctx) {
+    marshal_rebuild* r = (marshal_rebuild*)ctx->as_ptr;
+    r->map = cog_omap_insert(r->map, marshal(key, r->m), marshal(val, r->m));
+    return ctx;
+}
+
+// copies an object that has its own C structure, by building a new one
+// out of copies of what's in it
+static cog_object* marshal_container(cog_object* obj, marshal_memo* m) {
+    cog_obj_type* t = obj->type;
+    if (t == &cog_ot_f64_array || t == &cog_ot_i64_array) {
+        cog_object* arr = cog_make_numarray(t == &cog_ot_f64_array, NUMARRAY(obj)->len);
+        memcpy(NUMARRAY(arr)->i, NUMARRAY(obj)->i, NUMARRAY(obj)->len * sizeof(int64_t));
+        return arr;
     }
-    // test if it's in the table
-    int64_t ref = cog_rec_get_refnum(obj, alist, counter);
-    if (ref < 0) {
-        snprintf(buffer, sizeof(buffer), "#%" PRId64 "#", -ref);
-        cog_fputs_imm(stream, buffer);
-        return;
+    if (t == &cog_ot_dict) {
+        // done first so a Dict that holds itself comes out the same
+        cog_object* dict = cog_make_dict();
+        marshal_put(m, obj, dict);
+        cog_dict* d = (cog_dict*)obj->as_ptr;
+        for (size_t i = 0; i < d->cap; i++)
+            if (d->slots[i].dist) cog_dict_set(dict, marshal(d->slots[i].key, m), marshal(d->slots[i].val, m));
+        return dict;
     }
-    if (ref) {
-        snprintf(buffer, sizeof(buffer), "#%" PRId64 "=", ref);
-        cog_fputs_imm(stream, buffer);
+    // an immutable container can only hold itself through a Box or a Dict,
+    // and it isn't made until after its contents, so that is caught here
+    marshal_put(m, obj, NULL);
+    cog_object* ctx = cog_make_obj(&cog_ot_pointer);
+    marshal_rebuild r = {m, {0}, NULL};
+    ctx->as_ptr = &r;
+    if (t == &cog_ot_table) {
+        cog_table_transient(&r.t, cog_emptytab());
+        cog_table_reduce(obj, _marshal_table_entry, ctx);
+        return cog_transient_freeze(&r.t);
     }
-    // Use Show_Recursive if available
-    cog_object* counter_ptr = cog_make_obj(&cog_ot_pointer);
-    counter_ptr->as_ptr = (void*)counter;
-    cog_push(counter_ptr);
-    cog_push(alist);
-    cog_push(stream);
-    cog_push(cog_box_bool(readably));
-    if (cog_same_identifiers(cog_run_well_known(obj, "Show_Recursive"), cog_not_implemented())) {
-        cog_pop();
-        cog_pop();
-        cog_pop();
-        cog_pop();
-        // defer to Show if that didn't work
-        cog_push(cog_box_bool(readably));
-        if (cog_same_identifiers(cog_run_well_known(obj, "Show"), cog_not_implemented())) {
-            cog_pop();
-            snprintf(buffer, sizeof(buffer), "#<%s: %p %p>", obj->type ? obj->type->name : "NULL", obj->data, obj->next);
-            cog_fputs_imm(stream, buffer);
-        } else {
-            cog_run_well_known_strict(stream, "Stream::PutString");
+    if (t == &cog_ot_ordered_map) {
+        r.map = cog_empty_omap();
+        cog_omap_reduce_reverse(obj, _marshal_omap_entry, ctx);
+        return r.map;
+    }
+    // a vector
+    size_t count = cog_vector_length(obj);
+    cog_object** items = (cog_object**)malloc((count ? count : 1) * sizeof(cog_object*));
+    if (items == NULL) {
+        perror(__func__);
+        abort();
+    }
+    for (size_t i = 0; i < count; i++) items[i] = marshal(cog_vector_nth(obj, i), m);
+    cog_object* vec = cog_vector_from_array(items, count);
+    free(items);
+    return vec;
+}
+
+// copies an object from another interpreter's heap into this one, keeping
+// shared structure and cycles. It only reads the other heap.
+static cog_object* marshal(cog_object* obj, marshal_memo* m) {
+    cog_object* head = NULL;
+    cog_object** into = &head;
+    // list-like objects are followed along `next` in a loop, so long lists
+    // don't recurse
+    while (obj) {
+        marshal_slot* done = marshal_find(m, obj);
+        if (done) {
+            *into = done->to ? done->to : marshal_unshared(m, "value that holds itself");
+            break;
+        }
+        cog_obj_type* t = obj->type;
+        if (t == &ot_not_shared) {
+            *into = marshal_unshared(m, (const char*)obj->as_ptr);
+            break;
         }
+        if (t == &ot_channel) {
+            *into = channel_share(obj);
+            marshal_put(m, obj, *into);
+            break;
+        }
+        if (t == &cog_ot_table || t == &cog_ot_ordered_map || t == &cog_ot_vector || t == &cog_ot_dict
+                || t == &cog_ot_f64_array || t == &cog_ot_i64_array) {
+            *into = marshal_container(obj, m);
+            marshal_put(m, obj, *into);
+            break;
+        }
+        bool is_cells = t == NULL || t == &cog_ot_identifier
+            || (t->destroy == NULL && (t->walk == NULL || t->walk == cog_walk_both || t->walk == cog_walk_only_next));
+        if (!is_cells || t == &ot_strbuf_stream) {
+            *into = marshal_unshared(m, t->name);
+            break;
+        }
+        cog_object* copy = cog_make_obj(t);
+        copy->as_int = obj->as_int; // all of the union
+        marshal_put(m, obj, copy);
+        *into = copy;
+        if (t == &cog_ot_identifier) {
+            // only a long identifier has anything in it; builtin ones point at
+            // the modfunc, which is the same in every interpreter
+            if ((obj->as_packed_sym & 1) || obj->as_fun) break;
+        } else if (t == NULL || t->walk == cog_walk_both) {
+            copy->data = marshal(obj->data, m);
+        } else if (t->walk == NULL) break;
+        into = &copy->next;
+        obj = obj->next;
+    }
+    return head;
+}
+
+typedef struct {
+    cog_object* item; // in the caller's heap
+    cog_object* result; // in the heap of the worker that ran it
+    bool failed; // the result is an error message
+    bool done;
+    cog_strbuf out; // what the block printed
+} par_item;
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t next, end; // the items left to do
+} par_deque;
+
+typedef struct par_job par_job;
+
+typedef struct {
+    par_job* job;
+    size_t index;
+    pthread_t thread;
+    cog_state* state;
+    par_deque deque;
+    cog_strbuf out; // what the block is printing for the current item
+    cog_object* roots; // what the state kept from the GC before this job
+} par_worker;
+
+struct par_job {
+    cog_object* block; // in the caller's heap
+    par_item* items;
+    size_t count;
+    bool keep_results;
+    cog_module** modules; // newest first, like the modules list
+    size_t nmodules;
+    par_worker* workers;
+    size_t nworkers;
+    pthread_mutex_t lock; // for the items and the rest of these
+    pthread_cond_t progress;
+    size_t running; // workers that haven't finished yet
+    bool stop; // an item failed, so no more get started
+};
+
+static bool par_take(par_worker* w, size_t* i) {
+    par_job* job = w->job;
+    pthread_mutex_lock(&w->deque.lock);
+    bool got = w->deque.next < w->deque.end;
+    if (got) *i = w->deque.next++;
+    pthread_mutex_unlock(&w->deque.lock);
+    if (got) return true;
+    for (size_t k = 1; k < job->nworkers; k++) {
+        par_deque* victim = &job->workers[(w->index + k) % job->nworkers].deque;
+        pthread_mutex_lock(&victim->lock);
+        size_t end = victim->end;
+        size_t from = end - (end - victim->next + 1) / 2;
+        victim->end = from;
+        pthread_mutex_unlock(&victim->lock);
+        if (from == end) continue;
+        pthread_mutex_lock(&w->deque.lock);
+        w->deque.next = from + 1;
+        w->deque.end = end;
+        pthread_mutex_unlock(&w->deque.lock);
+        *i = from;
+        return true;
     }
+    return false;
 }
 
-void cog_dump(cog_object* obj, cog_object* stream, bool readably) {
-    cog_object* alist_header = cog_make_obj(&cog_ot_list);
-    int64_t counter = 1;
-    cog_walk(obj, make_refs_list, alist_header);
-    cog_print_refs_recursive(obj, alist_header->data, stream, &counter, readably);
+// How many threads running interpreters might still do something: all but
+// those parked on a shared channel and those waiting for the workers of a
+// job. Once none are, nothing parked will ever be woken (see channel_wait).
+// It starts with the thread running the first interpreter.
+static size_t par_busy = 1;
+
+static bool has_module(cog_module* mod) {
+    COG_ITER_LIST(COG_GLOBALS.modules, modobj)
+        if (modobj->as_ptr == (void*)mod) return true;
+    return false;
 }
 
-// MARK: PARSER
+static void* par_worker_main(void* arg) {
+    par_worker* w = (par_worker*)arg;
+    par_job* job = w->job;
+    if (w->state) cog_set_state(w->state);
+    else {
+        cog_set_state(NULL);
+        cog_init();
+        w->state = cog_get_state();
+    }
+    w->roots = COG_GLOBALS.gc_protected;
+    for (size_t i = job->nmodules; i-- > 0;)
+        if (!has_module(job->modules[i])) cog_add_module(job->modules[i]);
+    cog_object* out = cog_strbuf_stream(&w->out);
+    cog_set_stdout(out);
+    cog_set_stderr(out);
+    cog_set_stdin(cog_empty_io_string());
+    marshal_memo m = {0};
+    cog_object* block = marshal(job->block, &m);
+    marshal_memo_free(&m);
+    cog_make_immortal(block);
+    size_t i;
+    while (!__atomic_load_n(&job->stop, __ATOMIC_RELAXED) && par_take(w, &i)) {
+        cog_object* item = marshal(job->items[i].item, &m);
+        const char* unshared = m.unshared;
+        marshal_memo_free(&m);
+        cog_object* result = NULL;
+        bool failed = true;
+        if (unshared) result = cog_sprintf("Can't pass a %s to a parallel block", unshared);
+        else {
+            cog_push(item);
+            cog_run_next(block, NULL, NULL);
+            cog_object* status = cog_mainloop(NULL);
+            if (cog_same_identifiers(status, cog_error())) result = cog_pop();
+            else if (job->keep_results && cog_is_stack_empty()) result = cog_string("the block didn't return anything");
+            else {
+                failed = false;
+                if (job->keep_results) result = cog_pop();
+            }
+        }
+        while (!cog_is_stack_empty()) cog_pop();
+        if (result) cog_make_immortal(result);
+        pthread_mutex_lock(&job->lock);
+        par_item* it = &job->items[i];
+        it->result = result;
+        it->failed = failed;
+        it->done = true;
+        it->out = w->out;
+        w->out = (cog_strbuf)COG_STRBUF_INIT;
+        if (failed) __atomic_store_n(&job->stop, true, __ATOMIC_RELAXED);
+        pthread_cond_signal(&job->progress);
+        pthread_mutex_unlock(&job->lock);
+    }
+    pthread_mutex_lock(&job->lock);
+    // the last one to finish hands its turn back to the thread waiting for the job
+    if (--job->running > 0) __atomic_sub_fetch(&par_busy, 1, __ATOMIC_ACQ_REL);
+    pthread_cond_signal(&job->progress);
+    pthread_mutex_unlock(&job->lock);
+    cog_set_state(NULL);
+    return NULL;
+}
 
-const char COG_ESCAPE_MAP[23] = "a\ab\bf\fn\nr\rt\tv\ve\x1b\\\\\"\"z";
+static size_t par_threads() {
+    if (!COG_GLOBALS.threads) {
+        const char* env = getenv("COGNI_THREADS");
+        long n = env ? strtol(env, NULL, 10) : 0;
+        if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+        COG_GLOBALS.threads = n > 0 ? (size_t)n : 1;
+    }
+    return COG_GLOBALS.threads;
+}
 
-char cog_maybe_escape_char(char c, bool* did_escape) {
-    const char* p = COG_ESCAPE_MAP;
-    while (*p) {
-        if (*(p + 1) == c) {
-            *did_escape = true;
-            return *p;
+// keeps a worker's interpreter for the next job, unless there are enough
+static bool par_pool_put(cog_state* state) {
+    if (COG_GLOBALS.pool_count >= par_threads()) return false;
+    cog_state** pool = (cog_state**)realloc(COG_GLOBALS.pool, (COG_GLOBALS.pool_count + 1) * sizeof(cog_state*));
+    if (pool == NULL) {
+        perror(__func__);
+        abort();
+    }
+    COG_GLOBALS.pool = pool;
+    COG_GLOBALS.pool[COG_GLOBALS.pool_count++] = state;
+    return true;
+}
+
+static void par_pool_free() {
+    cog_state** pool = COG_GLOBALS.pool;
+    size_t count = COG_GLOBALS.pool_count;
+    COG_GLOBALS.pool = NULL;
+    COG_GLOBALS.pool_count = 0;
+    cog_state* mine = cog_get_state();
+    for (size_t i = 0; i < count; i++) {
+        cog_set_state(pool[i]);
+        cog_quit();
+    }
+    cog_set_state(mine);
+    free(pool);
+}
+
+// runs the block on each item over the workers. On success the results (if
+// kept) are in `items`, copied back into this heap
+static cog_object* par_run(cog_object* block, par_item* items, size_t count, bool keep_results) {
+    par_job job = {0};
+    job.block = block;
+    job.items = items;
+    job.count = count;
+    job.keep_results = keep_results;
+    COG_ITER_LIST(COG_GLOBALS.modules, _) job.nmodules++;
+    job.modules = (cog_module**)malloc(job.nmodules * sizeof(cog_module*));
+    job.nworkers = min(par_threads(), count);
+    job.workers = (par_worker*)calloc(job.nworkers, sizeof(par_worker));
+    if (job.modules == NULL || job.workers == NULL) {
+        perror(__func__);
+        abort();
+    }
+    size_t n = 0;
+    COG_ITER_LIST(COG_GLOBALS.modules, modobj) job.modules[n++] = (cog_module*)modobj->as_ptr;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.progress, NULL);
+    job.running = job.nworkers;
+    for (size_t i = 0; i < job.nworkers; i++) {
+        par_worker* w = &job.workers[i];
+        w->job = &job;
+        w->index = i;
+        // setting up an interpreter takes longer than most jobs, so reuse one
+        if (COG_GLOBALS.pool_count) w->state = COG_GLOBALS.pool[--COG_GLOBALS.pool_count];
+        pthread_mutex_init(&w->deque.lock, NULL);
+        w->deque.next = count * i / job.nworkers;
+        w->deque.end = count * (i + 1) / job.nworkers;
+    }
+    // the workers are busy, and this thread isn't until they are done
+    __atomic_add_fetch(&par_busy, job.nworkers - 1, __ATOMIC_ACQ_REL);
+    for (size_t i = 0; i < job.nworkers; i++) {
+        if (pthread_create(&job.workers[i].thread, NULL, par_worker_main, &job.workers[i]) != 0) {
+            perror(__func__);
+            abort();
+        }
+    }
+    // write out what got printed, in order, as the items get done
+    size_t shown = 0;
+    cog_object* stdout_stream = cog_get_stdout();
+    pthread_mutex_lock(&job.lock);
+    for (;;) {
+        while (shown < count && items[shown].done) {
+            cog_strbuf out = items[shown].out;
+            items[shown].out = (cog_strbuf)COG_STRBUF_INIT;
+            bool failed = items[shown++].failed;
+            pthread_mutex_unlock(&job.lock);
+            if (stdout_stream) cog_strbuf_flush(&out, stdout_stream);
+            cog_strbuf_free(&out);
+            pthread_mutex_lock(&job.lock);
+            // nothing after the first failure gets shown
+            if (failed) shown = count;
         }
-        p += 2;
+        if (job.running == 0) break;
+        pthread_cond_wait(&job.progress, &job.lock);
     }
-    return c;
-}
-
-char cog_unescape_char(char c) {
-    const char* p = COG_ESCAPE_MAP;
-    while (*p) {
-        if (*p == c) return *(p + 1);
-        p += 2;
+    pthread_mutex_unlock(&job.lock);
+    for (size_t i = 0; i < job.nworkers; i++) pthread_join(job.workers[i].thread, NULL);
+    // the first item that failed, in order, is the error
+    cog_object* status = NULL;
+    marshal_memo m = {0};
+    for (size_t i = 0; i < count; i++) {
+        cog_strbuf_free(&items[i].out);
+        if (status || !items[i].done) continue;
+        if (items[i].failed) {
+            cog_push(marshal(items[i].result, &m));
+            status = cog_error();
+        } else if (keep_results) {
+            items[i].result = marshal(items[i].result, &m);
+            if (m.unshared) {
+                cog_push(cog_sprintf("a %s can't be returned from a parallel block", m.unshared));
+                status = cog_error();
+            }
+        }
     }
-    return c;
+    marshal_memo_free(&m);
+    cog_state* mine = cog_get_state();
+    for (size_t i = 0; i < job.nworkers; i++) {
+        par_worker* w = &job.workers[i];
+        cog_set_state(w->state);
+        // let go of the block and the results
+        COG_GLOBALS.gc_protected = w->roots;
+        // fibers left behind would carry on in the next job
+        bool clean = !COG_GLOBALS.fiber;
+        cog_set_state(mine);
+        if (!clean || !par_pool_put(w->state)) {
+            cog_set_state(w->state);
+            cog_quit();
+            cog_set_state(mine);
+        }
+        cog_strbuf_free(&w->out);
+        pthread_mutex_destroy(&w->deque.lock);
+    }
+    cog_set_state(mine);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.progress);
+    free(job.workers);
+    free(job.modules);
+    return status;
 }
 
-const char doc_parser_internals[] = "Parser Internal -- you should never see this.";
+// MARK: FIBERS
 
-static void run_nextitem_next(cog_object* stream, cog_object* ibuf) {
-    cog_object* cookie = cog_emptystring();
-    cog_push_to(&cookie, cog_box_int(0));
-    cog_push_to(&cookie, ibuf);
-    cog_push_to(&cookie, COG_GLOBALS.modules);
-    cog_push_to(&cookie, stream);
-    cog_run_next(cog_make_identifier_c("[[Parser::NextItem]]"), NULL, cookie);
-}
+// Fibers take turns running in the one main loop, each with its own stack,
+// command queue and scopes. The running one gives way to the next ready one
+// when it yields, waits for another to finish, would block reading a stream,
+// or has run COG_FIBER_SLICE commands. The main fiber is whatever was running
+// before the first one got spawned; when it runs out of commands the main
+// loop returns, even if others are still ready.
 
-cog_object* fn_parser_handle_token() {
-    cog_object* cookie = cog_pop();
-    cog_object* stream = cookie->data;
-    cog_object* modlist = cookie->next->data;
-    cog_object* buffer = cookie->next->next->data;
-    cog_object* index = cookie->next->next->next;
-    cog_module* curr_mod;
-    cog_modfunc* curr_func;
-    cog_object* cookie2;
-    cog_object* res;
-    if (!modlist) goto error;
-    // handle what's in the buffer
-    curr_mod = (cog_module*)modlist->data->as_ptr;
-    if (!curr_mod->table) goto nextmod;
-    curr_func = curr_mod->table[index->as_int];
-    if (!curr_func) goto nextmod;
-    if (curr_func->when != COG_PARSE_TOKEN_HANDLER) goto nextfun;
-    if (curr_func->name && buffer->type == &cog_ot_string && cog_strcasecmp_c(buffer, curr_func->name))
-        goto nextfun;
-    if (curr_func->name && buffer->type != &cog_ot_string) goto nextfun;
+enum { FIBER_RUNNING, FIBER_WAITING, FIBER_DONE, FIBER_FAILED };
+enum { FIBER_GO_ON, FIBER_YIELD, FIBER_WAIT };
 
-    cookie2 = cog_make_obj(&cog_ot_list);
-    cookie2->data = buffer;
-    cookie2->next = stream;
-    cog_push(cookie2);
-    res = curr_func->fun();
-    if (cog_same_identifiers(res, cog_not_implemented())) {
-        cog_pop();
-        if (buffer->type == &cog_ot_string && cog_strlen(buffer) == 0) {
-            // clearing buffer == no token
-            // so try again
-            run_nextitem_next(stream, cog_emptystring());
-            return NULL;
-        }
-        goto nextfun;
+typedef struct {
+    cog_object* stack;
+    cog_object* command_queue;
+    cog_object* scopes;
+    cog_object* handlers;
+    cog_object* generator; // the generator it was running, if any
+    cog_object* result; // its stack when it finished, or its error
+    cog_object* waiters; // the fibers waiting for it to finish
+    cog_object* next_ready;
+    int state;
+    uint64_t id;
+} fiber;
+
+#define FIBER(obj) ((fiber*)(obj)->as_ptr)
+
+static cog_object* walk_fiber(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    fiber* fb = FIBER(obj);
+    cog_walk(fb->stack, f, arg);
+    cog_walk(fb->command_queue, f, arg);
+    cog_walk(fb->scopes, f, arg);
+    cog_walk(fb->handlers, f, arg);
+    cog_walk(fb->generator, f, arg);
+    cog_walk(fb->result, f, arg);
+    cog_walk(fb->waiters, f, arg);
+    return fb->next_ready;
+}
+
+static void free_fiber(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
+}
+
+cog_obj_type ot_fiber = {"Fiber", walk_fiber, free_fiber};
+
+static cog_object* fiber_new() {
+    fiber* fb = (fiber*)calloc(1, sizeof(fiber));
+    if (fb == NULL) {
+        perror(__func__);
+        abort();
     }
-    return res;
-
-    nextfun:
-    cookie->next->next->next = cog_box_int(index->as_int + 1);
-    goto retry;
-
-    nextmod:
-    cookie->next->next->next = cog_box_int(0);
-    cog_pop_from(&cookie->next->data);
-    goto retry;
+    fb->id = COG_GLOBALS.fibers_made++;
+    cog_object* obj = cog_make_obj(&ot_fiber);
+    obj->as_ptr = (void*)fb;
+    return obj;
+}
 
-    error:
-    cog_push(cog_box_bool(true));
-    cog_run_well_known_strict(buffer, "Show");
-    COG_RETURN_ERROR(cog_sprintf("PARSE ERROR: could not handle token %O", cog_pop()));
+// the running fiber, making the main one if there isn't one yet
+static cog_object* fiber_current() {
+    if (!COG_GLOBALS.fiber) COG_GLOBALS.fiber = COG_GLOBALS.main_fiber = fiber_new();
+    return COG_GLOBALS.fiber;
+}
 
-    retry:
-    cog_run_next(cog_make_identifier_c("[[Parser::HandleToken]]"), NULL, cookie);
-    return NULL;
+static void fiber_ready(cog_object* obj) {
+    FIBER(obj)->state = FIBER_RUNNING;
+    FIBER(obj)->next_ready = NULL;
+    if (COG_GLOBALS.ready_fibers) FIBER(COG_GLOBALS.ready_fibers_tail)->next_ready = obj;
+    else COG_GLOBALS.ready_fibers = obj;
+    COG_GLOBALS.ready_fibers_tail = obj;
 }
-cog_modfunc fne_parser_handle_token = {
-    "[[Parser::HandleToken]]",
-    COG_COOKIEFUNC,
-    fn_parser_handle_token,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_nextitem() {
-    cog_object* cookie = cog_pop();
-    cog_object* stream = cookie->data;
-    cog_object* modlist = cookie->next->data;
-    cog_object* buffer = cookie->next->next->data;
-    cog_object* index = cookie->next->next->next->data;
-    cog_object* curr_char = cookie->next->next->next->next;
-    cog_object* tail = buffer;
-    cog_module* curr_mod;
-    cog_modfunc* curr_func;
-    cog_object* cookie2;
-    cog_object* res;
-    cog_object* old_top;
-    int ch;
+static void fiber_load(cog_object* obj) {
+    fiber* fb = FIBER(obj);
+    COG_GLOBALS.stack = fb->stack;
+    COG_GLOBALS.command_queue = fb->command_queue;
+    COG_GLOBALS.scopes = fb->scopes;
+    COG_GLOBALS.handlers = fb->handlers;
+    COG_GLOBALS.generator = fb->generator;
+    fb->stack = fb->command_queue = fb->scopes = fb->handlers = fb->generator = NULL;
+    fb->state = FIBER_RUNNING;
+    COG_GLOBALS.fiber = obj;
+    COG_GLOBALS.fiber_stop = FIBER_GO_ON;
+}
 
-    if (curr_char->type != &ot_eof && cog_strlen(curr_char) != 1) goto firstchar;
-    ch = curr_char->type != &ot_eof ? cog_nthchar(curr_char, 0) : EOF;
+static cog_object* fiber_next_ready() {
+    cog_object* obj = COG_GLOBALS.ready_fibers;
+    COG_GLOBALS.ready_fibers = FIBER(obj)->next_ready;
+    FIBER(obj)->next_ready = NULL;
+    return obj;
+}
 
-    if (!modlist) goto nextchar;
-    // test current character
-    curr_mod = (cog_module*)modlist->data->as_ptr;
-    if (!curr_mod->table) goto nextmod;
-    curr_func = curr_mod->table[index->as_int];
-    if (!curr_func) goto nextmod;
-    if (curr_func->when != COG_PARSE_INDIV_CHAR && curr_func->when != COG_PARSE_END_CHAR) goto nextfun;
-    if (curr_func->when == COG_PARSE_END_CHAR && cog_strlen(buffer) == 0) goto nextfun;
-    if (curr_func->name != NULL && strchr(curr_func->name, ch) == NULL) goto nextfun;
+// What fibers wait on besides each other: file descriptors becoming ready,
+// which are watched with epoll (or poll() where there isn't one), and
+// timers. When no fiber is ready to run, the main loop sleeps until one of
+// those wakes a fiber up.
 
-    cookie2 = stream;
-    cog_push_to(&cookie2, curr_char);
-    cog_push_to(&cookie2, buffer);
-    old_top = COG_GLOBALS.stack->data;
-    cog_push(cookie2);
-    res = curr_func->fun();
-    if (cog_same_identifiers(res, cog_not_implemented())) {
-        cog_pop();
-        goto nextfun;
-    }
-    assert(COG_GLOBALS.stack->data == old_top);
-    goto end_of_token;
+static double monotonic_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    nextfun:
-    cookie->next->next->next->data = cog_box_int(index->as_int + 1);
-    goto loop;
+// whether any other fiber might run, so waiting on something is worth it
+static bool fiber_others_alive() {
+    // nothing else gets a turn until a cog_call returns
+    if (COG_GLOBALS.calls) return false;
+    return COG_GLOBALS.ready_fibers || COG_GLOBALS.io_waiting || COG_GLOBALS.timers_count;
+}
 
-    nextmod:
-    cookie->next->next->next->data = cog_box_int(0);
-    cog_pop_from(&cookie->next->data);
-    goto loop;
+static void fiber_wake(cog_object* obj) {
+    if (FIBER(obj)->state == FIBER_WAITING) fiber_ready(obj);
+}
 
-    nextchar:
-    if (curr_char->type == &ot_eof && cog_strlen(buffer) == 0) goto end_of_token;
-    if (ch != EOF) cog_string_append_byte(&tail, ch);
+static bool fd_ready(int fd, bool for_write) {
+    struct pollfd p = {fd, (short)(for_write ? POLLOUT : POLLIN), 0};
+    return poll(&p, 1, 0) != 0;
+}
 
-    firstchar:
-    COG_RUN_WKM_RETURN_IF_ERROR(stream, "Stream::GetChar");
-    cookie->next->next->next->next = cog_pop();
-    cookie->next->data = COG_GLOBALS.modules;
+#ifdef __linux__
+#define IO_IN EPOLLIN
+#define IO_OUT EPOLLOUT
+#define IO_DONE (EPOLLHUP | EPOLLERR)
+#else
+#define IO_IN POLLIN
+#define IO_OUT POLLOUT
+#define IO_DONE (POLLHUP | POLLERR | POLLNVAL)
+#endif
 
-    loop:
-    cog_run_next(cog_make_identifier_c("[[Parser::NextItem]]"), NULL, cookie);
-    return NULL;
+// changes what a file descriptor is watched for; false if it can't be, like
+// a regular file, which is always ready anyway
+static bool io_watch_set(int fd, uint32_t events) {
+    struct io_watch* w = &COG_GLOBALS.watches[fd];
+    if (events == w->events) return true;
+#ifdef __linux__
+    if (!COG_GLOBALS.epoll_fd) {
+        // stored one higher, so 0 means there isn't one yet
+        int ep = epoll_create1(EPOLL_CLOEXEC);
+        if (ep < 0) return false;
+        COG_GLOBALS.epoll_fd = ep + 1;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    int op = !events ? EPOLL_CTL_DEL : w->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(COG_GLOBALS.epoll_fd - 1, op, fd, &ev) != 0 && events) return false;
+#else
+    struct stat st;
+    if (events && (fstat(fd, &st) != 0 || S_ISREG(st.st_mode))) return false;
+#endif
+    w->events = events;
+    return true;
+}
 
-    end_of_token:
-    if (cog_strlen(buffer) == 0 && curr_char->type == &cog_ot_string) buffer = curr_char;
-    else if (ch != EOF) cog_ungetch(stream, ch);
-    // handle current token
-    if (cog_strlen(buffer) == 0) {
-        assert(curr_char->type == &ot_eof);
-        buffer = curr_char;
+// wakes the fibers waiting on a file descriptor that something happened to
+static void io_happened(int fd, uint32_t events) {
+    struct io_watch* w = &COG_GLOBALS.watches[fd];
+    cog_object** lists[2] = {&w->readers, &w->writers};
+    uint32_t wanted[2] = {IO_IN | IO_DONE, IO_OUT | IO_DONE};
+    for (int i = 0; i < 2; i++) {
+        if (!(events & wanted[i])) continue;
+        COG_ITER_LIST(*lists[i], waiter) {
+            fiber_wake(waiter);
+            COG_GLOBALS.io_waiting--;
+        }
+        *lists[i] = NULL;
     }
-    cookie = cog_box_int(0);
-    cog_push_to(&cookie, buffer);
-    cog_push_to(&cookie, COG_GLOBALS.modules);
-    cog_push_to(&cookie, stream);
-    cog_run_next(cog_make_identifier_c("[[Parser::HandleToken]]"), NULL, cookie);
-    return NULL;
+    io_watch_set(fd, (w->readers ? IO_IN : 0) | (w->writers ? IO_OUT : 0));
 }
-cog_modfunc fne_parser_nextitem = {
-    "[[Parser::NextItem]]",
-    COG_COOKIEFUNC,
-    fn_parser_nextitem,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_rule_special_chars() {
-    cog_object* cookie = cog_pop();
-    cog_object* ch = cookie->next->data;
-    if (ch->type == &cog_ot_string) {
-        char ch = cog_nthchar(cookie->next->data, 0);
-        if (isspace(ch)) return NULL;
-        if (strchr("([{\"~;", ch)) return NULL;
+bool cog_wait_for_fd(int fd, bool for_write, cog_object* retry, cog_object* cookie) {
+    if (fd < 0 || !fiber_others_alive()) return false;
+    if ((size_t)fd >= COG_GLOBALS.watches_cap) {
+        size_t cap = COG_GLOBALS.watches_cap ? COG_GLOBALS.watches_cap : 16;
+        while (cap <= (size_t)fd) cap *= 2;
+        struct io_watch* watches = (struct io_watch*)realloc(COG_GLOBALS.watches, cap * sizeof(struct io_watch));
+        if (watches == NULL) {
+            perror(__func__);
+            abort();
+        }
+        memset(watches + COG_GLOBALS.watches_cap, 0, (cap - COG_GLOBALS.watches_cap) * sizeof(struct io_watch));
+        COG_GLOBALS.watches = watches;
+        COG_GLOBALS.watches_cap = cap;
     }
-    if (ch->type == &ot_eof) return NULL;
-    cog_push(cookie);
-    return cog_not_implemented();
+    struct io_watch* w = &COG_GLOBALS.watches[fd];
+    if (!io_watch_set(fd, w->events | (for_write ? IO_OUT : IO_IN))) return false;
+    cog_push_to(for_write ? &w->writers : &w->readers, fiber_current());
+    COG_GLOBALS.io_waiting++;
+    cog_run_next(retry, NULL, cookie);
+    COG_GLOBALS.fiber_stop = FIBER_WAIT;
+    return true;
 }
-cog_modfunc fne_parser_rule_special_chars = {
-    NULL,
-    COG_PARSE_INDIV_CHAR,
-    fn_parser_rule_special_chars,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_rule_break_chars() {
-    cog_object* cookie = cog_pop();
-    cog_object* ch = cookie->next->data;
-    if (cookie->next->data->type == &cog_ot_string) {
-        char ch = cog_nthchar(cookie->next->data, 0);
-        if (strchr("\\)]}", ch)) return NULL;
+bool cog_wait_for_stream(cog_object* stream, bool for_write, cog_object* retry) {
+    if (!fiber_others_alive()) return false;
+    int fd = cog_stream_fd(stream);
+    if (for_write ? fd < 0 || fd_ready(fd, true) : cog_stream_ready(stream)) return false;
+    if (cog_wait_for_fd(fd, for_write, retry, NULL)) return true;
+    // it can't be watched, so look again after the others have had a turn
+    if (!COG_GLOBALS.ready_fibers) return false;
+    cog_run_next(retry, NULL, NULL);
+    COG_GLOBALS.fiber_stop = FIBER_YIELD;
+    return true;
+}
+
+static void timer_sift_down(size_t i) {
+    struct fiber_timer* t = COG_GLOBALS.timers;
+    size_t n = COG_GLOBALS.timers_count;
+    for (;;) {
+        size_t least = i;
+        if (2 * i + 1 < n && t[2 * i + 1].when < t[least].when) least = 2 * i + 1;
+        if (2 * i + 2 < n && t[2 * i + 2].when < t[least].when) least = 2 * i + 2;
+        if (least == i) return;
+        struct fiber_timer tmp = t[i];
+        t[i] = t[least];
+        t[least] = tmp;
+        i = least;
     }
-    cog_push(cookie);
-    return cog_not_implemented();
 }
-cog_modfunc fne_parser_rule_break_chars = {
-    NULL,
-    COG_PARSE_END_CHAR,
-    fn_parser_rule_break_chars,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_ignore_whitespace() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        size_t len = cog_strlen(s);
-        for (size_t i = 0; i < len; i++) {
-            if (!isspace(cog_nthchar(s, i))) {
-                cog_push(cookie);
-                return cog_not_implemented();
-            }
+// the running fiber sleeps until `when`
+static void fiber_sleep(double when) {
+    if (COG_GLOBALS.timers_count == COG_GLOBALS.timers_cap) {
+        size_t cap = COG_GLOBALS.timers_cap ? COG_GLOBALS.timers_cap * 2 : 16;
+        struct fiber_timer* timers = (struct fiber_timer*)realloc(COG_GLOBALS.timers, cap * sizeof(struct fiber_timer));
+        if (timers == NULL) {
+            perror(__func__);
+            abort();
         }
-        // clear the token to discard it
-        s->stored_chars = 0;
-        s->next = NULL;
+        COG_GLOBALS.timers = timers;
+        COG_GLOBALS.timers_cap = cap;
     }
-    cog_push(cookie);
-    return cog_not_implemented();
+    struct fiber_timer* t = COG_GLOBALS.timers;
+    size_t i = COG_GLOBALS.timers_count++;
+    t[i].when = when;
+    t[i].fiber = fiber_current();
+    while (i > 0 && t[(i - 1) / 2].when > t[i].when) {
+        struct fiber_timer tmp = t[i];
+        t[i] = t[(i - 1) / 2];
+        t[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+    COG_GLOBALS.fiber_stop = FIBER_WAIT;
 }
-cog_modfunc fne_parser_ignore_whitespace = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_ignore_whitespace,
-    doc_parser_internals
-};
 
-cog_object* fn_parser_handle_int() {
-    char buffer[32];
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        cog_string_to_cstring(s, buffer, sizeof(buffer));
-        int64_t i;
-        int len = 0;
-        int filled = sscanf(buffer, "%" SCNd64 "%n", &i, &len);
-        if (len == cog_strlen(s)) {
-            cog_push(cog_box_int(i));
-            return NULL;
+// Wakes up the fibers whose file descriptors are ready or whose timers are
+// up. If `block`, it waits until there is at least one.
+static void event_poll(bool block) {
+    int timeout = block ? -1 : 0;
+    if (block && COG_GLOBALS.timers_count) {
+        double left = COG_GLOBALS.timers[0].when - monotonic_now();
+        timeout = left <= 0 ? 0 : (int)(left * 1000) + 1;
+    }
+    if (!COG_GLOBALS.io_waiting) {
+        if (timeout > 0) poll(NULL, 0, timeout);
+    } else {
+#ifdef __linux__
+        struct epoll_event events[64];
+        int n = epoll_wait(COG_GLOBALS.epoll_fd - 1, events, 64, timeout);
+        for (int i = 0; i < n; i++) io_happened(events[i].data.fd, events[i].events);
+#else
+        struct pollfd* fds = (struct pollfd*)malloc(COG_GLOBALS.watches_cap * sizeof(struct pollfd));
+        if (fds == NULL) {
+            perror(__func__);
+            abort();
+        }
+        nfds_t n = 0;
+        for (size_t fd = 0; fd < COG_GLOBALS.watches_cap; fd++) {
+            if (!COG_GLOBALS.watches[fd].events) continue;
+            fds[n].fd = fd;
+            fds[n].events = COG_GLOBALS.watches[fd].events;
+            fds[n++].revents = 0;
         }
+        if (poll(fds, n, timeout) > 0) {
+            for (nfds_t i = 0; i < n; i++)
+                if (fds[i].revents) io_happened(fds[i].fd, fds[i].revents);
+        }
+        free(fds);
+#endif
+    }
+    double now = monotonic_now();
+    while (COG_GLOBALS.timers_count && COG_GLOBALS.timers[0].when <= now) {
+        fiber_wake(COG_GLOBALS.timers[0].fiber);
+        COG_GLOBALS.timers[0] = COG_GLOBALS.timers[--COG_GLOBALS.timers_count];
+        timer_sift_down(0);
     }
-    cog_push(cookie);
-    return cog_not_implemented();
 }
-cog_modfunc fne_parser_handle_int = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_int,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_handle_float() {
-    char buffer[32];
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        cog_string_to_cstring(s, buffer, sizeof(buffer));
-        double i;
-        int len = 0;
-        int filled = sscanf(buffer, "%lg%n", &i, &len);
-        if (len == cog_strlen(s)) {
-            cog_push(cog_box_float(i));
-            return NULL;
-        }
+static void event_loop_free() {
+    free(COG_GLOBALS.watches);
+    free(COG_GLOBALS.timers);
+    COG_GLOBALS.watches = NULL;
+    COG_GLOBALS.timers = NULL;
+    COG_GLOBALS.watches_cap = COG_GLOBALS.timers_cap = COG_GLOBALS.timers_count = COG_GLOBALS.io_waiting = 0;
+#ifdef __linux__
+    if (COG_GLOBALS.epoll_fd) close(COG_GLOBALS.epoll_fd - 1);
+    COG_GLOBALS.epoll_fd = 0;
+#endif
+}
+
+// Loads the next ready fiber, first waking up any that were waiting on I/O
+// or timers, and waiting for them if none are ready yet. If nothing can ever
+// be ready, the main fiber gets an error.
+static cog_object* fiber_run_next() {
+    while (COG_GLOBALS.io_waiting || COG_GLOBALS.timers_count) {
+        event_poll(!COG_GLOBALS.ready_fibers);
+        if (COG_GLOBALS.ready_fibers) break;
     }
-    cog_push(cookie);
-    return cog_not_implemented();
+    if (COG_GLOBALS.ready_fibers) {
+        fiber_load(fiber_next_ready());
+        return NULL;
+    }
+    // the rest are all waiting on each other, so the main one gets the blame
+    fiber_load(COG_GLOBALS.main_fiber);
+    cog_push(cog_string("All the fibers are waiting for each other"));
+    return cog_error();
 }
-cog_modfunc fne_parser_handle_float = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_float,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_handle_bool() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    cog_push(cog_box_bool(cog_strcasecmp_c(s, "true") == 0));
+static cog_object* fiber_switch() {
+    cog_object* self = fiber_current();
+    fiber* fb = FIBER(self);
+    fb->stack = COG_GLOBALS.stack;
+    fb->command_queue = COG_GLOBALS.command_queue;
+    fb->scopes = COG_GLOBALS.scopes;
+    fb->handlers = COG_GLOBALS.handlers;
+    fb->generator = COG_GLOBALS.generator;
+    if (COG_GLOBALS.fiber_stop == FIBER_WAIT) fb->state = FIBER_WAITING;
+    else fiber_ready(self);
+    return fiber_run_next();
+}
+
+// Called when the main loop runs out of commands. If a spawned fiber was
+// running, this finishes it and switches to the next one, and returns true.
+static bool fiber_finished(cog_object** status) {
+    cog_object* self = COG_GLOBALS.fiber;
+    if (!self || self == COG_GLOBALS.main_fiber) return false;
+    fiber* fb = FIBER(self);
+    if (*status == NULL) {
+        fb->state = FIBER_DONE;
+        fb->result = COG_GLOBALS.stack;
+    } else {
+        fb->state = FIBER_FAILED;
+        fb->result = cog_is_stack_empty() ? cog_string("the fiber failed") : cog_pop();
+    }
+    COG_ITER_LIST(fb->waiters, waiter) fiber_wake(waiter);
+    fb->waiters = NULL;
+    *status = fiber_run_next();
+    return true;
+}
+
+cog_object* m_fiber_show() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore readably
+    static const char* states[] = {"running", "waiting", "done", "failed"};
+    cog_push(cog_sprintf("<Fiber %i %s>", (int)FIBER(self)->id, states[FIBER(self)->state]));
+    return NULL;
+}
+cog_object_method ome_fiber_show = {&ot_fiber, "Show", m_fiber_show};
+
+// MARK: CHANNELS
+
+// A channel starts out belonging to the interpreter that made it, and just
+// passes objects along, with fibers waiting on it in lists. Once a handle
+// to it gets copied into another interpreter (by Parallel-Map, say) it is
+// shared for good: items get copied into a heap of the channel's own as they
+// are sent and out again as they are received, and an interpreter that has
+// nothing else to run while it waits parks its thread on `changed`.
+
+typedef struct {
+    pthread_mutex_t lock; // for everything but the handle counts
+    pthread_cond_t changed;
+    size_t parked; // threads waiting on `changed`, and not counted in par_busy
+    uint64_t changes; // how many times it has changed, so a parked thread can tell
+    size_t refs; // handles to it in every interpreter
+    size_t capacity; // 0 if it has no limit
+    size_t count;
+    bool closed;
+    bool shared;
+    cog_object* items; // oldest first, in the home heap, or in `heap` once shared
+    cog_object* items_tail;
+    cog_state* heap;
+    size_t heap_gc_at;
+    // only ever touched by the home interpreter
+    cog_state* home; // NULL once it has no handles left
+    size_t home_handles;
+    cog_object* senders; // fibers waiting for room
+    cog_object* receivers; // fibers waiting for an item
+} channel;
+
+#define CHANNEL(obj) ((channel*)(obj)->as_ptr)
+
+static bool channel_at_home(channel* c) {
+    return __atomic_load_n(&c->home, __ATOMIC_ACQUIRE) == cog_get_state();
+}
+
+static cog_object* walk_channel(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    channel* c = CHANNEL(obj);
+    if (!channel_at_home(c)) return NULL;
+    if (!__atomic_load_n(&c->shared, __ATOMIC_ACQUIRE)) cog_walk(c->items, f, arg);
+    cog_walk(c->senders, f, arg);
+    cog_walk(c->receivers, f, arg);
     return NULL;
 }
-cog_modfunc fne_parser_handle_bool_true = {
-    "true",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_bool,
-    doc_parser_internals,
-};
-cog_modfunc fne_parser_handle_bool_false = {
-    "false",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_bool,
-    doc_parser_internals,
-};
 
-bool all_valid_for_ident(cog_object* string) {
-    size_t len = cog_strlen(string);
-    for (size_t i = 0; i < len; i++) {
-        char ch = cog_nthchar(string, i);
-        if (!(isalpha(ch) || isdigit(ch) || strchr("-?!'+/*>=<^.", ch))) return false;
+static void free_channel(cog_object* obj) {
+    channel* c = CHANNEL(obj);
+    if (!c) return;
+    obj->as_ptr = NULL;
+    if (channel_at_home(c) && --c->home_handles == 0) {
+        c->senders = c->receivers = NULL;
+        __atomic_store_n(&c->home, NULL, __ATOMIC_RELEASE);
     }
-    return true;
+    if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    if (c->heap) {
+        cog_state* mine = cog_set_state(c->heap);
+        cog_quit();
+        cog_set_state(mine);
+    }
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->changed);
+    free(c);
 }
 
-cog_object* fn_parser_handle_symbols() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        char first = cog_nthchar(s, 0);
-        if (first == '\\') {
-            cog_string_delete_char(&s, 0);
-            if (!all_valid_for_ident(s)) {
-                cog_string_prepend_byte(&s, '\\');
-            } else {
-                cog_push(cog_sym(cog_make_identifier(s)));
-                return NULL;
-            }
-        }
+cog_obj_type ot_channel = {"Channel", walk_channel, free_channel};
+
+static cog_object* channel_new(size_t capacity) {
+    channel* c = (channel*)calloc(1, sizeof(channel));
+    if (c == NULL) {
+        perror(__func__);
+        abort();
     }
-    // defer to next stuff
-    cog_push(cookie);
-    return cog_not_implemented();
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->changed, NULL);
+    c->refs = 1;
+    c->capacity = capacity;
+    c->home = cog_get_state();
+    c->home_handles = 1;
+    cog_object* obj = cog_make_obj(&ot_channel);
+    obj->as_ptr = (void*)c;
+    return obj;
 }
-cog_modfunc fne_parser_handle_symbols = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_symbols,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_discard_informal_syntax() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        char first = cog_nthchar(s, 0);
-        if (tolower(first) == first && isalpha(first)) {
-            // clear string to signal there is no token here
-            s->stored_chars = 0;
-            s->next = NULL;
+// puts an item on the end, made in whichever heap is current
+static void channel_append(channel* c, cog_object* item) {
+    cog_object* cell = cog_make_obj(&cog_ot_list);
+    cell->data = item;
+    if (c->items) c->items_tail->next = cell;
+    else c->items = cell;
+    c->items_tail = cell;
+    c->count++;
+}
+
+static cog_object* channel_take(channel* c) {
+    cog_object* item = c->items->data;
+    c->items = c->items->next;
+    if (!c->items) c->items_tail = NULL;
+    c->count--;
+    return item;
+}
+
+static void add_modules_oldest_first(cog_object* modules) {
+    if (!modules) return;
+    add_modules_oldest_first(modules->next);
+    cog_module* mod = (cog_module*)modules->data->as_ptr;
+    if (!has_module(mod)) cog_add_module(mod);
+}
+
+// Called by marshal to copy a handle into another interpreter. The first
+// time, this moves the items into the channel's own heap; the home
+// interpreter isn't running then, as it is the one being copied from or to.
+static cog_object* channel_share(cog_object* obj) {
+    channel* c = CHANNEL(obj);
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_ACQ_REL);
+    cog_object* copy = cog_make_obj(&ot_channel);
+    copy->as_ptr = (void*)c;
+    if (channel_at_home(c)) c->home_handles++;
+    if (__atomic_load_n(&c->shared, __ATOMIC_ACQUIRE)) return copy;
+    pthread_mutex_lock(&c->lock);
+    if (!c->shared) {
+        cog_object* modules = COG_GLOBALS.modules;
+        cog_state* mine = cog_set_state(NULL);
+        cog_init();
+        c->heap = cog_get_state();
+        add_modules_oldest_first(modules);
+        cog_object* items = c->items;
+        c->items = c->items_tail = NULL;
+        c->count = 0;
+        marshal_memo m = {0};
+        COG_ITER_LIST(items, item) channel_append(c, marshal(item, &m));
+        marshal_memo_free(&m);
+        c->heap_gc_at = COG_GLOBALS.alloc_chunks * 2;
+        cog_set_state(mine);
+        __atomic_store_n(&c->shared, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return copy;
+}
+
+// lets the waiting fibers (if they're this interpreter's) and threads look again
+static void channel_changed(channel* c, cog_object** waiters) {
+    c->changes++;
+    if (c->parked) {
+        // they're busy from now, so none of them can be taken for stuck
+        // before they get the lock back
+        __atomic_add_fetch(&par_busy, c->parked, __ATOMIC_ACQ_REL);
+        c->parked = 0;
+        pthread_cond_broadcast(&c->changed);
+    }
+    if (!channel_at_home(c)) return;
+    COG_ITER_LIST(*waiters, waiter) {
+        if (FIBER(waiter)->state == FIBER_WAITING) fiber_ready(waiter);
+    }
+    *waiters = NULL;
+}
+
+// Waits, with the lock held, until the channel might have changed, then has
+// `retry` go again, so the caller puts its arguments back if this succeeds.
+static cog_object* channel_wait(channel* c, cog_object** waiters, cog_modfunc* retry) {
+    if (!c->shared) {
+        if (!fiber_others_alive())
+            COG_RETURN_ERROR(cog_string("Waiting on the channel would never end, as nothing else can run"));
+        cog_push_to(waiters, fiber_current());
+        COG_GLOBALS.fiber_stop = FIBER_WAIT;
+    } else if (COG_GLOBALS.ready_fibers && fiber_others_alive()) {
+        COG_GLOBALS.fiber_stop = FIBER_YIELD;
+    } else {
+        // nothing else here can run, so park until another thread changes
+        // the channel, unless all of them are stuck too
+        uint64_t seen = c->changes;
+        bool stuck = __atomic_sub_fetch(&par_busy, 1, __ATOMIC_ACQ_REL) == 0;
+        if (!stuck) c->parked++;
+        while (!stuck && c->changes == seen) {
+            // the thread that gets stuck last doesn't wake anything, so look now and then
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 20000000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&c->changed, &c->lock, &until);
+            if (c->changes == seen && __atomic_load_n(&par_busy, __ATOMIC_ACQUIRE) == 0) {
+                c->parked--;
+                stuck = true;
+            }
+        }
+        if (stuck) {
+            __atomic_add_fetch(&par_busy, 1, __ATOMIC_ACQ_REL);
+            COG_RETURN_ERROR(cog_string("Waiting on the channel would never end, as nothing else can run"));
         }
     }
-    // defer to next stuff
-    cog_push(cookie);
-    return cog_not_implemented();
+    cog_run_next(cog_make_bfunction(retry), NULL, NULL);
+    return NULL;
 }
-cog_modfunc fne_parser_discard_informal_syntax = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_discard_informal_syntax,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_handle_identifiers() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        char first = cog_nthchar(s, 0);
-        if (!isalpha(first) || (toupper(first) == first && all_valid_for_ident(s))) {
-            // defined identifier
-            cog_push(cog_make_identifier(s));
-            return NULL;
-        }
+// the heap only gets garbage collected here, as it never runs anything
+static void channel_heap_gc(channel* c) {
+    cog_state* mine = cog_set_state(c->heap);
+    if (COG_GLOBALS.alloc_chunks > c->heap_gc_at) {
+        COG_GLOBALS.stack = c->items;
+        gc();
+        COG_GLOBALS.stack = NULL;
+        c->heap_gc_at = COG_GLOBALS.alloc_chunks * 2;
     }
-    // defer to next stuff
-    cog_push(cookie);
-    return cog_not_implemented();
+    cog_set_state(mine);
 }
-cog_modfunc fne_parser_handle_identifiers = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_identifiers,
-    doc_parser_internals,
-};
 
-cog_object* fn_parser_handle_open_paren() {
-    cog_object* cookie = cog_pop();
-    cog_object* stream = cookie->next;
-    cog_push(NULL); // the current block
-    cog_push(NULL); // the current statement
-    cog_object* cookie2 = stream;
-    cog_push_to(&cookie2, cog_make_character(')'));
-    cog_run_next(cog_make_identifier_c("[[Parser::ParseBlockLoop]]"), NULL, cookie2);
-    run_nextitem_next(stream, cog_emptystring());
+cog_object* m_channel_show() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore readably
+    channel* c = CHANNEL(self);
+    pthread_mutex_lock(&c->lock);
+    size_t count = c->count;
+    bool closed = c->closed;
+    pthread_mutex_unlock(&c->lock);
+    cog_push(cog_sprintf("<Channel of %zu items%s>", count, closed ? ", closed" : ""));
     return NULL;
 }
-cog_modfunc fne_parser_handle_open_paren = {
-    "(",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_open_paren,
-    doc_parser_internals
-};
-
-cog_obj_type ot_parser_sentinel = {"[[Parser::Object::Sentinel]]", cog_walk_only_next, NULL};
+cog_object_method ome_channel_show = {&ot_channel, "Show", m_channel_show};
 
-cog_object* make_sentinel(cog_object* ch) {
-    cog_object* x = cog_make_obj(&ot_parser_sentinel);
-    x->next = ch;
-    return x;
+cog_object* m_channel_close() {
+    cog_object* self = cog_pop();
+    channel* c = CHANNEL(self);
+    pthread_mutex_lock(&c->lock);
+    bool was_closed = c->closed;
+    c->closed = true;
+    channel_changed(c, &c->senders);
+    channel_changed(c, &c->receivers);
+    pthread_mutex_unlock(&c->lock);
+    if (was_closed) COG_RETURN_ERROR(cog_string("Channel is already closed"));
+    return NULL;
 }
+cog_object_method ome_channel_close = {&ot_channel, "Close", m_channel_close};
 
-cog_object* fn_parser_handle_close_paren_or_eof() {
-    cog_object* cookie = cog_pop();
-    cog_object* closer = cookie->data;
-    if (closer->type == &ot_eof) goto yes;
-    if (cog_strlen(closer) == 1 && strchr(")]}\xff", cog_nthchar(closer, 0))) goto yes;
-    cog_push(cookie);
-    return cog_not_implemented();
+// MARK: BUILTIN FUNCTIONS
 
-    yes:
-    cog_push(make_sentinel(closer));
+cog_object* fn_empty() {
+    cog_push(NULL);
     return NULL;
 }
-cog_modfunc fne_parser_handle_close_paren_or_eof = {
-    NULL,
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_close_paren_or_eof,
-    doc_parser_internals
+cog_modfunc fne_empty = {
+    "Empty",
+    COG_FUNC,
+    fn_empty,
+    "Return an empty list."
 };
 
-cog_object* fn_parser_handle_string() {
-    cog_object* cookie = cog_pop();
-    cog_object* stream = cookie->next;
-    cog_object* buffer = cog_emptystring();
-    cog_object* tail = buffer;
-    char ch;
-    for (;;) {
-        ch = cog_getch(stream);
-        if (ch == '"') break;
-        if (ch == EOF || ch == '\n') goto unterminated;
-        if (ch == '\\') {
-            ch = cog_getch(stream);
-            if (ch == EOF) goto unterminated;
-            if (ch == 'x') {
-                // \x escapes are not in cognac but github copilot
-                // gave this to me for free and it works so why not
-                char hex[3];
-                hex[0] = cog_getch(stream);
-                hex[1] = cog_getch(stream);
-                hex[2] = 0;
-                if (hex[0] == EOF || hex[1] == EOF) goto unterminated;
-                if (!isxdigit(hex[0]) || !isxdigit(hex[1])) goto badescape;
-                ch = strtol(hex, NULL, 16);
-            } else {
-                char ch2 = cog_unescape_char(ch);
-                if (ch2 == ch) {
-                    cog_string_append_byte(&tail, '\\');
-                } else {
-                    ch = ch2;
-                }
-            }
-        }
-        cog_string_append_byte(&tail, ch);
-    }
-    cog_push(buffer);
+#define _NUMBERBODY(op, either_float_type, both_ints_type, both_ints_cast) \
+    COG_ENSURE_N_ITEMS(2); \
+    cog_object* a = cog_pop(); \
+    cog_object* b = cog_pop(); \
+    if (IS_NUMARRAY(a) || IS_NUMARRAY(b)) return cog_numarray_arith(#op, b, a); \
+    if (a && b) { \
+        if (a->type == &cog_ot_int && b->type == &cog_ot_int) { \
+            cog_push(cog_box_##both_ints_type((both_ints_cast b->as_int) op (both_ints_cast a->as_int))); \
+        } else { \
+            double a_val, b_val; \
+            COG_GET_NUMBER(a, a_val); \
+            COG_GET_NUMBER(b, b_val); \
+            cog_push(cog_box_##either_float_type(b_val op a_val)); \
+        } \
+        return NULL; \
+    } \
+    cog_push(cog_sprintf("Can't apply operator %s to %s and %s", #op, \
+        GET_TYPENAME_STRING(a), GET_TYPENAME_STRING(b))); \
+    return cog_error();
+
+cog_object* fn_plus() { _NUMBERBODY(+, float, int, ) }
+cog_object* fn_minus() { _NUMBERBODY(-, float, int, ) }
+cog_object* fn_times() { _NUMBERBODY(*, float, int, ) }
+cog_object* fn_divide() { _NUMBERBODY(/, float, float, (double)) }
+cog_object* fn_less() { _NUMBERBODY(<, bool, bool, ) }
+cog_object* fn_greater() { _NUMBERBODY(>, bool, bool, ) }
+cog_object* fn_lesseq() { _NUMBERBODY(<=, bool, bool, ) }
+cog_object* fn_greatereq() { _NUMBERBODY(>=, bool, bool, ) } // cSpell: ignore greatereq
+cog_object* fn_pow() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* a = cog_pop();
+    cog_object* b = cog_pop();
+    double a_val, b_val;
+    COG_GET_NUMBER(a, a_val);
+    COG_GET_NUMBER(b, b_val);
+    cog_push(cog_box_float(pow(b_val, a_val)));
     return NULL;
+}
 
-    unterminated:
-    cog_push(cog_string("unterminated string"));
-    return cog_error();
+cog_modfunc fne_plus = {"+", COG_FUNC, fn_plus, "Add two numbers, or numeric arrays item by item."};
+cog_modfunc fne_minus = {"-", COG_FUNC, fn_minus, "Subtract two numbers, or numeric arrays item by item."};
+cog_modfunc fne_times = {"*", COG_FUNC, fn_times, "Multiply two numbers, or numeric arrays item by item."};
+cog_modfunc fne_divide = {"/", COG_FUNC, fn_divide, "Divide two numbers, or numeric arrays item by item."};
+cog_modfunc fne_less = {"<", COG_FUNC, fn_less, "Check if a is less than b. On numeric arrays, gives an array of 1s and 0s."};
+cog_modfunc fne_greater = {">", COG_FUNC, fn_greater, "Check if a is greater than b. On numeric arrays, gives an array of 1s and 0s."};
+cog_modfunc fne_lesseq = {"<=", COG_FUNC, fn_lesseq, "Check if a is less than or equal to b. On numeric arrays, gives an array of 1s and 0s."};
+cog_modfunc fne_greatereq = {">=", COG_FUNC, fn_greatereq, "Check if a is greater than or equal to b. On numeric arrays, gives an array of 1s and 0s."};
+cog_modfunc fne_pow = {"^", COG_FUNC, fn_pow, "Get the power of a to b."};
 
-    badescape:
-    cog_push(cog_string("bad hex escape sequence in string"));
-    return cog_error();
+bool cog_equal(cog_object* a, cog_object* b) {
+    if (a == b) return true;
+    // an empty range is the empty list
+    if (!a && b->type == &ot_lazy_range) return lazy_range_length(b) == 0;
+    if (!b && a->type == &ot_lazy_range) return lazy_range_length(a) == 0;
+    if (!a || !b) return false;
+    if (a->type != b->type) {
+        cog_push(b);
+        if (cog_same_identifiers(cog_run_well_known(a, "Equal_OtherType"), cog_not_implemented())) {
+            cog_pop();
+            cog_push(a);
+            if (cog_same_identifiers(cog_run_well_known(b, "Equal_OtherType"), cog_not_implemented())) {
+                cog_pop();
+                return false;
+            } else return cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+        } else return cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    }
+    // there's only one canonical copy of each value, and for these types
+    // (unlike lists and floats) being the same value is being equal
+    if (a->canonical && b->canonical && (a->type == &cog_ot_int || a->type == &cog_ot_bool || a->type == &cog_ot_string || a->type == &cog_ot_symbol))
+        return false;
+    // both hashes are known already, so different ones settle it for free
+    if (a->hashed && b->hashed && hash_memo_get(a) != hash_memo_get(b)) return false;
+    cog_push(b);
+    if (!cog_same_identifiers(cog_run_well_known(a, "Equal"), cog_not_implemented()))
+        return cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+    cog_pop();
+    // no structural comparison, so the best that can be done is the hash
+    int64_t ha, hb;
+    return cog_hash_value(a, &ha) && cog_hash_value(b, &hb) && ha == hb;
 }
-cog_modfunc fne_parser_handle_string = {
-    "\"",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_string,
-    doc_parser_internals
-};
 
-cog_object* fn_parser_handle_comments() {
-    cog_object* cookie = cog_pop();
-    cog_object* buffer = cookie->data;
-    // there is no token here
-    buffer->stored_chars = 0;
-    buffer->next = NULL;
-    cog_object* stream = cookie->next;
-    bool isline = false;
-    char ch = cog_getch(stream);
-    if (ch == EOF) goto unterminated;
-    if (ch == '~') isline =  true;
-    for (;;) {
-        ch = cog_getch(stream);
-        if (!isline && ch == EOF) goto unterminated;
-        if (!isline && ch == '~') break;
-        if (isline && ch == '\n') break;
-    }
-    cog_push(cookie);
-    return cog_not_implemented();
+cog_object* fn_eq() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* a = cog_pop();
+    cog_object* b = cog_pop();
+    cog_push(cog_box_bool(cog_equal(a, b)));
+    return NULL;
+}
+cog_modfunc fne_eq = {"==", COG_FUNC, fn_eq, "Check if two objects are equal."};
 
-    unterminated:
-    cog_push(cog_string("unterminated block comment"));
-    return cog_error();
+cog_object* fn_canonicalize() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_push(cog_canonicalize(cog_pop()));
+    return NULL;
 }
-cog_modfunc fne_parser_handle_comments = {
-    "~",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_comments,
-    doc_parser_internals
-};
+cog_modfunc fne_canonicalize = {"Canonicalize", COG_FUNC, fn_canonicalize, "Return the shared copy of an immutable value (a number, Boolean, string, symbol, or list of these), so that equal values only take up memory once and compare quickly."};
 
-cog_object* fn_parser_handle_def_and_let() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    bool is_def = !cog_strcasecmp_c(s, "def");
-    cog_run_next(cog_make_identifier_c("[[Parser::TransformDefOrLet]]"), NULL, cog_box_bool(is_def));
-    run_nextitem_next(cookie->next, cog_emptystring());
+cog_object* fn_if() {
+    COG_ENSURE_N_ITEMS(3);
+    cog_object* cond = cog_pop();
+    cog_object* iftrue = cog_pop();
+    cog_object* iffalse = cog_pop();
+    COG_ENSURE_TYPE(cond, &cog_ot_bool);
+    cog_push(cond->as_int ? iftrue : iffalse);
     return NULL;
 }
-cog_modfunc fne_parser_handle_def = {
-    "def",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_def_and_let,
-    doc_parser_internals
-};
-cog_modfunc fne_parser_handle_let = {
-    "let",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_def_and_let,
-    doc_parser_internals
-};
+cog_modfunc fne_if = {"If", COG_FUNC, fn_if, "If cond is true, return iftrue, else return iffalse."};
 
-cog_obj_type ot_def_or_let_special = {"[[Parser::Special::DefOrLet]]", cog_walk_only_next, NULL};
-cog_obj_type ot_var = {"Var", cog_walk_only_next, NULL};
+cog_object* fn_print() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* obj = cog_pop();
+    cog_printf(obj && obj->type == &cog_ot_string ? "%#O\n" : "%O\n", obj);
+    return NULL;
+}
+cog_modfunc fne_print = {"Print", COG_FUNC, fn_print, "Print an object to stdout, with a newline."};
 
-cog_object* make_def_or_let_special_obj(cog_object* what, bool is_def) {
-    cog_object* obj = cog_make_obj(&ot_def_or_let_special);
-    obj->as_int = is_def;
-    obj->next = what;
-    return obj;
+cog_object* fn_put() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* obj = cog_pop();
+    cog_printf(obj && obj->type == &cog_ot_string ? "%#O" : "%O", obj);
+    return NULL;
 }
+cog_modfunc fne_put = {"Put", COG_FUNC, fn_put, "Print an object to stdout, without a newline."};
 
-cog_object* cog_make_var(cog_object* what) {
-    cog_object* obj = cog_make_obj(&ot_var);
-    obj->next = what;
-    return obj;
+extern cog_modfunc fne_write;
+
+cog_object* fn_write() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* stream = cog_pop();
+    cog_object* obj = cog_pop();
+    if (!stream) COG_RETURN_ERROR(cog_string("Can't write to an empty List"));
+    if (cog_wait_for_stream(stream, true, cog_make_bfunction(&fne_write))) {
+        cog_push(obj);
+        cog_push(stream);
+        return NULL;
+    }
+    if (!obj || obj->type != &cog_ot_string) obj = cog_sprintf("%#O", obj);
+    cog_push(obj);
+    cog_object* res = cog_run_well_known(stream, "Stream::PutString");
+    if (cog_same_identifiers(res, cog_not_implemented())) {
+        cog_pop();
+        COG_RETURN_ERROR(cog_sprintf("expected IO object, got %s", GET_TYPENAME_STRING(stream)));
+    }
+    return res;
 }
+cog_modfunc fne_write = {"Write", COG_FUNC, fn_write, "Write a string (or any other object, like Put) to a stream."};
 
-cog_object* m_def_or_let_exec() {
-    cog_object* self = cog_pop();
-    cog_pop(); // ignore cookie
-    bool is_def = self->as_int;
-    cog_object* symbol = self->next;
+cog_object* fn_flush() {
     COG_ENSURE_N_ITEMS(1);
-    cog_object* value = cog_pop();
-    cog_defun(symbol, is_def ? value : cog_make_var(value));
+    cog_object* stream = cog_pop();
+    if (!stream) COG_RETURN_ERROR(cog_string("Can't flush an empty List"));
+    return cog_flush(stream);
+}
+cog_modfunc fne_flush = {"Flush", COG_FUNC, fn_flush, "Write out any output that a stream is holding in its buffer."};
+
+extern cog_modfunc fne_read_bytes;
+extern cog_modfunc fne_read_line;
+
+cog_object* fn_read_bytes() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* n = cog_pop();
+    cog_object* stream = cog_pop();
+    double count;
+    COG_GET_NUMBER(n, count);
+    if (count < 0 || count != (size_t)count) COG_RETURN_ERROR(cog_sprintf("can't read %O bytes", n));
+    if (!stream) COG_RETURN_ERROR(cog_string("Can't read from an empty List"));
+    if (cog_wait_for_stream(stream, false, cog_make_bfunction(&fne_read_bytes))) {
+        cog_push(stream);
+        cog_push(n);
+        return NULL;
+    }
+    cog_object* res = cog_read(stream, count);
+    if (res) return res;
+    cog_object* got = cog_pop();
+    cog_push(got && got->type == &ot_eof ? cog_emptystring() : got);
     return NULL;
 }
-cog_object_method ome_def_or_let_exec = {&ot_def_or_let_special, "Exec", m_def_or_let_exec};
+cog_modfunc fne_read_bytes = {"Read-Bytes", COG_FUNC, fn_read_bytes, "Read up to N bytes from a stream. Returns an empty string at the end of the stream."};
 
-cog_object* m_def_or_let_show() {
-    cog_object* self = cog_pop();
-    cog_pop(); // ignore readably
-    bool is_def = self->as_int;
-    cog_object* symbol = self->next;
-    cog_push(cog_sprintf("<%s %O>", is_def ? "Def" : "Let", symbol));
+cog_object* fn_read_line() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* stream = cog_pop();
+    if (!stream) COG_RETURN_ERROR(cog_string("Can't read from an empty List"));
+    if (cog_wait_for_stream(stream, false, cog_make_bfunction(&fne_read_line))) {
+        cog_push(stream);
+        return NULL;
+    }
+    cog_object* res = cog_readline(stream);
+    if (res) return res;
+    cog_object* got = cog_pop();
+    cog_push(got && got->type == &ot_eof ? cog_emptystring() : got);
     return NULL;
 }
-cog_object_method ome_def_or_let_show = {&ot_def_or_let_special, "Show", m_def_or_let_show};
+cog_modfunc fne_read_line = {"Read-Line", COG_FUNC, fn_read_line, "Read a line of text from a stream, until and including the next newline (ASCII 0x0A) character. Returns an empty string at the end of the stream."};
 
-cog_object* m_var_run_self() {
-    cog_object* self = cog_pop();
-    cog_pop(); // ignore cookie
-    cog_push(self->next);
+cog_object* fn_lines() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* stream = cog_pop();
+    if (!stream) COG_RETURN_ERROR(cog_string("Can't read from an empty List"));
+    cog_push(cog_lines(stream));
     return NULL;
 }
-cog_object_method ome_var_exec = {&ot_var, "Exec", m_var_run_self};
+cog_modfunc fne_lines = {"Lines", COG_FUNC, fn_lines, "Return a lazy list of the lines of a stream (without their newlines), which are only read as they are needed."};
 
-cog_object* fn_parser_transform_def_or_let() {
-    cog_object* cookie = cog_pop();
-    bool is_def = cookie->as_int;
-    cog_object* what = cog_pop();
-    if (!what || what->type != &cog_ot_identifier) goto error;
-    cog_push(make_def_or_let_special_obj(what, is_def));
+cog_object* fn_for_each() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* list = cog_pop();
+    cog_object* block = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    if (list && (list->type == &ot_seq || list->type == &ot_generator)) {
+        seq_start(list, block);
+        return NULL;
+    }
+    if (list && list->type == &cog_ot_vector) list = vector_seq(list, 0);
+    if (!COG_IS_LAZY_LIST(list)) COG_ENSURE_LIST(list);
+    cog_object* cookie = cog_make_obj(&cog_ot_list);
+    cookie->data = block;
+    cookie->next = list;
+    cog_run_next(cog_make_identifier_c("[[For-Each::Next]]"), NULL, cookie);
     return NULL;
+}
+cog_modfunc fne_for_each = {"For-Each", COG_FUNC, fn_for_each, "Run a block on each item of a list, vector, Seq or generator, one at a time. Lazy lists (like Lines and Entries) are only read as far as they are needed."};
 
-    error:
-    cog_push(cog_sprintf("expected identifier after %s not %O", is_def ? "Def" : "Let", what));
-    return cog_error();
+cog_object* fn_for_each_next() {
+    cog_object* cookie = cog_pop();
+    cog_object* block = cookie->data;
+    cog_object* list = cookie->next;
+    COG_FORCE_LAZY(list);
+    COG_ENSURE_LIST(list);
+    if (!list) return NULL;
+    // only the part of the list that's left is held on to
+    cog_object* cookie2 = cog_make_obj(&cog_ot_list);
+    cookie2->data = block;
+    cookie2->next = list->next;
+    cog_run_next(cog_make_identifier_c("[[For-Each::Next]]"), NULL, cookie2);
+    cog_run_next(block, NULL, NULL);
+    cog_push(list->data);
+    return NULL;
 }
-cog_modfunc fne_parser_transform_def_or_let = {
-    "[[Parser::TransformDefOrLet]]",
-    COG_COOKIEFUNC,
-    fn_parser_transform_def_or_let,
-    doc_parser_internals
-};
+cog_modfunc fne_for_each_next = {"[[For-Each::Next]]", COG_COOKIEFUNC, fn_for_each_next, NULL};
 
-void handle_end_of_statement() {
-    cog_object* statement = cog_pop();
-    cog_object* block_contents = cog_pop();
-    cog_list_splice(&block_contents, statement);
-    cog_push(block_contents);
-    cog_push(NULL); // next statement list
+cog_object* fn_lazy_range() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* start = cog_pop();
+    cog_object* end = cog_pop();
+    double start_val, end_val;
+    COG_GET_NUMBER(start, start_val);
+    COG_GET_NUMBER(end, end_val);
+    if (end_val < start_val) COG_RETURN_ERROR(cog_sprintf("Invalid range %O...%O", start, end));
+    cog_push(lazy_range(start, end));
+    return NULL;
 }
+cog_modfunc fne_lazy_range = {"Lazy-Range", COG_FUNC, fn_lazy_range, "Like Range, but return a lazy list that makes each number as it is needed."};
 
-void handle_end_of_block() {
-    handle_end_of_statement();
-    cog_pop(); // throw out empty new statement;
-    cog_object* commands = cog_pop();
-    cog_push(cog_make_block(commands));
+#define _LAZY_STAGE_BODY(kind) \
+    COG_ENSURE_N_ITEMS(2); \
+    cog_object* arg = cog_pop(); \
+    cog_object* list = cog_pop(); \
+    if (kind == SEQ_TAKE) { \
+        COG_ENSURE_TYPE(arg, &cog_ot_int); \
+        if (arg->as_int < 0) COG_RETURN_ERROR(cog_sprintf("Can't take %O items", arg)); \
+    } else COG_ENSURE_TYPE(arg, &ot_closure); \
+    if (!list || (list->type != &ot_seq && list->type != &ot_generator && list->type != &cog_ot_vector && !COG_IS_LAZY_LIST(list))) COG_ENSURE_LIST(list); \
+    cog_push(seq_add_stage(list, kind, arg)); \
+    return NULL;
+
+cog_object* fn_lazy_map() { _LAZY_STAGE_BODY(SEQ_MAP) }
+cog_object* fn_lazy_filter() { _LAZY_STAGE_BODY(SEQ_FILTER) }
+cog_object* fn_lazy_take() { _LAZY_STAGE_BODY(SEQ_TAKE) }
+cog_modfunc fne_lazy_map = {"Lazy-Map", COG_FUNC, fn_lazy_map, "Like Map, but return a Seq that only runs the block on each item when For or List gets to it."};
+cog_modfunc fne_lazy_filter = {"Lazy-Filter", COG_FUNC, fn_lazy_filter, "Like Filter, but return a Seq that only runs the block on each item when For or List gets to it."};
+cog_modfunc fne_lazy_take = {"Lazy-Take", COG_FUNC, fn_lazy_take, "Like Take, but return a Seq that stops after that many items, and doesn't mind if there are fewer."};
+
+// merge sorts the items, asking the block which goes first, so equal items
+// stay in the order they were in
+static cog_object* sort_by_merge(cog_object* block, cog_object** items, cog_object** tmp, size_t n) {
+    if (n < 2) return NULL;
+    size_t half = n / 2;
+    cog_object* status = sort_by_merge(block, items, tmp, half);
+    if (!status) status = sort_by_merge(block, items + half, tmp, n - half);
+    if (status) return status;
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < n) {
+        // whether the one from the right half goes before the one from the
+        // left, with the left one on top, like < with the right one given
+        cog_object* args[2] = {items[i], items[j]};
+        cog_object* res;
+        status = cog_call(block, 2, args, &res);
+        if (status) return status;
+        if (!res || !res->data || res->data->type != &cog_ot_bool)
+            COG_RETURN_ERROR(cog_sprintf("Expected the block given to Sort-By to return a Boolean, but got %O", res ? res->data : NULL));
+        tmp[k++] = res->data->as_int ? items[j++] : items[i++];
+    }
+    while (i < half) tmp[k++] = items[i++];
+    while (j < n) tmp[k++] = items[j++];
+    memcpy(items, tmp, n * sizeof(cog_object*));
+    return NULL;
 }
 
-void handle_item(cog_object* ijp) {
-    cog_object* statement = cog_pop();
-    cog_push_to(&statement, ijp);
-    cog_push(statement);
+cog_object* fn_sort_by() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* block = cog_pop();
+    cog_object* list = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    if (list && (list->type == &ot_seq || list->type == &ot_generator)) {
+        // run it into a list first, then come back
+        cog_run_next(cog_make_identifier_c("[[Sort-By::Again]]"), NULL, block);
+        seq_start(list, NULL);
+        return NULL;
+    }
+    if (list && list->type == &cog_ot_vector) list = vector_seq(list, 0);
+    if (!COG_IS_LAZY_LIST(list)) COG_ENSURE_LIST(list);
+    cog_object* keep = NULL;
+    size_t n = 0;
+    for (;;) {
+        COG_FORCE_LAZY(list);
+        if (!list) break;
+        COG_ENSURE_LIST(list);
+        cog_push_to(&keep, list->data);
+        list = list->next;
+        n++;
+    }
+    // the block and the items stay on the stack while the block runs, so
+    // the GC leaves them alone
+    cog_push(block);
+    cog_push(keep);
+    cog_object** items = (cog_object**)malloc((2 * n + 1) * sizeof(cog_object*));
+    if (items == NULL) {
+        perror(__func__);
+        abort();
+    }
+    size_t i = n;
+    COG_ITER_LIST(keep, item) items[--i] = item;
+    cog_object* status = sort_by_merge(block, items, items + n, n);
+    cog_object* error = same_status(status, cog_error()) ? cog_pop() : NULL;
+    cog_pop();
+    cog_pop();
+    if (error) cog_push(error);
+    else {
+        cog_object* sorted = NULL;
+        for (i = n; i > 0; i--) cog_push_to(&sorted, items[i - 1]);
+        cog_push(sorted);
+    }
+    free(items);
+    return status;
+}
+cog_object* fn_sort_by_again() {
+    // the cookie is the block, which goes back on top of the list
+    return fn_sort_by();
+}
+cog_modfunc fne_sort_by_again = {"[[Sort-By::Again]]", COG_COOKIEFUNC, fn_sort_by_again, NULL};
+cog_modfunc fne_sort_by = {"Sort-By", COG_FUNC, fn_sort_by, "Sort a list with a block that compares two of its items, the way < does: Sort-By ( < ) sorts in ascending order and Sort-By ( > ) in descending order. Equal items stay in the order they were in."};
+
+// gets the items of a list, lazy list or vector into an array
+static cog_object* par_gather(cog_object* list, par_item** items, size_t* count) {
+    if (list && (list->type == &ot_seq || list->type == &ot_generator))
+        COG_RETURN_ERROR(cog_sprintf("can't run a %s in parallel; make it into a List first", list->type->name));
+    cog_object* forced = NULL;
+    if (list && list->type == &cog_ot_vector) list = vector_seq(list, 0);
+    if (!COG_IS_LAZY_LIST(list)) COG_ENSURE_LIST(list);
+    size_t n = 0;
+    for (;;) {
+        COG_FORCE_LAZY(list);
+        if (!list) break;
+        COG_ENSURE_LIST(list);
+        cog_push_to(&forced, list->data);
+        list = list->next;
+        n++;
+    }
+    *items = (par_item*)calloc(n ? n : 1, sizeof(par_item));
+    if (*items == NULL) {
+        perror(__func__);
+        abort();
+    }
+    *count = n;
+    COG_ITER_LIST(forced, item) (*items)[--n].item = item;
+    return NULL;
 }
 
-cog_object* fn_parser_handle_semicolon() {
-    cog_object* cookie = cog_pop();
-    cog_object* s = cookie->data;
-    if (s->type == &cog_ot_string) {
-        s->stored_chars = 0;
-        s->next = NULL;
+cog_object* fn_parallel_map() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* block = cog_pop();
+    cog_object* list = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    bool is_vector = list && list->type == &cog_ot_vector;
+    par_item* items;
+    size_t count;
+    cog_object* status = par_gather(list, &items, &count);
+    if (status) return status;
+    status = count ? par_run(block, items, count, true) : NULL;
+    if (!status) {
+        if (is_vector) {
+            cog_object** results = (cog_object**)malloc((count ? count : 1) * sizeof(cog_object*));
+            if (results == NULL) {
+                perror(__func__);
+                abort();
+            }
+            for (size_t i = 0; i < count; i++) results[i] = items[i].result;
+            cog_push(cog_vector_from_array(results, count));
+            free(results);
+        } else {
+            cog_object* out = NULL;
+            for (size_t i = count; i-- > 0;) cog_push_to(&out, items[i].result);
+            cog_push(out);
+        }
     }
-    handle_end_of_statement();
-    cog_push(cookie);
-    return cog_not_implemented();
+    free(items);
+    return status;
+}
+cog_modfunc fne_parallel_map = {"Parallel-Map", COG_FUNC, fn_parallel_map, "Like Map, but run the block on the items in parallel, each in a separate worker interpreter (see Threads). The block is given copies of the item and of everything it can see, so changes it makes to variables aren't seen outside. The results come back in order, as a list (or a vector for a vector)."};
+
+cog_object* fn_parallel_for() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* list = cog_pop();
+    cog_object* block = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    par_item* items;
+    size_t count;
+    cog_object* status = par_gather(list, &items, &count);
+    if (status) return status;
+    if (count) status = par_run(block, items, count, false);
+    free(items);
+    return status;
 }
-cog_modfunc fne_parser_handle_semicolon = {
-    ";",
-    COG_PARSE_TOKEN_HANDLER,
-    fn_parser_handle_semicolon,
-    doc_parser_internals
-};
+cog_modfunc fne_parallel_for = {"Parallel-For", COG_FUNC, fn_parallel_for, "Like For, but run the block on the items in parallel, as Parallel-Map does. Whatever the block prints comes out in the order of the items."};
 
-cog_object* fn_parser_parse_block_loop() {
-    cog_object* cookie = cog_pop();
-    cog_object* stopwhen = cookie->data;
-    cog_object* stream = cookie->next;
-    cog_object* ijp = cog_pop();
-    if (!ijp || ijp->type != &ot_parser_sentinel) goto next;
-    if (ijp->next->type == &ot_eof && stopwhen->type == &ot_eof) goto stop;
-    if (ijp->next->type == &cog_ot_string && stopwhen->type == &cog_ot_string && !cog_strcmp(ijp->next, stopwhen)) goto stop;
-    // else it is an error
-    cog_push(ijp->next->type == &cog_ot_string ? cog_sprintf("unexpected %O", ijp->next) : cog_string("unexpected EOF"));
-    return cog_error();
+cog_object* fn_threads() {
+    cog_push(cog_box_int(par_threads()));
+    return NULL;
+}
+cog_modfunc fne_threads = {"Threads", COG_FUNC, fn_threads, "Return how many threads Parallel-Map and Parallel-For use. This starts as $COGNI_THREADS if that is set, or else the number of processors."};
 
-    next:
-    handle_item(ijp);
-    cog_run_next(cog_make_identifier_c("[[Parser::ParseBlockLoop]]"), NULL, cookie);
-    run_nextitem_next(stream, cog_emptystring());
+cog_object* fn_set_threads() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* n = cog_pop();
+    COG_ENSURE_TYPE(n, &cog_ot_int);
+    if (n->as_int < 1) COG_RETURN_ERROR(cog_sprintf("can't use %O threads", n));
+    COG_GLOBALS.threads = n->as_int;
     return NULL;
+}
+cog_modfunc fne_set_threads = {"Set-Threads!", COG_FUNC, fn_set_threads, "Set how many threads Parallel-Map and Parallel-For use."};
 
-    stop:
-    handle_end_of_block();
+cog_object* fn_spawn() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* block = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    fiber_current();
+    cog_object* obj = fiber_new();
+    fiber* fb = FIBER(obj);
+    cog_object* queue = COG_GLOBALS.command_queue;
+    COG_GLOBALS.command_queue = NULL;
+    cog_run_next(block, NULL, NULL);
+    fb->command_queue = COG_GLOBALS.command_queue;
+    COG_GLOBALS.command_queue = queue;
+    fb->scopes = COG_GLOBALS.scopes;
+    fiber_ready(obj);
+    cog_push(obj);
     return NULL;
 }
-cog_modfunc fne_parser_parse_block_loop = {
-    "[[Parser::ParseBlockLoop]]",
-    COG_COOKIEFUNC,
-    fn_parser_parse_block_loop,
-    doc_parser_internals
-};
+cog_modfunc fne_spawn = {"Spawn", COG_FUNC, fn_spawn, "Start running a block in a new fiber, with a stack of its own, taking turns with the others. Returns the fiber."};
 
-cog_object* fn_parse() {
-    cog_object* stream = cog_pop();
-    if (stream == NULL) {
-        cog_push(NULL);
+// whether a generator was running when C called into Cognate, at any
+// level, so its Yields can't reach it past the builtin in between
+static bool generator_under_call() {
+    COG_ITER_LIST(COG_GLOBALS.calls, saved) {
+        // (stack queue handlers scopes generator), as cog_call saved it
+        if (saved->next->next->next->next->data) return true;
+    }
+    return false;
+}
+
+cog_object* fn_yield() {
+    cog_object* gen = COG_GLOBALS.generator;
+    if (gen) {
+        // hand the value to whoever asked for it, and wait to be asked again
+        COG_ENSURE_N_ITEMS(1);
+        generator* g = GENERATOR(gen);
+        g->value = cog_pop();
+        g->has_value = true;
+        generator_return(gen, GEN_SUSPENDED);
         return NULL;
     }
-    if (stream->type == &cog_ot_string) {
-        stream = cog_iostring_wrap(stream);
+    if (generator_under_call())
+        COG_RETURN_ERROR(cog_string("Can't Yield out of a generator from a block that a builtin is running for it, like a Sort-By comparison"));
+    if (fiber_others_alive()) COG_GLOBALS.fiber_stop = FIBER_YIELD;
+    return NULL;
+}
+cog_modfunc fne_yield = {"Yield", COG_FUNC, fn_yield, "In a generator, hand a value out to whatever asked for the next one, and wait until it is asked again. Elsewhere, let the other fibers that are ready have a turn before this one goes on."};
+
+cog_object* fn_join_fiber() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* obj = cog_pop();
+    COG_ENSURE_TYPE(obj, &ot_fiber);
+    fiber* fb = FIBER(obj);
+    if (fb->state == FIBER_DONE) {
+        if (fb->result) cog_push(fb->result->data);
+        return NULL;
     }
-    cog_object* cookie2 = stream;
-    cog_push_to(&cookie2, cog_eof());
-    cog_run_next(cog_make_identifier_c("[[Parser::ParseBlockLoop]]"), NULL, cookie2);
-    run_nextitem_next(stream, cog_emptystring());
-    cog_push(NULL);
-    cog_push(NULL); // for block parsing and stuff
+    if (fb->state == FIBER_FAILED) {
+        cog_push(fb->result);
+        return cog_error();
+    }
+    if (obj == COG_GLOBALS.fiber) COG_RETURN_ERROR(cog_string("A fiber can't wait for itself to finish"));
+    if (!fiber_others_alive()) COG_RETURN_ERROR(cog_string("All the fibers are waiting for each other"));
+    // wait for it to finish, then look again
+    cog_push_to(&fb->waiters, fiber_current());
+    cog_run_next(cog_make_identifier_c("[[Fiber::Join]]"), NULL, obj);
+    COG_GLOBALS.fiber_stop = FIBER_WAIT;
     return NULL;
 }
-cog_modfunc fne_parse = {
-    "Parse",
-    COG_FUNC,
-    fn_parse,
-    "Parse the next item from the stream on the stack "
-    "into a Cognate data structure."
-};
+cog_modfunc fne_join_fiber = {"Join-Fiber", COG_FUNC, fn_join_fiber, "Wait for a fiber to finish, and return what it left on top of its stack. If the fiber failed, this fails with the same error."};
 
-// MARK: BUILTIN FUNCTIONS
+cog_object* fn_fiber_join_again() {
+    // the cookie is the fiber
+    return fn_join_fiber();
+}
+cog_modfunc fne_fiber_join_again = {"[[Fiber::Join]]", COG_COOKIEFUNC, fn_fiber_join_again, NULL};
 
-cog_object* fn_empty() {
-    cog_push(NULL);
+cog_object* fn_channel() {
+    cog_push(channel_new(0));
     return NULL;
 }
-cog_modfunc fne_empty = {
-    "Empty",
-    COG_FUNC,
-    fn_empty,
-    "Return an empty list."
-};
+cog_modfunc fne_channel = {"Channel", COG_FUNC, fn_channel, "Make a channel, for sending objects between fibers or parallel blocks, that holds as many as are sent to it."};
 
-#define GET_TYPENAME_STRING(obj) (obj && obj->type ? obj->type->name : "empty List")
-#define _NUMBERBODY(op, either_float_type, both_ints_type, both_ints_cast) \
-    COG_ENSURE_N_ITEMS(2); \
-    cog_object* a = cog_pop(); \
-    cog_object* b = cog_pop(); \
-    if (a && b) { \
-        if (a->type == &cog_ot_int && b->type == &cog_ot_int) { \
-            cog_push(cog_box_##both_ints_type((both_ints_cast b->as_int) op (both_ints_cast a->as_int))); \
-        } else { \
-            double a_val, b_val; \
-            COG_GET_NUMBER(a, a_val); \
-            COG_GET_NUMBER(b, b_val); \
-            cog_push(cog_box_##either_float_type(b_val op a_val)); \
-        } \
-        return NULL; \
-    } \
-    cog_push(cog_sprintf("Can't apply operator %s to %s and %s", #op, \
-        GET_TYPENAME_STRING(a), GET_TYPENAME_STRING(b))); \
-    return cog_error();
+cog_object* fn_bounded_channel() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* n = cog_pop();
+    COG_ENSURE_TYPE(n, &cog_ot_int);
+    if (n->as_int < 1) COG_RETURN_ERROR(cog_sprintf("can't make a channel that holds %O items", n));
+    cog_push(channel_new(n->as_int));
+    return NULL;
+}
+cog_modfunc fne_bounded_channel = {"Bounded-Channel", COG_FUNC, fn_bounded_channel, "Make a channel that holds at most N objects; sending to it when it is full waits until there is room."};
 
-cog_object* fn_plus() { _NUMBERBODY(+, float, int, ) }
-cog_object* fn_minus() { _NUMBERBODY(-, float, int, ) }
-cog_object* fn_times() { _NUMBERBODY(*, float, int, ) }
-cog_object* fn_divide() { _NUMBERBODY(/, float, float, (double)) }
-cog_object* fn_less() { _NUMBERBODY(<, bool, bool, ) }
-cog_object* fn_greater() { _NUMBERBODY(>, bool, bool, ) }
-cog_object* fn_lesseq() { _NUMBERBODY(<=, bool, bool, ) }
-cog_object* fn_greatereq() { _NUMBERBODY(>=, bool, bool, ) } // cSpell: ignore greatereq
-cog_object* fn_pow() {
+extern cog_modfunc fne_send;
+extern cog_modfunc fne_receive;
+extern cog_modfunc fne_channel_closed_p;
+
+cog_object* fn_send() {
     COG_ENSURE_N_ITEMS(2);
-    cog_object* a = cog_pop();
-    cog_object* b = cog_pop();
-    double a_val, b_val;
-    COG_GET_NUMBER(a, a_val);
-    COG_GET_NUMBER(b, b_val);
-    cog_push(cog_box_float(pow(b_val, a_val)));
+    cog_object* ch = cog_pop();
+    cog_object* value = cog_pop();
+    COG_ENSURE_TYPE(ch, &ot_channel);
+    channel* c = CHANNEL(ch);
+    cog_object* status = NULL;
+    pthread_mutex_lock(&c->lock);
+    if (c->closed) {
+        pthread_mutex_unlock(&c->lock);
+        COG_RETURN_ERROR(cog_string("Can't send to a closed channel"));
+    }
+    if (c->capacity && c->count >= c->capacity) {
+        status = channel_wait(c, &c->senders, &fne_send);
+        pthread_mutex_unlock(&c->lock);
+        if (status) return status;
+        cog_push(value);
+        cog_push(ch);
+        return NULL;
+    }
+    if (c->shared) {
+        cog_state* mine = cog_set_state(c->heap);
+        marshal_memo m = {0};
+        cog_object* copy = marshal(value, &m);
+        if (!m.unshared) channel_append(c, copy);
+        marshal_memo_free(&m);
+        cog_set_state(mine);
+        if (m.unshared) status = cog_sprintf("a %s can't be sent to another thread", m.unshared);
+    } else channel_append(c, value);
+    if (!status) channel_changed(c, &c->receivers);
+    pthread_mutex_unlock(&c->lock);
+    if (status) COG_RETURN_ERROR(status);
     return NULL;
 }
+cog_modfunc fne_send = {"Send", COG_FUNC, fn_send, "Send an object on a channel, waiting first if the channel is full. Across parallel blocks, the object is copied."};
 
-cog_modfunc fne_plus = {"+", COG_FUNC, fn_plus, "Add two numbers."};
-cog_modfunc fne_minus = {"-", COG_FUNC, fn_minus, "Subtract two numbers."};
-cog_modfunc fne_times = {"*", COG_FUNC, fn_times, "Multiply two numbers."};
-cog_modfunc fne_divide = {"/", COG_FUNC, fn_divide, "Divide two numbers."};
-cog_modfunc fne_less = {"<", COG_FUNC, fn_less, "Check if a is less than b."};
-cog_modfunc fne_greater = {">", COG_FUNC, fn_greater, "Check if a is greater than b."};
-cog_modfunc fne_lesseq = {"<=", COG_FUNC, fn_lesseq, "Check if a is less than or equal to b."};
-cog_modfunc fne_greatereq = {">=", COG_FUNC, fn_greatereq, "Check if a is greater than or equal to b."};
-cog_modfunc fne_pow = {"^", COG_FUNC, fn_pow, "Get the power of a to b."};
+// takes the oldest item, copying it out if the channel is shared
+static cog_object* channel_receive(channel* c) {
+    cog_object* item = channel_take(c);
+    if (c->shared) {
+        marshal_memo m = {0};
+        item = marshal(item, &m);
+        marshal_memo_free(&m);
+        channel_heap_gc(c);
+    }
+    channel_changed(c, &c->senders);
+    return item;
+}
 
-bool cog_equal(cog_object* a, cog_object* b) {
-    if (a && b && a->type != b->type) {
-        cog_push(b);
-        if (cog_same_identifiers(cog_run_well_known(a, "Equal_OtherType"), cog_not_implemented())) {
-            cog_pop();
-            cog_push(a);
-            if (cog_same_identifiers(cog_run_well_known(b, "Equal_OtherType"), cog_not_implemented())) {
-                cog_pop();
-                return false;
-            } else return cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
-        } else return cog_expect_type_fatal(cog_pop(), &cog_ot_bool)->as_int;
+cog_object* fn_receive() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* ch = cog_pop();
+    COG_ENSURE_TYPE(ch, &ot_channel);
+    channel* c = CHANNEL(ch);
+    pthread_mutex_lock(&c->lock);
+    if (c->count) {
+        cog_push(channel_receive(c));
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
     }
-    else {
-        cog_object* ha = cog_hash(a);
-        cog_object* hb = cog_hash(b);
-        return ha && hb ? (ha->as_int == hb->as_int) : (a == b);
+    if (c->closed) {
+        pthread_mutex_unlock(&c->lock);
+        COG_RETURN_ERROR(cog_string("Can't receive from a closed channel that is empty"));
     }
+    cog_object* status = channel_wait(c, &c->receivers, &fne_receive);
+    pthread_mutex_unlock(&c->lock);
+    if (status) return status;
+    cog_push(ch);
+    return NULL;
 }
+cog_modfunc fne_receive = {"Receive", COG_FUNC, fn_receive, "Receive the oldest object sent on a channel, waiting until there is one. It is an error if the channel is closed and empty."};
 
-cog_object* fn_eq() {
-    COG_ENSURE_N_ITEMS(2);
-    cog_object* a = cog_pop();
-    cog_object* b = cog_pop();
-    cog_push(cog_box_bool(cog_equal(a, b)));
+cog_object* fn_try_receive() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* ch = cog_pop();
+    COG_ENSURE_TYPE(ch, &ot_channel);
+    channel* c = CHANNEL(ch);
+    pthread_mutex_lock(&c->lock);
+    bool got = c->count;
+    if (got) cog_push(channel_receive(c));
+    pthread_mutex_unlock(&c->lock);
+    cog_push(cog_box_bool(got));
     return NULL;
 }
-cog_modfunc fne_eq = {"==", COG_FUNC, fn_eq, "Check if two objects are equal."};
+cog_modfunc fne_try_receive = {"Try-Receive", COG_FUNC, fn_try_receive, "Receive the oldest object sent on a channel and then True, or just False if there isn't one, without waiting."};
 
-cog_object* fn_if() {
-    COG_ENSURE_N_ITEMS(3);
-    cog_object* cond = cog_pop();
-    cog_object* iftrue = cog_pop();
-    cog_object* iffalse = cog_pop();
-    COG_ENSURE_TYPE(cond, &cog_ot_bool);
-    cog_push(cond->as_int ? iftrue : iffalse);
+cog_object* fn_channel_closed_p() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* ch = cog_pop();
+    COG_ENSURE_TYPE(ch, &ot_channel);
+    channel* c = CHANNEL(ch);
+    pthread_mutex_lock(&c->lock);
+    if (!c->closed && !c->count) {
+        // so that Receive after it won't wait for what never comes
+        cog_object* status = channel_wait(c, &c->receivers, &fne_channel_closed_p);
+        pthread_mutex_unlock(&c->lock);
+        if (status) return status;
+        cog_push(ch);
+        return NULL;
+    }
+    bool done = c->closed && !c->count;
+    pthread_mutex_unlock(&c->lock);
+    cog_push(cog_box_bool(done));
     return NULL;
 }
-cog_modfunc fne_if = {"If", COG_FUNC, fn_if, "If cond is true, return iftrue, else return iffalse."};
+cog_modfunc fne_channel_closed_p = {"Closed?", COG_FUNC, fn_channel_closed_p, "Return whether a channel has been closed and everything sent on it has been received. If it is open and empty, this waits until one or the other changes, so Until ( Closed? C ) ( Receive C ) works."};
 
-cog_object* fn_print() {
+cog_object* fn_generator() {
     COG_ENSURE_N_ITEMS(1);
-    cog_object* obj = cog_pop();
-    cog_printf(obj && obj->type == &cog_ot_string ? "%#O\n" : "%O\n", obj);
+    cog_object* block = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    cog_object* gen = generator_new(NULL, NULL, COG_GLOBALS.scopes);
+    cog_object* queue = COG_GLOBALS.command_queue;
+    cog_object* handlers = COG_GLOBALS.handlers;
+    COG_GLOBALS.command_queue = COG_GLOBALS.handlers = NULL;
+    // the cleanup only runs if it fails, as finishing swaps its queue out
+    cog_run_next(cog_make_identifier_c("[[Generator::Cleanup]]"), cog_on_exit(), gen);
+    cog_run_next(cog_make_identifier_c("[[Generator::End]]"), NULL, gen);
+    cog_run_next(block, NULL, NULL);
+    GENERATOR(gen)->command_queue = COG_GLOBALS.command_queue;
+    GENERATOR(gen)->handlers = COG_GLOBALS.handlers;
+    COG_GLOBALS.command_queue = queue;
+    COG_GLOBALS.handlers = handlers;
+    cog_push(gen);
     return NULL;
 }
-cog_modfunc fne_print = {"Print", COG_FUNC, fn_print, "Print an object to stdout, with a newline."};
+cog_modfunc fne_generator = {"Generator", COG_FUNC, fn_generator, "Make a generator from a block, which runs a bit at a time, each time something asks it for a value, until it hands one out with Yield. Next, For and List take values from it."};
 
-cog_object* fn_put() {
+cog_object* fn_generator_end() {
+    generator_return(cog_pop(), GEN_DONE);
+    return NULL;
+}
+cog_modfunc fne_generator_end = {"[[Generator::End]]", COG_COOKIEFUNC, fn_generator_end, NULL};
+
+cog_object* fn_generator_cleanup() {
+    // it failed, so take its error back to whoever asked it for a value
+    cog_object* gen = cog_pop();
+    if (GENERATOR(gen)->state != GEN_RUNNING) return NULL;
+    bool has_error = !cog_is_stack_empty();
+    cog_object* error = has_error ? cog_pop() : NULL;
+    generator_return(gen, GEN_FAILED);
+    if (has_error) cog_push(error);
+    return NULL;
+}
+cog_modfunc fne_generator_cleanup = {"[[Generator::Cleanup]]", COG_COOKIEFUNC, fn_generator_cleanup, NULL};
+
+cog_object* fn_next() {
     COG_ENSURE_N_ITEMS(1);
-    cog_object* obj = cog_pop();
-    cog_printf(obj && obj->type == &cog_ot_string ? "%#O" : "%O", obj);
+    cog_object* gen = cog_pop();
+    COG_ENSURE_TYPE(gen, &ot_generator);
+    bool resumed;
+    cog_object* status = generator_fill(gen, cog_make_identifier_c("[[Generator::Next]]"), gen, &resumed);
+    if (status || resumed) return status;
+    if (!GENERATOR(gen)->has_value) COG_RETURN_ERROR(cog_string("The generator has no more values"));
+    cog_push(generator_take(gen));
     return NULL;
 }
-cog_modfunc fne_put = {"Put", COG_FUNC, fn_put, "Print an object to stdout, without a newline."};
+cog_modfunc fne_next = {"Next", COG_FUNC, fn_next, "Return the next value from a generator, running it until it yields one."};
+
+cog_object* fn_generator_next_again() {
+    // the cookie is the generator
+    return fn_next();
+}
+cog_modfunc fne_generator_next_again = {"[[Generator::Next]]", COG_COOKIEFUNC, fn_generator_next_again, NULL};
+
+cog_object* fn_generator_finished_p() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* gen = cog_pop();
+    COG_ENSURE_TYPE(gen, &ot_generator);
+    bool resumed;
+    cog_object* status = generator_fill(gen, cog_make_identifier_c("[[Generator::Finished]]"), gen, &resumed);
+    if (status || resumed) return status;
+    cog_push(cog_box_bool(!GENERATOR(gen)->has_value));
+    return NULL;
+}
+cog_modfunc fne_generator_finished_p = {"Finished?", COG_FUNC, fn_generator_finished_p, "Return whether a generator has no more values. This runs it until it yields the next one, which Next then returns, so Until ( Finished? G ) ( Next G ) works."};
+
+cog_object* fn_generator_finished_again() {
+    // the cookie is the generator
+    return fn_generator_finished_p();
+}
+cog_modfunc fne_generator_finished_again = {"[[Generator::Finished]]", COG_COOKIEFUNC, fn_generator_finished_again, NULL};
 
 cog_object* fn_do() {
     COG_ENSURE_N_ITEMS(1);
@@ -2596,7 +7194,7 @@ cog_modfunc fne_is_number = {"Number?", COG_FUNC, fn_is_number, "Return true if
 
 cog_object* fn_is_symbol() { _TYPEP_BODY(,&cog_ot_symbol) }
 cog_object* fn_is_integer() { _TYPEP_BODY(,&cog_ot_int || (a->type == &cog_ot_float && a->as_float == floor(a->as_float))) }
-cog_object* fn_is_list() { _TYPEP_BODY(!a ||, &cog_ot_list) }
+cog_object* fn_is_list() { _TYPEP_BODY(!a || COG_IS_LAZY_LIST(a) ||, &cog_ot_list) }
 cog_object* fn_is_string() { _TYPEP_BODY(,&cog_ot_string) }
 cog_object* fn_is_block() { _TYPEP_BODY(,&ot_closure) }
 cog_object* fn_is_boolean() { _TYPEP_BODY(,&cog_ot_bool) }
@@ -2651,7 +7249,7 @@ cog_modfunc fne_assert_boolean = {"Boolean!", COG_FUNC, fn_assert_boolean, "Asse
 cog_object* fn_assert_list() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* a = cog_pop();
-    COG_ENSURE_LIST(a);
+    if (!COG_IS_LAZY_LIST(a)) COG_ENSURE_LIST(a);
     cog_push(a);
     return NULL;
 }
@@ -2679,12 +7277,18 @@ cog_object* fn_first() {
         cog_push(cog_make_character(cog_nthchar(a, 0)));
         return NULL;
     }
+    if (a && a->type == &cog_ot_vector) {
+        if (cog_vector_length(a) == 0) COG_RETURN_ERROR(cog_string("tried to get First of an empty vector"));
+        cog_push(cog_vector_nth(a, 0));
+        return NULL;
+    }
+    COG_FORCE_LAZY(a);
     COG_ENSURE_LIST(a);
     if (!a) COG_RETURN_ERROR(cog_string("tried to get First of an empty list"));
     cog_push(a->data);
     return NULL;
 }
-cog_modfunc fne_first = {"First", COG_FUNC, fn_first, "Return the first element of a list."};
+cog_modfunc fne_first = {"First", COG_FUNC, fn_first, "Return the first element of a list or vector."};
 
 cog_object* fn_rest() {
     COG_ENSURE_N_ITEMS(1);
@@ -2696,12 +7300,19 @@ cog_object* fn_rest() {
         cog_push(dup);
         return NULL;
     }
+    if (a && a->type == &cog_ot_vector) {
+        if (cog_vector_length(a) == 0) COG_RETURN_ERROR(cog_string("tried to get Rest of an empty vector"));
+        // a lazy list, so walking a vector with Rest doesn't copy it every time
+        cog_push(vector_seq(a, 1));
+        return NULL;
+    }
+    COG_FORCE_LAZY(a);
     COG_ENSURE_LIST(a);
     if (!a) COG_RETURN_ERROR(cog_string("tried to get Rest of an empty list"));
     cog_push(a->next);
     return NULL;
 }
-cog_modfunc fne_rest = {"Rest", COG_FUNC, fn_rest, "Return the rest of a list."};
+cog_modfunc fne_rest = {"Rest", COG_FUNC, fn_rest, "Return the rest of a list. The rest of a vector is a lazy list of its items after the first."};
 
 cog_object* fn_push() {
     COG_ENSURE_N_ITEMS(2);
@@ -2719,7 +7330,10 @@ cog_object* fn_is_empty() {
     cog_object* a = cog_pop();
     if (a && a->type == &cog_ot_string) {
         cog_push(cog_box_bool(cog_strlen(a) == 0));
+    } else if (a && a->type == &cog_ot_vector) {
+        cog_push(cog_box_bool(cog_vector_length(a) == 0));
     } else {
+        COG_FORCE_LAZY(a);
         COG_ENSURE_LIST(a);
         cog_push(cog_box_bool(!a));
     }
@@ -2821,48 +7435,247 @@ cog_object* fn_split() {
 }
 cog_modfunc fne_split = {"Split", COG_FUNC, fn_split, "Split a string into a list of substrings."};
 
-#define _UPPERLOWERBODY(ulfunc) \
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+static uint64_t swar_flip_case(uint64_t word, char from_lo, char from_hi) {
+    // every byte is < 0x80 here, so none of these additions can carry
+    // into the next byte; the high bit of each byte ends up set iff the
+    // byte is in [from_lo, from_hi]
+    uint64_t ge_lo = word + (0x80 - from_lo) * SWAR_ONES;
+    uint64_t gt_hi = word + (0x80 - from_hi - 1) * SWAR_ONES;
+    uint64_t in_range = ge_lo & ~gt_hi & SWAR_HIGHS;
+    // 0x80 >> 2 == 0x20, the ASCII case bit
+    return word ^ (in_range >> 2);
+}
+
+static void case_convert(cog_strbuf* out, const char* in, size_t len, bool upper) {
+    char from_lo = upper ? 'a' : 'A';
+    char from_hi = upper ? 'z' : 'Z';
+    strbuf_reserve(out, len);
+    size_t i = 0;
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    while (i < len) {
+        // pure ASCII runs, 8 bytes at a time
+        while (i + sizeof(uint64_t) <= len) {
+            uint64_t word;
+            memcpy(&word, in + i, sizeof(word));
+            if (word & SWAR_HIGHS) break;
+            word = swar_flip_case(word, from_lo, from_hi);
+            strbuf_reserve(out, sizeof(word));
+            memcpy(out->data + out->len, &word, sizeof(word));
+            out->len += sizeof(word);
+            i += sizeof(word);
+        }
+        if (i >= len) break;
+        unsigned char c = in[i];
+        if (c < 0x80) {
+            if (c >= from_lo && c <= from_hi) c ^= 0x20;
+            cog_strbuf_putc(out, c);
+            i++;
+            continue;
+        }
+        // non-ASCII byte, so go the slow way
+        wchar_t wc;
+        size_t n = mbrtowc(&wc, in + i, len - i, &state);
+        if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+            // not valid in this locale; pass it through unchanged
+            memset(&state, 0, sizeof(state));
+            cog_strbuf_putc(out, c);
+            i++;
+            continue;
+        }
+        wc = upper ? towupper(wc) : towlower(wc);
+        char mb[MB_LEN_MAX];
+        mbstate_t wstate;
+        memset(&wstate, 0, sizeof(wstate));
+        size_t m = wcrtomb(mb, wc, &wstate);
+        if (m == (size_t)-1) cog_strbuf_write(out, in + i, n);
+        else cog_strbuf_write(out, mb, m);
+        i += n;
+    }
+}
+
+#define _UPPERLOWERBODY(upper) \
     COG_ENSURE_N_ITEMS(1); \
     cog_object* str = cog_pop(); \
     COG_ENSURE_TYPE(str, &cog_ot_string); \
-    cog_object* result = cog_emptystring(); \
-    cog_object* tail = result; \
-    char buffer[MB_CUR_MAX + 1]; \
-    int i = 0; \
-    while (str) { \
-        memset(buffer, 0, sizeof(buffer)); \
-        int len = min(MB_CUR_MAX, str->stored_chars - i); \
-        strncpy(buffer, &str->as_chars[i], len); \
-        /* If the current chunk has less than MB_CUR_MAX characters, */ \
-        /* copy remaining characters from the next chunk             */ \
-        if (len < MB_CUR_MAX && str->next) { \
-            int remaining = MB_CUR_MAX - len; \
-            int next_len = min(remaining, str->next->stored_chars); \
-            strncat(buffer, str->next->as_chars, next_len); \
-        } \
-        wchar_t wc; \
-        len = mblen(buffer, MB_CUR_MAX); \
-        mbtowc(&wc, buffer, len); \
-        wc = ulfunc(wc); \
-        memset(buffer, 0, sizeof(buffer)); \
-        wctomb(buffer, wc); \
-        for (int j = 0; j < strlen(buffer); j++) { \
-            cog_string_append_byte(&tail, buffer[j]); \
-        } \
-        i += len; \
-        while (str && i >= str->stored_chars) { \
-            i -= str->stored_chars; \
-            str = str->next; \
-        } \
-    } \
-    cog_push(result); \
+    cog_strbuf in = COG_STRBUF_INIT; \
+    cog_strbuf out = COG_STRBUF_INIT; \
+    cog_strbuf_append_string(&in, str); \
+    case_convert(&out, in.data, in.len, upper); \
+    cog_push(cog_strbuf_to_string(&out)); \
+    cog_strbuf_free(&in); \
+    cog_strbuf_free(&out); \
     return NULL; \
 
-cog_object* fn_lowercase() { _UPPERLOWERBODY(towlower) }
-cog_object* fn_uppercase() { _UPPERLOWERBODY(towupper) }
+cog_object* fn_lowercase() { _UPPERLOWERBODY(false) }
+cog_object* fn_uppercase() { _UPPERLOWERBODY(true) }
 cog_modfunc fne_lowercase = {"Lowercase", COG_FUNC, fn_lowercase, "Converts a string to lower case."};
 cog_modfunc fne_uppercase = {"Uppercase", COG_FUNC, fn_uppercase, "Converts a string to upper case."};
 
+cog_object* fn_equal_ignoring_case() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* a = cog_pop();
+    cog_object* b = cog_pop();
+    COG_ENSURE_TYPE(a, &cog_ot_string);
+    COG_ENSURE_TYPE(b, &cog_ot_string);
+    cog_strbuf in = COG_STRBUF_INIT;
+    cog_strbuf fa = COG_STRBUF_INIT;
+    cog_strbuf fb = COG_STRBUF_INIT;
+    cog_strbuf_append_string(&in, a);
+    case_convert(&fa, in.data, in.len, false);
+    in.len = 0;
+    cog_strbuf_append_string(&in, b);
+    case_convert(&fb, in.data, in.len, false);
+    cog_push(cog_box_bool(fa.len == fb.len && (fa.len == 0 || !memcmp(fa.data, fb.data, fa.len))));
+    cog_strbuf_free(&in);
+    cog_strbuf_free(&fa);
+    cog_strbuf_free(&fb);
+    return NULL;
+}
+cog_modfunc fne_equal_ignoring_case = {"Equal-Ignoring-Case?", COG_FUNC, fn_equal_ignoring_case, "Return true if two strings are the same after converting both to lower case."};
+
+static void strbuf_append_shown(cog_strbuf* sb, cog_object* stream, cog_object* obj) {
+    // strings go in as-is, everything else the same as Show would do it
+    if (obj && obj->type == &cog_ot_string) cog_strbuf_append_string(sb, obj);
+    else cog_dump(obj, stream, false);
+}
+
+cog_object* fn_join() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* sep = cog_pop();
+    cog_object* list = cog_pop();
+    COG_ENSURE_TYPE(sep, &cog_ot_string);
+    COG_ENSURE_LIST(list);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    cog_object* stream = cog_strbuf_stream(&sb);
+    bool first = true;
+    COG_ITER_LIST(list, item) {
+        if (!first) cog_strbuf_append_string(&sb, sep);
+        strbuf_append_shown(&sb, stream, item);
+        first = false;
+    }
+    cog_push(cog_strbuf_to_string(&sb));
+    cog_strbuf_free(&sb);
+    return NULL;
+}
+cog_modfunc fne_join = {"Join", COG_FUNC, fn_join, "Join the items of a list into one string, with the separator string between each of them."};
+
+cog_object* fn_format() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* tmpl_str = cog_pop();
+    cog_object* args = cog_pop();
+    COG_ENSURE_TYPE(tmpl_str, &cog_ot_string);
+    COG_ENSURE_LIST(args);
+    size_t nargs = cog_list_length(args);
+    cog_object** argv = (cog_object**)alloca((nargs + 1) * sizeof(cog_object*));
+    size_t i = 0;
+    COG_ITER_LIST(args, arg) argv[i++] = arg;
+    cog_strbuf tmpl = COG_STRBUF_INIT;
+    cog_strbuf_append_string(&tmpl, tmpl_str);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    cog_object* stream = cog_strbuf_stream(&sb);
+    cog_object* err = NULL;
+    size_t next_slot = 0;
+    for (i = 0; i < tmpl.len; i++) {
+        char c = tmpl.data[i];
+        if (c == '}' && i + 1 < tmpl.len && tmpl.data[i + 1] == '}') {
+            cog_strbuf_putc(&sb, '}');
+            i++;
+            continue;
+        }
+        if (c != '{') {
+            cog_strbuf_putc(&sb, c);
+            continue;
+        }
+        if (i + 1 < tmpl.len && tmpl.data[i + 1] == '{') {
+            cog_strbuf_putc(&sb, '{');
+            i++;
+            continue;
+        }
+        // it's a slot: {} or {N}
+        size_t start = ++i;
+        while (i < tmpl.len && isdigit(tmpl.data[i])) i++;
+        if (i >= tmpl.len || tmpl.data[i] != '}') {
+            err = cog_sprintf("Bad slot in Format template %O", tmpl_str);
+            break;
+        }
+        size_t which = next_slot;
+        if (i > start) {
+            which = 0;
+            for (size_t j = start; j < i; j++) which = which * 10 + (tmpl.data[j] - '0');
+        }
+        if (which >= nargs) {
+            err = cog_sprintf("Format slot %i is out of range for %i arguments", (int)which, (int)nargs);
+            break;
+        }
+        strbuf_append_shown(&sb, stream, argv[which]);
+        next_slot = which + 1;
+    }
+    cog_strbuf_free(&tmpl);
+    if (!err) cog_push(cog_strbuf_to_string(&sb));
+    cog_strbuf_free(&sb);
+    if (err) COG_RETURN_ERROR(err);
+    return NULL;
+}
+cog_modfunc fne_format = {"Format", COG_FUNC, fn_format, "Fill the {} or {N} slots in a template string with the items of a list. Use {{ and }} for literal braces."};
+
+static void free_string_builder(cog_object* builder) {
+    cog_strbuf* sb = (cog_strbuf*)builder->as_ptr;
+    if (sb) {
+        cog_strbuf_free(sb);
+        free(sb);
+        builder->as_ptr = NULL;
+    }
+}
+cog_obj_type ot_string_builder = {"String-Builder", NULL, free_string_builder};
+
+cog_object* m_string_builder_show() {
+    cog_object* builder = cog_pop();
+    cog_pop(); // ignore readably
+    cog_strbuf* sb = (cog_strbuf*)builder->as_ptr;
+    cog_push(cog_sprintf("<String-Builder of %zu bytes>", sb->len));
+    return NULL;
+}
+cog_object_method ome_string_builder_show = {&ot_string_builder, "Show", m_string_builder_show};
+
+cog_object* fn_string_builder() {
+    cog_object* builder = cog_make_obj(&ot_string_builder);
+    cog_strbuf* sb = (cog_strbuf*)calloc(1, sizeof(cog_strbuf));
+    if (sb == NULL) {
+        perror(__func__);
+        abort();
+    }
+    builder->as_ptr = (void*)sb;
+    cog_push(builder);
+    return NULL;
+}
+cog_modfunc fne_string_builder = {"String-Builder", COG_FUNC, fn_string_builder, "Return a new empty mutable string builder."};
+
+cog_object* fn_builder_append() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* builder = cog_pop();
+    cog_object* item = cog_pop();
+    COG_ENSURE_TYPE(builder, &ot_string_builder);
+    cog_strbuf* sb = (cog_strbuf*)builder->as_ptr;
+    strbuf_append_shown(sb, cog_strbuf_stream(sb), item);
+    return NULL;
+}
+cog_modfunc fne_builder_append = {"Builder-Append", COG_FUNC, fn_builder_append, "Mutates a string builder in-place by adding a string (or the Show of any other object) to the end."};
+
+cog_object* fn_builder_finish() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* builder = cog_pop();
+    COG_ENSURE_TYPE(builder, &ot_string_builder);
+    cog_strbuf* sb = (cog_strbuf*)builder->as_ptr;
+    cog_push(cog_strbuf_to_string(sb));
+    cog_strbuf_free(sb);
+    return NULL;
+}
+cog_modfunc fne_builder_finish = {"Builder-Finish", COG_FUNC, fn_builder_finish, "Return the contents of a string builder as a string, and empty the builder."};
+
 #define _ONEFUNNUMBODY(ffn, ifn) \
     COG_ENSURE_N_ITEMS(1); \
     cog_object* a = cog_pop(); \
@@ -2895,13 +7708,18 @@ cog_modfunc fne_error = {"Error", COG_FUNC, fn_error, "Raise an error with a mes
 cog_object* fn_list() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* block = cog_pop();
+    if (block && (block->type == &ot_seq || block->type == &ot_generator || COG_IS_LAZY_LIST(block))) {
+        // run the whole Seq into a list
+        seq_start(block, NULL);
+        return NULL;
+    }
     COG_ENSURE_TYPE(block, &ot_closure);
     cog_run_next(cog_make_identifier_c("[[List::Finish]]"), NULL, COG_GLOBALS.stack);
     cog_run_next(block, NULL, NULL);
     COG_GLOBALS.stack = NULL;
     return NULL;
 }
-cog_modfunc fne_list = {"List", COG_FUNC, fn_list, "Create a list by using the stack created by a block."};
+cog_modfunc fne_list = {"List", COG_FUNC, fn_list, "Create a list by using the stack created by a block, or from the items of a Seq, generator or lazy list."};
 
 cog_object* fn_list_finish() {
     cog_object* old_stack = cog_pop();
@@ -2936,10 +7754,12 @@ cog_object* fn_wait() {
     cog_object* a = cog_pop();
     double duration;
     COG_GET_NUMBER(a, duration);
-    usleep(duration * 1000000);
+    // let the other fibers run in the meantime
+    if (fiber_others_alive()) fiber_sleep(monotonic_now() + duration);
+    else usleep(duration * 1000000);
     return NULL;
 }
-cog_modfunc fne_wait = {"Wait", COG_FUNC, fn_wait, "Sleep for a number of seconds."};
+cog_modfunc fne_wait = {"Wait", COG_FUNC, fn_wait, "Sleep for a number of seconds. Other fibers go on running in the meantime."};
 
 cog_object* fn_stop() {
     COG_RETURN_ERROR(NULL);
@@ -3074,25 +7894,35 @@ cog_object* fn_table() {
 }
 cog_modfunc fne_table = {"Table", COG_FUNC, fn_table, "Makes a table from the key-value pairs from a block."};
 
-#define ENSURE_HASHABLE(obj) \
+#define ENSURE_HASHABLE(obj) \
+    do { \
+        int64_t hash__; \
+        if (!cog_hash_value((obj), &hash__)) COG_RETURN_ERROR(cog_sprintf("Can't hash key %O", (obj))); \
+    } while (0)
+
+#define ENSURE_ORDERED_KEY(map, key) \
     do { \
-        if (!cog_hash(obj)) COG_RETURN_ERROR(cog_sprintf("Can't hash key %O", (obj))); \
+        int kind__ = omap_key_kind(key); \
+        if (!kind__) COG_RETURN_ERROR(cog_sprintf("Can't order key %O", (key))); \
+        if ((map)->next && kind__ != omap_key_kind(BNODE((map)->next)->keys[0])) \
+            COG_RETURN_ERROR(cog_sprintf("Can't use key %O in an ordered map of %s", (key), kind__ == 1 ? "strings" : "numbers")); \
     } while (0)
 
 cog_object* fn_list_to_tab() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* list = cog_pop();
     COG_ENSURE_LIST(list);
-    cog_object* tab = cog_emptytab();
+    cog_transient_table tab;
+    cog_table_transient(&tab, cog_emptytab());
     while (list) {
         cog_object* key = list->data;
         ENSURE_HASHABLE(key);
         if (!list->next) COG_RETURN_ERROR(cog_string("Odd-length list in Table initializer"));
         cog_object* val = list->next->data;
         list = list->next->next;
-        tab = cog_table_insert_or_update(tab, key, val);
+        cog_transient_insert(&tab, key, val);
     }
-    cog_push(tab);
+    cog_push(cog_transient_freeze(&tab));
     return NULL;
 }
 cog_modfunc fne_list_to_tab = {"[[Table::ListToTable]]", COG_FUNC, fn_list_to_tab, NULL};
@@ -3102,85 +7932,557 @@ cog_object* fn_insert() {
     cog_object* key = cog_pop();
     cog_object* value = cog_pop();
     cog_object* table = cog_pop();
+    if (table && table->type == &cog_ot_ordered_map) {
+        ENSURE_ORDERED_KEY(table, key);
+        cog_push(cog_omap_insert(table, key, value));
+        return NULL;
+    }
     COG_ENSURE_TYPE(table, &cog_ot_table);
     ENSURE_HASHABLE(key);
     cog_push(cog_table_insert_or_update(table, key, value));
     return NULL;
 }
-cog_modfunc fne_insert = {"Insert", COG_FUNC, fn_insert, "Insert a key-value pair into a table, and return the updated table."};
+cog_modfunc fne_insert = {"Insert", COG_FUNC, fn_insert, "Insert a key-value pair into a table or ordered map, and return the updated one."};
 
 cog_object* fn_remove() {
     COG_ENSURE_N_ITEMS(2);
     cog_object* key = cog_pop();
     cog_object* table = cog_pop();
+    bool found;
+    if (table && table->type == &cog_ot_ordered_map) {
+        ENSURE_ORDERED_KEY(table, key);
+        cog_omap_get(table, key, &found);
+        if (!found) COG_RETURN_ERROR(cog_sprintf("Can't remove key %O that is not in the ordered map", key));
+        cog_push(cog_omap_remove(table, key));
+        return NULL;
+    }
     COG_ENSURE_TYPE(table, &cog_ot_table);
     ENSURE_HASHABLE(key);
-    bool found;
     cog_table_get(table, key, &found);
     if (!found) COG_RETURN_ERROR(cog_sprintf("Can't remove key %O that is not in the table", key));
     cog_push(cog_table_remove(table, key));
     return NULL;
 }
-cog_modfunc fne_remove = {"Remove", COG_FUNC, fn_remove, "Remove a key-value pair from a table, and return the updated table."};
+cog_modfunc fne_remove = {"Remove", COG_FUNC, fn_remove, "Remove a key-value pair from a table or ordered map, and return the updated one."};
 
 cog_object* fn_dot() {
     COG_ENSURE_N_ITEMS(2);
     cog_object* key = cog_pop();
     cog_object* table = cog_pop();
+    bool found;
+    if (table && table->type == &cog_ot_ordered_map) {
+        ENSURE_ORDERED_KEY(table, key);
+        cog_object* value = cog_omap_get(table, key, &found);
+        if (!found) COG_RETURN_ERROR(cog_sprintf("Can't get key %O from ordered map", key));
+        cog_push(value);
+        return NULL;
+    }
     COG_ENSURE_TYPE(table, &cog_ot_table);
     ENSURE_HASHABLE(key);
-    bool found;
     cog_object* value = cog_table_get(table, key, &found);
     if (!found) COG_RETURN_ERROR(cog_sprintf("Can't get key %O from table", key));
     cog_push(value);
     return NULL;
 }
-cog_modfunc fne_dot = {".", COG_FUNC, fn_dot, "Return the value for a key in a table."};
+cog_modfunc fne_dot = {".", COG_FUNC, fn_dot, "Return the value for a key in a table or ordered map."};
 
 cog_object* fn_has() {
     COG_ENSURE_N_ITEMS(2);
     cog_object* key = cog_pop();
     cog_object* table = cog_pop();
+    bool found;
+    if (table && table->type == &cog_ot_ordered_map) {
+        // a key of the wrong kind just isn't there
+        int kind = omap_key_kind(key);
+        found = false;
+        if (kind && table->next && kind == omap_key_kind(BNODE(table->next)->keys[0])) cog_omap_get(table, key, &found);
+        cog_push(cog_box_bool(found));
+        return NULL;
+    }
     COG_ENSURE_TYPE(table, &cog_ot_table);
     ENSURE_HASHABLE(key);
-    bool found;
     cog_table_get(table, key, &found);
     cog_push(cog_box_bool(found));
     return NULL;
 }
-cog_modfunc fne_has = {"Has", COG_FUNC, fn_has, "Return true if the key is in the table."};
+cog_modfunc fne_has = {"Has", COG_FUNC, fn_has, "Return true if the key is in the table or ordered map."};
+
+cog_object* fn_dict() {
+    cog_run_next(cog_make_identifier_c("[[Dict::ListToDict]]"), NULL, NULL);
+    cog_run_next(cog_make_identifier_c("List"), NULL, NULL);
+    return NULL;
+}
+cog_modfunc fne_dict = {"Dict", COG_FUNC, fn_dict, "Makes a mutable dict from the key-value pairs from a block."};
+
+cog_object* fn_list_to_dict() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* list = cog_pop();
+    COG_ENSURE_LIST(list);
+    cog_object* dict = cog_make_dict();
+    while (list) {
+        cog_object* key = list->data;
+        ENSURE_HASHABLE(key);
+        if (!list->next) COG_RETURN_ERROR(cog_string("Odd-length list in Dict initializer"));
+        cog_dict_set(dict, key, list->next->data);
+        list = list->next->next;
+    }
+    cog_push(dict);
+    return NULL;
+}
+cog_modfunc fne_list_to_dict = {"[[Dict::ListToDict]]", COG_FUNC, fn_list_to_dict, NULL};
+
+cog_object* fn_dict_get() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* key = cog_pop();
+    cog_object* dict = cog_pop();
+    COG_ENSURE_TYPE(dict, &cog_ot_dict);
+    ENSURE_HASHABLE(key);
+    bool found;
+    cog_object* value = cog_dict_get(dict, key, &found);
+    if (!found) COG_RETURN_ERROR(cog_sprintf("Can't get key %O from dict", key));
+    cog_push(value);
+    return NULL;
+}
+cog_modfunc fne_dict_get = {"Dict-Get", COG_FUNC, fn_dict_get, "Return the value for a key in a dict."};
+
+cog_object* fn_dict_set() {
+    COG_ENSURE_N_ITEMS(3);
+    cog_object* key = cog_pop();
+    cog_object* value = cog_pop();
+    cog_object* dict = cog_pop();
+    COG_ENSURE_TYPE(dict, &cog_ot_dict);
+    ENSURE_HASHABLE(key);
+    cog_dict_set(dict, key, value);
+    return NULL;
+}
+cog_modfunc fne_dict_set = {"Dict-Set!", COG_FUNC, fn_dict_set, "Set the value for a key in a dict, changing the dict."};
+
+cog_object* fn_dict_remove() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* key = cog_pop();
+    cog_object* dict = cog_pop();
+    COG_ENSURE_TYPE(dict, &cog_ot_dict);
+    ENSURE_HASHABLE(key);
+    cog_dict_remove(dict, key);
+    return NULL;
+}
+cog_modfunc fne_dict_remove = {"Dict-Remove!", COG_FUNC, fn_dict_remove, "Remove a key from a dict, if it is there, changing the dict."};
+
+cog_object* fn_dict_has() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* key = cog_pop();
+    cog_object* dict = cog_pop();
+    COG_ENSURE_TYPE(dict, &cog_ot_dict);
+    ENSURE_HASHABLE(key);
+    bool found;
+    cog_dict_get(dict, key, &found);
+    cog_push(cog_box_bool(found));
+    return NULL;
+}
+cog_modfunc fne_dict_has = {"Dict-Has?", COG_FUNC, fn_dict_has, "Return true if the key is in the dict."};
+
+cog_object* fn_dict_to_table() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* dict = cog_pop();
+    COG_ENSURE_TYPE(dict, &cog_ot_dict);
+    cog_push(cog_dict_to_table(dict));
+    return NULL;
+}
+cog_modfunc fne_dict_to_table = {"Dict->Table", COG_FUNC, fn_dict_to_table, "Return a table with the same contents as a dict."};
+
+cog_object* fn_ordered_map() {
+    cog_run_next(cog_make_identifier_c("[[OrderedMap::ListToMap]]"), NULL, NULL);
+    cog_run_next(cog_make_identifier_c("List"), NULL, NULL);
+    return NULL;
+}
+cog_modfunc fne_ordered_map = {"Ordered-Map", COG_FUNC, fn_ordered_map, "Makes an ordered map from the key-value pairs from a block. The keys must be all numbers or all strings."};
+
+cog_object* fn_list_to_omap() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* list = cog_pop();
+    COG_ENSURE_LIST(list);
+    cog_object* map = cog_empty_omap();
+    while (list) {
+        cog_object* key = list->data;
+        ENSURE_ORDERED_KEY(map, key);
+        if (!list->next) COG_RETURN_ERROR(cog_string("Odd-length list in Ordered-Map initializer"));
+        map = cog_omap_insert(map, key, list->next->data);
+        list = list->next->next;
+    }
+    cog_push(map);
+    return NULL;
+}
+cog_modfunc fne_list_to_omap = {"[[OrderedMap::ListToMap]]", COG_FUNC, fn_list_to_omap, NULL};
+
+cog_object* fn_range_between() {
+    COG_ENSURE_N_ITEMS(3);
+    cog_object* from = cog_pop();
+    cog_object* to = cog_pop();
+    cog_object* map = cog_pop();
+    COG_ENSURE_TYPE(map, &cog_ot_ordered_map);
+    ENSURE_ORDERED_KEY(map, from);
+    ENSURE_ORDERED_KEY(map, to);
+    if (omap_key_kind(from) != omap_key_kind(to)) COG_RETURN_ERROR(cog_sprintf("Can't compare %O and %O", from, to));
+    cog_push(omap_range(map->next, from, to, 0));
+    return NULL;
+}
+cog_modfunc fne_range_between = {"Range-Between", COG_FUNC, fn_range_between, "Return a lazy list of the (key value) entries of an ordered map with keys from a to b inclusive, in order."};
+
+cog_object* fn_entries() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* map = cog_pop();
+    COG_ENSURE_TYPE(map, &cog_ot_ordered_map);
+    cog_push(omap_range(map->next, NULL, NULL, RANGE_NO_FROM | RANGE_NO_TO));
+    return NULL;
+}
+cog_modfunc fne_entries = {"Entries", COG_FUNC, fn_entries, "Return a lazy list of all the (key value) entries of an ordered map, in order."};
+
+// pushes the entry as a (key value) list, or the empty list if there isn't one
+static void _push_entry(bool any, cog_object* key, cog_object* val) {
+    cog_object* entry = NULL;
+    if (any) {
+        cog_push_to(&entry, val);
+        cog_push_to(&entry, key);
+    }
+    cog_push(entry);
+}
+
+cog_object* fn_floor_entry() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* key = cog_pop();
+    cog_object* map = cog_pop();
+    COG_ENSURE_TYPE(map, &cog_ot_ordered_map);
+    ENSURE_ORDERED_KEY(map, key);
+    cog_object *k, *v;
+    bool any = btree_floor(map->next, key, &k, &v);
+    _push_entry(any, k, v);
+    return NULL;
+}
+cog_modfunc fne_floor_entry = {"Floor-Entry", COG_FUNC, fn_floor_entry, "Return the (key value) entry of an ordered map with the largest key at or before the key, or an empty list if there is none."};
+
+cog_object* fn_ceiling_entry() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* key = cog_pop();
+    cog_object* map = cog_pop();
+    COG_ENSURE_TYPE(map, &cog_ot_ordered_map);
+    ENSURE_ORDERED_KEY(map, key);
+    cog_object *k, *v;
+    bool any = btree_ceiling(map->next, key, false, &k, &v);
+    _push_entry(any, k, v);
+    return NULL;
+}
+cog_modfunc fne_ceiling_entry = {"Ceiling-Entry", COG_FUNC, fn_ceiling_entry, "Return the (key value) entry of an ordered map with the smallest key at or after the key, or an empty list if there is none."};
+
+cog_object* fn_vector() {
+    cog_run_next(cog_make_identifier_c("List->Vector"), NULL, NULL);
+    cog_run_next(cog_make_identifier_c("List"), NULL, NULL);
+    return NULL;
+}
+cog_modfunc fne_vector = {"Vector", COG_FUNC, fn_vector, "Makes a vector from the items from a block."};
+
+cog_object* fn_list_to_vector() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* list = cog_pop();
+    COG_ENSURE_LIST(list);
+    cog_push(cog_list_to_vector(list));
+    return NULL;
+}
+cog_modfunc fne_list_to_vector = {"List->Vector", COG_FUNC, fn_list_to_vector, "Return a vector with the items of a list."};
+
+cog_object* fn_vector_to_list() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* vec = cog_pop();
+    COG_ENSURE_TYPE(vec, &cog_ot_vector);
+    cog_push(cog_vector_to_list(vec));
+    return NULL;
+}
+cog_modfunc fne_vector_to_list = {"Vector->List", COG_FUNC, fn_vector_to_list, "Return a list with the items of a vector."};
+
+// checks an index into a vector; `extra` allows the one just past the end
+#define ENSURE_VECTOR_INDEX(index, vec, extra) \
+    do { \
+        COG_ENSURE_TYPE((index), &cog_ot_int); \
+        if ((index)->as_int < 0 || (size_t)(index)->as_int >= cog_vector_length(vec) + (extra)) \
+            COG_RETURN_ERROR(cog_sprintf("Index %O is out of range for a vector of length %O", (index), cog_box_int(cog_vector_length(vec)))); \
+    } while (0)
+
+cog_object* fn_nth() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* index = cog_pop();
+    cog_object* vec = cog_pop();
+    if (IS_NUMARRAY(vec)) {
+        COG_ENSURE_TYPE(index, &cog_ot_int);
+        if (index->as_int < 0 || (size_t)index->as_int >= cog_numarray_length(vec))
+            COG_RETURN_ERROR(cog_sprintf("Index %O is out of range for an array of length %O", index, cog_box_int(cog_numarray_length(vec))));
+        cog_push(cog_numarray_nth(vec, index->as_int));
+        return NULL;
+    }
+    COG_ENSURE_TYPE(vec, &cog_ot_vector);
+    ENSURE_VECTOR_INDEX(index, vec, 0);
+    cog_push(cog_vector_nth(vec, index->as_int));
+    return NULL;
+}
+cog_modfunc fne_nth = {"Nth", COG_FUNC, fn_nth, "Return the item at an index in a vector or packed array, counting from 0."};
+
+cog_object* fn_conj() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* item = cog_pop();
+    cog_object* vec = cog_pop();
+    COG_ENSURE_TYPE(vec, &cog_ot_vector);
+    cog_push(cog_vector_conj(vec, item));
+    return NULL;
+}
+cog_modfunc fne_conj = {"Conj", COG_FUNC, fn_conj, "Return a vector with an item added to the end."};
+
+cog_object* fn_assoc_nth() {
+    COG_ENSURE_N_ITEMS(3);
+    cog_object* index = cog_pop();
+    cog_object* item = cog_pop();
+    cog_object* vec = cog_pop();
+    COG_ENSURE_TYPE(vec, &cog_ot_vector);
+    ENSURE_VECTOR_INDEX(index, vec, 1);
+    cog_push(cog_vector_assoc(vec, index->as_int, item));
+    return NULL;
+}
+cog_modfunc fne_assoc_nth = {"Assoc-Nth", COG_FUNC, fn_assoc_nth, "Return a vector with the item at an index replaced (or added, if the index is the length)."};
+
+cog_object* fn_slice() {
+    COG_ENSURE_N_ITEMS(3);
+    cog_object* start = cog_pop();
+    cog_object* end = cog_pop();
+    cog_object* vec = cog_pop();
+    COG_ENSURE_TYPE(vec, &cog_ot_vector);
+    ENSURE_VECTOR_INDEX(start, vec, 1);
+    ENSURE_VECTOR_INDEX(end, vec, 1);
+    if (end->as_int < start->as_int) COG_RETURN_ERROR(cog_sprintf("Slice end %O is before start %O", end, start));
+    cog_push(cog_vector_slice(vec, start->as_int, end->as_int));
+    return NULL;
+}
+cog_modfunc fne_slice = {"Slice", COG_FUNC, fn_slice, "Return the items of a vector from the start index up to (but not including) the end index."};
+
+cog_object* fn_concat() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* a = cog_pop();
+    cog_object* b = cog_pop();
+    COG_ENSURE_TYPE(a, &cog_ot_vector);
+    COG_ENSURE_TYPE(b, &cog_ot_vector);
+    cog_push(cog_vector_concat(b, a));
+    return NULL;
+}
+cog_modfunc fne_concat = {"Concat", COG_FUNC, fn_concat, "Append two vectors."};
+
+static cog_object* _list_to_numarray(cog_object* list, bool is_float) {
+    COG_ENSURE_LIST(list);
+    cog_object* arr = cog_make_numarray(is_float, cog_list_length(list));
+    cog_numarray* a = NUMARRAY(arr);
+    for (size_t i = 0; list; i++, list = list->next) {
+        cog_object* x = list->data;
+        double val;
+        COG_GET_NUMBER(x, val);
+        if (is_float) a->f[i] = val;
+        else if (x->type == &cog_ot_int) a->i[i] = x->as_int;
+        else if (val == floor(val)) a->i[i] = val;
+        else COG_RETURN_ERROR(cog_sprintf("Can't put %O in an integer array", x));
+    }
+    cog_push(arr);
+    return NULL;
+}
+
+cog_object* fn_list_to_f64_array() {
+    COG_ENSURE_N_ITEMS(1);
+    return _list_to_numarray(cog_pop(), true);
+}
+cog_modfunc fne_list_to_f64_array = {"List->F64-Array", COG_FUNC, fn_list_to_f64_array, "Return a packed array of floats with the numbers in a list."};
+
+cog_object* fn_list_to_i64_array() {
+    COG_ENSURE_N_ITEMS(1);
+    return _list_to_numarray(cog_pop(), false);
+}
+cog_modfunc fne_list_to_i64_array = {"List->I64-Array", COG_FUNC, fn_list_to_i64_array, "Return a packed array of integers with the numbers in a list."};
+
+cog_object* fn_f64_array() {
+    cog_run_next(cog_make_identifier_c("List->F64-Array"), NULL, NULL);
+    cog_run_next(cog_make_identifier_c("List"), NULL, NULL);
+    return NULL;
+}
+cog_modfunc fne_f64_array = {"F64-Array", COG_FUNC, fn_f64_array, "Makes a packed array of floats from the numbers from a block."};
+
+cog_object* fn_i64_array() {
+    cog_run_next(cog_make_identifier_c("List->I64-Array"), NULL, NULL);
+    cog_run_next(cog_make_identifier_c("List"), NULL, NULL);
+    return NULL;
+}
+cog_modfunc fne_i64_array = {"I64-Array", COG_FUNC, fn_i64_array, "Makes a packed array of integers from the numbers from a block."};
+
+#define COG_ENSURE_NUMARRAY(obj) \
+    do { \
+        if (!IS_NUMARRAY(obj)) COG_RETURN_ERROR(cog_sprintf("Expected a numeric array, but got %s: %O", GET_TYPENAME_STRING(obj), (obj))); \
+    } while (0)
+
+cog_object* fn_array_to_list() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* arr = cog_pop();
+    COG_ENSURE_NUMARRAY(arr);
+    cog_push(cog_numarray_to_list(arr));
+    return NULL;
+}
+cog_modfunc fne_array_to_list = {"Array->List", COG_FUNC, fn_array_to_list, "Return a list of the numbers in a packed array."};
+
+cog_object* fn_is_array() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* a = cog_pop();
+    cog_push(cog_box_bool(IS_NUMARRAY(a)));
+    return NULL;
+}
+cog_modfunc fne_is_array = {"Array?", COG_FUNC, fn_is_array, "Return true if the object is a packed numeric array."};
+
+cog_object* fn_array_range() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* start = cog_pop();
+    cog_object* end = cog_pop();
+    double start_val, end_val;
+    COG_GET_NUMBER(start, start_val);
+    COG_GET_NUMBER(end, end_val);
+    if (end_val < start_val) COG_RETURN_ERROR(cog_sprintf("Invalid range %O...%O", start, end));
+    if (start->type == &cog_ot_int && end->type == &cog_ot_int) {
+        cog_object* arr = cog_make_numarray(false, end->as_int - start->as_int);
+        int64_t* p = NUMARRAY(arr)->i;
+        for (size_t i = 0; i < NUMARRAY(arr)->len; i++) p[i] = start->as_int + (int64_t)i;
+        cog_push(arr);
+    } else {
+        cog_object* arr = cog_make_numarray(true, (size_t)ceil(end_val - start_val));
+        double* p = NUMARRAY(arr)->f;
+        for (size_t i = 0; i < NUMARRAY(arr)->len; i++) p[i] = start_val + i;
+        cog_push(arr);
+    }
+    return NULL;
+}
+cog_modfunc fne_array_range = {"Array-Range", COG_FUNC, fn_array_range, "Like Range, but return a packed array: integers if both ends are integers, else floats."};
+
+// the float sums keep four running totals, so that an optimizing compiler
+// could vectorize them without reordering every addition. The Makefile
+// builds with -O0, which leaves them as scalar loops.
+cog_object* fn_sum() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* arr = cog_pop();
+    COG_ENSURE_NUMARRAY(arr);
+    cog_numarray* a = NUMARRAY(arr);
+    if (arr->type == &cog_ot_i64_array) {
+        int64_t total = 0;
+        for (size_t i = 0; i < a->len; i++) total += a->i[i];
+        cog_push(cog_box_int(total));
+        return NULL;
+    }
+    double t[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= a->len; i += 4)
+        for (int j = 0; j < 4; j++) t[j] += a->f[i + j];
+    for (; i < a->len; i++) t[0] += a->f[i];
+    cog_push(cog_box_float((t[0] + t[1]) + (t[2] + t[3])));
+    return NULL;
+}
+cog_modfunc fne_sum = {"Sum", COG_FUNC, fn_sum, "Return the sum of the numbers in a packed array."};
+
+cog_object* fn_dot_product() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* x = cog_pop();
+    cog_object* y = cog_pop();
+    COG_ENSURE_NUMARRAY(x);
+    COG_ENSURE_NUMARRAY(y);
+    cog_numarray* a = NUMARRAY(x);
+    cog_numarray* b = NUMARRAY(y);
+    if (a->len != b->len) COG_RETURN_ERROR(cog_sprintf("Can't take the dot product of arrays of lengths %O and %O", cog_box_int(a->len), cog_box_int(b->len)));
+    if (x->type == &cog_ot_i64_array && y->type == &cog_ot_i64_array) {
+        int64_t total = 0;
+        for (size_t i = 0; i < a->len; i++) total += a->i[i] * b->i[i];
+        cog_push(cog_box_int(total));
+        return NULL;
+    }
+    numarray_operand xo, yo;
+    numarray_operand_of(x, &xo);
+    numarray_operand_of(y, &yo);
+    double *xfree, *yfree;
+    double* xp = numarray_operand_floats(&xo, &xfree);
+    double* yp = numarray_operand_floats(&yo, &yfree);
+    double t[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= a->len; i += 4)
+        for (int j = 0; j < 4; j++) t[j] += xp[i + j] * yp[i + j];
+    for (; i < a->len; i++) t[0] += xp[i] * yp[i];
+    free(xfree);
+    free(yfree);
+    cog_push(cog_box_float((t[0] + t[1]) + (t[2] + t[3])));
+    return NULL;
+}
+cog_modfunc fne_dot_product = {"Dot", COG_FUNC, fn_dot_product, "Return the dot product of two packed arrays of the same length."};
+
+cog_object* fn_scale() {
+    COG_ENSURE_N_ITEMS(2);
+    cog_object* k = cog_pop();
+    cog_object* arr = cog_pop();
+    COG_ENSURE_NUMARRAY(arr);
+    if (IS_NUMARRAY(k)) COG_RETURN_ERROR(cog_sprintf("Expected a number, but got %s: %O", GET_TYPENAME_STRING(k), k));
+    return cog_numarray_arith("*", arr, k);
+}
+cog_modfunc fne_scale = {"Scale", COG_FUNC, fn_scale, "Multiply every number in a packed array by a number."};
+
+#define _ARRAY_EXTREME_BODY(cmp, name) \
+    COG_ENSURE_N_ITEMS(1); \
+    cog_object* arr = cog_pop(); \
+    COG_ENSURE_NUMARRAY(arr); \
+    cog_numarray* a = NUMARRAY(arr); \
+    if (a->len == 0) COG_RETURN_ERROR(cog_string("tried to get " name " of an empty array")); \
+    if (arr->type == &cog_ot_i64_array) { \
+        int64_t best = a->i[0]; \
+        for (size_t i = 1; i < a->len; i++) best = a->i[i] cmp best ? a->i[i] : best; \
+        cog_push(cog_box_int(best)); \
+    } else { \
+        double best = a->f[0]; \
+        for (size_t i = 1; i < a->len; i++) best = a->f[i] cmp best ? a->f[i] : best; \
+        cog_push(cog_box_float(best)); \
+    } \
+    return NULL;
 
-static cog_object* _get_values(cog_object* tab, cog_object* list) {
-    cog_push_to(&list, tab->TVAL);
+cog_object* fn_array_min() { _ARRAY_EXTREME_BODY(<, "Min") }
+cog_object* fn_array_max() { _ARRAY_EXTREME_BODY(>, "Max") }
+cog_modfunc fne_array_min = {"Array-Min", COG_FUNC, fn_array_min, "Return the smallest number in a packed array."};
+cog_modfunc fne_array_max = {"Array-Max", COG_FUNC, fn_array_max, "Return the largest number in a packed array."};
+
+static cog_object* _get_values(cog_object* key, cog_object* val, cog_object* list) {
+    cog_push_to(&list, val);
     return list;
 }
 
-static cog_object* _get_keys(cog_object* tab, cog_object* list) {
-    cog_push_to(&list, tab->TKEY);
+static cog_object* _get_keys(cog_object* key, cog_object* val, cog_object* list) {
+    cog_push_to(&list, key);
     return list;
 }
 
 cog_object* fn_values() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* table = cog_pop();
+    if (table && table->type == &cog_ot_ordered_map) {
+        cog_push(cog_omap_reduce_reverse(table, _get_values, NULL));
+        return NULL;
+    }
     COG_ENSURE_TYPE(table, &cog_ot_table);
     cog_push(cog_table_reduce(table, _get_values, NULL));
     return NULL;
 }
-cog_modfunc fne_values = {"Values", COG_FUNC, fn_values, "Return a list of all the values in the table."};
+cog_modfunc fne_values = {"Values", COG_FUNC, fn_values, "Return a list of all the values in the table, or in the ordered map in key order."};
 
 cog_object* fn_keys() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* table = cog_pop();
+    if (table && table->type == &cog_ot_ordered_map) {
+        cog_push(cog_omap_reduce_reverse(table, _get_keys, NULL));
+        return NULL;
+    }
     COG_ENSURE_TYPE(table, &cog_ot_table);
     cog_push(cog_table_reduce(table, _get_keys, NULL));
     return NULL;
 }
-cog_modfunc fne_keys = {"Keys", COG_FUNC, fn_keys, "Return a list of all the keys in the table."};
-
-static cog_object* _table_len(cog_object* _, cog_object* accum) {
-    return cog_box_int(accum->as_int + 1);
-}
+cog_modfunc fne_keys = {"Keys", COG_FUNC, fn_keys, "Return a list of all the keys in the table, or in the ordered map in order."};
 
 cog_object* fn_length() {
     COG_ENSURE_N_ITEMS(1);
@@ -3188,11 +8490,56 @@ cog_object* fn_length() {
     if (!x) cog_push(cog_box_int(0)); // empty list
     else if (x->type == &cog_ot_list) cog_push(cog_box_int(cog_list_length(x)));
     else if (x->type == &cog_ot_string) cog_push(cog_box_int(cog_strlen(x)));
-    else if (x->type == &cog_ot_table) cog_push(cog_table_reduce(x, _table_len, cog_box_int(0)));
+    else if (x->type == &cog_ot_table) cog_push(cog_box_int(cog_table_size(x)));
+    else if (x->type == &cog_ot_dict) cog_push(cog_box_int(cog_dict_size(x)));
+    else if (x->type == &cog_ot_ordered_map) cog_push(cog_box_int(cog_omap_size(x)));
+    else if (x->type == &cog_ot_vector) cog_push(cog_box_int(cog_vector_length(x)));
+    else if (IS_NUMARRAY(x)) cog_push(cog_box_int(cog_numarray_length(x)));
+    else if (x->type == &ot_lazy_range) cog_push(cog_box_int(lazy_range_length(x)));
+    else if (COG_IS_LAZY_LIST(x)) {
+        cog_object* cookie = cog_make_obj(&cog_ot_list);
+        cookie->data = cog_box_int(0);
+        cookie->next = x;
+        cog_run_next(cog_make_identifier_c("[[Length::More]]"), NULL, cookie);
+    }
+    else if (x->type == &ot_seq || x->type == &ot_generator) {
+        // run it into a list first, then come back
+        cog_run_next(cog_make_identifier_c("[[Length::Again]]"), NULL, NULL);
+        seq_start(x, NULL);
+    }
     else COG_RETURN_ERROR(cog_sprintf("%s object has no length: %O", GET_TYPENAME_STRING(x), x));
     return NULL;
 }
-cog_modfunc fne_length = {"Length", COG_FUNC, fn_length, "Return the length of a list, string, or table."};
+cog_modfunc fne_length = {"Length", COG_FUNC, fn_length, "Return the length of a list, string, vector, packed array, table, dict, or ordered map. Lazy lists (like Lines), Seqs and generators get read to the end."};
+cog_object* fn_length_again() {
+    cog_pop(); // ignore cookie
+    return fn_length();
+}
+cog_modfunc fne_length_again = {"[[Length::Again]]", COG_COOKIEFUNC, fn_length_again, NULL};
+
+// counts a lazy list a batch at a time, so the GC can have what has been
+// counted in between, like For does
+cog_object* fn_length_more() {
+    cog_object* cookie = cog_pop();
+    int64_t n = cookie->data->as_int;
+    cog_object* list = cookie->next;
+    for (int i = 0; i < 1024; i++) {
+        COG_FORCE_LAZY(list);
+        COG_ENSURE_LIST(list);
+        if (!list) {
+            cog_push(cog_box_int(n));
+            return NULL;
+        }
+        n++;
+        list = list->next;
+    }
+    cog_object* cookie2 = cog_make_obj(&cog_ot_list);
+    cookie2->data = cog_box_int(n);
+    cookie2->next = list;
+    cog_run_next(cog_make_identifier_c("[[Length::More]]"), NULL, cookie2);
+    return NULL;
+}
+cog_modfunc fne_length_more = {"[[Length::More]]", COG_COOKIEFUNC, fn_length_more, NULL};
 
 cog_obj_type cog_ot_continuation = {"Continuation", cog_walk_both, NULL};
 
@@ -3201,7 +8548,9 @@ cog_object* cog_make_continuation() {
     c->data = COG_GLOBALS.stack;
     c->next = cog_make_obj(&cog_ot_list);
     c->next->data = COG_GLOBALS.command_queue;
-    c->next->next = COG_GLOBALS.scopes;
+    c->next->next = cog_make_obj(&cog_ot_list);
+    c->next->next->data = COG_GLOBALS.handlers;
+    c->next->next->next = COG_GLOBALS.scopes;
     return c;
 }
 
@@ -3211,12 +8560,19 @@ cog_object* m_continuation_exec() {
     cog_object* contval = cog_pop();
     cog_object* old_stack = self->data;
     cog_object* old_command_queue = self->next->data;
-    cog_object* old_scopes = self->next->next;
+    cog_object* old_handlers = self->next->next->data;
+    cog_object* old_scopes = self->next->next->next;
     // TODO: get displaced enter and exit handlers and queue them to be run
     // TODO: this would mean continuations don't have to save the scopes because it gets saved
     // TODO: on the command queue cookie of closures' enter handlers
+    // Until then the handlers are just swapped out. Escape gets its exit
+    // handlers run by unwinding the command queue, which works because it
+    // only ever leaves blocks that are still running; a continuation can
+    // also jump back into a block that has already returned, and nothing
+    // records which enter handlers that block ran on the way in.
     COG_GLOBALS.stack = old_stack;
     COG_GLOBALS.command_queue = old_command_queue;
+    COG_GLOBALS.handlers = old_handlers;
     COG_GLOBALS.scopes = old_scopes;
     cog_push(contval);
     return NULL;
@@ -3233,6 +8589,106 @@ cog_object* fn_begin() {
 }
 cog_modfunc fne_begin = {"Begin", COG_FUNC, fn_begin, "Call-with-current-continuation, on a block."};
 
+// An Escape can only jump out of the block it was made for, while that is
+// still running, so rather than saving the command queue it unwinds it, like
+// an error does, running the exit handlers on the way, until it gets to the
+// handler Escape queued after the block.
+typedef struct {
+    cog_object* stack; // what to put the value on
+    cog_object* fiber;
+    cog_object* generator;
+    cog_object* value; // on its way out
+    bool active;
+} escape;
+
+#define ESCAPE(obj) ((escape*)(obj)->as_ptr)
+
+static cog_object* walk_escape(cog_object* obj, cog_walk_fun f, cog_object* arg) {
+    escape* e = ESCAPE(obj);
+    cog_walk(e->stack, f, arg);
+    cog_walk(e->fiber, f, arg);
+    cog_walk(e->generator, f, arg);
+    cog_walk(e->value, f, arg);
+    return NULL;
+}
+
+static void free_escape(cog_object* obj) {
+    free(obj->as_ptr);
+    obj->as_ptr = NULL;
+}
+
+cog_obj_type ot_escape = {"Escape", walk_escape, free_escape};
+
+cog_object* m_escape_exec() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore cookie
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* value = cog_pop();
+    escape* e = ESCAPE(self);
+    if (!e->active) COG_RETURN_ERROR(cog_string("Can't escape from a block that has already finished"));
+    // it has to be somewhere in the command queue that is running now
+    cog_object* gen = COG_GLOBALS.generator;
+    while (gen && gen != e->generator) gen = GENERATOR(gen)->outer;
+    if (gen != e->generator) COG_RETURN_ERROR(cog_string("Can't escape into a generator that isn't running"));
+    if (!e->generator && e->fiber != fiber_current()) COG_RETURN_ERROR(cog_string("Can't escape to a block in another fiber"));
+    e->value = value;
+    COG_GLOBALS.escaping = self;
+    return COG_GLOBALS.escape_sym;
+}
+cog_object_method ome_escape_exec = {&ot_escape, "Exec", m_escape_exec};
+
+cog_object* m_escape_show() {
+    cog_object* self = cog_pop();
+    cog_pop(); // ignore readably
+    cog_push(cog_sprintf("<Escape, %s>", ESCAPE(self)->active ? "active" : "finished"));
+    return NULL;
+}
+cog_object_method ome_escape_show = {&ot_escape, "Show", m_escape_show};
+
+cog_object* fn_escape() {
+    COG_ENSURE_N_ITEMS(1);
+    cog_object* block = cog_pop();
+    COG_ENSURE_TYPE(block, &ot_closure);
+    escape* e = (escape*)calloc(1, sizeof(escape));
+    if (e == NULL) {
+        perror(__func__);
+        abort();
+    }
+    e->stack = COG_GLOBALS.stack;
+    e->fiber = fiber_current();
+    e->generator = COG_GLOBALS.generator;
+    e->active = true;
+    cog_object* obj = cog_make_obj(&ot_escape);
+    obj->as_ptr = (void*)e;
+    cog_run_next(cog_make_identifier_c("[[Escape::Exit]]"), cog_on_exit(), obj);
+    cog_run_next(cog_make_identifier_c("[[Escape::Catch]]"), COG_GLOBALS.escape_sym, obj);
+    cog_run_next(block, NULL, NULL);
+    cog_push(obj);
+    return NULL;
+}
+cog_modfunc fne_escape = {"Escape", COG_FUNC, fn_escape, "Run a block with an escape on the stack. Running the escape with a value, while the block is still going, leaves the block (and anything it called) right away, as if it had returned just that value. Exit handlers on the way out still run."};
+
+cog_object* fn_escape_catch() {
+    cog_object* self = cog_pop();
+    // some other Escape further out, so keep going
+    if (COG_GLOBALS.escaping != self) return COG_GLOBALS.escape_sym;
+    escape* e = ESCAPE(self);
+    COG_GLOBALS.escaping = NULL;
+    COG_GLOBALS.stack = e->stack;
+    cog_push(e->value);
+    e->value = NULL;
+    return NULL;
+}
+cog_modfunc fne_escape_catch = {"[[Escape::Catch]]", COG_COOKIEFUNC, fn_escape_catch, NULL};
+
+cog_object* fn_escape_exit() {
+    escape* e = ESCAPE(cog_pop());
+    e->active = false;
+    e->stack = NULL;
+    return NULL;
+}
+cog_modfunc fne_escape_exit = {"[[Escape::Exit]]", COG_COOKIEFUNC, fn_escape_exit, NULL};
+
 // MARK: BUILTINS TABLES
 
 static cog_modfunc* builtin_modfunc_table[] = {
@@ -3273,6 +8729,7 @@ static cog_modfunc* builtin_modfunc_table[] = {
     &fne_greatereq,
     &fne_pow,
     &fne_eq,
+    &fne_canonicalize,
     &fne_random,
     &fne_sqrt,
     &fne_floor,
@@ -3329,6 +8786,41 @@ static cog_modfunc* builtin_modfunc_table[] = {
     // IO
     &fne_print,
     &fne_put,
+    &fne_write,
+    &fne_flush,
+    &fne_read_bytes,
+    &fne_read_line,
+    &fne_lines,
+    &fne_for_each,
+    &fne_for_each_next,
+    &fne_lazy_range,
+    &fne_lazy_map,
+    &fne_lazy_filter,
+    &fne_lazy_take,
+    &fne_sort_by,
+    &fne_sort_by_again,
+    &fne_seq_next,
+    &fne_parallel_map,
+    &fne_parallel_for,
+    &fne_threads,
+    &fne_set_threads,
+    &fne_spawn,
+    &fne_yield,
+    &fne_join_fiber,
+    &fne_fiber_join_again,
+    &fne_channel,
+    &fne_bounded_channel,
+    &fne_send,
+    &fne_receive,
+    &fne_try_receive,
+    &fne_channel_closed_p,
+    &fne_generator,
+    &fne_generator_end,
+    &fne_generator_cleanup,
+    &fne_next,
+    &fne_generator_next_again,
+    &fne_generator_finished_p,
+    &fne_generator_finished_again,
     // list functions
     &fne_list,
     &fne_list_finish,
@@ -3337,6 +8829,8 @@ static cog_modfunc* builtin_modfunc_table[] = {
     &fne_push,
     &fne_is_empty,
     &fne_length,
+    &fne_length_more,
+    &fne_length_again,
     // table functions
     &fne_table,
     &fne_list_to_tab,
@@ -3344,6 +8838,39 @@ static cog_modfunc* builtin_modfunc_table[] = {
     &fne_remove,
     &fne_dot,
     &fne_has,
+    &fne_dict,
+    &fne_list_to_dict,
+    &fne_dict_get,
+    &fne_dict_set,
+    &fne_dict_remove,
+    &fne_dict_has,
+    &fne_dict_to_table,
+    &fne_ordered_map,
+    &fne_list_to_omap,
+    &fne_range_between,
+    &fne_entries,
+    &fne_floor_entry,
+    &fne_ceiling_entry,
+    &fne_vector,
+    &fne_list_to_vector,
+    &fne_vector_to_list,
+    &fne_nth,
+    &fne_conj,
+    &fne_assoc_nth,
+    &fne_slice,
+    &fne_concat,
+    &fne_list_to_f64_array,
+    &fne_list_to_i64_array,
+    &fne_f64_array,
+    &fne_i64_array,
+    &fne_array_to_list,
+    &fne_is_array,
+    &fne_array_range,
+    &fne_sum,
+    &fne_dot_product,
+    &fne_scale,
+    &fne_array_min,
+    &fne_array_max,
     &fne_values,
     &fne_keys,
     // string functions
@@ -3354,6 +8881,12 @@ static cog_modfunc* builtin_modfunc_table[] = {
     &fne_split,
     &fne_lowercase,
     &fne_uppercase,
+    &fne_equal_ignoring_case,
+    &fne_join,
+    &fne_format,
+    &fne_string_builder,
+    &fne_builder_append,
+    &fne_builder_finish,
     // box functions
     &fne_box,
     &fne_unbox,
@@ -3369,6 +8902,9 @@ static cog_modfunc* builtin_modfunc_table[] = {
     &fne_stack,
     &fne_clear,
     &fne_begin,
+    &fne_escape,
+    &fne_escape_catch,
+    &fne_escape_exit,
     NULL
 };
 
@@ -3387,9 +8923,25 @@ static cog_object_method* builtin_objfunc_table[] = {
     &ome_string_show,
     &ome_string_exec,
     &ome_iostring_write,
+    &ome_iostring_putbytes,
     &ome_iostring_getch,
+    &ome_iostring_read,
+    &ome_iostring_readline,
     &ome_iostring_ungets,
     &ome_iostring_show,
+    &ome_lines_show,
+    &ome_lines_hash,
+    &ome_lazy_range_show,
+    &ome_lazy_range_hash,
+    &ome_lazy_range_equal,
+    &ome_lazy_range_equal_other_type,
+    &ome_seq_show,
+    &ome_seq_hash,
+    &ome_not_shared_exec,
+    &ome_not_shared_show,
+    &ome_strbuf_stream_write,
+    &ome_strbuf_stream_putbytes,
+    &ome_strbuf_stream_show,
     &ome_bfunction_exec,
     &ome_closure_exec,
     &ome_block_exec,
@@ -3398,17 +8950,51 @@ static cog_object_method* builtin_objfunc_table[] = {
     &ome_def_or_let_show,
     &ome_var_exec,
     &ome_int_hash,
+    &ome_int_equal,
     &ome_bool_hash,
+    &ome_bool_equal,
     &ome_float_hash,
+    &ome_float_equal,
     &ome_identifier_hash,
+    &ome_identifier_equal,
     &ome_symbol_hash,
+    &ome_symbol_equal,
     &ome_string_hash,
+    &ome_string_equal,
     &ome_continuation_exec,
+    &ome_fiber_show,
+    &ome_channel_show,
+    &ome_channel_close,
+    &ome_generator_show,
+    &ome_generator_hash,
+    &ome_escape_exec,
+    &ome_escape_show,
     &ome_list_show_recursive,
     &ome_list_hash,
+    &ome_list_equal,
     &ome_box_show_recursive,
+    &ome_string_builder_show,
     &ome_table_show_recursive,
     &ome_table_hash,
+    &ome_table_equal,
+    &ome_dict_show_recursive,
+    &ome_dict_hash,
+    &ome_omap_show_recursive,
+    &ome_omap_hash,
+    &ome_omap_equal,
+    &ome_omap_range_show,
+    &ome_omap_range_hash,
+    &ome_vector_show_recursive,
+    &ome_vector_hash,
+    &ome_vector_equal,
+    &ome_vector_seq_show,
+    &ome_vector_seq_hash,
+    &ome_f64_array_show,
+    &ome_i64_array_show,
+    &ome_f64_array_hash,
+    &ome_i64_array_hash,
+    &ome_f64_array_equal,
+    &ome_i64_array_equal,
     &ome_int_equal_other_type,
     &ome_float_equal_other_type,
     NULL
@@ -3419,6 +9005,13 @@ static cog_obj_type* builtin_types[] = {
     &cog_ot_owned_pointer,
     &cog_ot_list,
     &cog_ot_table,
+    &cog_ot_dict,
+    &cog_ot_ordered_map,
+    &ot_omap_range,
+    &cog_ot_vector,
+    &ot_vector_seq,
+    &cog_ot_f64_array,
+    &cog_ot_i64_array,
     &cog_ot_int,
     &cog_ot_bool,
     &cog_ot_float,
@@ -3426,6 +9019,10 @@ static cog_obj_type* builtin_types[] = {
     &cog_ot_symbol,
     &cog_ot_string,
     &ot_iostring,
+    &ot_lines,
+    &ot_lazy_range,
+    &ot_seq,
+    &ot_strbuf_stream,
     &ot_bfunction,
     &ot_parser_sentinel,
     &ot_eof,
@@ -3434,7 +9031,12 @@ static cog_obj_type* builtin_types[] = {
     &ot_def_or_let_special,
     &ot_var,
     &ot_box,
+    &ot_string_builder,
     &cog_ot_continuation,
+    &ot_fiber,
+    &ot_channel,
+    &ot_generator,
+    &ot_escape,
     NULL
 };
 
@@ -3450,11 +9052,13 @@ static void cogni_debug_handler(int sig);
 void cog_init() {
     signal(SIGSEGV, cogni_debug_handler);
     setlocale(LC_ALL, "");
+    if (current_state == NULL) current_state = cog_new_state();
 
     COG_GLOBALS.not_impl_sym = cog_make_identifier_c("[[Status::NotImplemented]]");
     COG_GLOBALS.error_sym = cog_make_identifier_c("[[Status::Error]]");
     COG_GLOBALS.on_enter_sym = cog_make_identifier_c("[[Status::OnEnterHandler]]");
     COG_GLOBALS.on_exit_sym = cog_make_identifier_c("[[Status::OnExitHandler]]");
+    COG_GLOBALS.escape_sym = cog_make_identifier_c("[[Status::Escape]]");
     cog_push_new_scope(); // the global scope
     install_builtins();
 }
@@ -3481,78 +9085,71 @@ static void cogni_debug_handler(int sig) {
 static void debug_dump_stuff() {
     putchar('\n');
     print_backtrace();
+    if (current_state == NULL) return;
     cog_printf("DEBUG: work stack: %O\nDEBUG: command queue: %O\n", COG_GLOBALS.stack, COG_GLOBALS.command_queue);
 }
 
 // MARK: PRINTF / FPRINTF / SPRINTF
 // down here because long
 
-void vprint_inner(cog_object* stream, const char* fmt, va_list args) {
+static void vprint_inner(cog_strbuf* out, const char* fmt, va_list args) {
     const char* p = fmt;
+    cog_object* stream = NULL; // only made if there is a %O
     while (*p) {
         // find index of first '%'
         const char* first_fmt = strchr(p, '%');
         if (first_fmt == NULL) {
             // no more format strings
-            char* s;
-            asprintf(&s, "%s", p);
-            cog_fputs_imm(stream, s);
-            free(s);
+            cog_strbuf_puts(out, p);
             break;
         }
         // print everything up to fmt
-        char* s;
-        int len = first_fmt - p;
-        asprintf(&s, "%.*s", len, p);
-        cog_fputs_imm(stream, s);
-        free(s);
+        cog_strbuf_write(out, p, first_fmt - p);
         p = first_fmt;
         if (*p == '%') {
             p++;
-            char* format;
-            int len = strcspn(p, "diuOoxXfFeEgGacAsp") + 1;
-            asprintf(&format, "%%%.*s", len, p);
+            char format[32];
+            int len = strcspn(p, "diuOoxXfFeEgGacAsp%") + 1;
+            if (len + 2 > (int)sizeof(format)) {
+                fprintf(stderr, "format too long %s\n", p - 1);
+                abort();
+            }
+            snprintf(format, sizeof(format), "%%%.*s", len, p);
+            // length modifiers mean the argument is wider than an int
+            bool is_long = strpbrk(format, "lzjt") != NULL;
 
-            char* buffer;
             switch (format[len]) {
                 case 'O': {
                     cog_object* obj = va_arg(args, cog_object*);
+                    if (!stream) stream = cog_strbuf_stream(out);
                     cog_dump(obj, stream, strchr(format, '#') == NULL);
-                    goto afterprint;
+                    break;
                 }
                 case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c': {
-                    int val = va_arg(args, int);
-                    asprintf(&buffer, format, val);
-                    goto done;
+                    if (is_long) cog_strbuf_printf(out, format, va_arg(args, long long));
+                    else cog_strbuf_printf(out, format, va_arg(args, int));
+                    break;
                 }
                 case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
-                    double val = va_arg(args, double);
-                    asprintf(&buffer, format, val);
-                    goto done;
+                    cog_strbuf_printf(out, format, va_arg(args, double));
+                    break;
                 }
                 case 's': {
-                    char* val = va_arg(args, char*);
-                    asprintf(&buffer, format, val);
-                    goto done;
+                    cog_strbuf_printf(out, format, va_arg(args, char*));
+                    break;
                 }
                 case 'p': {
-                    void* val = va_arg(args, void*);
-                    asprintf(&buffer, format, val);
-                    goto done;
+                    cog_strbuf_printf(out, format, va_arg(args, void*));
+                    break;
                 }
                 case '%': {
-                    asprintf(&buffer, "%%");
-                    goto done;
+                    cog_strbuf_putc(out, '%');
+                    break;
                 }
                 default:
                     fprintf(stderr, "bad format %s\n", format);
                     abort();
             }
-            done:
-            cog_fputs_imm(stream, buffer);
-            free(buffer);
-            afterprint:
-            free(format);
             p += len;
         }
     }
@@ -3561,22 +9158,30 @@ void vprint_inner(cog_object* stream, const char* fmt, va_list args) {
 void cog_fprintf(cog_object* stream, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vprint_inner(stream, fmt, args);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    vprint_inner(&sb, fmt, args);
     va_end(args);
+    cog_strbuf_flush(&sb, stream);
+    cog_strbuf_free(&sb);
 }
 
 void cog_printf(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vprint_inner(COG_GLOBALS.stdout_stream, fmt, args);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    vprint_inner(&sb, fmt, args);
     va_end(args);
+    cog_strbuf_flush(&sb, COG_GLOBALS.stdout_stream);
+    cog_strbuf_free(&sb);
 }
 
 cog_object* cog_sprintf(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    cog_object* stream = cog_empty_io_string();
-    vprint_inner(stream, fmt, args);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    vprint_inner(&sb, fmt, args);
     va_end(args);
-    return cog_iostring_get_contents(stream);
+    cog_object* str = cog_strbuf_to_string(&sb);
+    cog_strbuf_free(&sb);
+    return str;
 }
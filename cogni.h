@@ -20,6 +20,7 @@ extern "C" {
 // MARK: TYPES N' STUFF
 
 typedef struct _cog_object cog_object;
+typedef struct _cog_state cog_state;
 typedef const struct _cog_module cog_module;
 typedef const struct _cog_obj_type cog_obj_type;
 typedef const struct _cog_modfunc cog_modfunc;
@@ -32,6 +33,8 @@ typedef cog_object* (*cog_function)();
 struct _cog_object {
     cog_obj_type* type;
     bool marked;
+    bool hashed; // the hash has been worked out and remembered
+    bool canonical; // the shared copy of this value, see cog_canonicalize()
     union {
         cog_object* data;
         int64_t as_int;
@@ -77,12 +80,20 @@ struct _cog_modfunc {
     Show_Recursive: (counter alist stream readably self --)
     Serialize: (self -- buffer)
     Unserialize: (buffer trash -- obj)
+    Equal: (other self -- result) other is the same type as self
     Equal_OtherType: (other self -- result)
+    Close: (self -- ) for things other than files that Close works on
 
     -- for streams --
     Stream::GetChar: (stream -- buffer)
     Stream::PutString: (buffer stream -- )
     Stream::UngetString: (buffer stream -- )
+    Stream::Flush: (stream -- )
+    Stream::Read: (n stream -- buffer) up to n bytes, or EOF
+    Stream::ReadLine: (stream -- buffer) including the newline, or EOF
+    Stream::PutBytes: (bytes stream -- ) bytes is a StringBuilder::Stream
+    Stream::Ready: (stream -- bool) whether reading now wouldn't block
+    Stream::Fd: (stream -- fd) the file descriptor underneath, if it has one
 */
 
 struct _cog_object_method {
@@ -327,6 +338,73 @@ cog_object* cog_iostring_wrap(cog_object*);
 
 cog_object* cog_iostring_get_contents(cog_object*);
 
+/**
+ * Creates a lazy list of the lines of a stream, which are read
+ * as they are needed.
+ */
+cog_object* cog_lines(cog_object*);
+
+/**
+ * A growable C byte buffer, for building up text without allocating a
+ * `cog_object` per chunk. Initialize with `COG_STRBUF_INIT` and release
+ * with `cog_strbuf_free()`.
+ */
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} cog_strbuf;
+#define COG_STRBUF_INIT {NULL, 0, 0}
+
+/**
+ * Appends a single byte to a string builder.
+ */
+void cog_strbuf_putc(cog_strbuf*, char);
+
+/**
+ * Appends `n` bytes to a string builder.
+ */
+void cog_strbuf_write(cog_strbuf*, const char*, size_t);
+
+/**
+ * Appends a C string to a string builder.
+ */
+void cog_strbuf_puts(cog_strbuf*, const char*);
+
+/**
+ * Appends the contents of a Cognate string to a string builder.
+ */
+void cog_strbuf_append_string(cog_strbuf*, cog_object*);
+
+/**
+ * Appends plain C `printf()` output to a string builder (no `%O`).
+ */
+void cog_strbuf_printf(cog_strbuf*, const char* fmt, ...);
+
+/**
+ * Converts the contents of a string builder into a new Cognate string.
+ * The builder is left unchanged.
+ */
+cog_object* cog_strbuf_to_string(cog_strbuf*);
+
+/**
+ * Writes the contents of a string builder to a stream with a single
+ * `Stream::PutBytes` (or `Stream::PutString`), and empties the builder.
+ */
+void cog_strbuf_flush(cog_strbuf*, cog_object*);
+
+/**
+ * Frees the memory held by a string builder and resets it to empty.
+ */
+void cog_strbuf_free(cog_strbuf*);
+
+/**
+ * Wraps a string builder in a stream object, so that things that write to
+ * streams (such as `cog_dump`) append straight to the builder. The builder
+ * must outlive the stream.
+ */
+cog_object* cog_strbuf_stream(cog_strbuf*);
+
 /**
  * Writes a literal character to a stream.
  */
@@ -337,6 +415,59 @@ void cog_fputchar_imm(cog_object*, char);
  */
 void cog_fputs_imm(cog_object*, const char* s);
 
+/**
+ * Writes out anything the stream has buffered, if it buffers output.
+ * @return The status returned by `Stream::Flush`, or `NULL` if the stream
+ * doesn't implement it.
+ */
+cog_object* cog_flush(cog_object*);
+
+/**
+ * Reads up to `n` bytes from a stream and pushes them as a string, or an
+ * EOF object if the stream is at its end. Streams that don't implement
+ * `Stream::Read` are read a character at a time.
+ * @return The status returned by the stream.
+ */
+cog_object* cog_read(cog_object*, size_t n);
+
+/**
+ * Reads a line from a stream and pushes it (including the newline, if there
+ * was one), or an EOF object if the stream is at its end. Streams that don't
+ * implement `Stream::ReadLine` are read a character at a time.
+ * @return The status returned by the stream.
+ */
+cog_object* cog_readline(cog_object*);
+
+/**
+ * Returns whether reading from a stream now wouldn't block. Streams that
+ * don't implement `Stream::Ready` are always ready.
+ */
+bool cog_stream_ready(cog_object*);
+
+/**
+ * Returns the file descriptor underneath a stream, or -1 if it doesn't have
+ * one (it doesn't implement `Stream::Fd`).
+ */
+int cog_stream_fd(cog_object*);
+
+/**
+ * If other fibers can run, parks the running one until the file descriptor
+ * is ready to read from (or write to, if `for_write`), and queues `retry`
+ * with `cookie` to run when it is. The caller should then put its arguments
+ * back and return, so `retry` finds them.
+ * @return false if nothing else can run or the descriptor can't be watched
+ * (like a regular file), in which case the caller should just go ahead.
+ */
+bool cog_wait_for_fd(int fd, bool for_write, cog_object* retry, cog_object* cookie);
+
+/**
+ * Like `cog_wait_for_fd`, but for a stream, and only if reading from it (or
+ * writing to it) now would block. Streams without a file descriptor that
+ * aren't `Stream::Ready` are looked at again after the other fibers have
+ * had a turn.
+ */
+bool cog_wait_for_stream(cog_object* stream, bool for_write, cog_object* retry);
+
 /**
  * Wraps a `cog_modfunc*` into an object that can be run.
  * The modfunc mush have a `when` of `COG_FUNC` or `COG_COOKIEFUNC`.
@@ -420,7 +551,125 @@ void cog_push_to(cog_object**, cog_object*);
  */
 cog_object* cog_pop_from(cog_object** stack);
 
-cog_object* cog_table_reduce(cog_object*, cog_object* (*f)(cog_object*, cog_object*), cog_object*);
+/**
+ * Folds a function over every key and value in a table.
+ * @param f Called as `f(key, value, accum)`, returning the new accumulator.
+ */
+cog_object* cog_table_reduce(cog_object*, cog_object* (*f)(cog_object*, cog_object*, cog_object*), cog_object*);
+
+/**
+ * Returns the number of entries in a table.
+ */
+size_t cog_table_size(cog_object*);
+
+/**
+ * A table that is being built up in place. Start one with
+ * `cog_table_transient()`, change it with `cog_transient_insert()` and
+ * `cog_transient_remove()`, and then `cog_transient_freeze()` it to get a
+ * normal table back; the transient can't be used after that. The table it
+ * was started from is never changed. The nodes aren't protected from the
+ * garbage collector, so this is only for use inside one native function.
+ */
+typedef struct {
+    cog_object* root;
+    size_t size;
+    uint64_t edit;
+} cog_transient_table;
+
+void cog_table_transient(cog_transient_table*, cog_object*);
+void cog_transient_insert(cog_transient_table*, cog_object* key, cog_object* val);
+void cog_transient_remove(cog_transient_table*, cog_object* key);
+cog_object* cog_transient_freeze(cog_transient_table*);
+
+/**
+ * Makes a new, empty dict. Unlike tables, dicts are changed in place.
+ */
+cog_object* cog_make_dict();
+
+/**
+ * Looks up a key in a dict.
+ * @param found Set to whether the key was there.
+ * @return The value, or NULL if the key wasn't there.
+ */
+cog_object* cog_dict_get(cog_object* dict, cog_object* key, bool* found);
+void cog_dict_set(cog_object* dict, cog_object* key, cog_object* val);
+
+/**
+ * Removes a key from a dict.
+ * @return Whether the key was there.
+ */
+bool cog_dict_remove(cog_object* dict, cog_object* key);
+size_t cog_dict_size(cog_object* dict);
+
+/**
+ * Returns a table with the same contents as a dict.
+ */
+cog_object* cog_dict_to_table(cog_object* dict);
+
+/**
+ * Makes a new, empty ordered map. Ordered maps are persistent like tables,
+ * but are kept sorted by key, which must be all numbers or all strings;
+ * the caller has to check that before calling these.
+ */
+cog_object* cog_empty_omap();
+cog_object* cog_omap_get(cog_object* map, cog_object* key, bool* found);
+cog_object* cog_omap_insert(cog_object* map, cog_object* key, cog_object* val);
+cog_object* cog_omap_remove(cog_object* map, cog_object* key);
+size_t cog_omap_size(cog_object* map);
+
+/**
+ * Folds a function over every key and value in an ordered map, from the
+ * last key to the first, so that pushing each onto a list leaves it in order.
+ * @param f Called as `f(key, value, accum)`, returning the new accumulator.
+ */
+cog_object* cog_omap_reduce_reverse(cog_object*, cog_object* (*f)(cog_object*, cog_object*, cog_object*), cog_object*);
+
+/**
+ * Makes a new, empty vector. Vectors are persistent: these all return a
+ * new vector and leave the old one as it was.
+ */
+cog_object* cog_empty_vector();
+size_t cog_vector_length(cog_object* vec);
+cog_object* cog_vector_nth(cog_object* vec, size_t i);
+
+/**
+ * Adds an item to the end of a vector.
+ */
+cog_object* cog_vector_conj(cog_object* vec, cog_object* item);
+
+/**
+ * Replaces the item at an index, which can be the length to add one.
+ */
+cog_object* cog_vector_assoc(cog_object* vec, size_t i, cog_object* item);
+
+/**
+ * Returns the items from `start` up to but not including `end`.
+ */
+cog_object* cog_vector_slice(cog_object* vec, size_t start, size_t end);
+cog_object* cog_vector_concat(cog_object* a, cog_object* b);
+cog_object* cog_vector_from_array(cog_object** items, size_t count);
+cog_object* cog_list_to_vector(cog_object* list);
+cog_object* cog_vector_to_list(cog_object* vec);
+
+/**
+ * Makes a packed array of `len` floats or integers, which are left
+ * uninitialized.
+ */
+cog_object* cog_make_numarray(bool is_float, size_t len);
+size_t cog_numarray_length(cog_object* arr);
+
+/**
+ * Returns the item at an index of a packed array, boxed.
+ */
+cog_object* cog_numarray_nth(cog_object* arr, size_t i);
+cog_object* cog_numarray_to_list(cog_object* arr);
+
+/**
+ * Applies `left op right` item by item, for `op` one of `+ - * / < > <= >=`,
+ * where one side can be a single number. Pushes the result, or returns an
+ * error status if the operands don't fit.
+ */
+cog_object* cog_numarray_arith(const char* op, cog_object* left, cog_object* right);
 
 /**
  * Dumps an object to a stream.
@@ -428,10 +677,20 @@ cog_object* cog_table_reduce(cog_object*, cog_object* (*f)(cog_object*, cog_obje
 void cog_dump(cog_object*, cog_object*, bool);
 
 /**
- * Returns true if a == b.
+ * Returns true if a == b. Objects of the same type are compared with their
+ * Equal method, falling back to comparing hashes if they have none.
  */
 bool cog_equal(cog_object*, cog_object*);
 
+/**
+ * Returns the shared copy of an immutable value (a number, Boolean, string,
+ * symbol, or list of these), making this one the shared copy if there isn't
+ * one yet. Lists are done all the way down. Values that can't be shared are
+ * returned as they are. The shared copies are forgotten by the GC once
+ * nothing else points to them.
+ */
+cog_object* cog_canonicalize(cog_object* obj);
+
 /**
  * printf() to Cognate's internal stdout, but with %O you can dump an object.
  * There are some slight restrictions. For best behavior only use one-argument format
@@ -453,12 +712,34 @@ void cog_print_refs_recursive(cog_object*, cog_object*, cog_object*, int64_t*, b
 int64_t cog_rec_get_refnum(cog_object*, cog_object*, int64_t*);
 
 /**
- * Initializes the system.
+ * Makes a new, empty interpreter state, with its own heap, stack, scopes and
+ * modules. Switch to it with `cog_set_state()` and then call `cog_init()`.
+ * Native modules can be added to any number of states.
+ */
+cog_state* cog_new_state();
+
+/**
+ * Switches the calling thread to another interpreter state; everything else
+ * in this API works on the current state. A state must only be used by one
+ * thread at a time.
+ * @return The state the thread was using before, or NULL.
+ */
+cog_state* cog_set_state(cog_state* state);
+
+/**
+ * Returns the interpreter state the calling thread is using, or NULL.
+ */
+cog_state* cog_get_state();
+
+/**
+ * Initializes the current state, first making one if the calling thread
+ * doesn't have one.
  */
 void cog_init();
 
 /**
- * Frees all `cog_object`s (even ones made immortal) and resets system state.
+ * Frees all `cog_object`s (even ones made immortal) and then the current
+ * state itself, leaving the thread with no state.
  * Calls `abort()` if cleanup fails.
  */
 void cog_quit();
@@ -524,12 +805,33 @@ bool cog_has_well_known(cog_object*, const char*);
 
 /**
  * Runs the main loop of the system until the command queue is empty.
+ * If fibers have been spawned, it switches between them, and returns when
+ * the main fiber's command queue is empty. When none of them can run, it
+ * waits for the file descriptors and timers they're waiting on.
  * This may invoke the garbage collector.
  * @param status The initial status.
  * @return The final status.
  */
 cog_object* cog_mainloop(cog_object*);
 
+/**
+ * Runs a closure (or anything else that can be run) from C, right away,
+ * in a main loop of its own on top of whatever is running now, and returns
+ * once it has finished. Other fibers don't get a turn in the meantime.
+ * The GC can run during the call: `args` and everything on the stack are
+ * kept alive, but anything the caller only holds in C variables should be
+ * left on the stack until this returns.
+ * @param fn The closure to call.
+ * @param nargs How many arguments there are.
+ * @param args The arguments, `args[0]` ending up on top of the stack, where
+ * the first argument goes.
+ * @param results If not `NULL`, set to the stack the call left behind (top
+ * first), or `NULL` if it failed.
+ * @return `NULL`, or the status it failed with. If it raised an error, the
+ * error is pushed, so a builtin can just return the status.
+ */
+cog_object* cog_call(cog_object* fn, size_t nargs, cog_object* const* args, cog_object** results);
+
 /**
  * Returns the not implemented status identifier.
  */
@@ -599,10 +901,23 @@ void cog_pop_scope();
  */
 cog_object* cog_hash(cog_object* obj);
 
+/**
+ * Hashes an object without boxing the result. Lists, strings, symbols,
+ * tables, ordered maps and vectors remember their hash, so hashing them
+ * again is a lookup.
+ * @return false if the object has no Hash method implemented.
+ */
+bool cog_hash_value(cog_object* obj, int64_t* hash);
+
 extern cog_obj_type cog_ot_pointer;
 extern cog_obj_type cog_ot_owned_pointer;
 extern cog_obj_type cog_ot_list;
 extern cog_obj_type cog_ot_table;
+extern cog_obj_type cog_ot_dict;
+extern cog_obj_type cog_ot_ordered_map;
+extern cog_obj_type cog_ot_vector;
+extern cog_obj_type cog_ot_f64_array;
+extern cog_obj_type cog_ot_i64_array;
 extern cog_obj_type cog_ot_symbol;
 extern cog_obj_type cog_ot_identifier;
 extern cog_obj_type cog_ot_string;
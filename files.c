@@ -2,21 +2,107 @@
 #include "files.h"
 #include <stdio.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
 
-static void closefile(cog_object* stream) {
-    if (stream->as_ptr) {
-        FILE* f = (FILE*)stream->as_ptr;
-        if (f != stdin && f != stdout && f != stderr) {
-            fclose(f);
-            stream->as_ptr = NULL;
+#ifndef COG_FILE_BUFFER_SIZE
+#define COG_FILE_BUFFER_SIZE 4096
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// what a File object's as_ptr points to
+typedef struct {
+    FILE* f;
+    char* wbuf; // pending output, COG_FILE_BUFFER_SIZE bytes
+    size_t wlen;
+    bool is_tty; // flush on newline
+} cog_file;
+
+static FILE* file_of(cog_object* stream) {
+    cog_file* cf = (cog_file*)stream->as_ptr;
+    return cf ? cf->f : NULL;
+}
+
+static bool write_all(FILE* f, const char* data, size_t len) {
+    if (len == 0) return true;
+    if (fwrite(data, 1, len, f) != len) return false;
+    return fflush(f) == 0;
+}
+
+static bool file_flush(cog_file* cf) {
+    if (!cf || !cf->f || cf->wlen == 0) return true;
+    bool ok = write_all(cf->f, cf->wbuf, cf->wlen);
+    cf->wlen = 0;
+    return ok;
+}
+
+static bool write_chunks(FILE* f, cog_object* buf) {
+    // big strings skip the buffer and get written straight from the chunks
+    if (fflush(f) != 0) return false;
+    int fd = fileno(f);
+    struct iovec iov[IOV_MAX];
+    while (buf) {
+        int n = 0;
+        for (; buf && n < IOV_MAX; buf = buf->next) {
+            if (!buf->stored_chars) continue;
+            iov[n].iov_base = buf->as_chars;
+            iov[n].iov_len = buf->stored_chars;
+            n++;
+        }
+        struct iovec* v = iov;
+        while (n > 0) {
+            ssize_t written = writev(fd, v, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            // skip over what got written and retry the rest
+            while (n > 0 && (size_t)written >= v->iov_len) {
+                written -= v->iov_len;
+                v++;
+                n--;
+            }
+            if (n > 0) {
+                v->iov_base = (char*)v->iov_base + written;
+                v->iov_len -= written;
+            }
         }
     }
+    return true;
+}
+
+static void closefile(cog_object* stream) {
+    cog_file* cf = (cog_file*)stream->as_ptr;
+    if (cf) {
+        file_flush(cf);
+        FILE* f = cf->f;
+        if (f && f != stdin && f != stdout && f != stderr) fclose(f);
+        free(cf->wbuf);
+        free(cf);
+        stream->as_ptr = NULL;
+    }
 }
 cog_obj_type ot_file = {"File", cog_walk_only_next, closefile};
 
 cog_object* cog_make_filestream(FILE* f, cog_object* filename) {
     cog_object* fo = cog_make_obj(&ot_file);
-    fo->as_ptr = (void*)f;
+    cog_file* cf = (cog_file*)calloc(1, sizeof(cog_file));
+    if (cf == NULL) {
+        perror(__func__);
+        abort();
+    }
+    cf->f = f;
+    int saved_errno = errno; // isatty() sets it if it isn't a tty
+    cf->is_tty = f && isatty(fileno(f));
+    errno = saved_errno;
+    fo->as_ptr = (void*)cf;
     fo->next = filename;
     return fo;
 }
@@ -25,32 +111,150 @@ cog_object* cog_open_file(const char* const filename, const char* const mode) {
     return cog_make_filestream(fopen(filename, mode), cog_string(filename));
 }
 
+static bool file_write_bytes(cog_file* cf, const char* data, size_t len) {
+    if (cf->wlen + len > COG_FILE_BUFFER_SIZE && !file_flush(cf)) return false;
+    if (len >= COG_FILE_BUFFER_SIZE) return write_all(cf->f, data, len);
+    if (!cf->wbuf) {
+        cf->wbuf = (char*)malloc(COG_FILE_BUFFER_SIZE);
+        if (cf->wbuf == NULL) {
+            perror(__func__);
+            abort();
+        }
+    }
+    memcpy(cf->wbuf + cf->wlen, data, len);
+    cf->wlen += len;
+    if (cf->is_tty && memchr(data, '\n', len)) return file_flush(cf);
+    return true;
+}
+
 static cog_object* m_file_write() {
     cog_object* file = cog_pop();
     cog_object* buf = cog_pop();
-    FILE* f = (FILE*)file->as_ptr;
-    while (buf) {
-        fprintf(f, "%.*s", buf->stored_chars, buf->as_chars);
-        fflush(f);
-        buf = buf->next;
-    }
+    cog_file* cf = (cog_file*)file->as_ptr;
+    if (!cf || !cf->f) COG_RETURN_ERROR(cog_string("Tried to write to a closed file"));
+    size_t len = cog_strlen(buf);
+    bool ok = true;
+    if (len >= COG_FILE_BUFFER_SIZE) ok = file_flush(cf) && write_chunks(cf->f, buf);
+    else for (; ok && buf; buf = buf->next) ok = file_write_bytes(cf, buf->as_chars, buf->stored_chars);
+    if (!ok) COG_RETURN_ERROR(cog_sprintf("While writing to %O: [Errno %i] %s", file->next, errno, strerror(errno)));
     return NULL;
 }
 cog_object_method ome_file_write = {&ot_file, "Stream::PutString", m_file_write};
 
+static cog_object* m_file_putbytes() {
+    cog_object* file = cog_pop();
+    cog_strbuf* bytes = (cog_strbuf*)cog_pop()->as_ptr;
+    cog_file* cf = (cog_file*)file->as_ptr;
+    if (!cf || !cf->f) COG_RETURN_ERROR(cog_string("Tried to write to a closed file"));
+    if (!file_write_bytes(cf, bytes->data, bytes->len))
+        COG_RETURN_ERROR(cog_sprintf("While writing to %O: [Errno %i] %s", file->next, errno, strerror(errno)));
+    return NULL;
+}
+static cog_object_method ome_file_putbytes = {&ot_file, "Stream::PutBytes", m_file_putbytes};
+
+static cog_object* m_file_flush() {
+    cog_object* file = cog_pop();
+    cog_file* cf = (cog_file*)file->as_ptr;
+    if (!file_flush(cf)) COG_RETURN_ERROR(cog_sprintf("While writing to %O: [Errno %i] %s", file->next, errno, strerror(errno)));
+    return NULL;
+}
+static cog_object_method ome_file_flush = {&ot_file, "Stream::Flush", m_file_flush};
+
 static cog_object* m_file_getch() {
     cog_object* file = cog_pop();
-    FILE* f = (FILE*)file->as_ptr;
-    if (feof(f)) cog_push(cog_eof());
-    else cog_push(cog_make_character(fgetc(f)));
+    file_flush((cog_file*)file->as_ptr);
+    FILE* f = file_of(file);
+    int ch = fgetc(f);
+    if (ch == EOF) cog_push(cog_eof());
+    else cog_push(cog_make_character(ch));
     return NULL;
 }
 static cog_object_method ome_file_getch = {&ot_file, "Stream::GetChar", m_file_getch};
 
+// whether stdio already has input for f, so reading won't touch the fd
+static bool input_buffered(FILE* f) {
+#ifdef __GLIBC__
+    return f->_IO_read_ptr < f->_IO_read_end;
+#else
+    (void)f;
+    return true; // can't tell, so don't put off reading it
+#endif
+}
+
+static cog_object* m_file_ready() {
+    cog_object* file = cog_pop();
+    FILE* f = file_of(file);
+    bool ready = true;
+    if (f && !input_buffered(f)) {
+        struct pollfd p = {fileno(f), POLLIN, 0};
+        ready = poll(&p, 1, 0) != 0;
+    }
+    cog_push(cog_box_bool(ready));
+    return NULL;
+}
+static cog_object_method ome_file_ready = {&ot_file, "Stream::Ready", m_file_ready};
+
+static cog_object* m_file_fd() {
+    cog_object* file = cog_pop();
+    FILE* f = file_of(file);
+    cog_push(cog_box_int(f ? fileno(f) : -1));
+    return NULL;
+}
+static cog_object_method ome_file_fd = {&ot_file, "Stream::Fd", m_file_fd};
+
+static cog_object* m_file_read() {
+    cog_object* file = cog_pop();
+    size_t n = cog_expect_type_fatal(cog_pop(), &cog_ot_int)->as_int;
+    FILE* f = file_of(file);
+    if (!f) COG_RETURN_ERROR(cog_string("Tried to read a closed file"));
+    file_flush((cog_file*)file->as_ptr);
+    char block[COG_FILE_BUFFER_SIZE];
+    cog_strbuf sb = COG_STRBUF_INIT;
+    while (sb.len < n) {
+        size_t want = n - sb.len < sizeof(block) ? n - sb.len : sizeof(block);
+        size_t got = fread(block, 1, want, f);
+        cog_strbuf_write(&sb, block, got);
+        if (got < want) break;
+    }
+    bool err = ferror(f);
+    cog_push(sb.len || !n ? cog_strbuf_to_string(&sb) : cog_eof());
+    cog_strbuf_free(&sb);
+    if (err) {
+        clearerr(f);
+        cog_pop();
+        COG_RETURN_ERROR(cog_sprintf("While reading %O: [Errno %i] %s", file->next, errno, strerror(errno)));
+    }
+    return NULL;
+}
+static cog_object_method ome_file_read = {&ot_file, "Stream::Read", m_file_read};
+
+static cog_object* m_file_readline() {
+    cog_object* file = cog_pop();
+    FILE* f = file_of(file);
+    if (!f) COG_RETURN_ERROR(cog_string("Tried to read a closed file"));
+    file_flush((cog_file*)file->as_ptr);
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len = getline(&line, &cap, f);
+    if (len < 0) {
+        free(line);
+        if (ferror(f)) {
+            clearerr(f);
+            COG_RETURN_ERROR(cog_sprintf("While reading %O: [Errno %i] %s", file->next, errno, strerror(errno)));
+        }
+        cog_push(cog_eof());
+        return NULL;
+    }
+    cog_push(cog_string_from_bytes(line, len));
+    free(line);
+    return NULL;
+}
+static cog_object_method ome_file_readline = {&ot_file, "Stream::ReadLine", m_file_readline};
+
 static cog_object* m_file_ungets() {
     cog_object* file = cog_pop();
     cog_object* buf = cog_pop();
-    FILE* f = (FILE*)file->as_ptr;
+    FILE* f = file_of(file);
     while (buf) {
         for (int i = 0; i < buf->stored_chars; i++)
             ungetc(buf->as_chars[i], f);
@@ -81,7 +285,8 @@ XXX:                 then why does this not work??
 
 static cog_object* m_file_stringify() {
     cog_object* file = cog_pop();
-    FILE* f = (FILE*)file->as_ptr;
+    file_flush((cog_file*)file->as_ptr);
+    FILE* f = file_of(file);
     int modes = fcntl(fileno(f), F_GETFL);
     const char* modestr;
     switch (modes) {
@@ -103,7 +308,13 @@ cog_object_method ome_file_hash = {&ot_file, "Hash", cog_not_implemented};
 
 cog_object_method* m_file_table[] = {
     &ome_file_write,
+    &ome_file_putbytes,
+    &ome_file_flush,
     &ome_file_getch,
+    &ome_file_ready,
+    &ome_file_fd,
+    &ome_file_read,
+    &ome_file_readline,
     &ome_file_ungets,
     &ome_file_stringify,
     &ome_file_hash,
@@ -144,16 +355,91 @@ cog_object* fn_open() {
 }
 cog_modfunc fne_open = {"Open", COG_FUNC, fn_open, "Open a file with a specific mode."};
 
+static cog_object* read_rest_mmap(FILE* f, bool* ok) {
+    // regular files get mapped and copied into chunks in one go
+    struct stat st;
+    *ok = false;
+    if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) return NULL;
+    off_t pos = ftello(f);
+    if (pos < 0 || pos > st.st_size) return NULL;
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map == MAP_FAILED) return NULL;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    cog_object* str = cog_string_from_bytes((const char*)map + pos, st.st_size - pos);
+    munmap(map, st.st_size);
+    // mark it all as read
+    fseeko(f, st.st_size, SEEK_SET);
+    *ok = true;
+    return str;
+}
+
+#ifdef __GLIBC__
+extern cog_modfunc fne_readfile_more;
+
+// Reads a pipe or such in blocks, as they come, letting the other fibers run
+// while there isn't anything to read yet. The cookie is the file followed by
+// the blocks read so far, newest first.
+static cog_object* fn_readfile_more() {
+    cog_object* cookie = cog_pop();
+    cog_object* file = cookie->data;
+    FILE* f = file_of(file);
+    if (!f) COG_RETURN_ERROR(cog_string("Tried to read a closed file"));
+    int fd = fileno(f);
+    char block[65536];
+    for (;;) {
+        // what stdio already has comes first
+        size_t buffered = f->_IO_read_end - f->_IO_read_ptr;
+        if (buffered) {
+            size_t n = fread(block, 1, buffered < sizeof(block) ? buffered : sizeof(block), f);
+            cog_push_to(&cookie->next, cog_string_from_bytes(block, n));
+            continue;
+        }
+        struct pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, 0) == 0 && cog_wait_for_fd(fd, false, cog_make_bfunction(&fne_readfile_more), cookie))
+            return NULL;
+        ssize_t n = read(fd, block, sizeof(block));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) COG_RETURN_ERROR(cog_sprintf("While reading %O: [Errno %i] %s", file->next, errno, strerror(errno)));
+        if (n == 0) break;
+        cog_push_to(&cookie->next, cog_string_from_bytes(block, n));
+    }
+    cog_object* blocks = NULL;
+    COG_ITER_LIST(cookie->next, part) cog_push_to(&blocks, part);
+    cog_strbuf sb = COG_STRBUF_INIT;
+    COG_ITER_LIST(blocks, part) cog_strbuf_append_string(&sb, part);
+    cog_push(cog_strbuf_to_string(&sb));
+    cog_strbuf_free(&sb);
+    return NULL;
+}
+cog_modfunc fne_readfile_more = {"[[Read-File::More]]", COG_COOKIEFUNC, fn_readfile_more, NULL};
+#endif
+
 cog_object* fn_readfile() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* file = cog_pop();
     COG_ENSURE_TYPE(file, &ot_file);
-    FILE* f = (FILE*)file->as_ptr;
+    FILE* f = file_of(file);
     if (!f) COG_RETURN_ERROR(cog_string("Tried to read a closed file"));
-    cog_object* str = cog_emptystring();
-    cog_object* tail = str;
-    for (int ch = fgetc(f); ch != EOF; ch = fgetc(f))
-        cog_string_append_byte(&tail, ch);
+    file_flush((cog_file*)file->as_ptr);
+    bool ok;
+    cog_object* str = read_rest_mmap(f, &ok);
+    if (!ok) {
+#ifdef __GLIBC__
+        cog_object* cookie = NULL;
+        cog_push_to(&cookie, file);
+        cog_push(cookie);
+        return fn_readfile_more();
+#else
+        // pipes and such can only be read in blocks
+        cog_strbuf sb = COG_STRBUF_INIT;
+        char block[65536];
+        size_t n;
+        while ((n = fread(block, 1, sizeof(block), f)) > 0)
+            cog_strbuf_write(&sb, block, n);
+        str = cog_strbuf_to_string(&sb);
+        cog_strbuf_free(&sb);
+#endif
+    }
     cog_push(str);
     return NULL;
 }
@@ -169,8 +455,9 @@ cog_object* fn_seek() {
     COG_GET_NUMBER(where, n);
     COG_ENSURE_TYPE(what, &ot_file);
     int w = SEEK_SET;
-    FILE* f = (FILE*)what->as_ptr;
+    FILE* f = file_of(what);
     if (!f) COG_RETURN_ERROR(cog_string("Tried to seek a closed file"));
+    file_flush((cog_file*)what->as_ptr);
     if (cog_same_identifiers(how->next, cog_make_identifier_c("start"))) w = SEEK_SET;
     else if (cog_same_identifiers(how->next, cog_make_identifier_c("end"))) w = SEEK_END;
     else if (cog_same_identifiers(how->next, cog_make_identifier_c("current"))) w = SEEK_CUR;
@@ -183,40 +470,28 @@ cog_object* fn_seek() {
 }
 cog_modfunc fne_seek = {"Seek", COG_FUNC, fn_seek, "Seeks a file to a particular offset,"};
 
-cog_object* fn_readline() {
-    COG_ENSURE_N_ITEMS(1);
-    cog_object* file = cog_pop();
-    COG_ENSURE_TYPE(file, &ot_file);
-    FILE* f = (FILE*)file->as_ptr;
-    if (!f) COG_RETURN_ERROR(cog_string("Tried to read a closed file"));
-    cog_object* str = cog_emptystring();
-    cog_object* tail = str;
-    int ch;
-    do {
-        ch = fgetc(f);
-        cog_string_append_byte(&tail, ch);
-    } while (ch != '\n');
-    cog_push(str);
-    return NULL;
-}
-cog_modfunc fne_readline = {"Read-Line", COG_FUNC, fn_readline, "Read a line of text from the file, until and including the next newline (ASCII 0x0A) character."};
-
 cog_object* fn_close() {
     COG_ENSURE_N_ITEMS(1);
     cog_object* file = cog_pop();
+    if (file && file->type != &ot_file) {
+        // other things that can be closed, like channels
+        cog_object* res = cog_run_well_known(file, "Close");
+        if (!cog_same_identifiers(res, cog_not_implemented())) return res;
+    }
     COG_ENSURE_TYPE(file, &ot_file);
-    FILE* f = (FILE*)file->as_ptr;
-    if (!f) COG_RETURN_ERROR(cog_string("File is already closed"));
-    fclose(f);
-    file->as_ptr = NULL;
+    cog_file* cf = (cog_file*)file->as_ptr;
+    if (!cf || !cf->f) COG_RETURN_ERROR(cog_string("File is already closed"));
+    bool flushed = file_flush(cf);
+    fclose(cf->f);
+    cf->f = NULL;
+    if (!flushed) COG_RETURN_ERROR(cog_sprintf("While writing to %O: [Errno %i] %s", file->next, errno, strerror(errno)));
     return NULL;
 }
-cog_modfunc fne_close = {"Close", COG_FUNC, fn_close, "Close an opened file."};
+cog_modfunc fne_close = {"Close", COG_FUNC, fn_close, "Close an opened file, or anything else that can be closed, like a channel."};
 
 cog_modfunc* m_file_functions[] = {
     &fne_open,
     &fne_readfile,
-    &fne_readline,
     &fne_seek,
     &fne_close,
     NULL
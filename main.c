@@ -55,6 +55,7 @@ void repl() {
     for (;;) {
         bool is_end = false;
         if (!setjmp(interrupt_jump)) {
+            cog_flush(cog_get_stdout());
             line_input = readline(prompt);
             prompt = "    ...> ";
             if (!line_input) {
@@ -2,6 +2,7 @@
 #include "files.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <poll.h>
 
 cog_object* fn_path() {
     char buf[FILENAME_MAX];
@@ -19,27 +20,53 @@ cog_modfunc fne_path = {"Path", COG_FUNC, fn_path, "Return the current working d
 #define USE_READLINE 0
 #endif
 
+extern cog_modfunc fne_input;
+
 cog_object* fn_input() {
-    // TODO: use cog_get_stdin()
-    char* input;
+    // so the prompt shows up
+    cog_flush(cog_get_stdout());
     #if USE_READLINE
     if (isatty(fileno(stdin))) {
-        input = readline("");
-        goto gotten;
+        // the other fibers go on until something is typed
+        struct pollfd p = {fileno(stdin), POLLIN, 0};
+        if (poll(&p, 1, 0) == 0 && cog_wait_for_fd(fileno(stdin), false, cog_make_bfunction(&fne_input), NULL))
+            return NULL;
+        char* input = readline("");
+        cog_push(cog_string(input ? input : ""));
+        free(input);
+        return NULL;
     }
     #endif
-    size_t len;
-	getline(&input, &len, stdin);
-    gotten:
-    cog_push(cog_string(input));
-    free(input);
+    cog_object* stdin_stream = cog_get_stdin();
+    if (!stdin_stream) COG_RETURN_ERROR(cog_string("No standard input to read from"));
+    if (cog_wait_for_stream(stdin_stream, false, cog_make_bfunction(&fne_input))) return NULL;
+    cog_object* status = cog_readline(stdin_stream);
+    if (status) return status;
+    cog_object* line = cog_pop();
+    cog_push(line && line->type == &cog_ot_string ? line : cog_emptystring());
     return NULL;
 }
 cog_modfunc fne_input = {"Input", COG_FUNC, fn_input, "Return a line of user input form stdin."};
 
+#define _STD_STREAM_BODY(which) \
+    cog_object* stream = cog_get_##which(); \
+    if (!stream) COG_RETURN_ERROR(cog_string("There is no " #which)); \
+    cog_push(stream); \
+    return NULL;
+
+cog_object* fn_stdin() { _STD_STREAM_BODY(stdin) }
+cog_object* fn_stdout() { _STD_STREAM_BODY(stdout) }
+cog_object* fn_stderr() { _STD_STREAM_BODY(stderr) }
+cog_modfunc fne_stdin = {"Stdin", COG_FUNC, fn_stdin, "Return the standard input stream."};
+cog_modfunc fne_stdout = {"Stdout", COG_FUNC, fn_stdout, "Return the standard output stream."};
+cog_modfunc fne_stderr = {"Stderr", COG_FUNC, fn_stderr, "Return the standard error stream."};
+
 cog_modfunc* m_misc_io_functions[] = {
     &fne_path,
     &fne_input,
+    &fne_stdin,
+    &fne_stdout,
+    &fne_stderr,
     NULL
 };
 
@@ -49,9 +49,14 @@ def test(file: str, process: subprocess.Popen, pad_length: int):
 
 test_files = sorted(glob.glob("tests/*.cog"))
 test_commands = [["../cogni", file] for file in test_files]
+test_dirs = ["." for file in test_files]
+# the interpreter's own tests, which open files relative to the top directory
+test_files.append("../test.cog")
+test_commands.append(["./cogni", "test.cog"])
+test_dirs.append("..")
 test_processes = [subprocess.Popen(
-    command, stderr=subprocess.PIPE, stdout=subprocess.PIPE)
-    for command in test_commands]
+    command, stderr=subprocess.PIPE, stdout=subprocess.PIPE, cwd=cwd)
+    for command, cwd in zip(test_commands, test_dirs)]
 for f, p in zip(test_files, test_processes):
     test(f, p, max(map(len, test_files)))
 